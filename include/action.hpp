@@ -10,6 +10,9 @@
 #ifndef NP_ACTION_HPP
 #define NP_ACTION_HPP
 
+#include <set>
+#include <string>
+
 #include "signal.hpp"
 
 namespace nparticles
@@ -18,6 +21,7 @@ namespace nparticles
 class ParticleSystem;
 class ComputeProgram;
 class ComputeSystem;
+class BufferBase;
 
 /**
  * The Action class represents the behaviour of a particles in a ParticleSystem.
@@ -27,6 +31,11 @@ class ComputeSystem;
  *
  * Many chained Actions result in a sequentially executed Action list which allow
  * great flexibility when defining the behaviour of a ParticleSystem.
+ *
+ * An Action can declare which particle attributes and storage buffers it reads and writes via addRead() and
+ * addWrite(). The ComputeSystem uses these declarations to run independent Actions concurrently (see ActionGraph).
+ * An Action which does not declare any access is assumed to read and write all buffers of its ParticleSystem,
+ * so it is executed strictly in list order.
  */
 class Action
 {
@@ -52,6 +61,107 @@ public:
      */
     ComputeProgram& getComputeProgram() { return mComputeProgram; }
 
+    /**
+     * Declare that the Action reads a buffer.
+     *
+     * @param bufferName The name of a particle attribute or storage buffer of the ParticleSystem.
+     */
+    void addRead(const std::string& bufferName);
+
+    /**
+     * Declare that the Action writes a buffer.
+     *
+     * @param bufferName The name of a particle attribute or storage buffer of the ParticleSystem.
+     */
+    void addWrite(const std::string& bufferName);
+
+    /**
+     * Get the names of the buffers read by the Action.
+     *
+     * @return The names passed to addRead().
+     */
+    const std::set<std::string>& getReads() const { return mReads; }
+
+    /**
+     * Get the names of the buffers written by the Action.
+     *
+     * @return The names passed to addWrite().
+     */
+    const std::set<std::string>& getWrites() const { return mWrites; }
+
+    /**
+     * Check if the Action declared its buffer accesses.
+     *
+     * @return True if addRead() or addWrite() was called at least once.
+     */
+    bool hasDeclaredAccesses() const { return !mReads.empty() || !mWrites.empty(); }
+
+    /**
+     * Check if the Action conflicts with another Action of the same ParticleSystem.
+     *
+     * Two Actions conflict if one of them writes a buffer the other one reads or writes, or if one of them
+     * did not declare its accesses. Conflicting Actions have to be executed in list order.
+     *
+     * @param other The other Action.
+     *
+     * @return True if the Actions conflict.
+     */
+    bool conflictsWith(const Action& other) const;
+
+    /**
+     * Dispatch the Action's ComputeProgram indirectly.
+     *
+     * By default, the ComputeSystem dispatches enough work groups to cover all particles. With an indirect dispatch
+     * buffer, the number of work groups is read from @p buffer instead (glDispatchComputeIndirect), so a previous
+     * Action can select the work on the GPU, e.g. by compacting the indices of the particles it applies to.
+     *
+     * The buffer has to hold the three unsigned integers num_groups_x, num_groups_y and num_groups_z at @p offset.
+     *
+     * @param buffer The buffer holding the work group counts or nullptr to cover all particles again.
+     * @param offset The offset of the work group counts in bytes. Must be a multiple of four.
+     */
+    void setIndirectDispatchBuffer(const BufferBase* buffer, unsigned offset = 0);
+
+    /**
+     * Get the indirect dispatch buffer.
+     *
+     * @return The buffer set by setIndirectDispatchBuffer() or nullptr if the Action covers all particles.
+     */
+    const BufferBase* getIndirectDispatchBuffer() const { return mIndirectDispatchBuffer; }
+
+    /**
+     * Get the offset of the work group counts in the indirect dispatch buffer.
+     *
+     * @return The offset in bytes.
+     */
+    unsigned getIndirectDispatchOffset() const { return mIndirectDispatchOffset; }
+
+    /**
+     * Execute the Action only in every n-th update.
+     *
+     * Useful for maintenance passes like a SpatialReorderer which do not have to run every frame. The Action is
+     * executed in the first update after this call and then every @p interval updates.
+     *
+     * @param interval The number of updates between two executions. 1 (the default) executes the Action in every update.
+     */
+    void setUpdateInterval(unsigned interval);
+
+    /**
+     * Get the update interval.
+     *
+     * @return The number of updates between two executions.
+     */
+    unsigned getUpdateInterval() const { return mUpdateInterval; }
+
+    /**
+     * Count an update of the ParticleSystem.
+     *
+     * This is called by the ComputeSystem once per update.
+     *
+     * @return True if the Action is executed in this update.
+     */
+    bool countUpdate();
+
     /**
      * The preUpdateSignal emitted right before the Action is applied.
      *
@@ -82,6 +192,36 @@ private:
      */
     ComputeProgram& mComputeProgram;
 
+    /**
+     * The names of the buffers read by this Action.
+     */
+    std::set<std::string> mReads;
+
+    /**
+     * The names of the buffers written by this Action.
+     */
+    std::set<std::string> mWrites;
+
+    /**
+     * The buffer holding the work group counts of an indirect dispatch or nullptr.
+     */
+    const BufferBase* mIndirectDispatchBuffer;
+
+    /**
+     * The offset of the work group counts in mIndirectDispatchBuffer.
+     */
+    unsigned mIndirectDispatchOffset;
+
+    /**
+     * The number of updates between two executions.
+     */
+    unsigned mUpdateInterval;
+
+    /**
+     * The number of updates until the next execution.
+     */
+    unsigned mUpdatesUntilExecution;
+
     // Hide copy and assignment operators
     Action(const Action&) = delete;
     void operator=(const Action&) = delete;
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_ACTIONGRAPH_HPP
+#define NP_ACTIONGRAPH_HPP
+
+#include <vector>
+
+namespace nparticles
+{
+
+class ParticleSystem;
+class Action;
+class CPUKernel;
+
+/**
+ * The ActionGraph class holds the dependencies between the Actions of several ParticleSystem%s for one update.
+ *
+ * Each Action added to the graph becomes a node. A node depends on an earlier node if:
+ * - Both belong to the same ParticleSystem and their Actions conflict (see Action::conflictsWith()).
+ * - Both belong to the same ParticleSystem and one runs on the CPU, the other on the GPU. The attribute buffers
+ *   of a ParticleSystem cannot be mapped for the CPU while the GPU uses them.
+ * - Both belong to ParticleSystem%s in the same ParticlePool and one runs on the CPU, the other on the GPU. The
+ *   systems share the storage of their attributes.
+ * - Both run the same CPUKernel. CPUKernel%s are shared by all ParticleSystem%s using their ComputeProgram and
+ *   usually hold per update state set by the pre update listeners.
+ *
+ * Nodes without a path between them can be executed concurrently. The ComputeSystem builds the graph
+ * in each ComputeSystem::updateParticleSystems() call.
+ */
+class ActionGraph
+{
+public:
+    /**
+     * A node of the ActionGraph.
+     */
+    struct Node
+    {
+        /**
+         * The ParticleSystem the Action is applied to.
+         */
+        ParticleSystem* particleSystem;
+
+        /**
+         * The Action.
+         */
+        Action* action;
+
+        /**
+         * The CPUKernel executing the Action or nullptr if the Action is executed on the GPU.
+         */
+        CPUKernel* kernel;
+
+        /**
+         * The indices of the nodes this node depends on.
+         */
+        std::vector<unsigned> predecessors;
+
+        /**
+         * The indices of the nodes depending on this node.
+         */
+        std::vector<unsigned> successors;
+    };
+
+    /**
+     * The ActionGraph constructor.
+     */
+    ActionGraph();
+
+    /**
+     * Remove all nodes.
+     */
+    void clear();
+
+    /**
+     * Add an Action to the graph.
+     *
+     * Actions have to be added in execution order: Actions of a ParticleSystem in list order. The dependencies to all
+     * nodes added before are determined immediately.
+     *
+     * @param particleSystem The ParticleSystem the Action is applied to.
+     * @param action The Action.
+     * @param kernel The CPUKernel executing the Action or nullptr if it is executed on the GPU.
+     *
+     * @return The index of the new node.
+     */
+    unsigned addAction(ParticleSystem* particleSystem, Action* action, CPUKernel* kernel);
+
+    /**
+     * Get the nodes.
+     *
+     * @return The nodes in the order they were added.
+     */
+    const std::vector<Node>& getNodes() const { return mNodes; }
+
+private:
+    /**
+     * Check if a node depends on an earlier node.
+     *
+     * @param node The later node.
+     * @param earlier The earlier node.
+     *
+     * @return True if @p node must not start before @p earlier is finished.
+     */
+    bool dependsOn(const Node& node, const Node& earlier) const;
+
+    /**
+     * The nodes of the graph.
+     */
+    std::vector<Node> mNodes;
+
+    // Hide copy constructor and assignment operator
+    ActionGraph(const ActionGraph&) = delete;
+    void operator=(const ActionGraph&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_ACTIONGRAPH_HPP
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_BARNESHUTSOLVER_HPP
+#define NP_BARNESHUTSOLVER_HPP
+
+#include <vector>
+
+#include "gravitysolver.hpp"
+#include "octree.hpp"
+
+namespace nparticles
+{
+
+/**
+ * The BarnesHutSolver class approximates gravity with the Barnes-Hut algorithm.
+ *
+ * Each time step, an octree is built over all bodies. Every node stores the multipole moments of the bodies
+ * it contains: the monopole (mass and center of mass) and, if enabled, the traceless quadrupole tensor.
+ * While evaluating the acceleration of a body, the tree is traversed from the root. A node is accepted as
+ * a whole if it appears small enough seen from the body:
+ *
+ *     size / distance < theta
+ *
+ * Otherwise its children are visited. Bodies in leaves which are not accepted are summed up directly.
+ * This reduces the complexity from O(N²) to O(N log N).
+ *
+ * The tree is not traversed for every body, but once for all bodies of a leaf (with the distance measured
+ * to the leaf's bounding box). The resulting interaction list is then evaluated for each body of the leaf.
+ *
+ * The tree construction (see Octree), the computation of moments and the force evaluation are
+ * done in parallel.
+ *
+ * The opening angle theta trades accuracy for speed: 0 equals the direct sum, 0.5 - 0.7 is common
+ * for simulations, larger values are fast but inaccurate.
+ */
+class BarnesHutSolver : public GravitySolver
+{
+public:
+    /**
+     * The BarnesHutSolver constructor.
+     *
+     * @param theta The opening angle.
+     * @param useQuadrupole If true, quadrupole moments are used in addition to the monopole.
+     * @param softeningFactor The softening factor (see GravitySolver).
+     * @param leafSize The maximum number of bodies stored in a leaf.
+     */
+    BarnesHutSolver(float theta = 0.5f, bool useQuadrupole = false, float softeningFactor = 0.1f, unsigned leafSize = 16);
+
+    /**
+     * @copydoc GravitySolver::computeAccelerations()
+     */
+    void computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool);
+
+    /**
+     * @copydoc GravitySolver::getName()
+     */
+    std::string getName() const;
+
+    /**
+     * Set the opening angle.
+     *
+     * @param theta The new opening angle.
+     */
+    void setTheta(float theta) { mTheta = theta; }
+
+    /**
+     * Get the opening angle.
+     *
+     * @return The opening angle.
+     */
+    float getTheta() const { return mTheta; }
+
+    /**
+     * Enable or disable quadrupole moments.
+     *
+     * @param useQuadrupole If true, quadrupole moments are used in addition to the monopole.
+     */
+    void setUseQuadrupole(bool useQuadrupole) { mUseQuadrupole = useQuadrupole; }
+
+    /**
+     * Check if quadrupole moments are used.
+     *
+     * @return True if quadrupole moments are used.
+     */
+    bool getUseQuadrupole() const { return mUseQuadrupole; }
+
+    /**
+     * Get the number of tree nodes.
+     *
+     * @return The number of nodes of the tree built by the last computeAccelerations() call.
+     */
+    unsigned getNodeCount() const { return mOctree.getNodes().size(); }
+
+private:
+    /**
+     * The multipole moments of a node.
+     */
+    struct Moments
+    {
+        glm::vec3 centerOfMass;
+        float mass;
+
+        /**
+         * Traceless quadrupole tensor relative to the center of mass: xx, xy, xz, yy, yz, zz.
+         */
+        float quadrupole[6];
+    };
+
+    /**
+     * The interactions of the bodies of a leaf.
+     */
+    struct InteractionList
+    {
+        /**
+         * Point masses in structure of arrays layout: bodies of opened leaves and monopoles of accepted nodes.
+         */
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> mass;
+
+        /**
+         * Centers of mass and quadrupole tensors of accepted nodes if quadrupole moments are used.
+         */
+        std::vector<float> quadrupoleCenter[3];
+        std::vector<float> quadrupole[6];
+    };
+
+    /**
+     * Compute the moments of a node from its bodies (leaves) or children (inner nodes).
+     */
+    void computeMoments(unsigned nodeIndex);
+
+    /**
+     * Compute the accelerations of the bodies in the leaf @p leafIndex.
+     *
+     * @param leafIndex The leaf whose bodies are evaluated.
+     * @param accelerations The accelerations of all bodies in the original order.
+     * @param list Storage for the interaction list, reused between leaves.
+     */
+    void evaluateLeaf(unsigned leafIndex, glm::vec3* accelerations, InteractionList& list) const;
+
+    /**
+     * The opening angle.
+     */
+    float mTheta;
+
+    /**
+     * True if quadrupole moments are used.
+     */
+    bool mUseQuadrupole;
+
+    /**
+     * The tree over all bodies.
+     */
+    Octree mOctree;
+
+    /**
+     * The moments of all nodes of the tree.
+     */
+    std::vector<Moments> mMoments;
+};
+
+} // namespace nparticles
+
+#endif // NP_BARNESHUTSOLVER_HPP
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_BLOCKTIMESTEPPER_HPP
+#define NP_BLOCKTIMESTEPPER_HPP
+
+#include <map>
+#include <string>
+
+namespace nparticles
+{
+
+class ParticleSystem;
+class ShaderProgram;
+
+/**
+ * @brief The BlockTimeStepParameters struct holds the parameters of a BlockTimeStepper.
+ */
+struct BlockTimeStepParameters
+{
+    /**
+     * Creates parameters for the gravity sample: five rungs below a time step of 0.001.
+     */
+    BlockTimeStepParameters();
+
+    /**
+     * The time step of the finest rung. Each update advances the simulation by this time.
+     */
+    float timeStep;
+
+    /**
+     * The finest rung. Rung r uses the time step timeStep * 2^(maxRung - r), so rung 0 is updated
+     * every 2^maxRung updates.
+     */
+    unsigned maxRung;
+
+    /**
+     * The accuracy parameter eta of the time step criterion dt = sqrt(2 * eta * softening / |a|).
+     */
+    float accuracy;
+
+    /**
+     * The softening factor of the gravitational accelerations.
+     */
+    float softening;
+};
+
+/**
+ * The BlockTimeStepper class integrates gravitating particles with hierarchical block time steps.
+ *
+ * Each particle is assigned to a rung whose time step is a power of two fraction of the largest time step, chosen
+ * from its acceleration. Particles in dense regions are kicked often, while the majority of the particles is only
+ * kicked every few updates. Each update is one sub-step of the finest rung and appends three Actions to a
+ * ParticleSystem:
+ * - Compact: the indices of the particles whose rung is active in the current sub-step are gathered in a compacted
+ *   list, which also yields the work group count of the kick (np/block-compact.glsl).
+ * - Kick: the active particles compute their accelerations by direct summation, select a new rung and update their
+ *   velocities. The Action is dispatched indirectly, so only the active particles are processed (np/block-kick.glsl).
+ * - Drift: all particles move by one sub-step (np/block-drift.glsl).
+ *
+ * Together, this is a leapfrog (kick-drift-kick) integrator: the kick of an active particle closes the half kick of
+ * its previous step and opens the half kick of its next step. A particle only moves to a coarser rung when the
+ * current sub-step is a multiple of the coarser time step, so all rungs stay synchronised.
+ *
+ * The positions attribute holds vec4s with the mass in w (the "ParticlePositions" layout of the gravity sample),
+ * the velocities attribute holds vec4s with the velocity in xyz. As the other gravity solvers, the BlockTimeStepper
+ * does not take the gravitational constant into account.
+ *
+ * All passes have CPUKernel%s which are registered when the compute programs are created. The shader sources are
+ * loaded from "/np", so the directory res/shader/np has to be added to the GPUProgramService before attach() is
+ * called. The BlockTimeStepper must outlive the ParticleSystems it is attached to.
+ */
+class BlockTimeStepper
+{
+public:
+    /**
+     * The BlockTimeStepper constructor.
+     *
+     * @param parameters The time step parameters.
+     * @param positionsAttribute The name of the particle attribute holding the positions and masses.
+     * @param velocitiesAttribute The name of the particle attribute holding the velocities.
+     */
+    BlockTimeStepper(const BlockTimeStepParameters& parameters = BlockTimeStepParameters(),
+                     const std::string& positionsAttribute = "ParticlePositions",
+                     const std::string& velocitiesAttribute = "ParticleProperties");
+
+    /**
+     * Attach the time stepper to a ParticleSystem.
+     *
+     * Adds the storage buffers of the time stepper and appends its Actions. The positions and velocities attributes
+     * have to exist. All particles start unassigned and are kicked in the first update.
+     *
+     * @param particleSystem The ParticleSystem to integrate.
+     *
+     * @return True on success, false if a compute program cannot be created, an attribute is missing or the
+     *         ParticleSystem already has a time stepper.
+     */
+    bool attach(ParticleSystem* particleSystem);
+
+    /**
+     * Set the uniforms of np/blocktimestep.glsl.
+     *
+     * @param program The ShaderProgram to set the uniforms for.
+     * @param particleSystem The ParticleSystem which is updated.
+     */
+    void setUniforms(const ShaderProgram& program, ParticleSystem* particleSystem) const;
+
+    /**
+     * Get the parameters.
+     *
+     * @return The time step parameters.
+     */
+    const BlockTimeStepParameters& getParameters() const { return mParameters; }
+
+    /**
+     * Set the time step of the finest rung.
+     *
+     * The rungs keep their assignment, so their time steps scale with @p timeStep.
+     *
+     * @param timeStep The new time step.
+     */
+    void setTimeStep(float timeStep) { mParameters.timeStep = timeStep; }
+
+    /**
+     * Get the time step of a rung.
+     *
+     * @param rung The rung in [0, maxRung].
+     *
+     * @return timeStep * 2^(maxRung - rung).
+     */
+    float getRungTimeStep(unsigned rung) const;
+
+    /**
+     * Select the rung for a particle.
+     *
+     * @param acceleration The magnitude of the particle's acceleration.
+     * @param oldRung The current rung of the particle or UNASSIGNED_RUNG.
+     * @param subStep The current sub-step.
+     *
+     * @return The finest rung whose time step does not exceed the criterion, clamped to [0, maxRung] and to the
+     *         rungs which are synchronised in @p subStep.
+     */
+    unsigned selectRung(float acceleration, unsigned oldRung, unsigned subStep) const;
+
+    /**
+     * Check if a rung is active in a sub-step.
+     *
+     * @param rung A rung in [0, maxRung] or UNASSIGNED_RUNG, which is always active.
+     * @param subStep The sub-step.
+     *
+     * @return True if particles on @p rung are kicked in @p subStep.
+     */
+    bool isActive(unsigned rung, unsigned subStep) const;
+
+    /**
+     * Get the current sub-step of a ParticleSystem.
+     *
+     * @param particleSystem A ParticleSystem the time stepper is attached to.
+     *
+     * @return The sub-step of the next update in [0, 2^maxRung).
+     */
+    unsigned getSubStep(ParticleSystem* particleSystem) const;
+
+    /**
+     * Get the name of the positions attribute.
+     *
+     * @return The name of the particle attribute holding the positions and masses.
+     */
+    const std::string& getPositionsAttribute() const { return mPositionsAttribute; }
+
+    /**
+     * Get the name of the velocities attribute.
+     *
+     * @return The name of the particle attribute holding the velocities.
+     */
+    const std::string& getVelocitiesAttribute() const { return mVelocitiesAttribute; }
+
+    /**
+     * Names of the storage buffers added to the ParticleSystem.
+     *
+     * DISPATCH_BUFFER holds four unsigned integers: the work group counts of the kick (x, y, z) and the
+     * number of active particles.
+     */
+    static const char* const RUNGS_BUFFER;
+    static const char* const ACTIVE_INDICES_BUFFER;
+    static const char* const DISPATCH_BUFFER;
+
+    /**
+     * The rung of particles which were not kicked yet.
+     */
+    static const unsigned UNASSIGNED_RUNG;
+
+    /**
+     * The number of active particles processed by one work group of the kick.
+     */
+    static const unsigned KICK_GROUP_SIZE;
+
+private:
+    /**
+     * Advance the sub-step of a ParticleSystem. Called after the drift.
+     *
+     * @param particleSystem The ParticleSystem which was updated.
+     */
+    void advanceSubStep(ParticleSystem* particleSystem);
+
+    /**
+     * The time step parameters.
+     */
+    BlockTimeStepParameters mParameters;
+
+    /**
+     * The name of the particle attribute holding the positions and masses.
+     */
+    std::string mPositionsAttribute;
+
+    /**
+     * The name of the particle attribute holding the velocities.
+     */
+    std::string mVelocitiesAttribute;
+
+    /**
+     * The current sub-step of each ParticleSystem.
+     */
+    std::map<ParticleSystem*, unsigned> mSubSteps;
+
+    // Hide copy constructor and assignment operator
+    BlockTimeStepper(const BlockTimeStepper&) = delete;
+    void operator=(const BlockTimeStepper&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_BLOCKTIMESTEPPER_HPP
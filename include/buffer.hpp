@@ -10,6 +10,9 @@
 #ifndef NP_BUFFER_HPP
 #define NP_BUFFER_HPP
 
+#include <vector>
+
+#include "glstate.hpp"
 #include "glutils.hpp"
 #include "logger.hpp"
 
@@ -23,6 +26,20 @@ namespace nparticles
  * of data (vertex positions, particle ids, etc.).
  *
  * This is a base class for Buffer%s which provides all type independant methods.
+ *
+ * Small edits of large buffers can be staged in dirty ranges (see Buffer::editRange()). Only the dirty ranges are
+ * uploaded, at the next use of the buffer, i.e. when it is bound, mapped or copied.
+ *
+ * All bindings are made through the GlState. If direct state access is used (see
+ * GlState::usesDirectStateAccess()), the storage is immutable and uploads, copies and mappings address the buffer by
+ * name. Otherwise they use GL_COPY_READ_BUFFER and GL_COPY_WRITE_BUFFER as scratch targets and leave the buffer bound
+ * to them, so code outside of the engine must not rely on these two bindings.
+ *
+ * A buffer can also be a view of a range of another buffer, its storage (see Buffer::Buffer(Buffer<T>&, GLsizei,
+ * GLsizei)). Views share the OpenGL buffer of their storage, all their methods work on the range and bindBase() binds
+ * only the range. This is used to place the attributes of several ParticleSystem%s in a common ParticlePool.
+ * Mapping a view maps the whole storage once and hands out the range of the view, so several views of a storage
+ * can be mapped at the same time. The storage is unmapped when the last view is unmapped.
  */
 class BufferBase
 {
@@ -33,8 +50,9 @@ public:
      * Since buffers are fixed size storage containser, the @p itemCount must be specified.
      *
      * @param itemCount The number of items that are stored in the buffer.
+     * @param itemSize The size of one item in bytes.
      */
-    BufferBase(int itemCount);
+    BufferBase(int itemCount, GLsizeiptr itemSize);
 
     /**
      * The virtual BufferBase destructor.
@@ -48,6 +66,8 @@ public:
      *
      * @note All previous bindings of this buffer are unbound before the new binding is performed!
      *
+     * Dirty ranges are uploaded before the buffer is bound.
+     *
      * @param target The OpenGL target (e.g. GL_VERTEX_ARRAY_BUFFER) to which the buffer is bound. This must be
      *               a target which does not support multiple binding points!
      */
@@ -61,12 +81,28 @@ public:
      *
      * @note All previous bindings of this buffer ar unbound before the new binding is performed!
      *
+     * Buffers which consist of several regions (see RingBufferBase) bind only their current region. Dirty ranges are
+     * uploaded before the buffer is bound.
+     *
      * @param target The OpenGL buffer target (e.g. GL_UNIFORM_BUFFER) to which the buffer should be bound. This must be
      *               a target with multiple binding points!
      * @param index The index of the target on which the buffer should be bound.
      */
     void bindBase(GLenum target, GLuint index);
 
+    /**
+     * Bind several buffers to consecutive indices of a target.
+     *
+     * Works like calling bindBase() for each buffer, but binds all buffers with a single glBindBuffersBase() or
+     * glBindBuffersRange() call if GL_ARB_multi_bind (OpenGL 4.4) is available.
+     *
+     * @param target The OpenGL buffer target with multiple binding points.
+     * @param first The index on which the first buffer is bound.
+     * @param count The number of buffers.
+     * @param buffers The buffers to bind on the indices @p first to @p first + @p count - 1.
+     */
+    static void bindBases(GLenum target, GLuint first, GLsizei count, BufferBase* const* buffers);
+
     /**
      * Unbind the buffer.
      *
@@ -83,6 +119,74 @@ public:
      */
     GLsizei getItemCount() const { return mItemCount; }
 
+    /**
+     * Get the size of one item.
+     *
+     * @return The size of one item in bytes (sizeof the template type of the Buffer).
+     */
+    GLsizeiptr getItemSize() const { return mItemSize; }
+
+    /**
+     * Get the OpenGL buffer handle.
+     *
+     * This can be used to bind the buffer to additional targets without changing its current binding,
+     * e.g. as GL_DISPATCH_INDIRECT_BUFFER while it is bound as shader storage buffer.
+     *
+     * @return The OpenGL buffer handle.
+     */
+    GLuint getHandle() const { return mBufferHandle; }
+
+    /**
+     * Get the offset of the buffer in its storage.
+     *
+     * @return The offset in bytes of the first item in the OpenGL buffer, 0 unless the buffer is a view of another
+     *         buffer.
+     */
+    GLintptr getStorageOffset() const { return mStorageOffset; }
+
+    /**
+     * Copy the data of another buffer into this buffer.
+     *
+     * The copy is executed by OpenGL (glCopyBufferSubData), so data written by shaders is only copied
+     * if a GL_BUFFER_UPDATE_BARRIER was issued after the shaders. Neither buffer may be mapped.
+     *
+     * Dirty ranges of @p source are uploaded first, dirty ranges of this buffer are discarded.
+     *
+     * @param source The buffer to copy from. Must be at least as large as this buffer.
+     */
+    void copyData(const BufferBase& source);
+
+    /**
+     * Copy a range of another buffer into this buffer.
+     *
+     * Works like copyData() but copies only @p size bytes. Dirty ranges of both buffers are uploaded first.
+     *
+     * @param source The buffer to copy from.
+     * @param readOffset The offset of the range in @p source in bytes.
+     * @param writeOffset The offset of the range in this buffer in bytes.
+     * @param size The size of the range in bytes.
+     */
+    void copyData(const BufferBase& source, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size);
+
+    /**
+     * Set all bytes of the buffer to zero.
+     *
+     * The buffer is cleared by OpenGL (glClearBufferData), so no data is transferred. The buffer must not be mapped.
+     * Dirty ranges are discarded.
+     */
+    void clearData();
+
+    /**
+     * Set a range of bytes of the buffer to zero.
+     *
+     * Works like clearData() but clears only @p size bytes, e.g. to reset a counter without uploading it. Dirty ranges
+     * are uploaded first.
+     *
+     * @param offset The offset of the range in bytes.
+     * @param size The size of the range in bytes.
+     */
+    void clearData(GLintptr offset, GLsizeiptr size);
+
     /**
      * Get the current binding target.
      *
@@ -123,14 +227,159 @@ public:
      */
     int getGlBaseSize() const { return mGlTypeInfo.mBaseSize; }
 
+    /**
+     * Map the buffer to application memory without type information.
+     *
+     * This works like Buffer::map() but returns an untyped pointer. It can be used to access the data of buffers
+     * when only a BufferBase pointer is available, e.g. when iterating the attributes of a ParticleSystem.
+     *
+     * If the buffer is already mapped, the existing mapping is returned without any OpenGL calls. Dirty ranges are
+     * uploaded before the buffer is mapped.
+     *
+     * @note *Always* unmap a buffer as soon as you are finish reading / writing data!
+     *
+     * @return Pointer to the buffer data or nullptr if only a range of the buffer is mapped (see Buffer::mapRange()).
+     */
+    virtual void* mapRaw();
+
+    /**
+     * Unmap a mapped Buffer.
+     *
+     * This method unmaps the mapped Buffer. Nothing happens if the buffer is not mapped.
+     */
+    virtual void unmap();
+
+    /**
+     * Check if the buffer is mapped.
+     *
+     * @return True if the buffer is currently mapped to application memory, false otherwise.
+     */
+    bool isMapped() const { return mMapPointer != nullptr; }
+
+    /**
+     * Upload all dirty ranges.
+     *
+     * This is done automatically at the next use of the buffer, call it to upload the edits earlier.
+     */
+    void uploadDirtyRanges() const;
+
+    /**
+     * Check if the buffer has dirty ranges which are not uploaded yet.
+     *
+     * @return True if there are dirty ranges.
+     */
+    bool hasDirtyRanges() const { return !mDirtyRanges.empty(); }
+
 protected:
+    /**
+     * The BufferBase constructor for views.
+     *
+     * The view shares the OpenGL buffer of @p storage, which must outlive the view. The range has to lie inside of
+     * @p storage.
+     *
+     * @param storage The buffer holding the items of the view.
+     * @param offset The offset of the first item of the view in @p storage in bytes.
+     * @param itemCount The number of items of the view.
+     * @param itemSize The size of one item in bytes.
+     */
+    BufferBase(BufferBase& storage, GLintptr offset, int itemCount, GLsizeiptr itemSize);
+
+    /**
+     * Allocate the storage of the buffer, which holds mItemCount items of mItemSize bytes.
+     *
+     * With direct state access the storage is immutable and the @p usage hint is not used, the storage stays in
+     * device memory unless @p clientStorage is set. Otherwise it is allocated with glBufferData() on @p target.
+     *
+     * @param target The target the buffer is bound to for the allocation.
+     * @param usage The OpenGL usage hint, e.g. GL_DYNAMIC_DRAW.
+     * @param clientStorage True to prefer client memory for immutable storage (GL_CLIENT_STORAGE_BIT).
+     */
+    void allocateStorage(GLenum target, GLenum usage, bool clientStorage);
+
+    /**
+     * Upload data to a range of the buffer, see glBufferSubData().
+     *
+     * @param offset The offset of the range in bytes.
+     * @param size The size of the range in bytes.
+     * @param data The uploaded data.
+     */
+    void setDataRaw(GLintptr offset, GLsizeiptr size, const void* data);
+
+    /**
+     * Copy a range of another buffer into this buffer without touching the dirty ranges.
+     *
+     * @param source The buffer to copy from.
+     * @param readOffset The offset of the range in @p source in bytes.
+     * @param writeOffset The offset of the range in this buffer in bytes.
+     * @param size The size of the range in bytes.
+     */
+    void copyRange(const BufferBase& source, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size);
+
+    /**
+     * Map a range of the buffer to application memory.
+     *
+     * @param offset The offset of the range in bytes.
+     * @param size The size of the range in bytes.
+     * @param access The OpenGL access flags, see glMapBufferRange().
+     *
+     * @return Pointer to the range or nullptr if the buffer is already mapped.
+     */
+    void* mapRangeRaw(GLintptr offset, GLsizeiptr size, GLbitfield access);
+
+    /**
+     * Flush a range of the mapped range, see glFlushMappedBufferRange().
+     *
+     * @param offset The offset of the flushed range in bytes, relative to the start of the buffer.
+     * @param size The size of the flushed range in bytes.
+     */
+    void flushMappedRangeRaw(GLintptr offset, GLsizeiptr size);
+
+    /**
+     * Get application memory for a range of bytes and mark the range dirty.
+     *
+     * Overlapping and adjacent dirty ranges are merged, so each merged range is uploaded with a single call.
+     *
+     * @param offset The offset of the range in bytes.
+     * @param size The size of the range in bytes.
+     *
+     * @return Pointer to the staged data of the range.
+     */
+    void* editRangeRaw(GLintptr offset, GLsizeiptr size);
+
+    /**
+     * Discard all dirty ranges without uploading them, e.g. because the whole buffer is overwritten.
+     */
+    void discardDirtyRanges() { mDirtyRanges.clear(); }
+
     /**
      * The OpenGL buffer handle.
      *
-     * This is the OpenGL buffer handle created by glGenBuffers().
+     * This is the OpenGL buffer handle created by glGenBuffers() or glCreateBuffers().
      */
     GLuint mBufferHandle;
 
+    /**
+     * The offset of the first item in the OpenGL buffer in bytes.
+     *
+     * All ranges passed to OpenGL are moved by this offset, so views address their range of the storage.
+     */
+    GLintptr mStorageOffset;
+
+    /**
+     * True if the buffer created the OpenGL buffer and deletes it, false for views.
+     */
+    bool mOwnsStorage;
+
+    /**
+     * The buffer which created the OpenGL buffer of a view, nullptr if the buffer is no view.
+     */
+    BufferBase* mStorage;
+
+    /**
+     * The number of views which use the mapping of this buffer.
+     */
+    unsigned mMappedViewCount;
+
     /**
      * The number of items in the buffer.
      *
@@ -138,6 +387,11 @@ protected:
      */
     GLsizei mItemCount;
 
+    /**
+     * The size of one item in bytes.
+     */
+    GLsizeiptr mItemSize;
+
     /**
      * The glutils::GlTypeInfo for the buffer.
      *
@@ -146,7 +400,50 @@ protected:
      */
     glutils::GlTypeInfo mGlTypeInfo;
 
+    /**
+     * Pointer to mapped buffer data.
+     *
+     * This pointer is returned by the glMap() command to map the buffer data to client memory.
+     */
+    void* mMapPointer;
+
+    /**
+     * The range bound by bindBase().
+     *
+     * If the size is 0, the whole buffer is bound. Otherwise only the range starting at the offset is bound.
+     */
+    GLintptr mBindOffset;
+    GLsizeiptr mBindSize;
+
+    /**
+     * The range mapped to mMapPointer in bytes.
+     */
+    GLintptr mMapOffset;
+    GLsizeiptr mMapSize;
+
 private:
+    /**
+     * A range of the buffer edited in application memory which is not uploaded yet.
+     */
+    struct DirtyRange
+    {
+        /**
+         * The offset of the range in bytes.
+         */
+        GLintptr offset;
+
+        /**
+         * The staged data of the range.
+         */
+        std::vector<char> data;
+    };
+
+    /**
+     * The dirty ranges sorted by offset. They neither overlap nor touch each other.
+     *
+     * Mutable, since uploading the ranges does not change the content of the buffer seen by its users.
+     */
+    mutable std::vector<DirtyRange> mDirtyRanges;
 
     /**
      * The current binding state.
@@ -207,8 +504,30 @@ public:
      * @param mainTarget The target the Buffer is most commonly bound to. This serves as a optimisation hint for the OpenGL
      *                   implementation, how the buffer is used most of the time. It is not necessary to specify the @p mainTarget,
      *                   but it is a good practice.
+     * @param clientStorage Set to true for staging buffers which are only copied to and read by the application. With
+     *                      direct state access their storage is then placed in client memory. Leave it false for
+     *                      buffers used by shaders.
+     */
+    Buffer(int itemCount, GLenum glType = GL_INVALID_VALUE, int glBaseSize = -1, GLenum usage = GL_STATIC_DRAW, GLenum mainTarget = GL_SHADER_STORAGE_BUFFER, bool clientStorage = false);
+
+    /**
+     * Buffer constructor for a view of a range of items of another buffer.
+     *
+     * No OpenGL buffer is created, the view uses the storage of @p storage and has its OpenGL type info. Deleting the
+     * view does not delete the storage, @p storage must outlive the view.
+     *
+     * @note bindBase() binds the range, so @p first should be a multiple of the offset alignment of the targets the
+     *       view is bound to (e.g. GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT).
+     *
+     * @note Views share the mapping of the whole storage for reading and writing, so the access flags of mapRange()
+     *       are not applied and flushMappedRange() has no effect. The storage itself must not be mapped directly
+     *       while views are mapped.
+     *
+     * @param storage The buffer holding the items of the view.
+     * @param first The index of the first item of the view in @p storage.
+     * @param count The number of items of the view. The range must lie inside of @p storage.
      */
-    Buffer(int itemCount, GLenum glType = GL_INVALID_VALUE, int glBaseSize = -1, GLenum usage = GL_STATIC_DRAW, GLenum mainTarget = GL_SHADER_STORAGE_BUFFER);
+    Buffer(Buffer<T>& storage, GLsizei first, GLsizei count);
 
     /**
      * Set the data inside the Buffer.
@@ -220,6 +539,34 @@ public:
      */
     void setData(T* data);
 
+    /**
+     * Set the data of a range of items.
+     *
+     * Only the range is uploaded, the other items are left untouched.
+     *
+     * @param first The index of the first item to set.
+     * @param count The number of items to set.
+     * @param data Array holding the @p count new items.
+     */
+    void setData(GLsizei first, GLsizei count, const T* data);
+
+    /**
+     * Edit a range of items in application memory.
+     *
+     * The range is marked dirty and uploaded at the next use of the buffer, so many small edits of a large buffer
+     * cost only the transfer of the edited items. Dirty ranges which overlap or touch each other are merged.
+     *
+     * @note The returned items are not read back from the buffer: all of them have to be written, except those
+     *       written by previous edits which are not uploaded yet. The pointer is valid until the next call to
+     *       editRange() or the next use of the buffer.
+     *
+     * @param first The index of the first edited item.
+     * @param count The number of edited items.
+     *
+     * @return Pointer to the @p count edited items.
+     */
+    T* editRange(GLsizei first, GLsizei count) { return static_cast<T*>(editRangeRaw(first * sizeof(T), count * sizeof(T))); }
+
     /**
      * Map the buffer to application memory.
      *
@@ -231,23 +578,39 @@ public:
      *
      * @return Pointer of template type T to access the buffer data.
      */
-    T* map();
+    T* map() { return static_cast<T*>(mapRaw()); }
 
     /**
-     * Unmap a mapped Buffer.
+     * Map a range of items to application memory.
      *
-     * This method unmaps the mapped Buffer
+     * Besides GL_MAP_READ_BIT and GL_MAP_WRITE_BIT, @p access may contain
+     * - GL_MAP_INVALIDATE_RANGE_BIT: The previous content of the range is discarded, so it need not be transferred.
+     * - GL_MAP_UNSYNCHRONIZED_BIT: OpenGL does not wait for pending commands using the buffer. The caller has to
+     *   make sure they do not use the range.
+     * - GL_MAP_FLUSH_EXPLICIT_BIT: Only the ranges passed to flushMappedRange() are made visible to OpenGL.
+     *
+     * Unmap the range with unmap(). Dirty ranges are uploaded before the range is mapped.
+     *
+     * @param first The index of the first mapped item.
+     * @param count The number of mapped items.
+     * @param access The OpenGL access flags, see glMapBufferRange().
+     *
+     * @return Pointer to the @p count mapped items or nullptr if the buffer is already mapped.
      */
-    void unmap();
+    T* mapRange(GLsizei first, GLsizei count, GLbitfield access = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT)
+    {
+        return static_cast<T*>(mapRangeRaw(first * sizeof(T), count * sizeof(T), access));
+    }
 
-protected:
     /**
-     * Pointer to mapped buffer data.
+     * Flush items written to a range mapped with GL_MAP_FLUSH_EXPLICIT_BIT.
      *
-     * This pointer is returned by the glMap() command to map the buffer data to client memory.
+     * @param first The index of the first flushed item. It has to be inside the mapped range.
+     * @param count The number of flushed items.
      */
-    T* mMapPointer;
+    void flushMappedRange(GLsizei first, GLsizei count) { flushMappedRangeRaw(first * sizeof(T), count * sizeof(T)); }
 
+protected:
     /**
      * The main target this buffer is associated with.
      *
@@ -259,9 +622,8 @@ protected:
 
 // Implementation
 template<typename T>
-Buffer<T>::Buffer(int itemCount, GLenum glType, int glBaseSize, GLenum usage, GLenum mainTarget)
-    : BufferBase(itemCount),
-      mMapPointer(nullptr),
+Buffer<T>::Buffer(int itemCount, GLenum glType, int glBaseSize, GLenum usage, GLenum mainTarget, bool clientStorage)
+    : BufferBase(itemCount, sizeof(T)),
       mMainTarget(mainTarget)
 {
     // Determine GL type info
@@ -278,65 +640,39 @@ Buffer<T>::Buffer(int itemCount, GLenum glType, int glBaseSize, GLenum usage, GL
         mGlTypeInfo.mBaseSize = glBaseSize;
     }
 
-    // Safe OpenGL buffer binding
-    GLint previouslyBoundBuffer = glutils::glGet(mainTarget);
-
     // Allocate the buffer
-    glBindBuffer(mMainTarget, mBufferHandle);
-    glBufferData(mMainTarget, itemCount * sizeof(T), nullptr, usage);
-
-    // Restore OpenGL buffer binding
-    glBindBuffer(mMainTarget, previouslyBoundBuffer);
+    allocateStorage(mMainTarget, usage, clientStorage);
 }
 
 template<typename T>
-void Buffer<T>::setData(T* data)
+Buffer<T>::Buffer(Buffer<T>& storage, GLsizei first, GLsizei count)
+    : BufferBase(storage, first * sizeof(T), count, sizeof(T)),
+      mMainTarget(storage.mMainTarget)
 {
-    // Safe OpenGL buffer binding.
-    GLuint previouslyBoundBuffer = glutils::glGet(GL_COPY_READ_BUFFER);
-
-    glBindBuffer(GL_COPY_READ_BUFFER, mBufferHandle);
-    glBufferSubData(GL_COPY_READ_BUFFER, 0, mItemCount * sizeof(T), data);
-    glBindBuffer(GL_COPY_READ_BUFFER, 0);
-
-    // Restore OpenGL buffer binding.
-    glBindBuffer(GL_COPY_READ_BUFFER, previouslyBoundBuffer);
 }
 
 template<typename T>
-T* Buffer<T>::map()
+void Buffer<T>::setData(T* data)
 {
-    if(mMapPointer)
-        return mMapPointer;
-
-    // Safe OpenGL buffer binding.
-    GLuint previouslyBoundBuffer = glutils::glGet(GL_COPY_READ_BUFFER);
-
-    glBindBuffer(GL_COPY_READ_BUFFER, mBufferHandle);
-    mMapPointer = (T*)glMapBuffer(GL_COPY_READ_BUFFER, GL_READ_WRITE);
+    // The dirty ranges would overwrite the new data
+    discardDirtyRanges();
 
-    // Restore OpenGL buffer binding.
-    glBindBuffer(GL_COPY_READ_BUFFER, previouslyBoundBuffer);
-
-    return mMapPointer;
+    setDataRaw(0, mItemCount * sizeof(T), data);
 }
 
 template<typename T>
-void Buffer<T>::unmap()
+void Buffer<T>::setData(GLsizei first, GLsizei count, const T* data)
 {
-    if(!mMapPointer)
+    if(first < 0 || count < 0 || first + count > mItemCount)
+    {
+        Logger::getInstance()->logWarning("Buffer: attempt to set items outside of the buffer.");
         return;
+    }
 
-    // Safe OpenGL buffer binding.
-    GLuint previouslyBoundBuffer = glutils::glGet(GL_COPY_READ_BUFFER);
-
-    glBindBuffer(GL_COPY_READ_BUFFER, mBufferHandle);
-    glUnmapBuffer(GL_COPY_READ_BUFFER);
-
-    // Restore OpenGL buffer binding.
-    glBindBuffer(GL_COPY_READ_BUFFER, previouslyBoundBuffer);
+    // Earlier edits have to be uploaded first, so they do not overwrite the new data
+    uploadDirtyRanges();
 
-    mMapPointer = nullptr;
+    setDataRaw(first * sizeof(T), count * sizeof(T), data);
 }
 
 } // namespace nparticles
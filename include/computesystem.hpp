@@ -10,7 +10,12 @@
 #ifndef NP_COMPUTESYSTEM_HPP
 #define NP_COMPUTESYSTEM_HPP
 
+#include <map>
+#include <set>
+
 #include "gpusystem.hpp"
+#include "threadpool.hpp"
+#include "actiongraph.hpp"
 
 namespace nparticles
 {
@@ -18,11 +23,35 @@ namespace nparticles
 class Engine;
 class ParticleSystem;
 class ComputeProgram;
+class CPUKernel;
+class Action;
+
+/**
+ * @brief The compute_backends enum defines where Action%s are executed.
+ */
+enum compute_backends
+{
+    /**
+     * Actions are executed on the GPU by dispatching their ComputeProgram.
+     */
+    NP_CB_GPU,
+
+    /**
+     * Actions are executed on the CPU by running the CPUKernel registered for their ComputeProgram.
+     */
+    NP_CB_CPU
+};
 
 /**
  * The ComputeSystem class is used to update ParticleSystem%s.
  *
- * The ComputeSystem update a ParticleSystem%s by invoking its Action%s in sequential order.
+ * The ComputeSystem update a ParticleSystem%s by invoking its Action%s. The order of the Actions is given by an
+ * ActionGraph built from the buffer accesses the Actions declare: Actions which do not depend on each other run
+ * concurrently on the ThreadPool (CPU) or are dispatched without memory barriers in between (GPU).
+ *
+ * Actions are either executed on the GPU (the default) or on the CPU, see setBackend(). On the CPU backend, the
+ * CPUKernel registered for an Action's ComputeProgram is run on all cores of the machine. Actions whose ComputeProgram
+ * has no registered CPUKernel are still dispatched to the GPU.
  */
 class ComputeSystem : public GPUSystem
 {
@@ -32,18 +61,35 @@ public:
     /**
      * Update a ParticleSystem.
      *
-     * This method updates a given ParticleSystem. All Action%s of this system are executed in sequential
-     * order.
-     *
-     * Action::preUpdateSignal and Action::postUpdateSignal are issued right before / after a
-     * ParticleSystem is / was updated. This allows the user to manually bind stuff like buffers.
+     * This method updates a given ParticleSystem. It is equivalent to updateParticleSystems() with
+     * @p particleSystem as the only system.
      *
-     * After a particle system was updated, the memory barriers GL_SHADER_STORAGE_BARRIER and GL_VERTEX_ATTRIB_ARRAY_BARRIER
-     * are synchronised. For all custom synchronisation, the Action::postUpdateSignal can be used.
      * @param particleSystem The ParticleSystem which is updated.
      */
     void updateParticleSystem(ParticleSystem* particleSystem);
 
+    /**
+     * Update several ParticleSystem%s.
+     *
+     * Builds the ActionGraph of all Action%s of the @p particleSystems and executes it. An Action starts as soon as all
+     * Actions it depends on are finished. Actions without declared buffer accesses are executed in list order, so a
+     * ParticleSystem without declarations is updated exactly like before. Actions are skipped in the updates between
+     * their executions (see Action::setUpdateInterval()).
+     *
+     * CPUKernel%s run as tasks of the ThreadPool while the calling thread dispatches GPU Actions and processes
+     * jobs of the ThreadPool. Action::preUpdateSignal and Action::postUpdateSignal are always emitted by the calling
+     * thread, right before an Action starts and after it finished. This allows the user to manually bind stuff like
+     * buffers.
+     *
+     * The memory barriers GL_SHADER_STORAGE_BARRIER and GL_VERTEX_ATTRIB_ARRAY_BARRIER are issued before an Action
+     * which depends on a GPU Action dispatched since the last barrier, and once after all Actions were executed.
+     * GL_COMMAND_BARRIER is added if the Action is dispatched indirectly.
+     * For all custom synchronisation, the Action::postUpdateSignal can be used.
+     *
+     * @param particleSystems The ParticleSystems which are updated.
+     */
+    void updateParticleSystems(const std::set<ParticleSystem*>& particleSystems);
+
     /**
      * Get the current ComputeProgram.
      *
@@ -54,11 +100,70 @@ public:
      */
     ComputeProgram* getCurrentComputeProgram() const { return mCurrentComputeProgram; }
 
+    /**
+     * Get the current CPUKernel.
+     *
+     * This method can be used to retrieve the CPUKernel which runs the current Action in a Action::preUpdateSignal or
+     * Action::postUpdateSignal callback.
+     *
+     * @return The currently used CPUKernel or nullptr if the current Action is executed on the GPU.
+     */
+    CPUKernel* getCurrentCPUKernel() const { return mCurrentCPUKernel; }
+
+    /**
+     * Select the compute backend.
+     *
+     * Selects whether Action%s are executed on the GPU or on the CPU.
+     *
+     * @param backend The new compute backend. Defaults to NP_CB_GPU.
+     */
+    void setBackend(compute_backends backend) { mBackend = backend; }
+
+    /**
+     * Get the compute backend.
+     *
+     * @return The compute backend used to execute Action%s.
+     */
+    compute_backends getBackend() const { return mBackend; }
+
+    /**
+     * Register a CPUKernel for a ComputeProgram.
+     *
+     * On the CPU backend, all Action%s using @p computeProgram are executed by running @p kernel. Any kernel
+     * previously registered for @p computeProgram is deleted.
+     *
+     * @note The ComputeSystem takes ownership of @p kernel!
+     *
+     * @param computeProgram The ComputeProgram whose Action%s are executed by @p kernel.
+     * @param kernel The CPUKernel used to execute the Action%s.
+     */
+    void registerCPUKernel(const ComputeProgram& computeProgram, CPUKernel* kernel);
+
+    /**
+     * Get the CPUKernel registered for a ComputeProgram.
+     *
+     * @param computeProgram The ComputeProgram.
+     *
+     * @return The CPUKernel registered for @p computeProgram or nullptr if there is none.
+     */
+    CPUKernel* getCPUKernel(const ComputeProgram& computeProgram) const;
+
+    /**
+     * Get the ThreadPool used by the CPU backend.
+     *
+     * This is the ThreadPool of the Engine (see Engine::getThreadPool()).
+     *
+     * @return Reference to the ThreadPool.
+     */
+    ThreadPool& getThreadPool() { return mThreadPool; }
+
 protected:
     /**
      * The ComputeSystem constructor.
+     *
+     * @param threadPool The ThreadPool used to run CPUKernel%s.
      */
-    ComputeSystem();
+    ComputeSystem(ThreadPool& threadPool);
 
     /**
      * The ComputeSystem destructor.
@@ -66,6 +171,34 @@ protected:
     ~ComputeSystem();
 
 private:
+    /**
+     * Execute an Action on the GPU.
+     *
+     * Emits the Action's signals. No memory barrier is issued. The work groups cover all particles unless the
+     * Action has an indirect dispatch buffer (see Action::setIndirectDispatchBuffer()).
+     *
+     * @param particleSystem The ParticleSystem which is updated.
+     * @param action The Action to execute.
+     */
+    void dispatchOnGPU(ParticleSystem* particleSystem, Action* action);
+
+    /**
+     * Run a CPUKernel on the work items of a ParticleSystem (see CPUKernel::getWorkItemCount()).
+     *
+     * This is executed as a task of the ThreadPool, the Action's signals are emitted by updateParticleSystems().
+     *
+     * @param particleSystem The ParticleSystem which is updated. Its attribute buffers have to be mapped.
+     * @param kernel The CPUKernel to run.
+     */
+    void runCPUKernel(ParticleSystem* particleSystem, CPUKernel* kernel);
+
+    /**
+     * Map or unmap all particle attribute and storage buffers of a ParticleSystem.
+     *
+     * @param particleSystem The ParticleSystem.
+     * @param mapped True to map the buffers, false to unmap them.
+     */
+    void mapParticleAttributes(ParticleSystem* particleSystem, bool mapped);
 
     /**
      * The currently used ComputeProgram.
@@ -74,6 +207,35 @@ private:
      */
     ComputeProgram* mCurrentComputeProgram;
 
+    /**
+     * The currently used CPUKernel.
+     *
+     * This is only set during a updateParticleSystem() call if the current Action runs on the CPU.
+     */
+    CPUKernel* mCurrentCPUKernel;
+
+    /**
+     * The compute backend used to execute Actions.
+     */
+    compute_backends mBackend;
+
+    /**
+     * The registered CPUKernels.
+     *
+     * Key is the ComputeProgram, value the CPUKernel which replaces it on the CPU backend.
+     */
+    std::map<const ComputeProgram*, CPUKernel*> mCPUKernels;
+
+    /**
+     * The ThreadPool used to run CPUKernels. It is owned by the Engine.
+     */
+    ThreadPool& mThreadPool;
+
+    /**
+     * The ActionGraph of the current updateParticleSystems() call.
+     */
+    ActionGraph mActionGraph;
+
     // Hide copy and assignment operators
     ComputeSystem(const ComputeSystem&) = delete;
     void operator=(const ComputeSystem&) = delete;
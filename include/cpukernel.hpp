@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_CPUKERNEL_HPP
+#define NP_CPUKERNEL_HPP
+
+#include <functional>
+
+namespace nparticles
+{
+
+class ParticleSystem;
+class ThreadPool;
+
+/**
+ * The CPUKernel class is the C++ counterpart of a ComputeProgram.
+ *
+ * When the ComputeSystem runs on the CPU backend (see ComputeSystem::setBackend()), an Action is not
+ * dispatched to the GPU. Instead, the CPUKernel registered for the Action's ComputeProgram (see
+ * ComputeSystem::registerCPUKernel()) is run on the particle attributes of the ParticleSystem.
+ *
+ * While a CPUKernel runs, all particle attribute and storage Buffers of the ParticleSystem are mapped, so Buffer::map()
+ * returns the attribute data without further OpenGL calls and can safely be called from all threads.
+ *
+ * An update consists of three steps:
+ * - beginUpdate() is called once by the ComputeSystem. This can be used to prepare shared data.
+ * - update() is called in parallel for disjoint ranges covering [0, getWorkItemCount()), by default all particles.
+ * - endUpdate() is called once after all ranges are processed.
+ *
+ * Simple kernels can be created by passing a kernel_function to the constructor which is used as update().
+ * More complex kernels derive from CPUKernel and override the methods above.
+ *
+ * @code
+ * computeSystem.registerCPUKernel(*computeProgram, new CPUKernel([](ParticleSystem* particleSystem, unsigned first, unsigned last)
+ * {
+ *     glm::vec4* positions = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer("Positions"))->map();
+ *     for(unsigned i = first; i < last; ++i)
+ *         positions[i].y += 0.01f;
+ * }));
+ * @endcode
+ */
+class CPUKernel
+{
+public:
+    /**
+     * Typedef for functions updating a range of particles.
+     *
+     * The function updates the particles [first, last) of the ParticleSystem.
+     */
+    typedef std::function<void(ParticleSystem* particleSystem, unsigned first, unsigned last)> kernel_function;
+
+    /**
+     * The CPUKernel constructor.
+     *
+     * @param function The function used to update a range of particles. May be empty if update() is overridden.
+     * @param grainSize The minimum number of particles processed by one thread at a time. Small kernels
+     *                  should use larger grain sizes to keep the scheduling overhead low. If 0, the ThreadPool
+     *                  chooses the grain size.
+     */
+    CPUKernel(kernel_function function = kernel_function(), unsigned grainSize = 1024);
+
+    /**
+     * The virtual CPUKernel destructor.
+     */
+    virtual ~CPUKernel();
+
+    /**
+     * Prepare an update.
+     *
+     * This is called once per update before update() is invoked for the particle ranges. Note that
+     * the Action::preUpdateSignal is emitted before this method is called.
+     *
+     * @param particleSystem The ParticleSystem which is updated.
+     * @param threadPool The ThreadPool which can be used to parallelise the preparation.
+     */
+    virtual void beginUpdate(ParticleSystem* particleSystem, ThreadPool& threadPool);
+
+    /**
+     * Get the number of work items of an update.
+     *
+     * This is called after beginUpdate(), so kernels which only process a subset of the particles (the CPU
+     * counterpart of an indirect dispatch, see Action::setIndirectDispatchBuffer()) can select the subset there.
+     *
+     * @param particleSystem The ParticleSystem which is updated.
+     *
+     * @return The number of items update() is invoked for. Defaults to the number of alive particles
+     *         (see ParticleSystem::getAliveCount()).
+     */
+    virtual unsigned getWorkItemCount(ParticleSystem* particleSystem) const;
+
+    /**
+     * Update a range of particles.
+     *
+     * This method is called concurrently from several threads for disjoint ranges.
+     *
+     * @param particleSystem The ParticleSystem which is updated.
+     * @param first The first particle to update.
+     * @param last The particle one past the last particle to update.
+     */
+    virtual void update(ParticleSystem* particleSystem, unsigned first, unsigned last);
+
+    /**
+     * Finish an update.
+     *
+     * This is called once per update after all particle ranges are processed and before the
+     * Action::postUpdateSignal is emitted.
+     *
+     * @param particleSystem The ParticleSystem which is updated.
+     * @param threadPool The ThreadPool which can be used to parallelise the clean up.
+     */
+    virtual void endUpdate(ParticleSystem* particleSystem, ThreadPool& threadPool);
+
+    /**
+     * Get the grain size.
+     *
+     * @return The minimum number of particles processed by one thread at a time.
+     */
+    unsigned getGrainSize() const { return mGrainSize; }
+
+private:
+    /**
+     * The function used by update().
+     */
+    kernel_function mFunction;
+
+    /**
+     * The minimum number of particles processed by one thread at a time.
+     */
+    unsigned mGrainSize;
+
+    // Hide copy constructor and assignment operator
+    CPUKernel(const CPUKernel&) = delete;
+    void operator=(const CPUKernel&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_CPUKERNEL_HPP
@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_DIRECTGRAVITYSOLVER_HPP
+#define NP_DIRECTGRAVITYSOLVER_HPP
+
+#include <vector>
+
+#include "gravitysolver.hpp"
+
+namespace nparticles
+{
+
+/**
+ * @brief The instruction_sets enum defines the SIMD instruction sets used by CPU kernels.
+ */
+enum instruction_sets
+{
+    /**
+     * Plain C++ without explicit vectorisation.
+     */
+    NP_ISA_SCALAR,
+
+    /**
+     * SSE, 4 floats per instruction.
+     */
+    NP_ISA_SSE,
+
+    /**
+     * AVX2 and FMA, 8 floats per instruction.
+     */
+    NP_ISA_AVX2,
+
+    /**
+     * AVX-512F, 16 floats per instruction.
+     */
+    NP_ISA_AVX512,
+
+    /**
+     * Select the best instruction set supported by the CPU at run time.
+     */
+    NP_ISA_BEST
+};
+
+/**
+ * Get the name of an instruction set.
+ *
+ * @param instructionSet One of the instruction_sets.
+ *
+ * @return The name of @p instructionSet, e.g. "AVX2".
+ */
+std::string instructionSetToString(instruction_sets instructionSet);
+
+/**
+ * Get the best instruction set supported by the CPU.
+ *
+ * The supported instruction sets are queried from CPUID at run time.
+ *
+ * @return The widest instruction set supported by both, the CPU and the engine build.
+ */
+instruction_sets getBestInstructionSet();
+
+/**
+ * The DirectGravitySolver class is the CPU equivalent of the all-pairs gravity shaders.
+ *
+ * It computes the accelerations of all bodies by summing up the contribution of every other body, i.e.
+ * it is of complexity O(N²). This is the same calculation as done by npCalcAcceleration() in the gravity shaders.
+ *
+ * Like update-verlet-shared.glsl stages positions through shared memory, the solver processes the bodies
+ * in tiles small enough to stay in the L1 cache. The interactions of a tile are evaluated with SIMD instructions
+ * for several bodies at once, using the approximate reciprocal square root of the instruction set refined by
+ * one Newton-Raphson step.
+ *
+ * The instruction set is selected at construction. By default the best instruction set supported by the CPU is used.
+ */
+class DirectGravitySolver : public GravitySolver
+{
+public:
+    /**
+     * The DirectGravitySolver constructor.
+     *
+     * @param softeningFactor The softening factor (see GravitySolver).
+     * @param instructionSet The instruction set used to evaluate interactions. If the instruction set is not supported
+     *                       by the CPU, the best supported one is used.
+     */
+    DirectGravitySolver(float softeningFactor = 0.1f, instruction_sets instructionSet = NP_ISA_BEST);
+
+    /**
+     * @copydoc GravitySolver::computeAccelerations()
+     */
+    void computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool);
+
+    /**
+     * @copydoc GravitySolver::getName()
+     */
+    std::string getName() const;
+
+    /**
+     * Get the used instruction set.
+     *
+     * @return The instruction set used to evaluate interactions.
+     */
+    instruction_sets getInstructionSet() const { return mInstructionSet; }
+
+    /**
+     * The number of bodies per tile.
+     *
+     * 1024 bodies take 16 KiB in structure of arrays layout which fits into the L1 data cache of all common CPUs.
+     */
+    static const unsigned TILE_SIZE = 1024;
+
+    /**
+     * The number of target bodies whose accelerations are accumulated while the tiles are processed.
+     */
+    static const unsigned TARGET_BLOCK_SIZE = 128;
+
+    /**
+     * Body data in structure of arrays layout as used by the SIMD implementations.
+     *
+     * All arrays are 64 byte aligned and padded with massless bodies to a multiple of TILE_SIZE.
+     */
+    struct BodyArrays
+    {
+        const float* x;
+        const float* y;
+        const float* z;
+        const float* mass;
+
+        /**
+         * The number of bodies including padding.
+         */
+        unsigned count;
+    };
+
+    /**
+     * Signature of the instruction set specific implementations.
+     *
+     * Computes the accelerations of the bodies [first, last) caused by all @p bodies.
+     */
+    typedef void (*acceleration_function)(const BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations);
+
+private:
+    /**
+     * Resize the body arrays so they can hold @p count bodies.
+     */
+    void reserve(unsigned count);
+
+    /**
+     * Convert the bodies to structure of arrays layout.
+     */
+    void copyBodies(const glm::vec4* bodies, unsigned bodyCount, ThreadPool& threadPool);
+
+    /**
+     * The used instruction set.
+     */
+    instruction_sets mInstructionSet;
+
+    /**
+     * The implementation for the used instruction set.
+     */
+    acceleration_function mAccelerationFunction;
+
+    /**
+     * Storage of the body arrays. Holds x, y, z and mass arrays one after another.
+     */
+    std::vector<float> mStorage;
+
+    /**
+     * The body arrays pointing into mStorage.
+     */
+    BodyArrays mBodies;
+};
+
+/**
+ * Instruction set specific implementations of DirectGravitySolver::acceleration_function.
+ *
+ * These are compiled for the respective instruction set with target attributes and must only be called if the CPU
+ * supports the instruction set.
+ */
+namespace directgravity
+{
+void computeAccelerationsScalar(const DirectGravitySolver::BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations);
+void computeAccelerationsSSE(const DirectGravitySolver::BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations);
+void computeAccelerationsAVX2(const DirectGravitySolver::BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations);
+void computeAccelerationsAVX512(const DirectGravitySolver::BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations);
+} // namespace directgravity
+
+} // namespace nparticles
+
+#endif // NP_DIRECTGRAVITYSOLVER_HPP
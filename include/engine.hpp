@@ -11,6 +11,7 @@
 #define NP_ENGINE_HPP
 
 #include <set>
+#include <vector>
 #include <glm/glm.hpp>
 
 #include "computesystem.hpp"
@@ -21,6 +22,7 @@
 
 #include "singleton.hpp"
 #include "gpuprogramservice.hpp"
+#include "readbackqueue.hpp"
 #include "camera.hpp"
 
 #include "signal.hpp"
@@ -33,6 +35,7 @@ class GLFWwindow;
 namespace nparticles
 {
 
+class ParticlePool;
 class ParticleSystem;
 
 /**
@@ -103,11 +106,16 @@ public:
      */
     inline void useDepthTest(bool depthTest = true) { mRenderSystem.useDepthTest(depthTest); }
 
+    /**
+     * @copydoc ComputeSystem::setBackend()
+     */
+    inline void setComputeBackend(compute_backends backend) { mComputeSystem.setBackend(backend); }
+
     /**
      * Update all ParticleSystem%s.
      *
-     * This method can be called to update all ParticleSystem%s of the Engine. All systems are
-     * updated sequentially by invoking their respective Action%s.
+     * This method can be called to update all ParticleSystem%s of the Engine. The Action%s of all systems
+     * are executed as one dependency graph, so independent Actions run concurrently (see ComputeSystem::updateParticleSystems()).
      *
      * A good idea to call this method is at the beginning of a render / "game" loop.
      */
@@ -118,6 +126,9 @@ public:
      *
      * This method renders all ParticleSystem%s sequentially.
      *
+     * The ParticleSystem%s are sorted by RenderProgram, Mesh, Material and ParticlePool, so systems which can be
+     * drawn together are adjacent and are merged by RenderSystem::drawParticleSystems().
+     *
      * A good idea to call this method is at the end of a render / "game" loop, i.e. after updateAllParticleSystems() was called.
      *
      * @note Since this method calls RenderSystem::beginFrame() and RenderSystem::endFrame(), all manually drawn stuff is whiped out!
@@ -129,7 +140,8 @@ public:
     /**
      * Process all input events.
      *
-     * This method processes all user keyboard and mouse events.
+     * This method processes all user keyboard and mouse events. It also resolves the finished readbacks of the
+     * ReadbackQueue.
      *
      * @note You have to call this method within your render / "game" loop or all input events are ignored!
      */
@@ -173,10 +185,12 @@ public:
      * @param particleCount The number of particles in the ParticleSystem.
      * @param mesh The Mesh used to render the particles.
      * @param material The Material used to render the particles.
+     * @param particlePool The ParticlePool to store the particle attributes in (see createParticlePool()). Pooled
+     *                     systems with the same Mesh and Material are drawn with a single draw call.
      *
      * @return Pointer to the newly created ParticleSytem.
      */
-    ParticleSystem* createParticleSystem(int particleCount, const Mesh& mesh, const Material& material);
+    ParticleSystem* createParticleSystem(int particleCount, const Mesh& mesh, const Material& material, ParticlePool* particlePool = nullptr);
 
     /**
      * Delete a ParticleSystem.
@@ -188,6 +202,18 @@ public:
      */
     void deleteParticleSystem(ParticleSystem* particleSystem);
 
+    /**
+     * Create a ParticlePool.
+     *
+     * The pool is owned by the Engine and deleted along with it, after all ParticleSystem%s. It queries the OpenGL
+     * context, so create it after init().
+     *
+     * @param capacity The number of particles of all ParticleSystem%s in the pool.
+     *
+     * @return Pointer to the newly created ParticlePool.
+     */
+    ParticlePool* createParticlePool(int capacity);
+
     /**
      * Get handle for GPUProgramService.
      *
@@ -250,6 +276,35 @@ public:
      */
     inline RenderSystem& getRenderSystem() { return mRenderSystem; }
 
+    /**
+     * Get the ComputeSystem of the Engine.
+     *
+     * Get the ComputeSystem to select the compute backend or to register CPUKernel%s.
+     *
+     * @return Reference to the ComputeSystem.
+     */
+    inline ComputeSystem& getComputeSystem() { return mComputeSystem; }
+
+    /**
+     * Get the ThreadPool of the Engine.
+     *
+     * The ThreadPool is the job system shared by all CPU work of the engine: CPUKernel%s, gravity solvers, neighbor
+     * searches as well as initial condition generation, file loading or analysis of applications.
+     *
+     * @return Reference to the ThreadPool.
+     */
+    inline ThreadPool& getThreadPool() { return mThreadPool; }
+
+    /**
+     * Get the ReadbackQueue of the Engine.
+     *
+     * Use it to read counters or attributes back every frame without stalling the pipeline. The queue is polled by
+     * processEvents().
+     *
+     * @return Reference to the ReadbackQueue.
+     */
+    inline ReadbackQueue& getReadbackQueue() { return mReadbackQueue; }
+
 private:
     /**
      * Private Engine constructor.
@@ -365,6 +420,11 @@ private:
      */
     glm::dvec2 mLastCursorPosition;
 
+    /**
+     * The ThreadPool running all CPU work. It has to be constructed before and destroyed after the ComputeSystem.
+     */
+    ThreadPool mThreadPool;
+
     /**
      * The ComputeSystem to update ParticleSystems.
      */
@@ -385,11 +445,21 @@ private:
      */
     GPUProgramService mGPUProgramService;
 
+    /**
+     * The ReadbackQueue resolving asynchronous readbacks.
+     */
+    ReadbackQueue mReadbackQueue;
+
     /**
      * All created and managed ParticleSystem%s.
      */
     std::set<ParticleSystem*> mParticleSystems;
 
+    /**
+     * All created ParticlePool%s.
+     */
+    std::vector<ParticlePool*> mParticlePools;
+
     // Hide copy constructor and assignment operators
     Engine(const Engine&) = delete;
     void operator=(const Engine&) = delete;
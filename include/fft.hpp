@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_FFT_HPP
+#define NP_FFT_HPP
+
+#include <complex>
+#include <vector>
+
+namespace nparticles
+{
+
+class ThreadPool;
+
+/**
+ * The FFT class computes fast Fourier transforms of complex data of power of two sizes.
+ *
+ * It uses an iterative radix-2 Cooley-Tukey algorithm with precomputed twiddle factors and
+ * bit reversal table. Besides single lines, cubic 3D grids can be transformed. The lines of
+ * 3D grids are distributed among the threads of a ThreadPool.
+ *
+ * Like most FFT implementations, the transforms are not normalised: a forward transform followed by an
+ * inverse transform scales the data by the number of transformed elements.
+ */
+class FFT
+{
+public:
+    /**
+     * The FFT constructor.
+     *
+     * @param size The number of elements of a line. Must be a power of two.
+     */
+    FFT(unsigned size = 1);
+
+    /**
+     * Set the size of the transform.
+     *
+     * @param size The number of elements of a line. Must be a power of two.
+     *
+     * @return True if @p size is a power of two, false otherwise. The size is not changed in this case.
+     */
+    bool setSize(unsigned size);
+
+    /**
+     * Get the size of the transform.
+     *
+     * @return The number of elements of a line.
+     */
+    unsigned getSize() const { return mSize; }
+
+    /**
+     * Transform a line in place.
+     *
+     * @param data Array of getSize() elements.
+     * @param inverse If true, the inverse transform is computed.
+     */
+    void transform(std::complex<float>* data, bool inverse) const;
+
+    /**
+     * Transform a cubic 3D grid in place.
+     *
+     * The element (x, y, z) is stored at index (x * size + y) * size + z.
+     *
+     * @param data Array of getSize()³ elements.
+     * @param inverse If true, the inverse transform is computed.
+     * @param threadPool The ThreadPool used to transform the lines in parallel.
+     */
+    void transform3D(std::complex<float>* data, bool inverse, ThreadPool& threadPool) const;
+
+private:
+    /**
+     * The number of elements of a line.
+     */
+    unsigned mSize;
+
+    /**
+     * exp(-2 * pi * i * k / size) for k < size / 2.
+     */
+    std::vector<std::complex<float> > mTwiddles;
+
+    /**
+     * The bit reversed index of each element.
+     */
+    std::vector<unsigned> mBitReversal;
+};
+
+} // namespace nparticles
+
+#endif // NP_FFT_HPP
@@ -0,0 +1,294 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_FMMSOLVER_HPP
+#define NP_FMMSOLVER_HPP
+
+#include <vector>
+#include <utility>
+
+#include "gravitysolver.hpp"
+#include "octree.hpp"
+
+namespace nparticles
+{
+
+/**
+ * The FMMSolver class approximates gravity with the fast multipole method (FMM).
+ *
+ * The solver uses Cartesian Taylor expansions up to a configurable order on an adaptive Octree. One time step
+ * consists of the following phases:
+ * - Tree build: The Octree is built over all bodies.
+ * - Upward pass: Multipole expansions of the leaves are computed from their bodies (P2M) and shifted to
+ *   the parent nodes (M2M), level by level.
+ * - Traversal: A dual tree traversal finds the pairs of well separated nodes and the pairs of neighbouring leaves.
+ *   Two nodes are well separated if (radius A + radius B) < theta * distance.
+ * - M2L: The multipole expansions of well separated nodes are converted into local expansions.
+ * - P2P: Bodies of neighbouring leaves interact directly.
+ * - Downward pass: Local expansions are shifted to the children (L2L) and evaluated at the bodies of the
+ *   leaves (L2P).
+ *
+ * The complexity is O(N). The order and theta trade accuracy for speed: the error of the far field decreases
+ * with theta^(order + 1), while the cost of each M2L grows with order^6.
+ *
+ * The expansions are derived from the softened kernel 1 / sqrt(r² + softening²), so the far field matches the
+ * direct P2P interactions even in dense regions where nodes are closer than the softening length.
+ */
+class FMMSolver : public GravitySolver
+{
+public:
+    /**
+     * Time spent in the phases of the last computeAccelerations() call in seconds.
+     */
+    struct PhaseTimes
+    {
+        double treeBuild;
+        double upwardPass;
+        double traversal;
+        double m2l;
+        double p2p;
+        double downwardPass;
+    };
+
+    /**
+     * The FMMSolver constructor.
+     *
+     * @param order The expansion order. Clamped to [1, MAX_ORDER].
+     * @param theta The opening angle used to decide if two nodes are well separated.
+     * @param softeningFactor The softening factor (see GravitySolver).
+     * @param leafSize The maximum number of bodies stored in a leaf.
+     */
+    FMMSolver(unsigned order = 4, float theta = 0.6f, float softeningFactor = 0.1f, unsigned leafSize = 64);
+
+    /**
+     * @copydoc GravitySolver::computeAccelerations()
+     */
+    void computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool);
+
+    /**
+     * @copydoc GravitySolver::getName()
+     */
+    std::string getName() const;
+
+    /**
+     * Set the expansion order.
+     *
+     * @param order The new expansion order. Clamped to [1, MAX_ORDER].
+     */
+    void setOrder(unsigned order);
+
+    /**
+     * Get the expansion order.
+     *
+     * @return The expansion order.
+     */
+    unsigned getOrder() const { return mOrder; }
+
+    /**
+     * Set the opening angle.
+     *
+     * @param theta The new opening angle.
+     */
+    void setTheta(float theta) { mTheta = theta; }
+
+    /**
+     * Get the opening angle.
+     *
+     * @return The opening angle.
+     */
+    float getTheta() const { return mTheta; }
+
+    /**
+     * Set the maximum number of bodies stored in a leaf.
+     *
+     * Larger leaves shift work from the M2L to the P2P phase.
+     *
+     * @param leafSize The maximum number of bodies stored in a leaf.
+     */
+    void setLeafSize(unsigned leafSize) { mOctree.setLeafSize(leafSize); }
+
+    /**
+     * Get the maximum number of bodies stored in a leaf.
+     *
+     * @return The maximum number of bodies stored in a leaf.
+     */
+    unsigned getLeafSize() const { return mOctree.getLeafSize(); }
+
+    /**
+     * Get the time spent in each phase.
+     *
+     * @return The phase times of the last computeAccelerations() call.
+     */
+    const PhaseTimes& getPhaseTimes() const { return mPhaseTimes; }
+
+    /**
+     * The maximum expansion order.
+     */
+    static const unsigned MAX_ORDER = 12;
+
+private:
+    /**
+     * A multi index (kx, ky, kz) of an expansion term.
+     */
+    struct Term
+    {
+        unsigned k[3];
+        unsigned degree;
+    };
+
+    /**
+     * The interactions of the nodes of a subtree found by the traversal.
+     */
+    struct TraversalTask
+    {
+        /**
+         * Root of the subtree. All targets of the interactions are in this subtree.
+         */
+        unsigned node;
+
+        /**
+         * (target, source) pairs of well separated nodes.
+         */
+        std::vector<std::pair<unsigned, unsigned> > m2l;
+
+        /**
+         * (target, source) pairs of neighbouring leaves.
+         */
+        std::vector<std::pair<unsigned, unsigned> > p2p;
+    };
+
+    /**
+     * Set up the multi index tables for the current order.
+     */
+    void initTerms();
+
+    /**
+     * Get the number of terms of an expansion of order @p order.
+     */
+    static unsigned getTermCount(unsigned order) { return (order + 1) * (order + 2) * (order + 3) / 6; }
+
+    /**
+     * Compute d^k / k! for all terms k.
+     */
+    void computePowers(const glm::dvec3& d, double* powers) const;
+
+    /**
+     * Compute the derivatives of 1 / |r| for all terms.
+     */
+    void computeDerivatives(const glm::dvec3& r, double* derivatives) const;
+
+    /**
+     * Compute the multipole expansion and radius of a node (P2M for leaves, M2M for inner nodes).
+     */
+    void upward(unsigned nodeIndex);
+
+    /**
+     * Collect the interactions of the subtree @p target with the subtree @p source.
+     */
+    void traverse(unsigned target, unsigned source, TraversalTask& task) const;
+
+    /**
+     * Collect the subtrees for which the traversal is run in parallel.
+     */
+    void collectTraversalTasks(unsigned nodeIndex);
+
+    /**
+     * Add the multipole expansion of @p source to the local expansion of @p target.
+     */
+    void multipoleToLocal(unsigned target, unsigned source);
+
+    /**
+     * Add the direct interactions of the bodies of @p source to the bodies of @p target.
+     */
+    void particleToParticle(unsigned target, unsigned source);
+
+    /**
+     * Shift the local expansion of a node to its children (L2L), or evaluate it at its bodies if it
+     * is a leaf (L2P).
+     */
+    void downward(unsigned nodeIndex, glm::vec3* accelerations);
+
+    /**
+     * The expansion order.
+     */
+    unsigned mOrder;
+
+    /**
+     * The opening angle.
+     */
+    float mTheta;
+
+    /**
+     * The tree over all bodies.
+     */
+    Octree mOctree;
+
+    /**
+     * The terms of an expansion, sorted by degree.
+     */
+    std::vector<Term> mTerms;
+
+    /**
+     * Index of term (kx, ky, kz) at ((kx * (order + 1) + ky) * (order + 1) + kz), -1 if the degree exceeds the order.
+     */
+    std::vector<int> mTermIndices;
+
+    /**
+     * For each term k and axis i, the index of k - e_i or -1.
+     */
+    std::vector<int> mLowerTerms[3];
+
+    /**
+     * For each pair of terms (k, n), the index of k + n or -1.
+     */
+    std::vector<int> mSumTerms;
+
+    /**
+     * (-1)^|k| for each term k.
+     */
+    std::vector<double> mSigns;
+
+    /**
+     * Multipole and local expansions of all nodes, getTermCount(mOrder) coefficients per node.
+     */
+    std::vector<double> mMultipoles;
+    std::vector<double> mLocals;
+
+    /**
+     * Distance from the center of each node to its farthest body.
+     */
+    std::vector<float> mRadii;
+
+    /**
+     * Sorted bodies in structure of arrays layout for P2P.
+     */
+    std::vector<float> mX;
+    std::vector<float> mY;
+    std::vector<float> mZ;
+    std::vector<float> mMass;
+
+    /**
+     * Near field accelerations of the sorted bodies.
+     */
+    std::vector<glm::vec3> mNearField;
+
+    /**
+     * The subtrees traversed in parallel and their interactions.
+     */
+    std::vector<TraversalTask> mTasks;
+
+    /**
+     * The times of the last computeAccelerations() call.
+     */
+    PhaseTimes mPhaseTimes;
+};
+
+} // namespace nparticles
+
+#endif // NP_FMMSOLVER_HPP
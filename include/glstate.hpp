@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_GLSTATE_HPP
+#define NP_GLSTATE_HPP
+
+#include <GL/glew.h>
+
+#include <map>
+#include <utility>
+
+#include "singleton.hpp"
+
+namespace nparticles
+{
+
+/**
+ * The GlState class shadows the OpenGL state changed by the engine.
+ *
+ * All buffer bindings, the current program, the vertex array binding and the capabilities are changed through the
+ * GlState. It remembers the state of the context, so
+ * - binding an object which is already bound is skipped and
+ * - saving a binding to restore it later does not query OpenGL (glGet*() calls are synchronous and may flush the
+ *   command stream on some drivers).
+ *
+ * Element array buffer bindings are part of the vertex array object, so they are shadowed per vertex array.
+ *
+ * The shadow starts with the default state of a new context. If code outside of the engine changes the state, it has
+ * to call invalidate(). Afterwards every binding is queried from OpenGL once when it is needed.
+ *
+ * Objects have to be deleted through the GlState (deleteBuffer(), deleteProgram(), deleteVertexArray()), since
+ * OpenGL unbinds deleted objects and their names may be reused.
+ *
+ * If direct state access (OpenGL 4.5 or GL_ARB_direct_state_access) is used, objects are created with glCreate*()
+ * and edited by name, so most binds are not needed at all (see usesDirectStateAccess()).
+ *
+ * @code
+ * GlState* glState = GlState::getInstance();
+ *
+ * GLuint previouslyBoundBuffer = glState->getBoundBuffer(GL_ARRAY_BUFFER);
+ * glState->bindBuffer(GL_ARRAY_BUFFER, buffer);
+ * // ...
+ * glState->bindBuffer(GL_ARRAY_BUFFER, previouslyBoundBuffer);
+ * @endcode
+ */
+class GlState : public Singleton<GlState>
+{
+friend class Singleton<GlState>;
+
+public:
+    /**
+     * Bind a buffer to a target, see glBindBuffer().
+     *
+     * @param target The buffer target.
+     * @param buffer The buffer handle, 0 to unbind.
+     */
+    void bindBuffer(GLenum target, GLuint buffer);
+
+    /**
+     * Bind a buffer to an indexed target, see glBindBufferBase().
+     *
+     * Like in OpenGL, the buffer is also bound to the generic binding point of @p target.
+     *
+     * @param target The buffer target with multiple binding points.
+     * @param index The binding index.
+     * @param buffer The buffer handle, 0 to unbind.
+     */
+    void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+
+    /**
+     * Bind a range of a buffer to an indexed target, see glBindBufferRange().
+     *
+     * @param target The buffer target with multiple binding points.
+     * @param index The binding index.
+     * @param buffer The buffer handle.
+     * @param offset The offset of the range in bytes.
+     * @param size The size of the range in bytes.
+     */
+    void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+    /**
+     * Bind buffers to consecutive indices, see glBindBuffersBase() and glBindBuffersRange().
+     *
+     * Requires GL_ARB_multi_bind. Bindings which are already set are not skipped, the call binds all buffers at once.
+     *
+     * @param target The buffer target with multiple binding points.
+     * @param first The first binding index.
+     * @param count The number of buffers.
+     * @param buffers The buffer handles.
+     * @param offsets The offsets of the ranges or nullptr to bind the whole buffers.
+     * @param sizes The sizes of the ranges or nullptr to bind the whole buffers.
+     */
+    void bindBuffers(GLenum target, GLuint first, GLsizei count, const GLuint* buffers, const GLintptr* offsets = nullptr, const GLsizeiptr* sizes = nullptr);
+
+    /**
+     * Get the buffer bound to a target.
+     *
+     * @param target The buffer target.
+     *
+     * @return The handle of the bound buffer or 0.
+     */
+    GLuint getBoundBuffer(GLenum target);
+
+    /**
+     * Delete a buffer and remove it from all bindings.
+     *
+     * @param buffer The buffer handle.
+     */
+    void deleteBuffer(GLuint buffer);
+
+    /**
+     * Use a program, see glUseProgram().
+     *
+     * @param program The program handle, 0 to use no program.
+     */
+    void useProgram(GLuint program);
+
+    /**
+     * Get the current program.
+     *
+     * @return The handle of the current program or 0.
+     */
+    GLuint getCurrentProgram();
+
+    /**
+     * Delete a program.
+     *
+     * @param program The program handle.
+     */
+    void deleteProgram(GLuint program);
+
+    /**
+     * Bind a vertex array object, see glBindVertexArray().
+     *
+     * @param vertexArray The vertex array handle, 0 to unbind.
+     */
+    void bindVertexArray(GLuint vertexArray);
+
+    /**
+     * Get the bound vertex array object.
+     *
+     * @return The handle of the bound vertex array or 0.
+     */
+    GLuint getBoundVertexArray();
+
+    /**
+     * Set the element array buffer of a vertex array object by name, see glVertexArrayElementBuffer().
+     *
+     * Requires direct state access.
+     *
+     * @param vertexArray The vertex array handle.
+     * @param buffer The buffer handle, 0 to remove the element array buffer.
+     */
+    void setVertexArrayElementBuffer(GLuint vertexArray, GLuint buffer);
+
+    /**
+     * Delete a vertex array object.
+     *
+     * @param vertexArray The vertex array handle.
+     */
+    void deleteVertexArray(GLuint vertexArray);
+
+    /**
+     * Enable or disable a capability, see glEnable() and glDisable().
+     *
+     * @param capability The capability, e.g. GL_DEPTH_TEST.
+     * @param enabled True to enable the capability, false to disable it.
+     */
+    void setCapability(GLenum capability, bool enabled);
+
+    /**
+     * Check if a capability is enabled.
+     *
+     * @param capability The capability, e.g. GL_DEPTH_TEST.
+     *
+     * @return True if the capability is enabled.
+     */
+    bool isEnabled(GLenum capability);
+
+    /**
+     * Enable or disable the direct state access code path.
+     *
+     * The RenderSystem enables it at initialisation if the context supports it. It must not be changed after objects
+     * have been created, since names created by glGen*() are no objects until they are bound.
+     *
+     * @param directStateAccess True to create and edit objects with the direct state access functions.
+     */
+    void setDirectStateAccess(bool directStateAccess) { mDirectStateAccess = directStateAccess; }
+
+    /**
+     * Check if objects are created and edited with the direct state access functions.
+     *
+     * @return True if direct state access is used, false if objects are bound to be edited.
+     */
+    bool usesDirectStateAccess() const { return mDirectStateAccess; }
+
+    /**
+     * Forget the shadowed state.
+     *
+     * Call this after code outside of the engine changed bindings, the program or capabilities.
+     */
+    void invalidate();
+
+private:
+    /**
+     * GlState constructor.
+     */
+    GlState();
+
+    /**
+     * GlState destructor.
+     */
+    ~GlState();
+
+    // Hide copy constructor and assignment operator
+    GlState(const GlState&) = delete;
+    void operator=(const GlState&) = delete;
+
+    /**
+     * Get the shadowed binding of a target, querying it if it is unknown.
+     *
+     * @param target The buffer target.
+     *
+     * @return Reference to the shadowed binding.
+     */
+    GLuint& getBufferBinding(GLenum target);
+
+    /**
+     * An indexed buffer binding. A size of 0 denotes the whole buffer.
+     */
+    struct IndexedBinding
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    /**
+     * True if the direct state access code path is used.
+     */
+    bool mDirectStateAccess;
+
+    /**
+     * True if entries missing in the shadow have their default values, false after invalidate().
+     */
+    bool mDefaultsValid;
+
+    /**
+     * The generic buffer bindings by target, except GL_ELEMENT_ARRAY_BUFFER.
+     */
+    std::map<GLenum, GLuint> mBufferBindings;
+
+    /**
+     * The element array buffer bindings by vertex array.
+     */
+    std::map<GLuint, GLuint> mElementArrayBindings;
+
+    /**
+     * The indexed buffer bindings by target and index.
+     */
+    std::map<std::pair<GLenum, GLuint>, IndexedBinding> mIndexedBindings;
+
+    /**
+     * The current program and whether it is known.
+     */
+    GLuint mProgram;
+    bool mProgramKnown;
+
+    /**
+     * The bound vertex array and whether it is known.
+     */
+    GLuint mVertexArray;
+    bool mVertexArrayKnown;
+
+    /**
+     * The capabilities.
+     */
+    std::map<GLenum, bool> mCapabilities;
+};
+
+} // namespace nparticles
+
+#endif // NP_GLSTATE_HPP
@@ -10,9 +10,16 @@
 #ifndef NP_GPUSYSTEM_HPP
 #define NP_GPUSYSTEM_HPP
 
+#include <GL/glew.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
 namespace nparticles
 {
 
+class BufferBase;
 class ParticleSystem;
 class ShaderProgram;
 
@@ -39,17 +46,21 @@ protected:
     virtual ~GPUSystem();
 
     /**
-     * Bind the particle attributes, atomic counters and uniform buffers of a ParticleSystem.
+     * Bind the particle attributes, atomic counters, uniform buffers and storage buffers of a ParticleSystem.
      *
      * This binds all buffers of a particle system to the specified ShaderProgram.
      *
+     * The binding indices are queried once per pair of ShaderProgram and ParticleSystem and cached in a binding
+     * table, which is rebuilt when the buffers of the ParticleSystem change (see ParticleSystem::getBufferGeneration()).
+     * Buffers on consecutive indices of a target are bound with a single call (see BufferBase::bindBases()).
+     *
      * @param particleSystem The ParticleSystem to be bound. All its buffers are bound to the @p shaderProgram.
      * @param shaderProgram The ShaderProgram to which the buffers are bound.
      */
     void bindParticleBuffers(ParticleSystem* particleSystem, ShaderProgram* shaderProgram);
 
     /**
-     * Unbinds all particle attributes, atomic counters and uniform buffers of a ParticleSystem.
+     * Unbinds all particle attributes, atomic counters, uniform buffers and storage buffers of a ParticleSystem.
      *
      * This revertes the bindings applied by bindParticleBuffers(). Note that the ShaderProgram is not passed as parameter
      * since it does not store the current binding but the buffers of the ParticleSystem do.
@@ -57,6 +68,71 @@ protected:
      * @param particleSystem The ParticleSystem of which the buffers are unbound.
      */
     void unbindParticleBuffers(ParticleSystem* particleSystem);
+
+    /**
+     * Forget the cached state of a ParticleSystem, i.e. its binding tables.
+     *
+     * This is called by Engine::deleteParticleSystem() before the ParticleSystem is deleted.
+     *
+     * @param particleSystem The ParticleSystem which is removed.
+     */
+    virtual void removeParticleSystem(const ParticleSystem* particleSystem);
+
+private:
+    // Hide copy constructor and assignment operator
+    GPUSystem(const GPUSystem&) = delete;
+    void operator=(const GPUSystem&) = delete;
+
+    /**
+     * Buffers bound on consecutive indices of one target.
+     */
+    struct BindingRun
+    {
+        /**
+         * The buffer target, e.g. GL_SHADER_STORAGE_BUFFER.
+         */
+        GLenum target;
+
+        /**
+         * The index on which the first buffer is bound.
+         */
+        GLuint first;
+
+        /**
+         * The buffers, bound on the indices first, first + 1, ...
+         */
+        std::vector<BufferBase*> buffers;
+    };
+
+    /**
+     * The resolved bindings of the buffers of a ParticleSystem in a ShaderProgram.
+     */
+    struct BindingTable
+    {
+        /**
+         * The buffer generation of the ParticleSystem the table was built for.
+         */
+        unsigned generation;
+
+        /**
+         * The bindings, sorted by target and index.
+         */
+        std::vector<BindingRun> runs;
+    };
+
+    /**
+     * Build the binding table of a ParticleSystem in a ShaderProgram.
+     *
+     * @param particleSystem The ParticleSystem whose buffers are bound.
+     * @param shaderProgram The ShaderProgram which is queried for the binding indices.
+     * @param table The table to fill.
+     */
+    void buildBindingTable(ParticleSystem* particleSystem, const ShaderProgram* shaderProgram, BindingTable& table);
+
+    /**
+     * The binding tables of all pairs of ShaderProgram and ParticleSystem bound so far.
+     */
+    std::map<std::pair<const ShaderProgram*, const ParticleSystem*>, BindingTable> mBindingTables;
 };
 
 } // namespace nparticles
@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_GRAVITYCPUKERNEL_HPP
+#define NP_GRAVITYCPUKERNEL_HPP
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "cpukernel.hpp"
+
+namespace nparticles
+{
+
+class GravitySolver;
+
+/**
+ * @brief The gravity_integrators enum defines the integration methods of the GravityCPUKernel.
+ */
+enum gravity_integrators
+{
+    /**
+     * Improved Euler integration. The properties attribute holds the velocities.
+     */
+    NP_GI_EULER,
+
+    /**
+     * Verlet integration. The properties attribute holds the positions of the last time step.
+     */
+    NP_GI_VERLET,
+
+    /**
+     * Verlet integration writing the new positions to the properties attribute. The attributes have to be
+     * swapped after each update (see ParticleSystem::swapParticleAttributes()).
+     */
+    NP_GI_VERLET_DOUBLE_BUFFERED
+};
+
+/**
+ * The GravityCPUKernel class is the CPU counterpart of the gravity update shaders.
+ *
+ * The accelerations are computed by a GravitySolver, so the same integration can be run with
+ * different algorithms. Afterwards, the particles are integrated the same way as done by
+ * the update shaders of the gravity sample.
+ *
+ * The kernel expects two particle attributes of type glm::vec4:
+ * - Positions: Position in xyz, mass in w.
+ * - Properties: Velocity or last position in xyz (depending on the integrator), w is preserved.
+ *
+ * The accelerations of all particles are computed in beginUpdate(), so all particles see the positions of
+ * the previous time step. update() integrates the particles in parallel.
+ */
+class GravityCPUKernel : public CPUKernel
+{
+public:
+    /**
+     * The GravityCPUKernel constructor.
+     *
+     * @param solver The GravitySolver used to compute accelerations. The kernel takes ownership.
+     * @param integrator The integration method.
+     * @param positionsAttribute The name of the positions attribute.
+     * @param propertiesAttribute The name of the properties attribute.
+     */
+    GravityCPUKernel(GravitySolver* solver, gravity_integrators integrator = NP_GI_EULER,
+                     std::string positionsAttribute = "ParticlePositions", std::string propertiesAttribute = "ParticleProperties");
+
+    /**
+     * The GravityCPUKernel destructor.
+     */
+    ~GravityCPUKernel();
+
+    /**
+     * Compute the accelerations of all particles.
+     */
+    void beginUpdate(ParticleSystem* particleSystem, ThreadPool& threadPool);
+
+    /**
+     * Integrate a range of particles.
+     */
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last);
+
+    /**
+     * Set the time step.
+     *
+     * @param timeStep The time step used for integration.
+     */
+    void setTimeStep(float timeStep) { mTimeStep = timeStep; }
+
+    /**
+     * Get the time step.
+     *
+     * @return The time step used for integration.
+     */
+    float getTimeStep() const { return mTimeStep; }
+
+    /**
+     * Get the solver.
+     *
+     * @return The GravitySolver used to compute accelerations.
+     */
+    GravitySolver* getSolver() const { return mSolver; }
+
+private:
+    /**
+     * The GravitySolver used to compute accelerations.
+     */
+    GravitySolver* mSolver;
+
+    /**
+     * The integration method.
+     */
+    gravity_integrators mIntegrator;
+
+    /**
+     * The name of the positions attribute.
+     */
+    std::string mPositionsAttribute;
+
+    /**
+     * The name of the properties attribute.
+     */
+    std::string mPropertiesAttribute;
+
+    /**
+     * The time step used for integration.
+     */
+    float mTimeStep;
+
+    /**
+     * The accelerations computed by the solver.
+     */
+    std::vector<glm::vec3> mAccelerations;
+};
+
+} // namespace nparticles
+
+#endif // NP_GRAVITYCPUKERNEL_HPP
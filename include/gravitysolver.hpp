@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_GRAVITYSOLVER_HPP
+#define NP_GRAVITYSOLVER_HPP
+
+#include <string>
+
+#include <glm/glm.hpp>
+
+namespace nparticles
+{
+
+class ThreadPool;
+
+/**
+ * The GravitySolver class is the base class for CPU gravity solvers.
+ *
+ * A GravitySolver calculates the gravitational acceleration of a set of bodies. Bodies are passed as
+ * glm::vec4 with the position stored in xyz and the mass stored in w. This equals the layout of the
+ * "ParticlePositions" attribute used by the gravity sample.
+ *
+ * Accelerations are computed for all bodies at once, so solvers can choose how to split the work among
+ * the threads of the ThreadPool (e.g. along the nodes of a tree instead of the order of the bodies).
+ *
+ * As the gravity shaders (see gravity-utils.glsl), solvers do not take the gravitational constant into account.
+ *
+ * @see GravityCPUKernel
+ */
+class GravitySolver
+{
+public:
+    /**
+     * The GravitySolver constructor.
+     *
+     * @param softeningFactor The softening factor used to prevent accelerations from becoming infinite if two bodies
+     *                        are virtually at the same position.
+     */
+    GravitySolver(float softeningFactor = 0.1f);
+
+    /**
+     * The virtual GravitySolver destructor.
+     */
+    virtual ~GravitySolver();
+
+    /**
+     * Compute the accelerations of all bodies.
+     *
+     * @param bodies Array of @p bodyCount bodies. Positions are stored in xyz, masses in w.
+     * @param bodyCount The number of bodies.
+     * @param accelerations Array of @p bodyCount accelerations which receives the result.
+     * @param threadPool The ThreadPool used to parallelise the computation.
+     */
+    virtual void computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool) = 0;
+
+    /**
+     * Get the name of the solver.
+     *
+     * @return Human readable name of the solver, e.g. for benchmark output.
+     */
+    virtual std::string getName() const = 0;
+
+    /**
+     * Set the softening factor.
+     *
+     * @param softeningFactor The new softening factor.
+     */
+    void setSofteningFactor(float softeningFactor) { mSofteningFactor = softeningFactor; }
+
+    /**
+     * Get the softening factor.
+     *
+     * @return The softening factor.
+     */
+    float getSofteningFactor() const { return mSofteningFactor; }
+
+protected:
+    /**
+     * The softening factor.
+     */
+    float mSofteningFactor;
+
+private:
+    // Hide copy constructor and assignment operator
+    GravitySolver(const GravitySolver&) = delete;
+    void operator=(const GravitySolver&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_GRAVITYSOLVER_HPP
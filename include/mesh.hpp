@@ -31,6 +31,9 @@ class ResourceManager;
  *
  * It can be used to store per vertex data like texture coordinates which are currently not supported.
  *
+ * A Mesh has no vertex array object of its own, the RenderSystem sets one up for each RenderProgram the Mesh is
+ * rendered with.
+ *
  * Meshes are managed by the MeshManager and can not be created manually.
  */
 class Mesh
@@ -38,20 +41,6 @@ class Mesh
 friend class MeshManager;
 friend class ResourceManager<Mesh>;
 public:
-    /**
-     * Binds a Mesh for rendering.
-     *
-     * This activates the Mesh so it can be rendered.
-     */
-    void bind() const;
-
-    /**
-     * Unbinds the Mesh after rendering.
-     *
-     * This disables the Mesh after rendering completed.
-     */
-    void unbind() const;
-
     /**
      * Get the vertx Buffer of the Mesh.
      *
@@ -70,6 +59,16 @@ public:
      */
     Buffer<GLuint>* getIndexBuffer() { return &mIndexBuffer; }
 
+    /**
+     * Get the generation of the Mesh.
+     *
+     * The generation is unique across all Meshes, so it tells a new Mesh apart from a deleted one at the same address
+     * and can be used to invalidate state cached for a Mesh, e.g. vertex arrays.
+     *
+     * @return The generation of the Mesh.
+     */
+    unsigned getGeneration() const { return mGeneration; }
+
 private:
     /**
      * Private Mesh constructor.
@@ -90,11 +89,6 @@ private:
      */
     ~Mesh();
 
-    /**
-     * This is the vertex array object (VAO) used for binding of vertex attributes by OpenGL.
-     */
-    GLuint mVao;
-
     /**
      * The vertex Buffer.
      *
@@ -109,6 +103,11 @@ private:
      */
     Buffer<GLuint> mIndexBuffer;
 
+    /**
+     * The generation of the Mesh, see getGeneration().
+     */
+    unsigned mGeneration;
+
     // Hide copy constructor and assignment operator
     Mesh(const Mesh&) = delete;
     void operator=(const Mesh&) = delete;
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_NEIGHBORGRID_HPP
+#define NP_NEIGHBORGRID_HPP
+
+#include <string>
+
+#include <glm/glm.hpp>
+
+namespace nparticles
+{
+
+class ParticleSystem;
+class ShaderProgram;
+
+/**
+ * @brief The neighbor_grid_types enum defines how a NeighborGrid maps cells to its cell table.
+ */
+enum neighbor_grid_types
+{
+    /**
+     * A bounded uniform grid. Particles outside of the grid are sorted into the border cells.
+     */
+    NP_NG_UNIFORM,
+
+    /**
+     * An unbounded grid whose cells are hashed into a table of fixed size.
+     */
+    NP_NG_HASHED
+};
+
+/**
+ * The NeighborGrid class sorts the particles of a ParticleSystem into the cells of a grid, so short range
+ * interactions only have to visit the particles of adjacent cells instead of all particles.
+ *
+ * The grid is built by a counting sort which is appended to the ParticleSystem as three Actions:
+ * - Count: each particle determines its cell and its rank within the cell (np/grid-count.glsl).
+ * - Scan: the prefix sum over the cell counts yields the range of each cell (np/grid-scan.glsl).
+ * - Scatter: the particle indices are written sorted by cell (np/grid-scatter.glsl).
+ *
+ * The results are stored in storage buffers of the ParticleSystem and are bound to all following Actions:
+ * - NPGridCellStarts, NPGridCellEnds: the range of each cell in NPGridParticleIndices.
+ * - NPGridParticleIndices: the particle indices sorted by cell.
+ *
+ * Shaders access them by including np/neighborgrid.glsl; their uniforms are set with setUniforms(). On the
+ * CPU backend, the build runs in CPUKernels and getNeighborCells() provides the same lookup as the shader.
+ * The shader sources are loaded from "/np", so the directory res/shader/np has to be added to the
+ * GPUProgramService before attach() is called.
+ *
+ * The cell size should be at least the interaction radius, so all neighbors are within the 27 adjacent cells.
+ * The NeighborGrid must outlive the ParticleSystems it is attached to.
+ */
+class NeighborGrid
+{
+public:
+    /**
+     * Create a uniform grid.
+     *
+     * @param origin The minimum corner of the grid.
+     * @param dimensions The number of cells along each axis.
+     * @param cellSize The edge length of a cell.
+     * @param positionsAttribute The name of the particle attribute holding the positions (xyz of a vec4).
+     */
+    NeighborGrid(const glm::vec3& origin, const glm::uvec3& dimensions, float cellSize, const std::string& positionsAttribute = "ParticlePositions");
+
+    /**
+     * Create a spatial hash.
+     *
+     * @param cellSize The edge length of a cell.
+     * @param tableSize The number of entries of the hash table. Rounded up to a power of two.
+     * @param positionsAttribute The name of the particle attribute holding the positions (xyz of a vec4).
+     */
+    NeighborGrid(float cellSize, unsigned tableSize, const std::string& positionsAttribute = "ParticlePositions");
+
+    /**
+     * Attach the grid to a ParticleSystem.
+     *
+     * This adds the storage buffers of the grid and appends the Actions building it. Actions appended afterwards
+     * can use the grid. The compute programs are created and their CPUKernel%s registered on first use.
+     *
+     * @param particleSystem The ParticleSystem to sort into the grid.
+     *
+     * @return True on success, false if a compute program cannot be created or the ParticleSystem already has a grid.
+     */
+    bool attach(ParticleSystem* particleSystem);
+
+    /**
+     * Set the uniforms of np/neighborgrid.glsl.
+     *
+     * @param program The ShaderProgram to set the uniforms for.
+     */
+    void setUniforms(const ShaderProgram& program) const;
+
+    /**
+     * Get the integer coordinate of the cell containing a position.
+     *
+     * @param position The position.
+     * @return The cell coordinate. Not clamped to the grid.
+     */
+    glm::ivec3 getCellCoordinate(const glm::vec3& position) const;
+
+    /**
+     * Get the table index of a cell.
+     *
+     * @param cell The cell coordinate. Has to be inside of a uniform grid.
+     * @return The index of the cell in the cell tables.
+     */
+    unsigned getCellIndex(const glm::ivec3& cell) const;
+
+    /**
+     * Get the table index of the cell a particle at @p position is sorted into.
+     *
+     * @param position The position.
+     * @return The index of the cell in the cell tables.
+     */
+    unsigned getCellIndex(const glm::vec3& position) const;
+
+    /**
+     * Get the table indices of the cells adjacent to the cell containing a position (including the cell itself).
+     *
+     * Cells outside of a uniform grid are skipped. Duplicates caused by hash collisions are removed.
+     *
+     * @param position The position.
+     * @param cells Array receiving up to 27 cell indices.
+     * @return The number of cells written to @p cells.
+     */
+    unsigned getNeighborCells(const glm::vec3& position, unsigned cells[27]) const;
+
+    /**
+     * Get the grid type.
+     *
+     * @return The type of the grid.
+     */
+    neighbor_grid_types getType() const { return mType; }
+
+    /**
+     * Get the minimum corner of a uniform grid.
+     *
+     * @return The grid origin.
+     */
+    const glm::vec3& getOrigin() const { return mOrigin; }
+
+    /**
+     * Get the number of cells along each axis of a uniform grid.
+     *
+     * @return The grid dimensions.
+     */
+    const glm::uvec3& getDimensions() const { return mDimensions; }
+
+    /**
+     * Get the edge length of a cell.
+     *
+     * @return The cell size.
+     */
+    float getCellSize() const { return mCellSize; }
+
+    /**
+     * Get the size of the cell tables.
+     *
+     * @return The number of cells of a uniform grid or entries of the hash table.
+     */
+    unsigned getCellCount() const { return mCellCount; }
+
+    /**
+     * Get the name of the positions attribute.
+     *
+     * @return The name of the particle attribute holding the positions.
+     */
+    const std::string& getPositionsAttribute() const { return mPositionsAttribute; }
+
+    /**
+     * Names of the storage buffers added to the ParticleSystem.
+     */
+    static const char* const CELL_COUNTS_BUFFER;
+    static const char* const CELL_STARTS_BUFFER;
+    static const char* const CELL_ENDS_BUFFER;
+    static const char* const PARTICLE_CELLS_BUFFER;
+    static const char* const PARTICLE_INDICES_BUFFER;
+
+private:
+    /**
+     * Clamp a cell coordinate to the cells of a uniform grid.
+     *
+     * @param cell The cell coordinate.
+     * @return The nearest cell inside of the grid.
+     */
+    glm::ivec3 clampToGrid(const glm::ivec3& cell) const;
+
+    /**
+     * The grid type.
+     */
+    neighbor_grid_types mType;
+
+    /**
+     * The minimum corner of a uniform grid.
+     */
+    glm::vec3 mOrigin;
+
+    /**
+     * The number of cells along each axis of a uniform grid.
+     */
+    glm::uvec3 mDimensions;
+
+    /**
+     * The edge length of a cell.
+     */
+    float mCellSize;
+
+    /**
+     * The size of the cell tables.
+     */
+    unsigned mCellCount;
+
+    /**
+     * The name of the particle attribute holding the positions.
+     */
+    std::string mPositionsAttribute;
+
+    // Hide copy constructor and assignment operator
+    NeighborGrid(const NeighborGrid&) = delete;
+    void operator=(const NeighborGrid&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_NEIGHBORGRID_HPP
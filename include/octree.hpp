@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_OCTREE_HPP
+#define NP_OCTREE_HPP
+
+#include <vector>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+namespace nparticles
+{
+
+class ThreadPool;
+
+/**
+ * The Octree class is an adaptive octree over a set of bodies used by the tree based GravitySolvers.
+ *
+ * The tree is built from bodies sorted along a Morton (Z-order) curve, so each node covers a
+ * contiguous range of sorted bodies. Nodes are split until they contain at most leafSize bodies.
+ * Key generation, sorting and the construction of subtrees are done in parallel.
+ *
+ * Children are always stored after their parent, and siblings are stored next to each other. For
+ * passes over the tree (e.g. computing moments bottom up), the nodes are also provided grouped by level.
+ */
+class Octree
+{
+public:
+    /**
+     * A node of the octree.
+     */
+    struct Node
+    {
+        /**
+         * Geometric center of the node's cube.
+         */
+        glm::vec3 center;
+
+        /**
+         * Edge length of the node's cube.
+         */
+        float size;
+
+        /**
+         * Depth of the node. The root is on level 0.
+         */
+        unsigned level;
+
+        /**
+         * Index of the first child. Unused if childCount is 0.
+         */
+        unsigned firstChild;
+        unsigned childCount;
+
+        /**
+         * The range of sorted bodies covered by the node.
+         */
+        unsigned firstBody;
+        unsigned bodyCount;
+    };
+
+    /**
+     * The Octree constructor.
+     *
+     * @param leafSize The maximum number of bodies stored in a leaf.
+     */
+    Octree(unsigned leafSize = 16);
+
+    /**
+     * Build the tree.
+     *
+     * @param bodies Array of @p bodyCount bodies. Positions are stored in xyz, masses in w.
+     * @param bodyCount The number of bodies.
+     * @param threadPool The ThreadPool used to parallelise the construction.
+     */
+    void build(const glm::vec4* bodies, unsigned bodyCount, ThreadPool& threadPool);
+
+    /**
+     * Set the maximum number of bodies stored in a leaf. Takes effect on the next build().
+     *
+     * @param leafSize The maximum number of bodies stored in a leaf.
+     */
+    void setLeafSize(unsigned leafSize) { mLeafSize = leafSize > 0 ? leafSize : 1; }
+
+    /**
+     * Get the maximum number of bodies stored in a leaf.
+     *
+     * @return The maximum number of bodies stored in a leaf.
+     */
+    unsigned getLeafSize() const { return mLeafSize; }
+
+    /**
+     * Get the nodes. The root is at index 0. Empty if the tree was built without bodies.
+     *
+     * @return The nodes of the tree.
+     */
+    const std::vector<Node>& getNodes() const { return mNodes; }
+
+    /**
+     * Get the leaves.
+     *
+     * @return The indices of all leaf nodes.
+     */
+    const std::vector<unsigned>& getLeaves() const { return mLeaves; }
+
+    /**
+     * Get the nodes grouped by level.
+     *
+     * @return For each level, the indices of the nodes on this level.
+     */
+    const std::vector<std::vector<unsigned> >& getLevels() const { return mLevels; }
+
+    /**
+     * Get the bodies in Morton order.
+     *
+     * @return The bodies sorted by their Morton key.
+     */
+    const std::vector<glm::vec4>& getSortedBodies() const { return mSortedBodies; }
+
+    /**
+     * Get the original index of a sorted body.
+     *
+     * @param sortedIndex The index of the body in getSortedBodies().
+     *
+     * @return The index of the body in the array passed to build().
+     */
+    unsigned getBodyIndex(unsigned sortedIndex) const { return mKeys[sortedIndex].index; }
+
+    /**
+     * The maximum depth of the tree. Morton keys use 21 bits per axis.
+     */
+    static const unsigned MAX_LEVEL = 21;
+
+private:
+    /**
+     * A sorted body: its Morton key and its index in the array passed to build().
+     */
+    struct BodyKey
+    {
+        std::uint64_t key;
+        unsigned index;
+
+        bool operator<(const BodyKey& other) const { return key < other.key; }
+    };
+
+    /**
+     * A subtree built in parallel.
+     */
+    struct BuildTask
+    {
+        unsigned nodeIndex;
+        unsigned firstBody;
+        unsigned lastBody;
+        unsigned level;
+    };
+
+    /**
+     * Compute the bounding cube and Morton keys of all bodies and sort them.
+     */
+    void sortBodies(const glm::vec4* bodies, unsigned bodyCount, ThreadPool& threadPool);
+
+    /**
+     * Build the node @p nodeIndex covering the sorted bodies [@p first, @p last) and its children.
+     *
+     * If @p tasks is not nullptr, nodes on PARALLEL_BUILD_LEVEL are not built but added to @p tasks.
+     */
+    void buildNode(std::vector<Node>& nodes, unsigned nodeIndex, unsigned first, unsigned last, unsigned level, std::vector<BuildTask>* tasks);
+
+    /**
+     * The level on which subtrees are built in parallel. 8² = 64 subtrees at most.
+     */
+    static const unsigned PARALLEL_BUILD_LEVEL = 2;
+
+    /**
+     * The maximum number of bodies in a leaf.
+     */
+    unsigned mLeafSize;
+
+    /**
+     * Minimum corner and edge length of the root cube.
+     */
+    glm::vec3 mRootMin;
+    float mRootSize;
+
+    /**
+     * Bodies sorted by their Morton key.
+     */
+    std::vector<BodyKey> mKeys;
+
+    /**
+     * Bodies in Morton order.
+     */
+    std::vector<glm::vec4> mSortedBodies;
+
+    /**
+     * The nodes of the tree. The root is at index 0.
+     */
+    std::vector<Node> mNodes;
+
+    /**
+     * Indices of all leaves.
+     */
+    std::vector<unsigned> mLeaves;
+
+    /**
+     * Indices of the nodes of each level.
+     */
+    std::vector<std::vector<unsigned> > mLevels;
+};
+
+} // namespace nparticles
+
+#endif // NP_OCTREE_HPP
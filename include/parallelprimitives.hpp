@@ -0,0 +1,525 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_PARALLELPRIMITIVES_HPP
+#define NP_PARALLELPRIMITIVES_HPP
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "buffer.hpp"
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+class ComputeProgram;
+
+/**
+ * @brief The primitive_operations enum defines the associative operators of scans and reductions.
+ */
+enum primitive_operations
+{
+    /**
+     * Addition. The identity is 0.
+     */
+    NP_PO_SUM,
+
+    /**
+     * Minimum. The identity is the largest value of the type (infinity for floats).
+     */
+    NP_PO_MIN,
+
+    /**
+     * Maximum. The identity is the lowest value of the type (-infinity for floats).
+     */
+    NP_PO_MAX
+};
+
+/**
+ * @brief The scan_types enum defines whether a scan includes the item itself.
+ */
+enum scan_types
+{
+    /**
+     * Item i of the result combines the items [0, i). The first item is the identity.
+     */
+    NP_ST_EXCLUSIVE,
+
+    /**
+     * Item i of the result combines the items [0, i].
+     */
+    NP_ST_INCLUSIVE
+};
+
+/**
+ * The ParallelPrimitives class provides scans, reductions and stream compaction on the GPU and the CPU.
+ *
+ * The GPU versions operate on Buffer%s of GLuint, GLint or GLfloat and run as a single compute shader pass
+ * (np/primitive-scan.glsl) with decoupled look-back (D. Merrill, M. Garland, "Single-pass Parallel Prefix Scan
+ * with Decoupled Look-back", 2016): each work group scans a tile of TILE_SIZE items, publishes the aggregate of its
+ * tile and determines the prefix of its tile from the aggregates and prefixes published by its predecessors. Tiles
+ * are assigned in launch order by an atomic counter, so a work group only waits for work groups which are already
+ * running. Each item is read and written once, no auxiliary passes are needed. The results are written to GPU
+ * buffers, nothing is read back. The shader sources are loaded from "/np", so the directory res/shader/np has to be
+ * added to the GPUProgramService before the first GPU call.
+ *
+ * The CPU versions operate on arrays (e.g. mapped Buffers) and split them into chunks which are processed in
+ * parallel on the ThreadPool: the chunk aggregates are computed in parallel, scanned sequentially and the chunks
+ * are scanned in parallel starting from their prefix.
+ *
+ * Segmented scans restart at each item whose segment head flag is non-zero, i.e. they scan each segment
+ * independently (e.g. particles sorted by grid cell with a flag at the first particle of each cell).
+ *
+ * @note Floating point sums depend on the order of the additions, so the GPU and CPU results of NP_PO_SUM
+ *       differ by rounding.
+ */
+class ParallelPrimitives
+{
+public:
+    /**
+     * The ParallelPrimitives constructor.
+     *
+     * @param threadPool The ThreadPool which runs the CPU versions.
+     */
+    ParallelPrimitives(ThreadPool& threadPool);
+
+    /**
+     * The ParallelPrimitives destructor.
+     */
+    ~ParallelPrimitives();
+
+    // GPU --------------------------------------------------
+
+    /**
+     * Scan a Buffer on the GPU.
+     *
+     * @param input The items to scan.
+     * @param output The result. Must be a different Buffer than @p input.
+     * @param type Exclusive or inclusive scan.
+     * @param operation The operator.
+     * @param count The number of items to scan. Defaults to all items of @p input.
+     * @tparam T GLuint, GLint or GLfloat.
+     *
+     * @return True on success, false if the compute program cannot be created or a buffer is too small.
+     */
+    template<typename T>
+    bool scan(Buffer<T>& input, Buffer<T>& output, scan_types type = NP_ST_EXCLUSIVE,
+              primitive_operations operation = NP_PO_SUM, unsigned count = ALL_ITEMS);
+
+    /**
+     * Scan the segments of a Buffer on the GPU.
+     *
+     * @param input The items to scan.
+     * @param segmentHeads One flag per item, non-zero at the first item of each segment.
+     * @param output The result. Must be a different Buffer than @p input.
+     * @param type Exclusive or inclusive scan.
+     * @param operation The operator.
+     * @param count The number of items to scan. Defaults to all items of @p input.
+     * @tparam T GLuint, GLint or GLfloat.
+     *
+     * @return True on success, false if the compute program cannot be created or a buffer is too small.
+     */
+    template<typename T>
+    bool segmentedScan(Buffer<T>& input, Buffer<GLuint>& segmentHeads, Buffer<T>& output, scan_types type = NP_ST_EXCLUSIVE,
+                       primitive_operations operation = NP_PO_SUM, unsigned count = ALL_ITEMS);
+
+    /**
+     * Reduce a Buffer on the GPU.
+     *
+     * @param input The items to reduce.
+     * @param result The result is written to the first item of this Buffer.
+     * @param operation The operator.
+     * @param count The number of items to reduce, at least one. Defaults to all items of @p input.
+     * @tparam T GLuint, GLint or GLfloat.
+     *
+     * @return True on success, false if the compute program cannot be created, a buffer is too small or there
+     *         are no items.
+     */
+    template<typename T>
+    bool reduce(Buffer<T>& input, Buffer<T>& result, primitive_operations operation = NP_PO_SUM, unsigned count = ALL_ITEMS);
+
+    /**
+     * Compact a Buffer on the GPU.
+     *
+     * The items whose flag is non-zero are written to the first items of @p output, keeping their order.
+     *
+     * @param input The items to compact.
+     * @param flags One flag per item, non-zero for the items to keep.
+     * @param output The kept items. Must be a different Buffer than @p input.
+     * @param outputCount The number of kept items is written to the first item of this Buffer, e.g. to be used
+     *                    in an indirect dispatch.
+     * @param count The number of items to compact. Defaults to all items of @p input.
+     * @tparam T GLuint, GLint or GLfloat.
+     *
+     * @return True on success, false if the compute program cannot be created or a buffer is too small.
+     */
+    template<typename T>
+    bool compact(Buffer<T>& input, Buffer<GLuint>& flags, Buffer<T>& output, Buffer<GLuint>& outputCount, unsigned count = ALL_ITEMS);
+
+    // CPU --------------------------------------------------
+
+    /**
+     * Scan an array on the CPU.
+     *
+     * @param input The items to scan.
+     * @param output The result. May be @p input.
+     * @param count The number of items.
+     * @param type Exclusive or inclusive scan.
+     * @param operation The operator.
+     */
+    template<typename T>
+    void scan(const T* input, T* output, unsigned count, scan_types type = NP_ST_EXCLUSIVE, primitive_operations operation = NP_PO_SUM);
+
+    /**
+     * Scan the segments of an array on the CPU.
+     *
+     * @param input The items to scan.
+     * @param segmentHeads One flag per item, non-zero at the first item of each segment.
+     * @param output The result. May be @p input.
+     * @param count The number of items.
+     * @param type Exclusive or inclusive scan.
+     * @param operation The operator.
+     */
+    template<typename T>
+    void segmentedScan(const T* input, const GLuint* segmentHeads, T* output, unsigned count,
+                       scan_types type = NP_ST_EXCLUSIVE, primitive_operations operation = NP_PO_SUM);
+
+    /**
+     * Reduce an array on the CPU.
+     *
+     * @param input The items to reduce.
+     * @param count The number of items.
+     * @param operation The operator.
+     *
+     * @return The reduction of all items or the identity of @p operation if there are no items.
+     */
+    template<typename T>
+    T reduce(const T* input, unsigned count, primitive_operations operation = NP_PO_SUM);
+
+    /**
+     * Compact an array on the CPU.
+     *
+     * @param input The items to compact.
+     * @param flags One flag per item, non-zero for the items to keep.
+     * @param output The kept items in their order. Must not overlap @p input.
+     * @param count The number of items.
+     *
+     * @return The number of kept items.
+     */
+    template<typename T>
+    unsigned compact(const T* input, const GLuint* flags, T* output, unsigned count);
+
+    /**
+     * Get the identity of an operator.
+     *
+     * @param operation The operator.
+     *
+     * @return The value x with operation(x, y) = y for all y.
+     */
+    template<typename T>
+    static T getIdentity(primitive_operations operation);
+
+    /**
+     * Combine two items.
+     *
+     * @param operation The operator.
+     * @param a The left item.
+     * @param b The right item.
+     *
+     * @return operation(a, b).
+     */
+    template<typename T>
+    static T combine(primitive_operations operation, T a, T b);
+
+    /**
+     * Default item count: all items of the input Buffer.
+     */
+    static const unsigned ALL_ITEMS;
+
+    /**
+     * The number of items processed by one work group of the GPU versions.
+     */
+    static const unsigned TILE_SIZE;
+
+    /**
+     * The minimum number of items per chunk of the CPU versions.
+     */
+    static const unsigned CPU_GRAIN_SIZE;
+
+private:
+    /**
+     * Modes of np/primitive-scan.glsl.
+     */
+    enum gpu_modes
+    {
+        GPU_EXCLUSIVE_SCAN,
+        GPU_INCLUSIVE_SCAN,
+        GPU_REDUCE,
+        GPU_COMPACT
+    };
+
+    /**
+     * Item types of np/primitive-scan.glsl.
+     */
+    static unsigned getGPUType(GLuint) { return 0; }
+    static unsigned getGPUType(GLint) { return 1; }
+    static unsigned getGPUType(GLfloat) { return 2; }
+
+    /**
+     * Run np/primitive-scan.glsl.
+     *
+     * @param mode The gpu_modes value.
+     * @param type The item type, see getGPUType().
+     * @param operation The operator.
+     * @param input The input items.
+     * @param flags The segment heads or compaction flags, or nullptr.
+     * @param output The output items, or nullptr for reductions.
+     * @param result The reduction or the number of kept items, or nullptr for scans.
+     * @param count The number of items or ALL_ITEMS.
+     *
+     * @return True on success.
+     */
+    bool dispatch(gpu_modes mode, unsigned type, primitive_operations operation, BufferBase& input, BufferBase* flags,
+                  BufferBase* output, BufferBase* result, unsigned count);
+
+    /**
+     * Scan on the CPU. Plain scans have no segment heads.
+     */
+    template<typename T>
+    void scanOnCPU(const T* input, const GLuint* segmentHeads, T* output, unsigned count, scan_types type, primitive_operations operation);
+
+    /**
+     * Get the number of chunks the CPU versions split @p count items into.
+     */
+    unsigned getChunkCount(unsigned count) const;
+
+    /**
+     * The ThreadPool running the CPU versions.
+     */
+    ThreadPool& mThreadPool;
+
+    /**
+     * The compute program of the GPU versions. Created on first use.
+     */
+    ComputeProgram* mScanProgram;
+
+    /**
+     * The tile counter and the status, aggregate and inclusive prefix of each tile. Grows on demand.
+     */
+    Buffer<GLuint>* mTileStates;
+
+    // Hide copy constructor and assignment operator
+    ParallelPrimitives(const ParallelPrimitives&) = delete;
+    void operator=(const ParallelPrimitives&) = delete;
+};
+
+// Implementation
+template<typename T>
+bool ParallelPrimitives::scan(Buffer<T>& input, Buffer<T>& output, scan_types type, primitive_operations operation, unsigned count)
+{
+    return dispatch(type == NP_ST_EXCLUSIVE ? GPU_EXCLUSIVE_SCAN : GPU_INCLUSIVE_SCAN, getGPUType(T()), operation,
+                    input, nullptr, &output, nullptr, count);
+}
+
+template<typename T>
+bool ParallelPrimitives::segmentedScan(Buffer<T>& input, Buffer<GLuint>& segmentHeads, Buffer<T>& output, scan_types type,
+                                       primitive_operations operation, unsigned count)
+{
+    return dispatch(type == NP_ST_EXCLUSIVE ? GPU_EXCLUSIVE_SCAN : GPU_INCLUSIVE_SCAN, getGPUType(T()), operation,
+                    input, &segmentHeads, &output, nullptr, count);
+}
+
+template<typename T>
+bool ParallelPrimitives::reduce(Buffer<T>& input, Buffer<T>& result, primitive_operations operation, unsigned count)
+{
+    return dispatch(GPU_REDUCE, getGPUType(T()), operation, input, nullptr, nullptr, &result, count);
+}
+
+template<typename T>
+bool ParallelPrimitives::compact(Buffer<T>& input, Buffer<GLuint>& flags, Buffer<T>& output, Buffer<GLuint>& outputCount, unsigned count)
+{
+    static_assert(sizeof(T) == sizeof(GLuint), "ParallelPrimitives::compact() copies one 32 bit word per item.");
+
+    // The compaction scans the flags, the items are copied as words
+    return dispatch(GPU_COMPACT, getGPUType(GLuint()), NP_PO_SUM, input, &flags, &output, &outputCount, count);
+}
+
+template<typename T>
+void ParallelPrimitives::scan(const T* input, T* output, unsigned count, scan_types type, primitive_operations operation)
+{
+    scanOnCPU(input, (const GLuint*)nullptr, output, count, type, operation);
+}
+
+template<typename T>
+void ParallelPrimitives::segmentedScan(const T* input, const GLuint* segmentHeads, T* output, unsigned count,
+                                       scan_types type, primitive_operations operation)
+{
+    scanOnCPU(input, segmentHeads, output, count, type, operation);
+}
+
+template<typename T>
+T ParallelPrimitives::reduce(const T* input, unsigned count, primitive_operations operation)
+{
+    const unsigned chunkCount = getChunkCount(count);
+    const unsigned chunkSize = (count + chunkCount - 1) / chunkCount;
+    std::vector<T> partials(chunkCount, getIdentity<T>(operation));
+
+    mThreadPool.parallelFor(0, chunkCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned chunk = first; chunk < last; ++chunk)
+        {
+            const unsigned end = std::min((chunk + 1) * chunkSize, count);
+            T value = getIdentity<T>(operation);
+            for(unsigned i = chunk * chunkSize; i < end; ++i)
+                value = combine(operation, value, input[i]);
+            partials[chunk] = value;
+        }
+    }, 1);
+
+    T value = getIdentity<T>(operation);
+    for(auto partial : partials)
+        value = combine(operation, value, partial);
+    return value;
+}
+
+template<typename T>
+unsigned ParallelPrimitives::compact(const T* input, const GLuint* flags, T* output, unsigned count)
+{
+    const unsigned chunkCount = getChunkCount(count);
+    const unsigned chunkSize = (count + chunkCount - 1) / chunkCount;
+    std::vector<unsigned> offsets(chunkCount + 1, 0);
+
+    // Count the kept items of each chunk
+    mThreadPool.parallelFor(0, chunkCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned chunk = first; chunk < last; ++chunk)
+        {
+            const unsigned end = std::min((chunk + 1) * chunkSize, count);
+            unsigned kept = 0;
+            for(unsigned i = chunk * chunkSize; i < end; ++i)
+                kept += (flags[i] != 0);
+            offsets[chunk + 1] = kept;
+        }
+    }, 1);
+
+    for(unsigned chunk = 0; chunk < chunkCount; ++chunk)
+        offsets[chunk + 1] += offsets[chunk];
+
+    // Write the kept items of each chunk from its offset
+    mThreadPool.parallelFor(0, chunkCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned chunk = first; chunk < last; ++chunk)
+        {
+            const unsigned end = std::min((chunk + 1) * chunkSize, count);
+            unsigned offset = offsets[chunk];
+            for(unsigned i = chunk * chunkSize; i < end; ++i)
+            {
+                if(flags[i])
+                    output[offset++] = input[i];
+            }
+        }
+    }, 1);
+
+    return offsets[chunkCount];
+}
+
+template<typename T>
+void ParallelPrimitives::scanOnCPU(const T* input, const GLuint* segmentHeads, T* output, unsigned count, scan_types type, primitive_operations operation)
+{
+    const unsigned chunkCount = getChunkCount(count);
+    const unsigned chunkSize = (count + chunkCount - 1) / chunkCount;
+    const T identity = getIdentity<T>(operation);
+
+    // Aggregate of each chunk and whether it contains a segment head
+    std::vector<T> prefixes(chunkCount, identity);
+    std::vector<char> containsHead(chunkCount, 0);
+
+    mThreadPool.parallelFor(0, chunkCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned chunk = first; chunk < last; ++chunk)
+        {
+            const unsigned end = std::min((chunk + 1) * chunkSize, count);
+            T value = identity;
+            for(unsigned i = chunk * chunkSize; i < end; ++i)
+            {
+                if(segmentHeads && segmentHeads[i])
+                {
+                    value = identity;
+                    containsHead[chunk] = 1;
+                }
+                value = combine(operation, value, input[i]);
+            }
+            prefixes[chunk] = value;
+        }
+    }, 1);
+
+    // Exclusive scan of the chunk aggregates. A segment head cuts off the preceding chunks.
+    T prefix = identity;
+    for(unsigned chunk = 0; chunk < chunkCount; ++chunk)
+    {
+        T aggregate = prefixes[chunk];
+        prefixes[chunk] = prefix;
+        prefix = containsHead[chunk] ? aggregate : combine(operation, prefix, aggregate);
+    }
+
+    // Scan each chunk starting from its prefix
+    mThreadPool.parallelFor(0, chunkCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned chunk = first; chunk < last; ++chunk)
+        {
+            const unsigned end = std::min((chunk + 1) * chunkSize, count);
+            T value = prefixes[chunk];
+            for(unsigned i = chunk * chunkSize; i < end; ++i)
+            {
+                if(segmentHeads && segmentHeads[i])
+                    value = identity;
+
+                T inclusive = combine(operation, value, input[i]);
+                output[i] = (type == NP_ST_INCLUSIVE) ? inclusive : value;
+                value = inclusive;
+            }
+        }
+    }, 1);
+}
+
+template<typename T>
+T ParallelPrimitives::getIdentity(primitive_operations operation)
+{
+    switch(operation)
+    {
+    case NP_PO_MIN:
+        return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+    case NP_PO_MAX:
+        return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+    default:
+        return T(0);
+    }
+}
+
+template<typename T>
+T ParallelPrimitives::combine(primitive_operations operation, T a, T b)
+{
+    switch(operation)
+    {
+    case NP_PO_MIN:
+        return std::min(a, b);
+    case NP_PO_MAX:
+        return std::max(a, b);
+    default:
+        return a + b;
+    }
+}
+
+} // namespace nparticles
+
+#endif // NP_PARALLELPRIMITIVES_HPP
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_PARTICLECOMPACTOR_HPP
+#define NP_PARTICLECOMPACTOR_HPP
+
+#include <string>
+#include <vector>
+
+namespace nparticles
+{
+
+class ParticleSystem;
+
+/**
+ * The ParticleCompactor class removes dead particles from a ParticleSystem with a dynamic particle count.
+ *
+ * Kernels kill particles by clearing their flag in ParticleSystem::ALIVE_FLAGS_BUFFER (npKillParticle() of
+ * np/particlecount.glsl). The compactor packs the surviving particles into the first slots, keeping their order,
+ * and updates the alive count with the indirect dispatch and draw commands on the GPU. The count is never read
+ * back. The compaction is a stream compaction appended to the ParticleSystem as Actions:
+ * - Count: the number of survivors of each block of GROUP_SIZE slots (np/compact-count.glsl).
+ * - Scan: the prefix sum over the block counts yields the first new slot of each block and the new alive count,
+ *   which is written along with the commands (np/compact-scan.glsl).
+ * - Scatter: the permutation, i.e. the old slot of the particle at each new slot. The flags are reset for the
+ *   new order (np/compact-scatter.glsl).
+ * - Gather: one Action per buffer, which gathers the survivors through a scratch buffer (np/compact-gather.glsl).
+ *
+ * All particle attributes which exist when attach() is called are compacted, as well as the storage buffers added
+ * with addPerParticleBuffer(). Until the next compaction, dead particles stay in the alive range and have to be
+ * skipped by kernels (npIsParticleAlive()) and shaders.
+ *
+ * All passes have CPUKernel%s which are registered when the compute programs are created. The shader sources are
+ * loaded from "/np", so the directory res/shader/np has to be added to the GPUProgramService before attach() is
+ * called.
+ */
+class ParticleCompactor
+{
+public:
+    /**
+     * The ParticleCompactor constructor.
+     */
+    ParticleCompactor();
+
+    /**
+     * Compact a storage buffer of the ParticleSystems along with the particle attributes.
+     *
+     * Has to be called before attach(). The buffer must hold one item per particle.
+     *
+     * @param name The name of the storage buffer.
+     */
+    void addPerParticleBuffer(const std::string& name);
+
+    /**
+     * Attach the compactor to a ParticleSystem.
+     *
+     * Adds the storage buffers of the compactor and appends its Actions. Actions appended afterwards see the
+     * compacted particles. Particle attributes added afterwards are not compacted.
+     *
+     * @param particleSystem The ParticleSystem to compact. ParticleSystem::setAliveCount() must have been called.
+     * @param interval The number of updates between two compactions. The first update always compacts.
+     *
+     * @return True on success, false if the system has no dynamic particle count, a compute program cannot be
+     *         created, a buffer has a size which is not a multiple of four bytes or the ParticleSystem already
+     *         has a compactor.
+     */
+    bool attach(ParticleSystem* particleSystem, unsigned interval = 1);
+
+    /**
+     * Names of the storage buffers added to the ParticleSystem.
+     *
+     * STATE_BUFFER holds eight unsigned integers: the alive count before and after the compaction, the work group
+     * counts of the scatter (x, y, z) and of the scan (1, 1, 1).
+     */
+    static const char* const BLOCK_SUMS_BUFFER;
+    static const char* const STATE_BUFFER;
+    static const char* const PERMUTATION_BUFFER;
+    static const char* const SCRATCH_BUFFER;
+
+    /**
+     * The number of slots counted by one work group of the count and scatter passes.
+     */
+    static const unsigned GROUP_SIZE;
+
+private:
+    /**
+     * The storage buffers compacted along with the particle attributes.
+     */
+    std::vector<std::string> mPerParticleBuffers;
+
+    // Hide copy constructor and assignment operator
+    ParticleCompactor(const ParticleCompactor&) = delete;
+    void operator=(const ParticleCompactor&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_PARTICLECOMPACTOR_HPP
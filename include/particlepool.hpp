@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_PARTICLEPOOL_HPP
+#define NP_PARTICLEPOOL_HPP
+
+#include <GL/glew.h>
+
+#include <map>
+#include <string>
+
+#include "buffer.hpp"
+#include "logger.hpp"
+
+namespace nparticles
+{
+
+/**
+ * The ParticlePool class holds the particle attributes of several ParticleSystem%s in common buffers.
+ *
+ * Each ParticleSystem created in a pool (see Engine::createParticleSystem()) reserves a range of slots. Its particle
+ * attributes are views of that range of one storage buffer per attribute name (see Buffer::Buffer(Buffer<T>&,
+ * GLsizei, GLsizei)), so Actions and CPUKernel%s see the attributes of the system only.
+ *
+ * Since all systems of a pool share the storage of an attribute, the RenderSystem can draw systems with the same
+ * Mesh and Material with a single glMultiDrawElementsIndirect() call: each draw reads the shared storage, starting at
+ * the first slot of its system (see RenderSystem::drawParticleSystems()).
+ *
+ * Ranges start at multiples of the shader storage buffer offset alignment, so the views can be bound as shader
+ * storage buffers. Pools are created and owned by the Engine (see Engine::createParticlePool()).
+ *
+ * OpenGL maps only one range of a buffer at a time, so mapped views share one mapping of the whole storage. The
+ * storages must not be used by the GPU while they are mapped: the ComputeSystem orders the CPU and GPU Actions of all
+ * systems in a pool (see ActionGraph) and unmaps the pool before a GPU Action runs.
+ */
+class ParticlePool
+{
+friend class Engine;
+
+public:
+    /**
+     * Reserve a range of slots.
+     *
+     * @param count The number of slots.
+     *
+     * @return The first slot of the range or -1 if the pool has no free range of @p count slots.
+     */
+    int allocate(int count);
+
+    /**
+     * Release a range of slots reserved by allocate().
+     *
+     * @param first The first slot of the range.
+     * @param count The number of slots passed to allocate().
+     */
+    void release(int first, int count);
+
+    /**
+     * Get the storage of a particle attribute, creating it on first use.
+     *
+     * @param name The name of the particle attribute.
+     * @param glType The OpenGL type of the attribute, see Buffer::Buffer().
+     * @param glBaseSize The base size of the OpenGL type, see Buffer::Buffer().
+     * @tparam T The type of the attribute.
+     *
+     * @return The storage holding the attribute of all slots, or nullptr if the storage of @p name has another type
+     *         or T cannot be aligned in the pool.
+     */
+    template<typename T>
+    Buffer<T>* getAttributeStorage(const std::string& name, GLenum glType = GL_INVALID_VALUE, int glBaseSize = -1);
+
+    /**
+     * Get the storage of a particle attribute without type information.
+     *
+     * @param name The name of the particle attribute.
+     *
+     * @return The storage or nullptr if no attribute named @p name was created in the pool.
+     */
+    BufferBase* getAttributeStorage(const std::string& name) const;
+
+    /**
+     * Get the number of slots.
+     *
+     * @return The number of slots, which is the size of each storage buffer.
+     */
+    int getCapacity() const { return mCapacity; }
+
+private:
+    /**
+     * The ParticlePool constructor.
+     *
+     * No storage is allocated until the first attribute is added.
+     *
+     * @param capacity The number of slots. Rounded up to the alignment of ranges.
+     */
+    ParticlePool(int capacity);
+
+    /**
+     * The ParticlePool destructor.
+     *
+     * Deletes the storage buffers, so all ParticleSystem%s of the pool have to be deleted first.
+     */
+    ~ParticlePool();
+
+    /**
+     * The number of slots.
+     */
+    int mCapacity;
+
+    /**
+     * Ranges start and end at multiples of this number of slots, so they are aligned for attributes of 4 bytes.
+     * Attributes of larger types are aligned as well.
+     */
+    int mGranularity;
+
+    /**
+     * The free ranges of slots, first slot to slot count. Adjacent ranges are merged.
+     */
+    std::map<int, int> mFreeRanges;
+
+    /**
+     * The storage buffers by attribute name.
+     */
+    std::map<std::string, BufferBase*> mAttributeStorages;
+
+    // Hide copy constructor and assignment operator
+    ParticlePool(const ParticlePool&) = delete;
+    void operator=(const ParticlePool&) = delete;
+};
+
+// Implementation
+template<typename T>
+Buffer<T>* ParticlePool::getAttributeStorage(const std::string& name, GLenum glType, int glBaseSize)
+{
+    // The granularity aligns ranges for attributes whose size is a multiple of 4 bytes
+    if(sizeof(T) % 4 != 0)
+    {
+        Logger::getInstance()->logWarning("ParticlePool: attribute \"" + name + "\" cannot be aligned in the pool.");
+        return nullptr;
+    }
+
+    auto storageIter = mAttributeStorages.find(name);
+    if(storageIter == mAttributeStorages.end())
+    {
+        Buffer<T>* storage = new Buffer<T>(mCapacity, glType, glBaseSize, GL_DYNAMIC_READ, GL_SHADER_STORAGE_BUFFER);
+        mAttributeStorages[name] = storage;
+        return storage;
+    }
+
+    BufferBase* storage = storageIter->second;
+    bool typeMatches = storage->getItemSize() == (GLsizeiptr)sizeof(T);
+    if(glType != GL_INVALID_VALUE && glBaseSize != -1)
+        typeMatches = typeMatches && storage->getGlType() == glType && storage->getGlBaseSize() == glBaseSize;
+
+    if(!typeMatches)
+    {
+        Logger::getInstance()->logWarning("ParticlePool: attribute \"" + name + "\" is stored with another type in the pool.");
+        return nullptr;
+    }
+
+    return static_cast<Buffer<T>*>(storage);
+}
+
+} // namespace nparticles
+
+#endif // NP_PARTICLEPOOL_HPP
@@ -14,8 +14,11 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "buffer.hpp"
+#include "particlepool.hpp"
+#include "ringbuffer.hpp"
 #include "atomiccounterbuffer.hpp"
 #include "uniformbuffer.hpp"
 #include "signal.hpp"
@@ -33,7 +36,9 @@ class ComputeProgram;
 /**
  * The ParticleSystem class holds all attributes that define a particle system.
  *
- * A ParticleSystem contains a fixed number of particles.
+ * A ParticleSystem contains a fixed number of particle slots. By default, all slots are alive particles. After
+ * setAliveCount() was called, the system has a dynamic particle count: the first n slots hold the alive particles,
+ * n is stored on the GPU and particles die by being marked in a flag buffer (see ParticleCompactor).
  *
  * A ParticleSystem consists of a set of particle attributes which are stored in Buffer objects.
  * Each particle is associated with one value of each attribute buffer which formes its properties.
@@ -44,6 +49,9 @@ class ComputeProgram;
  *
  * Particles are updated via Actions which invoce compute shaders on the GPU.
  *
+ * ParticleSystems created in a ParticlePool store their attributes in the shared storage of the pool, so the
+ * RenderSystem can batch the draws of systems sharing Mesh and Material.
+ *
  * @see Mesh, Material, Action
  */
 class ParticleSystem
@@ -69,12 +77,181 @@ public:
      * Get the number of particles in the ParticleSystem.
      *
      * This is a fixed size since the attribute Buffers are all fixed size and cannot
-     * be reallocated.
+     * be reallocated. With a dynamic particle count, this is the capacity of the system.
      *
      * @return The number of particles in the ParticleSystem.
      */
     unsigned int getParticleCount() const { return mParticleCount; }
 
+    /**
+     * Get the ParticlePool holding the particle attributes.
+     *
+     * @return The ParticlePool or nullptr if the attributes are stored in buffers of their own.
+     */
+    ParticlePool* getParticlePool() const { return mParticlePool; }
+
+    /**
+     * Get the first slot of the ParticleSystem in its ParticlePool.
+     *
+     * The attributes of particle i are stored at slot getPoolOffset() + i of the pool storages.
+     *
+     * @return The first slot or 0 if the system has no ParticlePool.
+     */
+    unsigned getPoolOffset() const { return mPoolOffset; }
+
+    // DYNAMIC PARTICLE COUNT --------------------------------
+
+    /**
+     * Set the number of alive particles.
+     *
+     * The first call switches the ParticleSystem to a dynamic particle count: the alive count buffer and the
+     * ALIVE_FLAGS_BUFFER storage buffer are created. The slots [0, @p aliveCount) are alive, all others are dead.
+     * The attributes of the alive particles have to be initialised by the caller, e.g. to spawn new particles
+     * behind the current alive ones.
+     *
+     * From then on, Actions are dispatched for the alive particles only and the RenderSystem draws them
+     * with an indirect draw. Both read the count from the GPU, see getAliveCountBuffer().
+     *
+     * @note This uploads the alive count and flags, so it must not be called during an update.
+     *
+     * @param aliveCount The number of alive particles. Clamped to the particle count.
+     */
+    void setAliveCount(unsigned aliveCount);
+
+    /**
+     * Get the number of alive particles.
+     *
+     * CPUKernel%s can call this during an update, since the alive count buffer is mapped. Otherwise, the count
+     * is read back from the GPU, which stalls the pipeline. To read the count every frame, read the first item of
+     * getAliveCountBuffer() with ReadbackQueue::readItemAsync() instead.
+     *
+     * @return The number of alive particles, or the particle count if the system has no dynamic particle count.
+     */
+    unsigned getAliveCount();
+
+    /**
+     * Get the alive count buffer.
+     *
+     * The buffer holds the alive count as atomic counter (bound to binding point 0, see np/particlecount.glsl),
+     * followed by the indirect draw command at DRAW_COMMAND_OFFSET and one indirect dispatch command per
+     * work group size at DISPATCH_COMMANDS_OFFSET (see getDispatchCommandOffset()). The commands are
+     * updated along with the count, so neither dispatches nor draws need to read it back.
+     *
+     * @return The alive count buffer or nullptr if the system has no dynamic particle count.
+     */
+    AtomicCounterBuffer* getAliveCountBuffer() const { return mAliveCountBuffer; }
+
+    /**
+     * Get the offset of the indirect dispatch command for a work group size.
+     *
+     * A dispatch command is kept for up to MAX_DISPATCH_GROUP_SIZES different work group sizes. Unknown sizes
+     * are registered, but their command is only written by the next setAliveCount() or compaction. Until then,
+     * -1 is returned and the caller has to dispatch for all slots.
+     *
+     * @param groupSize The number of work items per work group.
+     *
+     * @return The offset in bytes of the dispatch command in the alive count buffer, or -1.
+     */
+    int getDispatchCommandOffset(unsigned groupSize);
+
+    /**
+     * Get the work group sizes which have a dispatch command.
+     *
+     * @return The work group sizes in the order of their dispatch commands.
+     */
+    const std::vector<unsigned>& getDispatchGroupSizes() const { return mDispatchGroupSizes; }
+
+    /**
+     * Name of the alive count, i.e. the atomic counter uniform. Used to declare buffer accesses of Actions.
+     */
+    static const char* const ALIVE_COUNT_BUFFER;
+
+    /**
+     * Name of the storage buffer holding one flag per slot, which is 1 for alive particles.
+     */
+    static const char* const ALIVE_FLAGS_BUFFER;
+
+    /**
+     * Offset of the indirect draw command in the alive count buffer in GLuints.
+     */
+    static const unsigned DRAW_COMMAND_OFFSET;
+
+    /**
+     * Offset of the first indirect dispatch command in the alive count buffer in GLuints.
+     */
+    static const unsigned DISPATCH_COMMANDS_OFFSET;
+
+    /**
+     * The maximum number of work group sizes with a dispatch command.
+     */
+    static const unsigned MAX_DISPATCH_GROUP_SIZES;
+
+    // FRUSTUM CULLING ---------------------------------------
+
+    /**
+     * Enable frustum culling.
+     *
+     * Before each draw, the RenderSystem tests the particles against the view frustum on the GPU
+     * (np/frustum-cull.glsl). The indices of the visible particles are written to VISIBLE_INSTANCES_BUFFER and
+     * the visible particles are drawn with an indirect draw, so the visible count is not read back. With a dynamic
+     * particle count, dead particles are culled as well.
+     *
+     * Vertex shaders get the particle of an instance with npGetParticleIndex() of np/culling.glsl instead of
+     * gl_InstanceID. The visible particles are not drawn in the order of their slots.
+     *
+     * @param positionAttribute The particle attribute holding the positions. The position has to be stored in the
+     *        first three floats of 16 byte items, e.g. a vec4 or a vec3 followed by a float.
+     * @param boundingRadius The radius of a sphere around the position which encloses the rendered particle.
+     *
+     * @return True on success, false if there is no such particle attribute or its items are not 16 bytes.
+     */
+    bool enableFrustumCulling(const std::string& positionAttribute, float boundingRadius);
+
+    /**
+     * Disable frustum culling. All particles are drawn again.
+     */
+    void disableFrustumCulling();
+
+    /**
+     * Check if the particles are frustum culled.
+     *
+     * @return True, if enableFrustumCulling() was called successfully.
+     */
+    bool usesFrustumCulling() const { return mVisibleInstancesBuffer != nullptr; }
+
+    /**
+     * Get the particle attribute holding the positions tested against the view frustum.
+     *
+     * @return The name of the particle attribute.
+     */
+    const std::string& getCullingPositionAttribute() const { return mCullingPositionAttribute; }
+
+    /**
+     * Get the bounding sphere radius of a particle tested against the view frustum.
+     *
+     * @return The bounding radius.
+     */
+    float getCullingRadius() const { return mCullingRadius; }
+
+    /**
+     * Get the indices of the visible particles.
+     *
+     * @return The buffer holding one index per visible particle or nullptr without frustum culling.
+     */
+    Buffer<GLuint>* getVisibleInstancesBuffer() const { return mVisibleInstancesBuffer; }
+
+    /**
+     * Get the indirect draw command of the visible particles.
+     *
+     * @return The buffer holding a DrawElementsIndirectCommand or nullptr without frustum culling.
+     */
+    Buffer<GLuint>* getCullingCommandBuffer() const { return mCullingCommandBuffer; }
+
+    /**
+     * Name of the storage buffer holding the indices of the visible particles, see np/culling.glsl.
+     */
+    static const char* const VISIBLE_INSTANCES_BUFFER;
+
 
     // PARTICLE ATTRIBUTES -----------------------------------
 
@@ -88,6 +265,9 @@ public:
      * Each attribute is identified by a name wich can be used to retrieve the
      * Buffer associated with an attribute.
      *
+     * If the ParticleSystem has a ParticlePool, the Buffer is a view of the range of the system in the pool storage of
+     * the attribute. If the pool cannot store the attribute, a Buffer of its own is created.
+     *
      * @param name Name of the new attribute as string.
      * @param glType The corresponding OpenGL type of the attribute (e.g. GL_FLOAT for floats). If not specified, the
      *               OpenGL type is guessed from the template type T.
@@ -100,6 +280,27 @@ public:
     template<typename T>
     Buffer<T>* addParticleAttribute(const std::string& name, GLenum glType = GL_INVALID_VALUE, int glBaseSize = -1);
 
+    /**
+     * Add a new particle attribute which is streamed from the application every frame.
+     *
+     * Works like addParticleAttribute() but the attribute is stored in a RingBuffer. Write the data of each frame
+     * between RingBuffer::beginWrite() and RingBuffer::endWrite(). The GPU reads the regions written in the previous
+     * frames meanwhile, so the upload neither stalls the pipeline nor needs a map call per frame.
+     *
+     * @note Streamed attributes are rewritten every frame and are not permuted. A SpatialReorderer or
+     *       ParticleCompactor refuses to attach to a system with streamed attributes, so add them afterwards.
+     *
+     * @param name Name of the new attribute as string.
+     * @param regionCount The number of regions of the RingBuffer. Defaults to three, so two frames are in flight.
+     * @param glType The corresponding OpenGL type of the attribute, see addParticleAttribute().
+     * @param glBaseSize The base size of the type of the attribute, see addParticleAttribute().
+     * @tparam T The type of the new particle attribute.
+     *
+     * @return The newly created RingBuffer or nullptr if an attribute named @p name already exists.
+     */
+    template<typename T>
+    RingBuffer<T>* addStreamedParticleAttribute(const std::string& name, unsigned regionCount = 3, GLenum glType = GL_INVALID_VALUE, int glBaseSize = -1);
+
     /**
      * Typedef for the map of particle attributes.
      *
@@ -140,6 +341,17 @@ public:
      */
     bool swapParticleAttributes(const std::string& firstAttributeName, const std::string& secondAttributeName);
 
+    /**
+     * Get the generation of the buffer sets.
+     *
+     * The generation changes whenever a particle attribute, atomic counter, uniform or storage buffer is added or
+     * attributes are swapped. It is unique across all ParticleSystem%s, so it identifies the buffers bound by
+     * GPUSystem::bindParticleBuffers() and can be used to invalidate cached bindings.
+     *
+     * @return The generation of the buffer sets.
+     */
+    unsigned getBufferGeneration() const { return mBufferGeneration; }
+
     /**
      * Append a new action to the ParticleSystem's action list.
      *
@@ -303,6 +515,50 @@ public:
      */
     inline const uniform_buffers& getUniformBuffers() { return mUniformBuffers; }
 
+
+    // STORAGE BUFFERS -------------------------
+    /**
+     * Typedef for the map of storage buffers.
+     *
+     * This is a map with names (std::string) as key and a pointer to a Buffer (to be precise: pointer to its BufferBase) as values.
+     */
+    typedef std::map<std::string, BufferBase*> storage_buffers;
+
+    /**
+     * Add a new storage buffer.
+     *
+     * Storage buffers are bound to shader storage blocks by name like particle attributes, but their size is
+     * independent of the particle count. They hold per system data, e.g. the cell tables of a NeighborGrid.
+     * Like particle attributes, storage buffers are mapped while CPUKernel%s run.
+     *
+     * @param name The name of the new storage buffer. Also the name of the shader storage block it is bound to.
+     * @param itemCount The number of items of type T that are stored in the buffer.
+     * @param glType The corresponding OpenGL type (e.g. GL_UNSIGNED_INT). If not specified, the OpenGL type is guessed from the template type T.
+     * @param glBaseSize The base size of type T. If not specified, the base size is guessed from the template type T.
+     * @tparam T The type of the items stored in the buffer.
+     *
+     * @return Pointer to the newly created Buffer or nullptr, if the name is already occupied by another storage buffer.
+     */
+    template<typename T>
+    Buffer<T>* addStorageBuffer(const std::string& name, int itemCount, GLenum glType = GL_INVALID_VALUE, int glBaseSize = -1);
+
+    /**
+     * Get a storage buffer by its name.
+     *
+     * The returned pointer has to be casted to the correct type if used for data manipulation (Buffer::map() or Buffer::setData()).
+     *
+     * @param name The name of a storage buffer.
+     * @return Pointer to the Buffer (i.e. pointer to its BufferBase) or nullptr if no buffer with given name exists.
+     */
+    BufferBase* getStorageBuffer(const std::string& name);
+
+    /**
+     * Get all storage buffers.
+     *
+     * @return Reference to the map of storage buffers.
+     */
+    inline const storage_buffers& getStorageBuffers() const { return mStorageBuffers; }
+
 private:
     /**
      * The ParticleSystem constructor.
@@ -315,8 +571,10 @@ private:
      * @param particleCount The number of particles in the system.
      * @param mesh The Mesh used to render the particles.
      * @param material The Material used to render the particles.
+     * @param particlePool The ParticlePool to store the particle attributes in, or nullptr to store them in buffers
+     *                     of their own. If the pool is full, a warning is logged and no pool is used.
      */
-    ParticleSystem(int particleCount, const Mesh& mesh, const Material& material);
+    ParticleSystem(int particleCount, const Mesh& mesh, const Material& material, ParticlePool* particlePool = nullptr);
 
     /**
      * Destructor for ParticleSystem.
@@ -338,6 +596,11 @@ private:
      */
     uniform_buffers mUniformBuffers;
 
+    /**
+     * The storage buffers.
+     */
+    storage_buffers mStorageBuffers;
+
     /**
      * The list of actions applied to the particles.
      */
@@ -348,6 +611,36 @@ private:
      */
     unsigned int mParticleCount;
 
+    /**
+     * The alive count and indirect commands. Null pointer without a dynamic particle count.
+     */
+    AtomicCounterBuffer* mAliveCountBuffer;
+
+    /**
+     * The work group sizes which have a dispatch command.
+     */
+    std::vector<unsigned> mDispatchGroupSizes;
+
+    /**
+     * The particle attribute tested against the view frustum.
+     */
+    std::string mCullingPositionAttribute;
+
+    /**
+     * The bounding sphere radius of a particle.
+     */
+    float mCullingRadius;
+
+    /**
+     * The indices of the visible particles. Null pointer without frustum culling.
+     */
+    Buffer<GLuint>* mVisibleInstancesBuffer;
+
+    /**
+     * The indirect draw command of the visible particles. Null pointer without frustum culling.
+     */
+    Buffer<GLuint>* mCullingCommandBuffer;
+
     /**
      * The Mesh used to render the particles.
      */
@@ -358,6 +651,26 @@ private:
      */
     const Material* mMaterial;
 
+    /**
+     * The generation of the buffer sets, see getBufferGeneration().
+     */
+    unsigned mBufferGeneration;
+
+    /**
+     * The ParticlePool holding the particle attributes. Null pointer without pool.
+     */
+    ParticlePool* mParticlePool;
+
+    /**
+     * The first slot of the system in mParticlePool.
+     */
+    unsigned mPoolOffset;
+
+    /**
+     * Assign a new generation after the buffer sets changed.
+     */
+    void updateBufferGeneration();
+
     // Hide copy constructor and assignment operator
     ParticleSystem(const ParticleSystem&) = delete;
     void operator=(const ParticleSystem&) = delete;
@@ -372,8 +685,29 @@ Buffer<T>* ParticleSystem::addParticleAttribute(const std::string& name, GLenum
     if(mParticleAttributeBuffers.find(name) != mParticleAttributeBuffers.end())
         return nullptr;
 
-    Buffer<T>* attributeBuffer = new Buffer<T>(mParticleCount, glType, glBaseSize, GL_DYNAMIC_READ, GL_SHADER_STORAGE_BUFFER);
+    // Pooled attributes are views of the range of the system in the pool storage
+    Buffer<T>* storage = mParticlePool ? mParticlePool->getAttributeStorage<T>(name, glType, glBaseSize) : nullptr;
+
+    Buffer<T>* attributeBuffer;
+    if(storage)
+        attributeBuffer = new Buffer<T>(*storage, mPoolOffset, mParticleCount);
+    else
+        attributeBuffer = new Buffer<T>(mParticleCount, glType, glBaseSize, GL_DYNAMIC_READ, GL_SHADER_STORAGE_BUFFER);
+
     mParticleAttributeBuffers[name] = attributeBuffer;
+    updateBufferGeneration();
+    return attributeBuffer;
+}
+
+template<typename T>
+RingBuffer<T>* ParticleSystem::addStreamedParticleAttribute(const std::string& name, unsigned regionCount, GLenum glType, int glBaseSize)
+{
+    if(mParticleAttributeBuffers.find(name) != mParticleAttributeBuffers.end())
+        return nullptr;
+
+    RingBuffer<T>* attributeBuffer = new RingBuffer<T>(mParticleCount, regionCount, glType, glBaseSize);
+    mParticleAttributeBuffers[name] = attributeBuffer;
+    updateBufferGeneration();
     return attributeBuffer;
 }
 
@@ -385,9 +719,22 @@ UniformBuffer<T>* ParticleSystem::addUniformBuffer(const std::string& name, int
 
     UniformBuffer<T>* uniformBuffer = new UniformBuffer<T>(itemCount);
     mUniformBuffers[name] = uniformBuffer;
+    updateBufferGeneration();
     return uniformBuffer;
 }
 
+template<typename T>
+Buffer<T>* ParticleSystem::addStorageBuffer(const std::string& name, int itemCount, GLenum glType, int glBaseSize)
+{
+    if(mStorageBuffers.find(name) != mStorageBuffers.end())
+        return nullptr;
+
+    Buffer<T>* storageBuffer = new Buffer<T>(itemCount, glType, glBaseSize, GL_DYNAMIC_COPY, GL_SHADER_STORAGE_BUFFER);
+    mStorageBuffers[name] = storageBuffer;
+    updateBufferGeneration();
+    return storageBuffer;
+}
+
 }
 
 #endif // NP_PARTICLESTYSTEM_HPP
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_PMGRAVITYGPU_HPP
+#define NP_PMGRAVITYGPU_HPP
+
+#include <glm/glm.hpp>
+
+#include "buffer.hpp"
+
+namespace nparticles
+{
+
+class Action;
+class ShaderProgram;
+class PMGravitySolver;
+
+/**
+ * The PMGravityGPU class runs the deposit and interpolation stages of a PMGravitySolver on the GPU.
+ *
+ * Two actions are required: a deposit action whose shader calls npPMDeposit() and an update action whose
+ * shader calls npPMInterpolate() (see particle-mesh.glsl). connect() registers listeners on both actions:
+ * - Before the deposit, the density buffer is cleared and bound.
+ * - After the deposit, the density is read back and the field is solved on the CPU with
+ *   PMGravitySolver::solveField() using the thread pool of the ComputeSystem.
+ * - Before the update, the field is uploaded and bound.
+ *
+ * The PMGravitySolver and the PMGravityGPU must outlive both actions.
+ */
+class PMGravityGPU
+{
+public:
+    /**
+     * The PMGravityGPU constructor.
+     *
+     * @param solver The PMGravitySolver which defines the grid and solves the field.
+     */
+    PMGravityGPU(PMGravitySolver& solver);
+
+    /**
+     * The PMGravityGPU destructor.
+     */
+    ~PMGravityGPU();
+
+    /**
+     * Register the listeners on the deposit and update actions.
+     *
+     * @param depositAction The Action assigning the masses to the density grid. Must precede @p updateAction.
+     * @param updateAction The Action interpolating the acceleration field.
+     */
+    void connect(Action& depositAction, Action& updateAction);
+
+    /**
+     * Get the PMGravitySolver.
+     *
+     * @return The solver used by this PMGravityGPU.
+     */
+    PMGravitySolver& getSolver() { return mSolver; }
+
+private:
+    /**
+     * Recreate the grid buffers if the grid size of the solver changed.
+     */
+    void updateBuffers();
+
+    /**
+     * Set the grid uniforms of particle-mesh.glsl.
+     *
+     * @param program The ShaderProgram to set the uniforms for.
+     */
+    void setUniforms(const ShaderProgram& program) const;
+
+    /**
+     * The solver defining the grid.
+     */
+    PMGravitySolver& mSolver;
+
+    /**
+     * The mass per grid cell, filled by the deposit action.
+     */
+    Buffer<float>* mDensityBuffer;
+
+    /**
+     * The acceleration field, read by the update action.
+     */
+    Buffer<glm::vec4>* mFieldBuffer;
+
+    // Hide copy constructor and assignment operator
+    PMGravityGPU(const PMGravityGPU&) = delete;
+    void operator=(const PMGravityGPU&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_PMGRAVITYGPU_HPP
@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_PMGRAVITYSOLVER_HPP
+#define NP_PMGRAVITYSOLVER_HPP
+
+#include <complex>
+#include <vector>
+
+#include "gravitysolver.hpp"
+#include "fft.hpp"
+
+namespace nparticles
+{
+
+/**
+ * @brief The mass_assignments enum defines how the PMGravitySolver distributes mass onto its grid.
+ */
+enum mass_assignments
+{
+    /**
+     * Cloud in cell: each body is spread over the 2³ nearest cells.
+     */
+    NP_MA_CIC,
+
+    /**
+     * Triangular shaped cloud: each body is spread over the 3³ nearest cells. Smoother than CIC, but more expensive.
+     */
+    NP_MA_TSC
+};
+
+/**
+ * The PMGravitySolver class approximates gravity with the particle-mesh (PM) method in a periodic box.
+ *
+ * One step consists of three stages:
+ * - deposit(): The masses of the bodies are assigned to a cubic grid (CIC or TSC).
+ * - solveField(): Poisson's equation is solved with FFTs. The resulting potential is differentiated
+ *   on the grid to obtain the acceleration field.
+ * - interpolate(): The field is interpolated at the bodies with the same assignment scheme.
+ *
+ * This costs O(N + G log G) for N bodies and G grid cells instead of O(N²).
+ *
+ * The box is periodic: bodies outside of the box are wrapped into it and feel the forces of all periodic
+ * images. The forces are smoothed on the scale of a grid cell, so the softening factor is not used.
+ *
+ * The stages are public, so they can be combined with the compute shaders in particle-mesh.glsl which
+ * run deposit and interpolation on the GPU (see PMGravityGPU).
+ *
+ * The grid element (x, y, z) is stored at index (x * gridSize + y) * gridSize + z.
+ */
+class PMGravitySolver : public GravitySolver
+{
+public:
+    /**
+     * The PMGravitySolver constructor.
+     *
+     * @param gridSize The number of grid cells along each axis. Rounded up to a power of two, at least 4.
+     * @param boxOrigin The minimum corner of the periodic box.
+     * @param boxSize The edge length of the periodic box.
+     * @param assignment The mass assignment scheme.
+     */
+    PMGravitySolver(unsigned gridSize = 64, const glm::vec3& boxOrigin = glm::vec3(-50, -50, -50), float boxSize = 100,
+                    mass_assignments assignment = NP_MA_CIC);
+
+    /**
+     * @copydoc GravitySolver::computeAccelerations()
+     */
+    void computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool);
+
+    /**
+     * @copydoc GravitySolver::getName()
+     */
+    std::string getName() const;
+
+    /**
+     * Assign the masses of the bodies to the density grid.
+     *
+     * @param bodies Array of @p bodyCount bodies. Positions are stored in xyz, masses in w.
+     * @param bodyCount The number of bodies.
+     * @param threadPool The ThreadPool used to parallelise the assignment.
+     */
+    void deposit(const glm::vec4* bodies, unsigned bodyCount, ThreadPool& threadPool);
+
+    /**
+     * Solve Poisson's equation for the density grid and compute the acceleration field.
+     *
+     * @param threadPool The ThreadPool used to parallelise the FFTs.
+     */
+    void solveField(ThreadPool& threadPool);
+
+    /**
+     * Interpolate the acceleration field at the bodies.
+     *
+     * @param bodies Array of @p bodyCount bodies. Positions are stored in xyz, masses in w.
+     * @param bodyCount The number of bodies.
+     * @param accelerations Array of @p bodyCount accelerations which receives the result.
+     * @param threadPool The ThreadPool used to parallelise the interpolation.
+     */
+    void interpolate(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool) const;
+
+    /**
+     * Set all cells of the density grid to zero.
+     *
+     * This is done by deposit(). It is only required if the density is filled by other means (e.g. on the GPU).
+     */
+    void clearDensity();
+
+    /**
+     * Get the density grid.
+     *
+     * @return Array of getCellCount() masses, one per grid cell.
+     */
+    float* getDensity() { return mDensity.data(); }
+
+    /**
+     * Get the acceleration field.
+     *
+     * @return Array of getCellCount() elements, one per grid cell. The acceleration is stored in xyz, the potential in w.
+     */
+    glm::vec4* getField() { return mField.data(); }
+
+    /**
+     * Set the grid size.
+     *
+     * @param gridSize The number of grid cells along each axis. Rounded up to a power of two, at least 4.
+     */
+    void setGridSize(unsigned gridSize);
+
+    /**
+     * Get the grid size.
+     *
+     * @return The number of grid cells along each axis.
+     */
+    unsigned getGridSize() const { return mGridSize; }
+
+    /**
+     * Get the number of grid cells.
+     *
+     * @return The number of cells of the grid, i.e. getGridSize()³.
+     */
+    unsigned getCellCount() const { return mGridSize * mGridSize * mGridSize; }
+
+    /**
+     * Set the periodic box.
+     *
+     * @param boxOrigin The minimum corner of the box.
+     * @param boxSize The edge length of the box.
+     */
+    void setBox(const glm::vec3& boxOrigin, float boxSize);
+
+    /**
+     * Get the minimum corner of the periodic box.
+     *
+     * @return The minimum corner of the box.
+     */
+    const glm::vec3& getBoxOrigin() const { return mBoxOrigin; }
+
+    /**
+     * Get the edge length of the periodic box.
+     *
+     * @return The edge length of the box.
+     */
+    float getBoxSize() const { return mBoxSize; }
+
+    /**
+     * Get the edge length of a grid cell.
+     *
+     * @return The edge length of a cell.
+     */
+    float getCellSize() const { return mBoxSize / mGridSize; }
+
+    /**
+     * Set the mass assignment scheme.
+     *
+     * @param assignment The mass assignment scheme.
+     */
+    void setMassAssignment(mass_assignments assignment) { mAssignment = assignment; }
+
+    /**
+     * Get the mass assignment scheme.
+     *
+     * @return The mass assignment scheme.
+     */
+    mass_assignments getMassAssignment() const { return mAssignment; }
+
+private:
+    /**
+     * The number of grid cells along each axis.
+     */
+    unsigned mGridSize;
+
+    /**
+     * The minimum corner of the periodic box.
+     */
+    glm::vec3 mBoxOrigin;
+
+    /**
+     * The edge length of the periodic box.
+     */
+    float mBoxSize;
+
+    /**
+     * The mass assignment scheme.
+     */
+    mass_assignments mAssignment;
+
+    /**
+     * The FFT used to solve Poisson's equation.
+     */
+    FFT mFFT;
+
+    /**
+     * Mass per grid cell.
+     */
+    std::vector<float> mDensity;
+
+    /**
+     * The potential in Fourier and real space.
+     */
+    std::vector<std::complex<float> > mPotential;
+
+    /**
+     * The acceleration (xyz) and potential (w) per grid cell.
+     */
+    std::vector<glm::vec4> mField;
+
+    /**
+     * Bodies sorted by the slab of grid planes their assignment stencil starts in, and the first body of each slab.
+     */
+    std::vector<unsigned> mSlabBodies;
+    std::vector<unsigned> mSlabStarts;
+};
+
+} // namespace nparticles
+
+#endif // NP_PMGRAVITYSOLVER_HPP
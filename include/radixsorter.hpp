@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_RADIXSORTER_HPP
+#define NP_RADIXSORTER_HPP
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include "buffer.hpp"
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+class ComputeProgram;
+
+/**
+ * @brief The sort_orders enum defines the order of sorted keys.
+ */
+enum sort_orders
+{
+    /**
+     * Smallest key first.
+     */
+    NP_SO_ASCENDING,
+
+    /**
+     * Largest key first, e.g. view depths for back to front rendering.
+     */
+    NP_SO_DESCENDING
+};
+
+/**
+ * The RadixSorter class sorts unsigned integer or floating point keys on the GPU and the CPU.
+ *
+ * Both versions are stable least significant digit radix sorts, which sort the keys in place and write the index
+ * permutation: item i of the permutation is the original index of the key at position i. The permutation is used
+ * to gather the values belonging to the keys, e.g. the indices of alpha blended sprites sorted by depth, particles
+ * binned by grid cell or ordered by species. Floating point keys are mapped to unsigned integers preserving their
+ * order. Since the sorts are stable, the GPU and the CPU produce the same permutation.
+ *
+ * The GPU version operates on Buffer%s and is a onesweep sort (A. Adinets, D. Merrill, "Onesweep: A Faster Least
+ * Significant Digit Radix Sort for GPUs", 2022) in np/radix-sort.glsl: a single upfront pass counts the digits of
+ * all sorting passes, then each sorting pass is a single dispatch. Each work group ranks a tile of TILE_SIZE keys
+ * in shared memory and determines the global offset of each digit in its tile with decoupled look-back over the
+ * digit counts of the preceding tiles, like the scans of ParallelPrimitives. The keys and the permutation are
+ * scattered through shared memory, so the writes of each digit are contiguous. Each sorting pass reads and writes
+ * each key once. The shader sources are loaded from "/np", so the directory res/shader/np has to be added to the
+ * GPUProgramService before the first GPU call.
+ *
+ * The CPU version operates on arrays (e.g. mapped Buffers). Each pass counts the digits of chunks of the keys in
+ * parallel on the ThreadPool, scans the counts digit by digit and chunk by chunk and scatters the chunks in
+ * parallel. Passes in which all keys have the same digit are skipped.
+ *
+ * Sorting fewer key bits saves passes: keys below 2^keyBits only need ceil(keyBits / RADIX_BITS) passes on the
+ * GPU and ceil(keyBits / CPU_RADIX_BITS) passes on the CPU.
+ */
+class RadixSorter
+{
+public:
+    /**
+     * The RadixSorter constructor.
+     *
+     * @param threadPool The ThreadPool which runs the CPU version.
+     */
+    RadixSorter(ThreadPool& threadPool);
+
+    /**
+     * The RadixSorter destructor.
+     */
+    ~RadixSorter();
+
+    // GPU --------------------------------------------------
+
+    /**
+     * Sort unsigned integer keys on the GPU.
+     *
+     * @param keys The keys, sorted in place.
+     * @param permutation The original index of each sorted key is written to this Buffer.
+     * @param order The order of the sorted keys.
+     * @param keyBits The number of low bits sorted, between 1 and 32. All keys must be smaller than 2^keyBits.
+     * @param count The number of keys to sort. Defaults to all items of @p keys.
+     *
+     * @return True on success, false if the compute program cannot be created, a buffer is too small, the key
+     *         count is too large or the number of key bits is invalid.
+     */
+    bool sort(Buffer<GLuint>& keys, Buffer<GLuint>& permutation, sort_orders order = NP_SO_ASCENDING,
+              unsigned keyBits = 32, unsigned count = ALL_ITEMS);
+
+    /**
+     * Sort floating point keys on the GPU.
+     *
+     * Negative zero is sorted before positive zero, NaNs are sorted after infinity (before negative infinity if
+     * they have the sign bit set).
+     *
+     * @param keys The keys, sorted in place.
+     * @param permutation The original index of each sorted key is written to this Buffer.
+     * @param order The order of the sorted keys.
+     * @param count The number of keys to sort. Defaults to all items of @p keys.
+     *
+     * @return True on success, false if the compute program cannot be created, a buffer is too small or the key
+     *         count is too large.
+     */
+    bool sort(Buffer<GLfloat>& keys, Buffer<GLuint>& permutation, sort_orders order = NP_SO_ASCENDING, unsigned count = ALL_ITEMS);
+
+    // CPU --------------------------------------------------
+
+    /**
+     * Sort unsigned integer keys on the CPU.
+     *
+     * @param keys The keys, sorted in place.
+     * @param permutation The original index of each sorted key is written to this array.
+     * @param count The number of keys.
+     * @param order The order of the sorted keys.
+     * @param keyBits The number of low bits sorted, between 1 and 32. All keys must be smaller than 2^keyBits.
+     */
+    void sort(GLuint* keys, GLuint* permutation, unsigned count, sort_orders order = NP_SO_ASCENDING, unsigned keyBits = 32);
+
+    /**
+     * Sort floating point keys on the CPU.
+     *
+     * @param keys The keys, sorted in place.
+     * @param permutation The original index of each sorted key is written to this array.
+     * @param count The number of keys.
+     * @param order The order of the sorted keys.
+     */
+    void sort(GLfloat* keys, GLuint* permutation, unsigned count, sort_orders order = NP_SO_ASCENDING);
+
+    /**
+     * Default key count: all items of the key Buffer.
+     */
+    static const unsigned ALL_ITEMS;
+
+    /**
+     * The number of keys ranked by one work group of the GPU version.
+     */
+    static const unsigned TILE_SIZE;
+
+    /**
+     * The number of key bits sorted per pass of the GPU version.
+     */
+    static const unsigned RADIX_BITS;
+
+    /**
+     * The number of key bits sorted per pass of the CPU version.
+     */
+    static const unsigned CPU_RADIX_BITS;
+
+    /**
+     * The minimum number of keys per chunk of the CPU version.
+     */
+    static const unsigned CPU_GRAIN_SIZE;
+
+    /**
+     * The largest number of keys the GPU version can sort at once. The digit counts of the look-back are packed
+     * with a status into one word.
+     */
+    static const unsigned MAX_GPU_KEY_COUNT;
+
+private:
+    /**
+     * Key types of np/radix-sort.glsl.
+     */
+    enum gpu_key_types
+    {
+        GPU_UINT_KEYS,
+        GPU_FLOAT_KEYS
+    };
+
+    /**
+     * Run np/radix-sort.glsl.
+     *
+     * @param keys The keys.
+     * @param permutation The permutation.
+     * @param keyType The gpu_key_types value.
+     * @param order The order of the sorted keys.
+     * @param keyBits The number of low bits sorted.
+     * @param count The number of keys or ALL_ITEMS.
+     *
+     * @return True on success.
+     */
+    bool dispatch(BufferBase& keys, BufferBase& permutation, gpu_key_types keyType, sort_orders order, unsigned keyBits, unsigned count);
+
+    /**
+     * Sort on the CPU. Floating point keys are sorted by their bits.
+     */
+    void sortOnCPU(GLuint* keys, GLuint* permutation, unsigned count, bool floatKeys, sort_orders order, unsigned keyBits);
+
+    /**
+     * The ThreadPool running the CPU version.
+     */
+    ThreadPool& mThreadPool;
+
+    /**
+     * The compute program of the GPU version. Created on first use.
+     */
+    ComputeProgram* mSortProgram;
+
+    /**
+     * The keys and permutation between two passes of the GPU version. Grow on demand.
+     */
+    Buffer<GLuint>* mScratchKeys;
+    Buffer<GLuint>* mScratchPermutation;
+
+    /**
+     * The digit counts of all passes, the tile counters and the look-back states of the GPU version. Grows on
+     * demand.
+     */
+    Buffer<GLuint>* mSortStates;
+
+    /**
+     * The keys and permutation between two passes of the CPU version.
+     */
+    std::vector<GLuint> mCPUScratchKeys;
+    std::vector<GLuint> mCPUScratchPermutation;
+
+    // Hide copy constructor and assignment operator
+    RadixSorter(const RadixSorter&) = delete;
+    void operator=(const RadixSorter&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_RADIXSORTER_HPP
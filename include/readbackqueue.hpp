@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_READBACKQUEUE_HPP
+#define NP_READBACKQUEUE_HPP
+
+#include <GL/glew.h>
+
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "buffer.hpp"
+
+namespace nparticles
+{
+
+/**
+ * The ReadbackQueue class reads Buffer data back to the application without stalling the pipeline.
+ *
+ * Mapping a buffer waits until the GPU has finished all commands writing it, i.e. it drains the pipeline. A
+ * readback issued by readAsync() instead copies the range into a staging buffer on the GPU and inserts a fence after
+ * the copy. The returned future is resolved by poll() as soon as the fence is signalled, usually one or two frames
+ * later. By then the copy has finished, so reading the staging buffer does not wait.
+ *
+ * The Engine owns a ReadbackQueue (see Engine::getReadbackQueue()) and polls it in Engine::processEvents().
+ *
+ * @code
+ * ReadbackQueue& readbackQueue = Engine::getInstance()->getReadbackQueue();
+ * std::future<GLuint> aliveCount = readbackQueue.readItemAsync(*particleSystem->getAliveCountBuffer(), 0);
+ *
+ * // In later frames
+ * if(aliveCount.valid() && aliveCount.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+ *     std::cout << aliveCount.get() << std::endl;
+ * @endcode
+ *
+ * @note The futures are resolved on the thread which owns the OpenGL context while it polls the queue. Blocking on a
+ *       future on that thread never returns, call finish() first.
+ */
+class ReadbackQueue
+{
+public:
+    /**
+     * The ReadbackQueue constructor.
+     *
+     * No OpenGL calls are made, the staging buffers are created on first use.
+     */
+    ReadbackQueue();
+
+    /**
+     * The ReadbackQueue destructor.
+     *
+     * The futures of pending readbacks are broken.
+     */
+    ~ReadbackQueue();
+
+    /**
+     * Read a range of items back asynchronously.
+     *
+     * A GL_BUFFER_UPDATE_BARRIER_BIT barrier is issued before the copy, so data written by shaders is read.
+     *
+     * @param buffer The buffer to read from. It must not be mapped.
+     * @param first The index of the first item to read.
+     * @param count The number of items to read, -1 to read up to the end of the buffer.
+     * @tparam T The type of the items.
+     *
+     * @return A future holding the items once the readback is resolved.
+     */
+    template<typename T>
+    std::future<std::vector<T>> readAsync(const Buffer<T>& buffer, GLsizei first = 0, GLsizei count = -1);
+
+    /**
+     * Read a single item back asynchronously, e.g. an atomic counter.
+     *
+     * @param buffer The buffer to read from. It must not be mapped.
+     * @param index The index of the item.
+     * @tparam T The type of the item.
+     *
+     * @return A future holding the item once the readback is resolved.
+     */
+    template<typename T>
+    std::future<T> readItemAsync(const Buffer<T>& buffer, GLsizei index);
+
+    /**
+     * Resolve the readbacks whose copies have finished, without waiting for the others.
+     *
+     * Readbacks are resolved in the order they were issued.
+     */
+    void poll();
+
+    /**
+     * Wait for all pending readbacks and resolve them.
+     *
+     * Readbacks whose fence cannot be waited for (GL_WAIT_FAILED) are logged and dropped.
+     */
+    void finish();
+
+    /**
+     * Get the number of readbacks which are not resolved yet.
+     *
+     * @return The number of pending readbacks.
+     */
+    unsigned getPendingCount() const { return mPendingReadbacks.size(); }
+
+private:
+    // Hide copy constructor and assignment operator
+    ReadbackQueue(const ReadbackQueue&) = delete;
+    void operator=(const ReadbackQueue&) = delete;
+
+    /**
+     * Function called with the data of a resolved readback.
+     */
+    typedef std::function<void(const void* data, GLsizeiptr size)> resolve_function;
+
+    /**
+     * A readback which is not resolved yet.
+     */
+    struct Readback
+    {
+        /**
+         * The staging buffer holding the copied data.
+         */
+        Buffer<GLubyte>* staging;
+
+        /**
+         * The size of the copied data in bytes.
+         */
+        GLsizeiptr size;
+
+        /**
+         * The fence inserted after the copy.
+         */
+        GLsync fence;
+
+        /**
+         * The function resolving the future of the readback.
+         */
+        resolve_function resolve;
+    };
+
+    /**
+     * Copy a range into a staging buffer and queue the readback.
+     *
+     * @param buffer The buffer to read from.
+     * @param offset The offset of the range in bytes.
+     * @param size The size of the range in bytes.
+     * @param resolve The function resolving the future of the readback.
+     *
+     * @return True if the readback was queued, false if the range is outside of @p buffer.
+     */
+    bool enqueue(const BufferBase& buffer, GLintptr offset, GLsizeiptr size, const resolve_function& resolve);
+
+    /**
+     * Read the staging buffer of a finished readback, resolve it and recycle the staging buffer.
+     *
+     * @param readback The readback to resolve. Its fence must be signalled.
+     */
+    void resolve(Readback& readback);
+
+    /**
+     * Drop a readback whose fence cannot be waited for, without resolving it.
+     *
+     * The staging buffer is deleted rather than recycled, since the copy may not have finished. The future of the
+     * readback reports a broken promise once the readback is removed.
+     *
+     * @param readback The readback to drop.
+     */
+    void discard(Readback& readback);
+
+    /**
+     * The pending readbacks in the order they were issued.
+     */
+    std::deque<Readback> mPendingReadbacks;
+
+    /**
+     * Staging buffers which are not used by pending readbacks.
+     */
+    std::vector<Buffer<GLubyte>*> mFreeStagingBuffers;
+};
+
+// Implementation
+template<typename T>
+std::future<std::vector<T>> ReadbackQueue::readAsync(const Buffer<T>& buffer, GLsizei first, GLsizei count)
+{
+    if(count < 0)
+        count = buffer.getItemCount() - first;
+
+    // std::function has to be copyable, the promise is not
+    std::shared_ptr<std::promise<std::vector<T>>> promise = std::make_shared<std::promise<std::vector<T>>>();
+    std::future<std::vector<T>> future = promise->get_future();
+
+    bool queued = enqueue(buffer, first * sizeof(T), count * sizeof(T), [promise](const void* data, GLsizeiptr size)
+    {
+        std::vector<T> items(size / sizeof(T));
+        std::memcpy(items.data(), data, size);
+        promise->set_value(std::move(items));
+    });
+
+    // Invalid ranges break the promise, so the future reports the error instead of blocking forever
+    if(!queued)
+        promise.reset();
+
+    return future;
+}
+
+template<typename T>
+std::future<T> ReadbackQueue::readItemAsync(const Buffer<T>& buffer, GLsizei index)
+{
+    std::shared_ptr<std::promise<T>> promise = std::make_shared<std::promise<T>>();
+    std::future<T> future = promise->get_future();
+
+    bool queued = enqueue(buffer, index * sizeof(T), sizeof(T), [promise](const void* data, GLsizeiptr)
+    {
+        T item;
+        std::memcpy(&item, data, sizeof(T));
+        promise->set_value(item);
+    });
+
+    if(!queued)
+        promise.reset();
+
+    return future;
+}
+
+} // namespace nparticles
+
+#endif // NP_READBACKQUEUE_HPP
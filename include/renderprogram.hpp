@@ -36,6 +36,8 @@ public:
      * If you have declared a vertex attribute but cannot retrieve its location, it maybe fell a victim to
      * the drivers compiler optimisations.
      *
+     * Locations are cached, so OpenGL is queried only once per attribute name.
+     *
      * @param attributeName String containing the name of the vertex attribute that is queried.
      *
      * @return The attribute location of the vertex attribute within the shader program or -1
@@ -74,6 +76,32 @@ public:
      */
     inline GLint getTessellationPatchSize() { return mTessellationPatchSize; }
 
+    /**
+     * @copydoc ShaderProgram::build()
+     */
+    bool build();
+
+    /**
+     * Get the handle of the view projection matrix set by the RenderSystem ("np_viewProjectionMatrix").
+     *
+     * @return The handle, invalid if the program does not declare the uniform.
+     */
+    const UniformHandle<glm::mat4>& getViewProjectionMatrixUniform() const { return mViewProjectionMatrixUniform; }
+
+    /**
+     * Get the handle of the normal matrix set by the RenderSystem ("np_normalMatrix").
+     *
+     * @return The handle, invalid if the program does not declare the uniform.
+     */
+    const UniformHandle<glm::mat3>& getNormalMatrixUniform() const { return mNormalMatrixUniform; }
+
+    /**
+     * Get the handle of the frustum culling switch set by the RenderSystem ("np_frustumCulling", see np/culling.glsl).
+     *
+     * @return The handle, invalid if the program does not declare the uniform.
+     */
+    const UniformHandle<bool>& getFrustumCullingUniform() const { return mFrustumCullingUniform; }
+
 private:
     /**
      * Contsructor for RenderProgram.
@@ -104,6 +132,18 @@ private:
      */
     GLint mTessellationPatchSize;
 
+    /**
+     * The handles of the uniforms set by the RenderSystem on every draw. Resolved by build().
+     */
+    UniformHandle<glm::mat4> mViewProjectionMatrixUniform;
+    UniformHandle<glm::mat3> mNormalMatrixUniform;
+    UniformHandle<bool> mFrustumCullingUniform;
+
+    /**
+     * The locations of the vertex attributes queried so far, by name.
+     */
+    mutable std::map<std::string, GLint> mVertexAttributeLocations;
+
     // Hide copy constructor and assignment operator
     RenderProgram(const RenderProgram&) = delete;
     void operator=(const RenderProgram&) = delete;
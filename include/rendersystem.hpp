@@ -13,8 +13,10 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <map>
 #include <vector>
 #include <string>
+#include <utility>
 
 #include "gpusystem.hpp"
 
@@ -30,6 +32,7 @@ class Mesh;
 class Material;
 
 class ParticleSystem;
+class ComputeProgram;
 
 /**
  * The RenderSystem class manages the OpenGL context and handles rendering.
@@ -74,10 +77,38 @@ public:
      * ParticleSystem::postRenderSignal are emitted respectively so you can hook into the
      * rendering process and manually set up stuff.
      *
+     * If the ParticleSystem uses frustum culling, the particles are culled against the current view
+     * projection matrix before the RenderProgram is bound and only the visible particles are drawn.
+     *
      * @param particleSystem Pointer to a particle system which should be rendered.
      */
     void drawParticleSystem(ParticleSystem* particleSytem);
 
+    /**
+     * Draw several ParticleSystem%s, merging the draws of compatible ones.
+     *
+     * Adjacent ParticleSystem%s with the same Mesh, Material and ParticlePool are drawn with a single
+     * glMultiDrawElementsIndirect() call: the RenderProgram, its uniforms and the vertex array are bound once and the
+     * pool storages of the particle attributes are bound instead of the attribute views of each system. The draw
+     * command of each system starts at its pool offset as base instance, so np_in_particleIndex (see
+     * np/vertex-inputs.glsl) is the slot of the particle in the pool storages. The instance counts of systems with a
+     * dynamic particle count are copied from their alive count buffers on the GPU.
+     *
+     * A ParticleSystem is only merged if
+     * - it has a ParticlePool and does not use frustum culling,
+     * - no callbacks are connected to its ParticleSystem::preRenderSignal and ParticleSystem::postRenderSignal,
+     * - its particle attributes are the views created by its pool (attributes swapped with other attributes or
+     *   streamed attributes are not),
+     * - the RenderProgram reads the particle index via np_in_particleIndex and none of its atomic counters, uniform
+     *   buffers or storage buffers, whose content is per system.
+     *
+     * All other ParticleSystem%s are drawn with drawParticleSystem(). Sort the systems by RenderProgram, Mesh and
+     * Material first, as Engine::drawAllParticleSystems() does.
+     *
+     * @param particleSystems The ParticleSystem%s to draw, in drawing order.
+     */
+    void drawParticleSystems(const std::vector<ParticleSystem*>& particleSystems);
+
     /**
      * Set up a vertex attribute.
      *
@@ -87,13 +118,17 @@ public:
      *
      * @note Only Buffers of types that provide a valid glutils::3GlTypeInfo are allowed!
      *
-     * Since multiple ParticleSystems can share one Mesh and Material, the vertex attribute bindings are revoked after the rendering took
-     * place. This means, that each rendering call all vertex attributes have to be set. Since they are autoamtically removed, the user
-     * does not need to disable any vertex attributes set in a ParticleSystem::preRenderSignal callback.
+     * Since multiple ParticleSystems can share one Mesh and Material, vertex attributes have to be set on each rendering call.
+     * Attributes which are not set again are disabled after the rendering, so the user does not need to disable any vertex
+     * attributes set in a ParticleSystem::preRenderSignal callback.
      *
      * This method is part of the RenderSystem rather than the RenderProgram, since setting vertex attributes in OpenGL
-     * changes the state of a vertex array object (VAO). This VAO is part of the Mesh and a RenderProgram should not be
-     * responsible to track Mesh states.
+     * changes the state of a vertex array object (VAO). The RenderSystem keeps a VAO per Mesh and RenderProgram, which
+     * keeps the attribute between draws: setting the same buffer again on the next draw of the same ParticleSystem does
+     * not change the VAO, unless the buffers of the system changed (see ParticleSystem::getBufferGeneration()).
+     *
+     * With direct state access the VAO is set up by name and @p buffer is not bound. Each attribute then uses the
+     * vertex buffer binding index equal to its location.
      *
      * @note You should never call this function outside a ParticleSystem::preRenderSignal or ParticleSystem::postRenderSignal,
      *       since the Mesh binding and active RenderProgram is only set during a call to drawParticleSystem(). Outside this events
@@ -203,11 +238,167 @@ protected:
      */
     void useDepthTest(bool depthTest = true);
 
+    /**
+     * Forget the cached state of a ParticleSystem, i.e. its binding tables and batch checks.
+     *
+     * This is called by Engine::deleteParticleSystem() before the ParticleSystem is deleted.
+     *
+     * @param particleSystem The ParticleSystem which is removed.
+     */
+    virtual void removeParticleSystem(const ParticleSystem* particleSystem) override;
+
 private:
     // Hide copy constructor and assignment operator
     RenderSystem(const RenderSystem&) = delete;
     void operator=(const RenderSystem&) = delete;
 
+    /**
+     * Cull the particles of a ParticleSystem against the view frustum.
+     *
+     * Runs np/frustum-cull.glsl, which writes the visible particle indices and the indirect draw command of the
+     * ParticleSystem. If the compute program cannot be created, frustum culling is disabled for the ParticleSystem.
+     *
+     * @param particleSystem The ParticleSystem to cull. It must use frustum culling.
+     *
+     * @return True if the particles were culled.
+     */
+    bool cullParticleSystem(ParticleSystem* particleSystem);
+
+    /**
+     * A vertex attribute set up by setVertexAttribute().
+     */
+    struct VertexAttribute
+    {
+        GLuint buffer;
+        GLintptr offset;
+        GLenum glType;
+        int glBaseSize;
+        bool instanced;
+
+        /**
+         * The buffer generation of the ParticleSystem drawn when the attribute was set up (see
+         * ParticleSystem::getBufferGeneration()). OpenGL reuses the names of deleted buffers, so the name alone does
+         * not tell if the attribute still sources the same buffer.
+         */
+        unsigned bufferGeneration;
+
+        /**
+         * True if the attribute was set during the current drawParticleSystem() call.
+         */
+        bool used;
+    };
+
+    /**
+     * A vertex array object configured for a Mesh and a RenderProgram.
+     */
+    struct VertexArray
+    {
+        /**
+         * The OpenGL vertex array handle.
+         */
+        GLuint handle;
+
+        /**
+         * The attributes set up by setVertexAttribute(), by location. They stay configured as long as they are set
+         * on every draw.
+         */
+        std::map<GLint, VertexAttribute> attributes;
+
+        /**
+         * The generation of the particle index buffer np_in_particleIndex is set up for, 0 if not set up yet.
+         */
+        unsigned particleIndexGeneration;
+
+        /**
+         * The generation of the Mesh the vertex array is set up for, see Mesh::getGeneration().
+         */
+        unsigned meshGeneration;
+    };
+
+    /**
+     * Get the vertex array object of a Mesh and a RenderProgram, creating it on first use.
+     *
+     * The vertex array is configured once: the vertex Buffer of the Mesh is bound to "np_in_position" and the index
+     * Buffer of the Mesh is its element array buffer. A vertex array cached for a deleted Mesh at the same address is
+     * recreated.
+     *
+     * @param mesh The Mesh.
+     * @param renderProgram The RenderProgram.
+     *
+     * @return The configured vertex array.
+     */
+    VertexArray* getVertexArray(Mesh* mesh, const RenderProgram* renderProgram);
+
+    /**
+     * Disable the attributes of the current vertex array which were not set during the current draw.
+     */
+    void releaseVertexAttributes();
+
+    /**
+     * Set up np_in_particleIndex in the current vertex array.
+     *
+     * The attribute is sourced from mParticleIndexBuffer with divisor 1, so it counts the instances starting at the
+     * base instance of the draw. The buffer is enlarged if it holds less than @p instanceCount indices.
+     *
+     * @param instanceCount The largest base instance plus instance count of the next draw.
+     */
+    void setUpParticleIndexAttribute(unsigned instanceCount);
+
+    /**
+     * Check if a ParticleSystem can be drawn along with others, see drawParticleSystems().
+     *
+     * @param particleSystem The ParticleSystem.
+     *
+     * @return True if the ParticleSystem can be merged into a multi draw.
+     */
+    bool isBatchable(ParticleSystem* particleSystem);
+
+    /**
+     * Check if two batchable ParticleSystem%s can be drawn with the same multi draw.
+     *
+     * @param first A batchable ParticleSystem.
+     * @param second Another batchable ParticleSystem.
+     *
+     * @return True if both have the same Mesh, Material, ParticlePool and particle attributes.
+     */
+    bool canShareDraw(const ParticleSystem* first, const ParticleSystem* second) const;
+
+    /**
+     * Draw batchable ParticleSystem%s with a single glMultiDrawElementsIndirect() call.
+     *
+     * @param particleSystems The ParticleSystem%s. All of them can share the draw of the first one.
+     * @param count The number of ParticleSystem%s.
+     */
+    void drawParticleSystemBatch(ParticleSystem* const* particleSystems, size_t count);
+
+    /**
+     * Upload draw commands to mDrawCommandBuffer.
+     *
+     * The commands of a frame are written one after another, so commands read by earlier draws are not overwritten.
+     * The buffer is replaced by a larger one if it is full.
+     *
+     * @param commands The commands.
+     *
+     * @return The offset of the commands in mDrawCommandBuffer in bytes.
+     */
+    GLintptr writeDrawCommands(const std::vector<GLuint>& commands);
+
+    /**
+     * The result of the static checks of isBatchable() for a ParticleSystem and its RenderProgram.
+     */
+    struct BatchInfo
+    {
+        /**
+         * The buffer generation of the ParticleSystem the checks were made for.
+         */
+        unsigned generation;
+
+        /**
+         * True if the ParticleSystem passed the checks for its RenderProgram.
+         */
+        bool batchable;
+    };
+
     /**
      * The glfw window handle.
      *
@@ -216,12 +407,44 @@ private:
     GLFWwindow* mWindow;
 
     /**
-     * This vector keeps track of the current vertex attribute bindings.
-     *
-     * The vertex attribute bindings of the current drawParticleSystem() call are stored here.
-     * After the drawing, all stored vertex attribute bindings are reset.
+     * The vertex arrays by Mesh and RenderProgram.
      */
-    std::vector<GLuint> mVertexAttributeBindings;
+    std::map<std::pair<const Mesh*, const RenderProgram*>, VertexArray> mVertexArrays;
+
+    /**
+     * The vertex array of the current drawParticleSystem() call.
+     */
+    VertexArray* mCurrentVertexArray;
+
+    /**
+     * The buffer generation of the ParticleSystem of the current drawParticleSystem() call.
+     */
+    unsigned mCurrentBufferGeneration;
+
+    /**
+     * The consecutive particle indices 0, 1, 2, ... sourcing np_in_particleIndex. Created on first use.
+     */
+    Buffer<GLuint>* mParticleIndexBuffer;
+
+    /**
+     * The generation of mParticleIndexBuffer, incremented whenever it is replaced.
+     */
+    unsigned mParticleIndexGeneration;
+
+    /**
+     * The indirect draw commands of the multi draws. Created on first use.
+     */
+    Buffer<GLuint>* mDrawCommandBuffer;
+
+    /**
+     * The number of commands written to mDrawCommandBuffer in the current frame, in GLuints.
+     */
+    GLsizei mDrawCommandOffset;
+
+    /**
+     * The static checks of isBatchable() by RenderProgram and ParticleSystem.
+     */
+    std::map<std::pair<const RenderProgram*, const ParticleSystem*>, BatchInfo> mBatchInfos;
 
     /**
      * This is the currently bound RenderProgram.
@@ -244,6 +467,19 @@ private:
      * This can be set by RenderSystem::setNormalMatrix().
      */
     glm::mat3 mNormalMatrix;
+
+    /**
+     * The compute program of the frustum culling. Created on first use.
+     */
+    ComputeProgram* mCullingProgram;
+
+    /**
+     * The handles of the uniforms of the frustum culling program. Resolved when the program is created.
+     */
+    UniformHandle<glm::mat4> mCullViewProjectionMatrixUniform;
+    UniformHandle<float> mCullRadiusUniform;
+    UniformHandle<GLuint> mCullParticleCountUniform;
+    UniformHandle<bool> mCullDynamicUniform;
 };
 
 template<typename T>
@@ -262,20 +498,55 @@ bool RenderSystem::setVertexAttribute(const std::string& attributeName, Buffer<T
         Logger::getInstance()->logError("RenderSystem: cannot bind vertex attribute for \"" + attributeName + "\" since target buffer does not provide legal GlTypeInfo!");
         return false;
     }
-    // Bind buffer so vertex attribute can be set up
-    buffer->bind(GL_ARRAY_BUFFER);
 
-    // Set up the vertex attribute pointer and store it
-    glVertexAttribPointer(location, buffer->getGlBaseSize(), buffer->getGlType(), GL_FALSE, 0, nullptr);
+    if(!mCurrentVertexArray)
+    {
+        Logger::getInstance()->logWarning("RenderSystem: attemp to set vertex attribute \"" + attributeName + "\" outside of drawParticleSystem()!");
+        return false;
+    }
+
+    // The buffer is read by the draw, so its edits have to be uploaded even if the attribute is already set up
+    buffer->uploadDirtyRanges();
+
+    // Skip the setup if the vertex array already sources the attribute from this buffer, set up for the same buffers
+    // of the same ParticleSystem
+    auto attributeIter = mCurrentVertexArray->attributes.find(location);
+    if(attributeIter != mCurrentVertexArray->attributes.end())
+    {
+        VertexAttribute& attribute = attributeIter->second;
+        if(attribute.bufferGeneration == mCurrentBufferGeneration && attribute.buffer == buffer->getHandle()
+                && attribute.offset == buffer->getStorageOffset() && attribute.glType == buffer->getGlType()
+                && attribute.glBaseSize == buffer->getGlBaseSize() && attribute.instanced == instanced)
+        {
+            attribute.used = true;
+            return true;
+        }
+    }
 
-    if(instanced)
-        glVertexAttribDivisor(location, 1);
+    GLuint vertexArray = mCurrentVertexArray->handle;
+    if(GlState::getInstance()->usesDirectStateAccess())
+    {
+        // Set up the vertex array by name, each attribute uses the vertex buffer binding of its location
+        glVertexArrayVertexBuffer(vertexArray, location, buffer->getHandle(), buffer->getStorageOffset(), sizeof(T));
+        glVertexArrayAttribFormat(vertexArray, location, buffer->getGlBaseSize(), buffer->getGlType(), GL_FALSE, 0);
+        glVertexArrayAttribBinding(vertexArray, location, location);
+        glVertexArrayBindingDivisor(vertexArray, location, instanced ? 1 : 0);
+        glEnableVertexArrayAttrib(vertexArray, location);
+    }
+    else
+    {
+        // The array buffer binding is not part of the vertex array, so the buffer keeps its other bindings
+        GlState::getInstance()->bindBuffer(GL_ARRAY_BUFFER, buffer->getHandle());
 
-    glEnableVertexAttribArray(location);
-    mVertexAttributeBindings.push_back(location);
+        // Set up the vertex attribute pointer, buffers in a ParticlePool start at their offset in the storage
+        glVertexAttribPointer(location, buffer->getGlBaseSize(), buffer->getGlType(), GL_FALSE, 0, (const void*)buffer->getStorageOffset());
+        glVertexAttribDivisor(location, instanced ? 1 : 0);
+        glEnableVertexAttribArray(location);
+    }
 
-    // Release buffer binding to restore state
-    buffer->unbind();
+    VertexAttribute attribute = { buffer->getHandle(), buffer->getStorageOffset(), buffer->getGlType(), buffer->getGlBaseSize(),
+                                  instanced, mCurrentBufferGeneration, true };
+    mCurrentVertexArray->attributes[location] = attribute;
 
     return true;
 }
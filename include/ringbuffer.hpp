@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_RINGBUFFER_HPP
+#define NP_RINGBUFFER_HPP
+
+#include <vector>
+
+#include "buffer.hpp"
+
+namespace nparticles
+{
+
+/**
+ * The RingBufferBase class is the type independent base of RingBuffer%s.
+ *
+ * A ring buffer holds several regions of getItemCount() items each. The application writes one region per frame
+ * while the GPU reads the regions written in the previous frames, so uploads do not stall the pipeline.
+ *
+ * The storage is allocated with glBufferStorage() and mapped once, persistently and coherently, so writes need no
+ * map, unmap or flush calls. Each region is protected by a fence: when the application starts to write the next
+ * region, a fence is inserted after all commands issued so far, i.e. after all commands which read the current
+ * region. Before a region is written again, its fence is waited for. With three regions, the application writes
+ * the data of frame N + 2 while the GPU still reads the data of frame N.
+ *
+ * Without GL_ARB_buffer_storage (OpenGL 4.4), each region is mapped unsynchronized while it is written instead,
+ * the fences protect the regions the same way.
+ *
+ * The region written last is the current region. bindBase() binds only the current region, so a ring buffer can
+ * be used like any other shader storage or uniform buffer, e.g. as particle attribute (see
+ * ParticleSystem::addStreamedParticleAttribute()).
+ *
+ * mapRaw() maps the current region only, so CPU kernels work on the data written last.
+ *
+ * @note Ring buffers must not be copied with copyData() or cleared with clearData(), these work on the first region.
+ *       Ranged mapping and dirty ranges are not available for the same reason.
+ *       Use beginWrite() and endWrite() to write them.
+ */
+class RingBufferBase : public BufferBase
+{
+public:
+    /**
+     * The RingBufferBase constructor.
+     *
+     * @param itemCount The number of items of each region.
+     * @param itemSize The size of one item in bytes.
+     * @param regionCount The number of regions, at least two.
+     */
+    RingBufferBase(int itemCount, GLsizeiptr itemSize, unsigned regionCount);
+
+    /**
+     * The RingBufferBase destructor.
+     */
+    virtual ~RingBufferBase();
+
+    /**
+     * Start writing the next region without type information.
+     *
+     * Fences the current region and waits until the GPU has finished the commands which read the next region
+     * when it was written the last time.
+     *
+     * @return Pointer to the items of the next region. Valid until endWrite().
+     */
+    void* beginWriteRaw();
+
+    /**
+     * Finish writing a region.
+     *
+     * The written region becomes the current region, which is bound by bindBase().
+     */
+    void endWrite();
+
+    /**
+     * Map the current region to application memory.
+     *
+     * Like glMapBuffer(), this waits until the GPU has finished all commands issued so far, so data written by
+     * the GPU can be read.
+     *
+     * @return Pointer to the items of the current region.
+     */
+    virtual void* mapRaw() override;
+
+    /**
+     * Unmap the current region.
+     */
+    virtual void unmap() override;
+
+    /**
+     * Get the number of regions.
+     *
+     * @return The number of regions.
+     */
+    unsigned getRegionCount() const { return mRegionCount; }
+
+    /**
+     * Get the current region.
+     *
+     * @return The index of the region written last.
+     */
+    unsigned getCurrentRegion() const { return mCurrentRegion; }
+
+    /**
+     * Get the offset of the current region.
+     *
+     * @return The offset in bytes of the current region in the buffer, e.g. for vertex attribute pointers.
+     */
+    GLintptr getCurrentRegionOffset() const { return mCurrentRegion * mRegionStride; }
+
+    /**
+     * Get the number of times beginWriteRaw() had to wait for the GPU.
+     *
+     * If this grows steadily, the GPU is more than getRegionCount() - 1 frames behind and more regions are needed.
+     *
+     * @return The number of waits.
+     */
+    unsigned getWaitCount() const { return mWaitCount; }
+
+    /**
+     * Check if the storage is persistently mapped.
+     *
+     * @return True if GL_ARB_buffer_storage is available, false if the regions are mapped while they are written.
+     */
+    bool isPersistent() const { return mPersistentPointer != nullptr; }
+
+private:
+    /**
+     * Wait for a fence, flushing the commands if it is not signalled yet.
+     *
+     * @param fence The fence to wait for.
+     *
+     * @return True if the fence was not signalled yet, i.e. the application had to wait.
+     */
+    bool waitForFence(GLsync fence);
+
+    /**
+     * The number of regions.
+     */
+    unsigned mRegionCount;
+
+    /**
+     * The distance between two regions in bytes. Regions are aligned for indexed bindings.
+     */
+    GLsizeiptr mRegionStride;
+
+    /**
+     * The region written last.
+     */
+    unsigned mCurrentRegion;
+
+    /**
+     * The region which is being written.
+     */
+    unsigned mWriteRegion;
+
+    /**
+     * True between beginWriteRaw() and endWrite().
+     */
+    bool mWriting;
+
+    /**
+     * The fence of each region, nullptr if the region was not used by the GPU.
+     */
+    std::vector<GLsync> mFences;
+
+    /**
+     * The persistently mapped storage or nullptr without GL_ARB_buffer_storage.
+     */
+    char* mPersistentPointer;
+
+    /**
+     * The number of waits for a fence.
+     */
+    unsigned mWaitCount;
+};
+
+/**
+ * The RingBuffer class is a RingBufferBase storing data of a specific type.
+ *
+ * @tparam T The type of data stored in the RingBuffer.
+ */
+template<typename T>
+class RingBuffer : public RingBufferBase
+{
+public:
+    /**
+     * The RingBuffer constructor.
+     *
+     * @param itemCount The number of items of each region.
+     * @param regionCount The number of regions, at least two. Defaults to three, so two frames are in flight.
+     * @param glType The OpenGL type of the buffer, see Buffer::Buffer().
+     * @param glBaseSize The base size of the OpenGL type, see Buffer::Buffer().
+     */
+    RingBuffer(int itemCount, unsigned regionCount = 3, GLenum glType = GL_INVALID_VALUE, int glBaseSize = -1);
+
+    /**
+     * Start writing the next region.
+     *
+     * @return Pointer to the getItemCount() items of the next region. Valid until endWrite().
+     */
+    T* beginWrite() { return static_cast<T*>(beginWriteRaw()); }
+};
+
+// Implementation
+template<typename T>
+RingBuffer<T>::RingBuffer(int itemCount, unsigned regionCount, GLenum glType, int glBaseSize)
+    : RingBufferBase(itemCount, sizeof(T), regionCount)
+{
+    if(glType == GL_INVALID_VALUE || glBaseSize == -1)
+    {
+        T testType;
+        mGlTypeInfo = glutils::getGlTypeInfo(testType);
+    }
+    else
+    {
+        mGlTypeInfo.mGlType = glType;
+        mGlTypeInfo.mBaseSize = glBaseSize;
+    }
+}
+
+} // namespace nparticles
+
+#endif // NP_RINGBUFFER_HPP
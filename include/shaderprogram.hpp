@@ -14,11 +14,13 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 #include <glm/glm.hpp>
 
 #include "logger.hpp"
 #include "buffer.hpp"
+#include "uniformhandle.hpp"
 
 namespace nparticles
 {
@@ -71,6 +73,9 @@ public:
      * This queries the location of a uniform variable named @p name. The index of the uniform variable is returned
      * or -1 if no such uniform exists or the ShaderProgram was not successfully built.
      *
+     * All active uniforms are reflected into a table when the program is built, so this does not query the driver.
+     * Only elements of arrays other than the first one (e.g. "values[3]") are queried.
+     *
      * If you have declared a uniform but cannot retrieve its location, it maybe fell a victim to the drivers compiler
      * optimisations.
      *
@@ -81,6 +86,19 @@ public:
      */
     GLint getUniformLocation(const std::string& name) const;
 
+    /**
+     * Get a typed handle to a uniform variable.
+     *
+     * Resolve the handle once and use it to set the uniform without any lookup (see UniformHandle).
+     *
+     * @param name String containing the name of the uniform variable.
+     * @tparam T The C++ type of the uniform. It has to match the GLSL type of the uniform (see UniformTraits).
+     *
+     * @return The handle or an invalid handle if there is no such uniform or its type does not match @p T.
+     */
+    template<typename T>
+    UniformHandle<T> getUniformHandle(const std::string& name) const;
+
     /**
      * Set uniform variable of type bool.
      *
@@ -161,6 +179,19 @@ public:
      */
     bool setUniform(const std::string& name, uint value) const;
 
+    /**
+     * Set a uniform variable of type uvec3.
+     *
+     * This is one of the overloaded setUniform() methods responsible for setting
+     * 3-dimensional unsigned integer vectors.
+     *
+     * @param name String containing the name of a uniform variable.
+     * @param value The value to set to the specified uniform variable.
+     *
+     * @return True if variable @p name exists, otherwise false.
+     */
+    bool setUniform(const std::string& name, const glm::uvec3& value) const;
+
     /**
      * Bind a Buffer to a shader storage block.
      *
@@ -204,6 +235,19 @@ public:
      */
     bool bindAtomicCounterBuffer(const std::string& atomicCounterName, BufferBase* buffer) const;
 
+    /**
+     * Get the binding index of a shader variable backed by a buffer.
+     *
+     * The bind*Buffer() methods query the binding index on every call. Callers binding the same buffers repeatedly
+     * can query it once with this method and bind the buffers themselves (see GPUSystem::bindParticleBuffers()).
+     *
+     * @param bufferTarget The target of the buffer. Must be GL_UNIFORM_BUFFER, GL_SHADER_STORAGE_BUFFER or GL_ATOMIC_COUNTER_BUFFER.
+     * @param shaderVariableName The name of the block or atomic counter as specified in the shader source code.
+     *
+     * @return The binding index or -1 if there is no such variable for @p bufferTarget.
+     */
+    GLint getBufferBinding(GLenum bufferTarget, const std::string& shaderVariableName) const;
+
     /**
      * Enables all selected subroutines.
      *
@@ -320,6 +364,50 @@ private:
      */
     void querySubroutines(GLenum shaderStage);
 
+    /**
+     * Reflect all active uniforms into mUniforms.
+     *
+     * This is queried directly after a successful build().
+     */
+    void queryUniforms();
+
+    /**
+     * An active uniform of the ShaderProgram.
+     */
+    struct UniformInfo
+    {
+        /**
+         * The name of the uniform.
+         */
+        std::string name;
+
+        /**
+         * The location of the uniform.
+         */
+        GLint location;
+
+        /**
+         * The GLSL type of the uniform, e.g. GL_FLOAT_MAT4.
+         */
+        GLenum type;
+    };
+
+    /**
+     * Find an active uniform.
+     *
+     * @param name The name of the uniform.
+     *
+     * @return The uniform or nullptr if there is no active uniform named @p name.
+     */
+    const UniformInfo* findUniform(const std::string& name) const;
+
+    /**
+     * All active uniforms which are not part of a block, sorted by name.
+     *
+     * Arrays are stored with and without the "[0]" suffix.
+     */
+    std::vector<UniformInfo> mUniforms;
+
     /**
      * The build status of the ShaderProgram.
      *
@@ -356,5 +444,23 @@ private:
     void operator=(const ShaderProgram&) = delete;
 };
 
+// Implementation
+template<typename T>
+UniformHandle<T> ShaderProgram::getUniformHandle(const std::string& name) const
+{
+    const UniformInfo* uniform = findUniform(name);
+
+    if(!uniform)
+        return UniformHandle<T>();
+
+    if(!UniformTraits<T>::accepts(uniform->type))
+    {
+        Logger::getInstance()->logWarning("ShaderProgram: cannot create handle for uniform \"" + name + "\". The type of the handle does not match the type of the uniform.");
+        return UniformHandle<T>();
+    }
+
+    return UniformHandle<T>(mShaderProgram, uniform->location);
+}
+
 } // namespace nparticles
 #endif // NP_SHADERPROGRAM_HPP
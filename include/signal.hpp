@@ -66,6 +66,13 @@ public:
      */
     void disconnectAll();
 
+    /**
+     * Check if no callbacks are connected.
+     *
+     * @return True if emit() would not call anything.
+     */
+    bool isEmpty() const { return mSlots.empty(); }
+
     /**
      * Emit the signal with a set of parameters.
      *
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_SPATIALREORDERER_HPP
+#define NP_SPATIALREORDERER_HPP
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace nparticles
+{
+
+class ParticleSystem;
+class ShaderProgram;
+
+/**
+ * @brief The space_filling_curves enum defines the order in which a SpatialReorderer visits the cells of its grid.
+ */
+enum space_filling_curves
+{
+    /**
+     * Z-order: the bits of the cell coordinates are interleaved. Cheap, but has jumps between octants.
+     */
+    NP_SFC_MORTON,
+
+    /**
+     * Hilbert curve: consecutive cells are always adjacent, so it preserves locality better than Z-order.
+     */
+    NP_SFC_HILBERT
+};
+
+/**
+ * The SpatialReorderer class sorts the particles of a ParticleSystem along a space filling curve.
+ *
+ * As particles move, neighbors in space drift apart in memory, so neighbor loops, tiled gravity loops and rendering
+ * access the attribute buffers less and less coherently. The SpatialReorderer periodically restores the locality:
+ * the cube from origin to origin + size is divided into 2^bitsPerAxis cells along each axis, the cells are numbered
+ * along a Morton or Hilbert curve and all particles are permuted so they are sorted by their cell. Particles outside
+ * of the cube are sorted into the border cells.
+ *
+ * The sort is a counting sort appended to the ParticleSystem as Actions:
+ * - Count: each particle determines the key of its cell and its rank within the cell (np/reorder-count.glsl).
+ * - Scan: the prefix sum over the cell counts yields the first slot of each cell (np/reorder-scan.glsl).
+ * - Scatter: the permutation, i.e. the old slot of the particle at each new slot (np/reorder-scatter.glsl).
+ * - Gather: one Action per permuted buffer, which gathers the buffer through a scratch buffer (np/reorder-gather.glsl).
+ *
+ * All particle attributes which exist when attach() is called are permuted, as well as the storage buffers added
+ * with addPerParticleBuffer() (e.g. per particle state of other passes). The Actions are executed every n-th update
+ * (see Action::setUpdateInterval()).
+ *
+ * Particles keep a stable id: PARTICLE_IDS_BUFFER holds the id of the particle at each slot and is permuted with the
+ * attributes, PARTICLE_SLOTS_BUFFER holds the current slot of each id. Ids start as the initial slots.
+ *
+ * All passes have CPUKernel%s which are registered when the compute programs are created. On the CPU, particles of
+ * the same cell keep their relative order. The shader sources are loaded from "/np", so the directory res/shader/np
+ * has to be added to the GPUProgramService before attach() is called. The SpatialReorderer must outlive the
+ * ParticleSystems it is attached to.
+ */
+class SpatialReorderer
+{
+public:
+    /**
+     * The SpatialReorderer constructor.
+     *
+     * @param origin The minimum corner of the sorted cube.
+     * @param size The edge length of the sorted cube.
+     * @param curve The space filling curve.
+     * @param bitsPerAxis The number of bits of the cell coordinates, clamped to [1, 7]. The cell tables have
+     *                    2^(3 * bitsPerAxis) entries.
+     * @param positionsAttribute The name of the particle attribute holding the positions (xyz of a vec4).
+     */
+    SpatialReorderer(const glm::vec3& origin, float size, space_filling_curves curve = NP_SFC_HILBERT,
+                     unsigned bitsPerAxis = 6, const std::string& positionsAttribute = "ParticlePositions");
+
+    /**
+     * Permute a storage buffer of the ParticleSystems along with the particle attributes.
+     *
+     * Has to be called before attach(). The buffer must hold one item per particle.
+     *
+     * @param name The name of the storage buffer.
+     */
+    void addPerParticleBuffer(const std::string& name);
+
+    /**
+     * Attach the reorderer to a ParticleSystem.
+     *
+     * Adds the storage buffers of the reorderer and appends its Actions. Actions appended afterwards see the
+     * sorted particles. Particle attributes added afterwards are not permuted.
+     *
+     * @param particleSystem The ParticleSystem to sort.
+     * @param interval The number of updates between two sorts. The first update always sorts.
+     *
+     * @return True on success, false if a compute program cannot be created, a buffer has a size which is not a
+     *         multiple of four bytes, the ParticleSystem has a dynamic particle count or already has a reorderer.
+     */
+    bool attach(ParticleSystem* particleSystem, unsigned interval = 1);
+
+    /**
+     * Set the uniforms of np/spacefillingcurve.glsl.
+     *
+     * @param program The ShaderProgram to set the uniforms for.
+     */
+    void setUniforms(const ShaderProgram& program) const;
+
+    /**
+     * Get the key of the cell containing a position.
+     *
+     * @param position The position.
+     *
+     * @return The index of the cell along the space filling curve.
+     */
+    unsigned getKey(const glm::vec3& position) const;
+
+    /**
+     * Get the space filling curve.
+     *
+     * @return The curve along which the particles are sorted.
+     */
+    space_filling_curves getCurve() const { return mCurve; }
+
+    /**
+     * Get the number of cells.
+     *
+     * @return 2^(3 * bitsPerAxis).
+     */
+    unsigned getCellCount() const { return 1u << (3 * mBitsPerAxis); }
+
+    /**
+     * Get the name of the positions attribute.
+     *
+     * @return The name of the particle attribute holding the positions.
+     */
+    const std::string& getPositionsAttribute() const { return mPositionsAttribute; }
+
+    /**
+     * Names of the storage buffers added to the ParticleSystem.
+     */
+    static const char* const CELL_COUNTS_BUFFER;
+    static const char* const CELL_STARTS_BUFFER;
+    static const char* const PARTICLE_KEYS_BUFFER;
+    static const char* const PERMUTATION_BUFFER;
+    static const char* const SCRATCH_BUFFER;
+    static const char* const PARTICLE_IDS_BUFFER;
+    static const char* const PARTICLE_SLOTS_BUFFER;
+    static const char* const SCAN_DISPATCH_BUFFER;
+
+private:
+    /**
+     * The minimum corner of the sorted cube.
+     */
+    glm::vec3 mOrigin;
+
+    /**
+     * The edge length of the sorted cube.
+     */
+    float mSize;
+
+    /**
+     * The space filling curve.
+     */
+    space_filling_curves mCurve;
+
+    /**
+     * The number of bits of the cell coordinates.
+     */
+    unsigned mBitsPerAxis;
+
+    /**
+     * The name of the particle attribute holding the positions.
+     */
+    std::string mPositionsAttribute;
+
+    /**
+     * The storage buffers permuted along with the particle attributes.
+     */
+    std::vector<std::string> mPerParticleBuffers;
+
+    // Hide copy constructor and assignment operator
+    SpatialReorderer(const SpatialReorderer&) = delete;
+    void operator=(const SpatialReorderer&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_SPATIALREORDERER_HPP
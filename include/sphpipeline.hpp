@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_SPHPIPELINE_HPP
+#define NP_SPHPIPELINE_HPP
+
+#include <glm/glm.hpp>
+
+#include "neighborgrid.hpp"
+
+namespace nparticles
+{
+
+class ParticleSystem;
+class ShaderProgram;
+
+/**
+ * @brief The SPHParameters struct holds the physical parameters of an SPHPipeline.
+ *
+ * The defaults simulate water in SI units (Müller et al., "Particle-Based Fluid Simulation for Interactive Applications").
+ */
+struct SPHParameters
+{
+    /**
+     * Creates water parameters in a box of 1 m³ centered at the origin.
+     */
+    SPHParameters();
+
+    /**
+     * The radius of the smoothing kernels (h).
+     */
+    float smoothingLength;
+
+    /**
+     * The mass of each particle.
+     */
+    float particleMass;
+
+    /**
+     * The density of the fluid at rest.
+     */
+    float restDensity;
+
+    /**
+     * The gas constant of the equation of state p = stiffness * (density - restDensity).
+     */
+    float stiffness;
+
+    /**
+     * The dynamic viscosity.
+     */
+    float viscosity;
+
+    /**
+     * The fraction of the velocity kept when a particle is reflected at the bounds.
+     */
+    float boundaryDamping;
+
+    /**
+     * The time step of the integration.
+     */
+    float timeStep;
+
+    /**
+     * The gravitational acceleration.
+     */
+    glm::vec3 gravity;
+
+    /**
+     * The minimum and maximum corner of the box containing the fluid.
+     */
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+/**
+ * The SPHPipeline class simulates fluids with smoothed-particle hydrodynamics.
+ *
+ * attach() adds the particle attributes of the fluid to a ParticleSystem and appends the passes as Actions:
+ * - The build of a NeighborGrid with cells of the smoothing length (see NeighborGrid).
+ * - Density: density and pressure of each particle (np/sph-density.glsl).
+ * - Pressure: pressure accelerations (np/sph-pressure.glsl).
+ * - Viscosity: viscosity accelerations and gravity (np/sph-viscosity.glsl).
+ * - Integrate: semi-implicit Euler integration and reflection at the bounds (np/sph-integrate.glsl).
+ *
+ * All passes have CPUKernel%s which are registered when the compute programs are created, so the pipeline
+ * runs on both compute backends. The neighbor passes process the particles in the order of the grid, so
+ * consecutive invocations (GPU) and iterations (CPU) visit the same cells.
+ *
+ * The attributes are:
+ * - SPHPositions (glm::vec4): position in xyz.
+ * - SPHVelocities (glm::vec4): velocity in xyz.
+ * - SPHDensities (glm::vec2): density and pressure.
+ * - SPHAccelerations (glm::vec4): acceleration in xyz.
+ *
+ * The shader sources are loaded from "/np", so the directory res/shader/np has to be added to the
+ * GPUProgramService before attach() is called. The SPHPipeline must outlive the ParticleSystems it is attached to.
+ */
+class SPHPipeline
+{
+public:
+    /**
+     * The SPHPipeline constructor.
+     *
+     * @param parameters The parameters of the fluid. The bounds also define the NeighborGrid.
+     */
+    SPHPipeline(const SPHParameters& parameters = SPHParameters());
+
+    /**
+     * Attach the pipeline to a ParticleSystem.
+     *
+     * Adds the attributes of the fluid and appends the Actions of the pipeline. The attributes have
+     * to be initialised by the caller, e.g. with initialiseBlock().
+     *
+     * @param particleSystem The ParticleSystem simulating the fluid.
+     *
+     * @return True on success, false if a compute program cannot be created or the attributes already exist.
+     */
+    bool attach(ParticleSystem* particleSystem);
+
+    /**
+     * Place the particles on a cubic lattice with the rest density of the fluid.
+     *
+     * The block starts at @p origin and is filled along x first, then z, then y. Velocities are set to zero.
+     *
+     * @param particleSystem A ParticleSystem the pipeline is attached to.
+     * @param origin The minimum corner of the block.
+     * @param width The number of particles along x and z.
+     */
+    void initialiseBlock(ParticleSystem* particleSystem, const glm::vec3& origin, unsigned width) const;
+
+    /**
+     * Set the uniforms of np/sph.glsl.
+     *
+     * @param program The ShaderProgram to set the uniforms for.
+     * @param particleCount The number of particles.
+     */
+    void setUniforms(const ShaderProgram& program, unsigned particleCount) const;
+
+    /**
+     * Get the parameters.
+     *
+     * @return The parameters of the fluid.
+     */
+    const SPHParameters& getParameters() const { return mParameters; }
+
+    /**
+     * Set the time step.
+     *
+     * @param timeStep The time step of the integration.
+     */
+    void setTimeStep(float timeStep) { mParameters.timeStep = timeStep; }
+
+    /**
+     * Get the distance of particles on a lattice with the rest density.
+     *
+     * @return The lattice spacing (particleMass / restDensity)^(1/3).
+     */
+    float getParticleSpacing() const;
+
+    /**
+     * Get the NeighborGrid.
+     *
+     * @return The grid used for neighbor lookups.
+     */
+    const NeighborGrid& getGrid() const { return mGrid; }
+
+    /**
+     * Get the normalisation factor of the poly6 kernel: 315 / (64 * pi * h^9).
+     */
+    float getPoly6Factor() const { return mPoly6Factor; }
+
+    /**
+     * Get the normalisation factor of the spiky kernel gradient: 45 / (pi * h^6).
+     */
+    float getSpikyGradientFactor() const { return mSpikyGradientFactor; }
+
+    /**
+     * Get the normalisation factor of the viscosity kernel laplacian: 45 / (pi * h^6).
+     */
+    float getViscosityLaplacianFactor() const { return mViscosityLaplacianFactor; }
+
+    /**
+     * Names of the particle attributes.
+     */
+    static const char* const POSITIONS_ATTRIBUTE;
+    static const char* const VELOCITIES_ATTRIBUTE;
+    static const char* const DENSITIES_ATTRIBUTE;
+    static const char* const ACCELERATIONS_ATTRIBUTE;
+
+private:
+    /**
+     * The parameters of the fluid.
+     */
+    SPHParameters mParameters;
+
+    /**
+     * The grid used for neighbor lookups.
+     */
+    NeighborGrid mGrid;
+
+    /**
+     * The normalisation factors of the smoothing kernels.
+     */
+    float mPoly6Factor;
+    float mSpikyGradientFactor;
+    float mViscosityLaplacianFactor;
+
+    // Hide copy constructor and assignment operator
+    SPHPipeline(const SPHPipeline&) = delete;
+    void operator=(const SPHPipeline&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_SPHPIPELINE_HPP
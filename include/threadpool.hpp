@@ -0,0 +1,302 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_THREADPOOL_HPP
+#define NP_THREADPOOL_HPP
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace nparticles
+{
+
+/**
+ * The ThreadPool class is the work-stealing job system which distributes CPU work across all available cores.
+ *
+ * A ThreadPool keeps a fixed set of worker threads alive for its whole lifetime, so no threads
+ * have to be created when work is issued. Each worker owns a deque of jobs: new jobs are pushed to
+ * and popped from the back of the deque of the issuing thread, idle workers steal from the front of
+ * the other deques. Threads which are not workers of the pool share one additional deque.
+ *
+ * Work is issued in two ways:
+ * - parallelFor() splits an index range into chunks which are processed by the workers and the calling thread.
+ * - submit() runs a single task asynchronously. then() creates continuations which are started as soon as
+ *   their antecedent tasks are finished.
+ *
+ * Threads waiting for work to finish (parallelFor(), wait()) process pending jobs in the meantime, so
+ * both may be called from inside tasks and range functions.
+ *
+ * The Engine owns the ThreadPool used by all of its subsystems (see Engine::getThreadPool()).
+ *
+ * @code
+ * ThreadPool& threadPool = Engine::getInstance()->getThreadPool();
+ * threadPool.parallelFor(0, particleCount, [&](unsigned first, unsigned last)
+ * {
+ *     for(unsigned i = first; i < last; ++i)
+ *         positions[i] += velocities[i] * timeStep;
+ * });
+ *
+ * ThreadPool::task_handle load = threadPool.submit([&]{ loadSnapshot(fileName, snapshot); });
+ * ThreadPool::task_handle analyse = threadPool.then(load, [&]{ computeStatistics(snapshot); });
+ * threadPool.wait(analyse);
+ * @endcode
+ */
+class ThreadPool
+{
+public:
+    /**
+     * Typedef for functions processing a range of indices.
+     *
+     * The function is called with the first index of the range and the index one past the last
+     * index of the range: [first, last).
+     */
+    typedef std::function<void(unsigned first, unsigned last)> range_function;
+
+    /**
+     * Typedef for functions run as tasks.
+     */
+    typedef std::function<void()> task_function;
+
+    /**
+     * A task issued via submit() or then(). The type is opaque, tasks are referred to via task_handle%s.
+     */
+    struct Task;
+
+    /**
+     * Typedef for handles to tasks. A task stays alive as long as it is pending or a handle refers to it.
+     */
+    typedef std::shared_ptr<Task> task_handle;
+
+    /**
+     * The ThreadPool constructor.
+     *
+     * Creates a ThreadPool and starts its worker threads. Threads waiting for work take part
+     * in processing, so @p threadCount - 1 workers are created.
+     *
+     * @param threadCount The number of threads used to process work. If 0 (the default), the number of
+     *                    hardware threads is used.
+     */
+    ThreadPool(unsigned threadCount = 0);
+
+    /**
+     * The ThreadPool destructor.
+     *
+     * Stops and joins all worker threads. Jobs which did not start yet are discarded, so all tasks
+     * have to be waited for before the ThreadPool is destroyed.
+     */
+    ~ThreadPool();
+
+    /**
+     * Get the number of threads.
+     *
+     * @return The number of threads processing work, including the thread calling parallelFor().
+     */
+    unsigned getThreadCount() const { return mWorkers.size() + 1; }
+
+    /**
+     * Process a range of indices in parallel.
+     *
+     * The range [@p first, @p last) is split recursively into halves until the parts are no larger than
+     * @p grainSize indices. Split off halves are pushed as jobs so idle threads can steal them, the chunks
+     * always start at @p first + k * @p grainSize. Each chunk is passed to @p function by one of the threads
+     * of the pool. This method returns when all chunks are processed.
+     *
+     * @param first The first index of the range.
+     * @param last The index one past the last index of the range.
+     * @param function The function called for each chunk.
+     * @param grainSize The number of indices per chunk. If 0 (the default), the range is split into
+     *                  four chunks per thread.
+     */
+    void parallelFor(unsigned first, unsigned last, const range_function& function, unsigned grainSize = 0);
+
+    /**
+     * Run a task asynchronously.
+     *
+     * @param function The function of the task.
+     *
+     * @return Handle to the task.
+     */
+    task_handle submit(const task_function& function);
+
+    /**
+     * Create a continuation of a task.
+     *
+     * The continuation is started when @p antecedent is finished.
+     *
+     * @param antecedent The task to continue. If nullptr, the continuation is started immediately.
+     * @param function The function of the continuation.
+     *
+     * @return Handle to the continuation.
+     */
+    task_handle then(const task_handle& antecedent, const task_function& function);
+
+    /**
+     * Create a continuation of several tasks.
+     *
+     * The continuation is started when all @p antecedents are finished.
+     *
+     * @param antecedents The tasks to continue. nullptr entries are ignored.
+     * @param function The function of the continuation.
+     *
+     * @return Handle to the continuation.
+     */
+    task_handle then(const std::vector<task_handle>& antecedents, const task_function& function);
+
+    /**
+     * Check if a task is finished.
+     *
+     * @param task The task.
+     *
+     * @return True if the function of @p task returned.
+     */
+    bool isFinished(const task_handle& task) const;
+
+    /**
+     * Wait for a task to finish.
+     *
+     * The calling thread processes pending jobs until @p task is finished.
+     *
+     * @param task The task to wait for.
+     */
+    void wait(const task_handle& task);
+
+    /**
+     * Wait for one of several tasks to finish.
+     *
+     * The calling thread processes pending jobs until one of the @p tasks is finished.
+     *
+     * @param tasks The tasks to wait for. Must not be empty.
+     *
+     * @return The index of a finished task in @p tasks.
+     */
+    unsigned waitAny(const std::vector<task_handle>& tasks);
+
+private:
+    /**
+     * Typedef for the jobs stored in the deques.
+     */
+    typedef std::function<void()> job;
+
+    /**
+     * The deque of jobs of one thread.
+     */
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<job> jobs;
+    };
+
+    /**
+     * The main loop of a worker thread.
+     *
+     * @param queueIndex The index of the WorkQueue owned by the worker.
+     */
+    void workerLoop(unsigned queueIndex);
+
+    /**
+     * Get the index of the WorkQueue of the calling thread.
+     *
+     * @return The index of the worker's WorkQueue or 0 if the calling thread is not a worker of this pool.
+     */
+    unsigned getQueueIndex() const;
+
+    /**
+     * Push a job to the back of the WorkQueue of the calling thread and wake up a sleeping worker.
+     *
+     * @param newJob The job.
+     */
+    void push(job&& newJob);
+
+    /**
+     * Run one pending job.
+     *
+     * Pops a job from the back of the WorkQueue @p queueIndex. If it is empty, a job is stolen from the
+     * front of another WorkQueue.
+     *
+     * @param queueIndex The index of the WorkQueue of the calling thread.
+     *
+     * @return True if a job was run, false if no job was found.
+     */
+    bool runPendingJob(unsigned queueIndex);
+
+    /**
+     * Process a part of a range of parallelFor().
+     *
+     * @param first The first index of the part.
+     * @param last The index one past the last index of the part.
+     * @param function The function of the range.
+     * @param grainSize The number of indices per chunk.
+     * @param remaining The number of indices of the range which are not processed yet.
+     */
+    void processRange(unsigned first, unsigned last, const range_function* function, unsigned grainSize,
+                      std::atomic<unsigned>* remaining);
+
+    /**
+     * Push the job running a task whose antecedents are finished.
+     *
+     * @param task The task.
+     */
+    void schedule(const task_handle& task);
+
+    /**
+     * Mark a task as finished and start its continuations.
+     *
+     * @param task The task.
+     */
+    void finish(const task_handle& task);
+
+    /**
+     * The worker threads.
+     */
+    std::vector<std::thread> mWorkers;
+
+    /**
+     * The WorkQueues. Index 0 is shared by all threads which are not workers, index i + 1 belongs to worker i.
+     */
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;
+
+    /**
+     * The number of jobs in all WorkQueues.
+     */
+    std::atomic<unsigned> mQueuedJobs;
+
+    /**
+     * The number of workers waiting for jobs.
+     */
+    std::atomic<unsigned> mSleepingWorkers;
+
+    /**
+     * Mutex protecting sleeping and wake up of workers.
+     */
+    std::mutex mSleepMutex;
+
+    /**
+     * Signals workers that new jobs are available or the pool is terminated.
+     */
+    std::condition_variable mWorkAvailable;
+
+    /**
+     * Set to true when the pool is destroyed.
+     */
+    bool mTerminate;
+
+    // Hide copy constructor and assignment operator
+    ThreadPool(const ThreadPool&) = delete;
+    void operator=(const ThreadPool&) = delete;
+};
+
+} // namespace nparticles
+
+#endif // NP_THREADPOOL_HPP
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_UNIFORMHANDLE_HPP
+#define NP_UNIFORMHANDLE_HPP
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+namespace nparticles
+{
+
+/**
+ * The UniformTraits struct maps C++ types to GLSL uniform types.
+ *
+ * Each specialisation provides the GLSL types a uniform of type T may be declared with and the call setting it.
+ * UniformHandle%s exist for all specialised types.
+ *
+ * @tparam T The C++ type of the uniform.
+ */
+template<typename T>
+struct UniformTraits;
+
+template<>
+struct UniformTraits<bool>
+{
+    static bool accepts(GLenum type) { return type == GL_BOOL; }
+    static void set(GLuint program, GLint location, bool value) { glProgramUniform1ui(program, location, value); }
+};
+
+template<>
+struct UniformTraits<GLint>
+{
+    static bool accepts(GLenum type) { return type == GL_INT; }
+    static void set(GLuint program, GLint location, GLint value) { glProgramUniform1i(program, location, value); }
+};
+
+template<>
+struct UniformTraits<GLuint>
+{
+    static bool accepts(GLenum type) { return type == GL_UNSIGNED_INT; }
+    static void set(GLuint program, GLint location, GLuint value) { glProgramUniform1ui(program, location, value); }
+};
+
+template<>
+struct UniformTraits<GLfloat>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT; }
+    static void set(GLuint program, GLint location, GLfloat value) { glProgramUniform1f(program, location, value); }
+};
+
+template<>
+struct UniformTraits<glm::vec3>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC3; }
+    static void set(GLuint program, GLint location, const glm::vec3& value) { glProgramUniform3fv(program, location, 1, &value[0]); }
+};
+
+template<>
+struct UniformTraits<glm::vec4>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_VEC4; }
+    static void set(GLuint program, GLint location, const glm::vec4& value) { glProgramUniform4fv(program, location, 1, &value[0]); }
+};
+
+template<>
+struct UniformTraits<glm::uvec3>
+{
+    static bool accepts(GLenum type) { return type == GL_UNSIGNED_INT_VEC3; }
+    static void set(GLuint program, GLint location, const glm::uvec3& value) { glProgramUniform3uiv(program, location, 1, &value[0]); }
+};
+
+template<>
+struct UniformTraits<glm::mat3>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT3; }
+    static void set(GLuint program, GLint location, const glm::mat3& value) { glProgramUniformMatrix3fv(program, location, 1, GL_FALSE, &value[0][0]); }
+};
+
+template<>
+struct UniformTraits<glm::mat4>
+{
+    static bool accepts(GLenum type) { return type == GL_FLOAT_MAT4; }
+    static void set(GLuint program, GLint location, const glm::mat4& value) { glProgramUniformMatrix4fv(program, location, 1, GL_FALSE, &value[0][0]); }
+};
+
+/**
+ * The UniformHandle class refers to a uniform variable of a ShaderProgram.
+ *
+ * A UniformHandle is resolved once with ShaderProgram::getUniformHandle(), which checks that the uniform is declared
+ * with a type matching T. Setting the uniform through the handle neither looks up the name nor queries the driver,
+ * so handles should be used for uniforms set on every draw or dispatch.
+ *
+ * @code
+ * UniformHandle<float> timeStepUniform = computeProgram->getUniformHandle<float>("timeStep");
+ *
+ * // On every update
+ * timeStepUniform.set(timeStep);
+ * @endcode
+ *
+ * Handles of uniforms which do not exist are invalid, setting them does nothing.
+ *
+ * @tparam T The C++ type of the uniform, see UniformTraits.
+ */
+template<typename T>
+class UniformHandle
+{
+friend class ShaderProgram;
+
+public:
+    /**
+     * Create an invalid UniformHandle.
+     */
+    UniformHandle() : mProgram(0), mLocation(-1) {}
+
+    /**
+     * Set the uniform.
+     *
+     * The program need not be bound.
+     *
+     * @param value The new value of the uniform.
+     *
+     * @return True if the handle is valid, false otherwise.
+     */
+    bool set(const T& value) const
+    {
+        if(mLocation == -1)
+            return false;
+
+        UniformTraits<T>::set(mProgram, mLocation, value);
+        return true;
+    }
+
+    /**
+     * Check if the handle refers to a uniform.
+     *
+     * @return True if the uniform exists and has a matching type.
+     */
+    bool isValid() const { return mLocation != -1; }
+
+    /**
+     * Get the location of the uniform.
+     *
+     * @return The location of the uniform or -1 if the handle is invalid.
+     */
+    GLint getLocation() const { return mLocation; }
+
+private:
+    /**
+     * Create a valid UniformHandle. Used by ShaderProgram::getUniformHandle().
+     *
+     * @param program The OpenGL program handle.
+     * @param location The location of the uniform.
+     */
+    UniformHandle(GLuint program, GLint location) : mProgram(program), mLocation(location) {}
+
+    /**
+     * The OpenGL program handle.
+     */
+    GLuint mProgram;
+
+    /**
+     * The location of the uniform.
+     */
+    GLint mLocation;
+};
+
+} // namespace nparticles
+
+#endif // NP_UNIFORMHANDLE_HPP
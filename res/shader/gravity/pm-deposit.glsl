@@ -0,0 +1,24 @@
+#version 430
+
+#extension GL_ARB_shading_language_include : enable
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/particle-mesh.glsl>
+
+#include </gravity/inputs.glsl>
+
+/**
+ * First stage of the particle-mesh update: assign the masses of the particles to the density grid.
+ */
+void main()
+{
+    uint globalInvocationIndex = npGetGlobalInvocationIndex();
+
+    // Return if this shader invocation was issued to fill up last work group
+    if(globalInvocationIndex >= particleCount)
+        return;
+
+    npPMDeposit(positions[globalInvocationIndex].position, positions[globalInvocationIndex].mass);
+}
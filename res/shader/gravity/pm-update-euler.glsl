@@ -0,0 +1,34 @@
+#version 430
+
+#extension GL_ARB_shading_language_include : enable
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/particle-mesh.glsl>
+
+#include </gravity/inputs.glsl>
+
+/**
+ * Second stage of the particle-mesh update: interpolate the acceleration field solved on the CPU
+ * and integrate using improved Euler integration.
+ */
+void main()
+{
+    uint globalInvocationIndex = npGetGlobalInvocationIndex();
+
+    // Return if this shader invocation was issued to fill up last work group
+    if(globalInvocationIndex >= particleCount)
+        return;
+
+    vec3 position = positions[globalInvocationIndex].position;
+    vec3 oldVelocity = properties[globalInvocationIndex].xyz;
+
+    vec3 acceleration = npPMInterpolate(position);
+
+    vec3 newVelocity = oldVelocity + acceleration * timeStep;
+    position += 0.5 * (oldVelocity + newVelocity) * timeStep;
+
+    positions[globalInvocationIndex].position = position;
+    properties[globalInvocationIndex].xyz = newVelocity;
+}
@@ -11,6 +11,7 @@
 
 #include </np/vertex-inputs.glsl>
 #include </np/uniforms.glsl>
+#include </np/culling.glsl>
 
 #include </gravity/inputs.glsl>
 
@@ -23,9 +24,9 @@ subroutine vec4 ColorFunc();
 subroutine (ColorFunc) vec4 velocityVector()
 {
     // Distinguish velocity for euler and verlet.
-    vec3 velocity = properties[gl_InstanceID].xyz;
+    vec3 velocity = properties[npGetParticleIndex()].xyz;
     if(usingVerlet)
-        velocity = (positions[gl_InstanceID].position - velocity) * 100;
+        velocity = (positions[npGetParticleIndex()].position - velocity) * 100;
 
     return vec4(velocity, 1.0);
 }
@@ -34,9 +35,9 @@ subroutine (ColorFunc) vec4 velocityVector()
 subroutine (ColorFunc) vec4 velocitySpeed()
 {
     // Distinguish velocity for euler and verlet.
-    vec3 velocity = properties[gl_InstanceID].xyz;
+    vec3 velocity = properties[npGetParticleIndex()].xyz;
     if(usingVerlet)
-        velocity = (positions[gl_InstanceID].position - velocity) * 500;
+        velocity = (positions[npGetParticleIndex()].position - velocity) * 500;
 
     return mix(vec4(0, 0, 1, 1), vec4(1, 0, 0, 1), length(velocity) / 500);
 }
@@ -45,7 +46,7 @@ subroutine (ColorFunc) vec4 velocitySpeed()
 // far away are painted red.
 subroutine (ColorFunc) vec4 distance()
 {
-    return mix(vec4(0, 1, 0, 1), vec4(1, 0, 0, 1), length(positions[gl_InstanceID].position) / 100);
+    return mix(vec4(0, 1, 0, 1), vec4(1, 0, 0, 1), length(positions[npGetParticleIndex()].position) / 100);
 }
 
 // Paints particles yellow.
@@ -71,10 +72,10 @@ void main()
     v_color = colorFunction();
 
     // Vertex transformation
-    vec3 pos = np_in_position + positions[gl_InstanceID].position;
+    vec3 pos = np_in_position + positions[npGetParticleIndex()].position;
 
     gl_Position = np_viewProjectionMatrix * vec4(pos, 1);
 
     // Sprite sizes
-    gl_PointSize = positions[gl_InstanceID].mass / length(gl_Position);
+    gl_PointSize = positions[npGetParticleIndex()].mass / length(gl_Position);
 }
@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/blocktimestep.glsl>
+
+/**
+ * First pass of the BlockTimeStepper: gather the indices of the particles active in the current sub-step.
+ *
+ * The first particle of each block of NP_BLOCK_KICK_GROUP_SIZE slots adds a work group to the indirect dispatch
+ * of the kick. The counts are reset by the drift.
+ */
+void main()
+{
+    uint particle = npGetGlobalInvocationIndex();
+
+    if(particle >= npBlockParticleCount)
+        return;
+
+    if(!npBlockIsActive(npBlockRungs[particle], npBlockSubStep))
+        return;
+
+    uint slot = atomicAdd(npBlockActiveCount, 1u);
+    npBlockActiveIndices[slot] = particle;
+
+    if(slot % NP_BLOCK_KICK_GROUP_SIZE == 0u)
+        atomicAdd(npBlockKickGroups.x, 1u);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/blocktimestep.glsl>
+
+/**
+ * Last pass of the BlockTimeStepper: move all particles by one sub-step.
+ *
+ * The first invocation resets the counts of the compaction for the next update.
+ */
+void main()
+{
+    uint particle = npGetGlobalInvocationIndex();
+
+    if(particle == 0u)
+    {
+        npBlockKickGroups.x = 0u;
+        npBlockActiveCount = 0u;
+    }
+
+    if(particle >= npBlockParticleCount)
+        return;
+
+    npBlockPositions[particle].xyz += npBlockVelocities[particle].xyz * npBlockTimeStep;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+#include </np/gravity-utils.glsl>
+#include </np/blocktimestep.glsl>
+
+layout (local_size_x = NP_BLOCK_KICK_GROUP_SIZE) in;
+
+#include </np/globalinvocationindex.glsl>
+
+/**
+ * Second pass of the BlockTimeStepper: kick the active particles.
+ *
+ * Dispatched indirectly with one invocation per active particle. Each particle sums the accelerations of all
+ * particles, selects its new rung and closes the half kick of its previous step and opens the one of its next step.
+ */
+void main()
+{
+    uint slot = npGetGlobalInvocationIndex();
+
+    if(slot >= npBlockActiveCount)
+        return;
+
+    uint particle = npBlockActiveIndices[slot];
+    vec3 position = npBlockPositions[particle].xyz;
+
+    vec3 acceleration = vec3(0.0, 0.0, 0.0);
+    for(uint i = 0; i < npBlockParticleCount; ++i)
+        acceleration += npCalcAcceleration(position, npBlockPositions[i].xyz, npBlockPositions[i].w, npBlockSoftening);
+
+    uint oldRung = npBlockRungs[particle];
+    uint newRung = npBlockSelectRung(length(acceleration), oldRung);
+
+    float oldTimeStep = (oldRung == NP_BLOCK_UNASSIGNED_RUNG) ? 0.0 : npBlockRungTimeStep(oldRung);
+    float kickTime = 0.5 * (oldTimeStep + npBlockRungTimeStep(newRung));
+
+    npBlockVelocities[particle].xyz += acceleration * kickTime;
+    npBlockRungs[particle] = newRung;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_BLOCKTIMESTEP_GLSL
+#define NP_BLOCKTIMESTEP_GLSL
+
+/**
+ * Buffers and helpers of a BlockTimeStepper.
+ *
+ * The uniforms are set by BlockTimeStepper::setUniforms(). NPBlockPositions and NPBlockVelocities are bound to the
+ * attributes passed to the BlockTimeStepper, the other buffers are storage buffers of the ParticleSystem.
+ *
+ * Binding points 10 to 14 are reserved for the BlockTimeStepper.
+ */
+
+/**
+ * Positions in xyz, masses in w.
+ */
+layout (std430, binding = 10) buffer NPBlockPositions
+{
+    vec4 npBlockPositions[];
+};
+
+/**
+ * Velocities in xyz.
+ */
+layout (std430, binding = 11) buffer NPBlockVelocities
+{
+    vec4 npBlockVelocities[];
+};
+
+/**
+ * The rung of each particle or NP_BLOCK_UNASSIGNED_RUNG.
+ */
+layout (std430, binding = 12) buffer NPBlockRungs
+{
+    uint npBlockRungs[];
+};
+
+/**
+ * The indices of the particles active in the current sub-step.
+ */
+layout (std430, binding = 13) buffer NPBlockActiveIndices
+{
+    uint npBlockActiveIndices[];
+};
+
+/**
+ * The work group counts of the kick (dispatch indirect command) and the number of active particles.
+ */
+layout (std430, binding = 14) buffer NPBlockDispatch
+{
+    uvec3 npBlockKickGroups;
+    uint npBlockActiveCount;
+};
+
+/**
+ * The rung of particles which were not kicked yet.
+ */
+#define NP_BLOCK_UNASSIGNED_RUNG 0xFFFFFFFFu
+
+/**
+ * The number of active particles processed by one work group of the kick.
+ */
+#define NP_BLOCK_KICK_GROUP_SIZE 128
+
+uniform uint npBlockParticleCount;
+
+/**
+ * The current sub-step in [0, 2^npBlockMaxRung).
+ */
+uniform uint npBlockSubStep;
+
+/**
+ * The finest rung.
+ */
+uniform uint npBlockMaxRung;
+
+/**
+ * The time step of the finest rung.
+ */
+uniform float npBlockTimeStep;
+
+/**
+ * The accuracy parameter of the time step criterion.
+ */
+uniform float npBlockAccuracy;
+
+uniform float npBlockSoftening;
+
+/**
+ * Check if particles on a rung are kicked in a sub-step.
+ */
+bool npBlockIsActive(in uint rung, in uint subStep)
+{
+    if(rung == NP_BLOCK_UNASSIGNED_RUNG)
+        return true;
+
+    return (subStep & ((1u << (npBlockMaxRung - rung)) - 1u)) == 0u;
+}
+
+/**
+ * Get the time step of a rung.
+ */
+float npBlockRungTimeStep(in uint rung)
+{
+    return npBlockTimeStep * float(1u << (npBlockMaxRung - rung));
+}
+
+/**
+ * Select the rung of a particle from the magnitude of its acceleration (see BlockTimeStepper::selectRung()).
+ */
+uint npBlockSelectRung(in float acceleration, in uint oldRung)
+{
+    int rung = 0;
+    if(acceleration > 0.0)
+    {
+        float criterion = sqrt(2.0 * npBlockAccuracy * npBlockSoftening / acceleration);
+        rung = int(ceil(log2(npBlockRungTimeStep(0u) / criterion)));
+        rung = clamp(rung, 0, int(npBlockMaxRung));
+    }
+
+    // Coarser rungs are only allowed if they are synchronised with the current sub-step
+    uint limit = (oldRung == NP_BLOCK_UNASSIGNED_RUNG) ? npBlockMaxRung : oldRung;
+    while(uint(rung) < limit && !npBlockIsActive(uint(rung), npBlockSubStep))
+        ++rung;
+
+    return uint(rung);
+}
+
+#endif // NP_BLOCKTIMESTEP_GLSL
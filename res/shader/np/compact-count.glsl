@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+#define NP_COMPACT_GROUP_SIZE 256
+
+layout (local_size_x = NP_COMPACT_GROUP_SIZE) in;
+
+#include </np/particlecount.glsl>
+
+/**
+ * First pass of the ParticleCompactor: count the survivors of each block of NP_COMPACT_GROUP_SIZE slots.
+ *
+ * The pass is dispatched for the alive count before the compaction, one work group per block.
+ */
+
+layout (std430, binding = 25) buffer NPCompactBlockSums
+{
+    uint npCompactBlockSums[];
+};
+
+shared uint blockSum;
+
+void main()
+{
+    if(gl_LocalInvocationIndex == 0)
+        blockSum = 0;
+
+    barrier();
+
+    if(npIsParticleAlive(gl_GlobalInvocationID.x))
+        atomicAdd(blockSum, 1u);
+
+    barrier();
+
+    if(gl_LocalInvocationIndex == 0)
+        npCompactBlockSums[gl_WorkGroupID.x] = blockSum;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/particlecount.glsl>
+
+/**
+ * Last pass of the ParticleCompactor: gather the survivors of one buffer into the scratch buffer.
+ *
+ * The pass is dispatched for the new alive count. The buffer is accessed as 32 bit words, so any item type can be
+ * compacted. The scratch buffer is copied back by the ParticleCompactor after the dispatch.
+ */
+
+layout (std430, binding = 27) buffer NPCompactPermutation
+{
+    uint npCompactPermutation[];
+};
+
+layout (std430, binding = 28) buffer NPCompactSource
+{
+    uint npCompactSource[];
+};
+
+layout (std430, binding = 29) buffer NPCompactScratch
+{
+    uint npCompactScratch[];
+};
+
+/**
+ * The size of one item of the source buffer in 32 bit words.
+ */
+uniform uint npCompactWordsPerItem;
+
+void main()
+{
+    uint slot = npGetGlobalInvocationIndex();
+
+    if(slot >= npGetAliveCount())
+        return;
+
+    uint source = npCompactPermutation[slot] * npCompactWordsPerItem;
+    uint destination = slot * npCompactWordsPerItem;
+
+    for(uint w = 0; w < npCompactWordsPerItem; ++w)
+        npCompactScratch[destination + w] = npCompactSource[source + w];
+}
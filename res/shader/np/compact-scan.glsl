@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#define NP_COMPACT_SCAN_GROUP_SIZE 256
+#define NP_COMPACT_GROUP_SIZE 256u
+
+// Layout of the alive count buffer (see ParticleSystem::getAliveCountBuffer())
+#define NP_DRAW_COMMAND_OFFSET 1u
+#define NP_DISPATCH_COMMANDS_OFFSET 6u
+#define NP_MAX_DISPATCH_GROUP_SIZES 8
+
+// Layout of the state buffer
+#define NP_COMPACT_OLD_ALIVE_COUNT 0
+#define NP_COMPACT_NEW_ALIVE_COUNT 1
+#define NP_COMPACT_SCATTER_GROUPS 2
+
+layout (local_size_x = NP_COMPACT_SCAN_GROUP_SIZE) in;
+
+/**
+ * Second pass of the ParticleCompactor: prefix sum over the block counts.
+ *
+ * Works like the scan of the SpatialReorderer (np/reorder-scan.glsl): a single work group scans the table,
+ * every invocation sums a contiguous range of blocks. The counts are replaced by the first new slot of their block.
+ * The total is the new alive count, which is written along with the instance count of the draw command and the
+ * dispatch commands. The alive count buffer is accessed as shader storage here.
+ */
+
+layout (std430, binding = 25) buffer NPCompactBlockSums
+{
+    uint npCompactBlockSums[];
+};
+
+layout (std430, binding = 26) buffer NPCompactState
+{
+    uint npCompactState[];
+};
+
+layout (std430, binding = 30) buffer NPCompactCommands
+{
+    uint npCompactCommands[];
+};
+
+/**
+ * The work group sizes which have a dispatch command.
+ */
+uniform uint npCompactGroupSizes[NP_MAX_DISPATCH_GROUP_SIZES];
+uniform uint npCompactGroupSizeCount;
+
+shared uint rangeOffsets[NP_COMPACT_SCAN_GROUP_SIZE];
+
+void main()
+{
+    uint aliveCount = npCompactCommands[0];
+    uint blockCount = (aliveCount + NP_COMPACT_GROUP_SIZE - 1u) / NP_COMPACT_GROUP_SIZE;
+
+    uint rangeSize = (blockCount + NP_COMPACT_SCAN_GROUP_SIZE - 1) / NP_COMPACT_SCAN_GROUP_SIZE;
+    uint first = min(gl_LocalInvocationIndex * rangeSize, blockCount);
+    uint last = min(first + rangeSize, blockCount);
+
+    uint sum = 0;
+    for(uint b = first; b < last; ++b)
+        sum += npCompactBlockSums[b];
+    rangeOffsets[gl_LocalInvocationIndex] = sum;
+
+    barrier();
+
+    // Exclusive scan of the range sums
+    if(gl_LocalInvocationIndex == 0)
+    {
+        uint offset = 0;
+        for(uint i = 0; i < NP_COMPACT_SCAN_GROUP_SIZE; ++i)
+        {
+            uint rangeSum = rangeOffsets[i];
+            rangeOffsets[i] = offset;
+            offset += rangeSum;
+        }
+    }
+
+    barrier();
+
+    uint offset = rangeOffsets[gl_LocalInvocationIndex];
+    for(uint b = first; b < last; ++b)
+    {
+        uint blockSum = npCompactBlockSums[b];
+        npCompactBlockSums[b] = offset;
+        offset += blockSum;
+    }
+
+    // The last range ends with the total
+    if(gl_LocalInvocationIndex != NP_COMPACT_SCAN_GROUP_SIZE - 1)
+        return;
+
+    npCompactState[NP_COMPACT_OLD_ALIVE_COUNT] = aliveCount;
+    npCompactState[NP_COMPACT_NEW_ALIVE_COUNT] = offset;
+    npCompactState[NP_COMPACT_SCATTER_GROUPS] = blockCount;
+
+    npCompactCommands[0] = offset;
+    npCompactCommands[NP_DRAW_COMMAND_OFFSET + 1u] = offset;
+
+    for(uint i = 0; i < npCompactGroupSizeCount; ++i)
+    {
+        uint command = NP_DISPATCH_COMMANDS_OFFSET + 3u * i;
+        npCompactCommands[command] = (offset + npCompactGroupSizes[i] - 1u) / npCompactGroupSizes[i];
+        npCompactCommands[command + 1u] = 1u;
+        npCompactCommands[command + 2u] = 1u;
+    }
+}
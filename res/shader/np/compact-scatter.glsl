@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+#define NP_COMPACT_GROUP_SIZE 256
+
+layout (local_size_x = NP_COMPACT_GROUP_SIZE) in;
+
+#include </np/particlecount.glsl>
+
+/**
+ * Third pass of the ParticleCompactor: the permutation, i.e. the old slot of the particle at each new slot.
+ *
+ * The survivors of a block are ranked by a scan in shared memory, so they keep their order. Afterwards, the flags
+ * are reset for the compacted order. Every invocation only accesses the flag of its own slot, so this is safe.
+ */
+
+layout (std430, binding = 25) buffer NPCompactBlockSums
+{
+    uint npCompactBlockSums[];
+};
+
+layout (std430, binding = 26) buffer NPCompactState
+{
+    uint npCompactState[];
+};
+
+layout (std430, binding = 27) buffer NPCompactPermutation
+{
+    uint npCompactPermutation[];
+};
+
+shared uint ranks[NP_COMPACT_GROUP_SIZE];
+
+void main()
+{
+    uint slot = gl_GlobalInvocationID.x;
+    uint oldAliveCount = npCompactState[0];
+    uint newAliveCount = npCompactState[1];
+
+    uint alive = (slot < oldAliveCount && npParticleAlive[slot] != 0u) ? 1u : 0u;
+    ranks[gl_LocalInvocationIndex] = alive;
+
+    barrier();
+
+    // Inclusive scan of the flags of the block
+    for(uint stride = 1; stride < NP_COMPACT_GROUP_SIZE; stride <<= 1)
+    {
+        uint value = gl_LocalInvocationIndex >= stride ? ranks[gl_LocalInvocationIndex - stride] : 0u;
+        barrier();
+        ranks[gl_LocalInvocationIndex] += value;
+        barrier();
+    }
+
+    if(alive != 0u)
+        npCompactPermutation[npCompactBlockSums[gl_WorkGroupID.x] + ranks[gl_LocalInvocationIndex] - 1u] = slot;
+
+    if(slot < oldAliveCount)
+        npParticleAlive[slot] = slot < newAliveCount ? 1u : 0u;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_CULLING_GLSL
+#define NP_CULLING_GLSL
+
+#include </np/vertex-inputs.glsl>
+
+/**
+ * Access to the particles of frustum culled ParticleSystems in vertex shaders.
+ *
+ * With frustum culling (see ParticleSystem::enableFrustumCulling()), only the visible particles are drawn, so the
+ * instance index is no particle index. The RenderSystem binds the indices of the visible particles and sets
+ * np_frustumCulling for each draw.
+ *
+ * Without frustum culling, the particle index is np_in_particleIndex, which includes the base instance. Batched draws
+ * of pooled ParticleSystem%s (see RenderSystem::drawParticleSystems()) read the particles of each system at its slots
+ * in the pool storages this way.
+ */
+
+/**
+ * The indices of the visible particles (ParticleSystem::VISIBLE_INSTANCES_BUFFER).
+ */
+layout (std430, binding = 31) readonly buffer NPVisibleInstances
+{
+    uint npVisibleInstances[];
+};
+
+/**
+ * True if the drawn ParticleSystem is frustum culled.
+ */
+uniform bool np_frustumCulling;
+
+/**
+ * Get the index of the particle drawn by the current instance.
+ */
+uint npGetParticleIndex()
+{
+    return np_frustumCulling ? npVisibleInstances[gl_InstanceID] : np_in_particleIndex;
+}
+
+#endif // NP_CULLING_GLSL
@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_DOUBLE_FLOAT_GLSL
+#define NP_DOUBLE_FLOAT_GLSL
+
+/**
+ * Double-float arithmetic.
+ *
+ * A double-float stores a value as the unevaluated sum hi + lo of two floats with |lo| <= ulp(hi) / 2. This gives
+ * 48 bits of mantissa computed with fp32 ALUs only, so it runs at full float rate on GPUs with slow or without
+ * double precision support. The exponent range is the one of float, intermediate results must stay below ~1e38.
+ *
+ * Scalars are stored in a vec2 (x = hi, y = lo), 3D vectors in npDFVec3. The error free transformations follow
+ * Dekker and Knuth, see A. Thall, "Extended-Precision Floating-Point Numbers for GPU Computation". All intermediate
+ * results are declared precise so the compiler does not reassociate or fuse the operations.
+ */
+
+/**
+ * A 3D vector of double-floats.
+ */
+struct npDFVec3
+{
+    vec3 hi;
+    vec3 lo;
+};
+
+// ------------------------------
+// Error free transformations
+// ------------------------------
+
+/**
+ * Compute s = fl(a + b) and the rounding error e with a + b = s + e. Requires |a| >= |b|.
+ */
+vec2 npQuickTwoSum(in float a, in float b)
+{
+    precise float s = a + b;
+    precise float e = b - (s - a);
+    return vec2(s, e);
+}
+
+/**
+ * Compute s = fl(a + b) and the rounding error e with a + b = s + e.
+ */
+vec2 npTwoSum(in float a, in float b)
+{
+    precise float s = a + b;
+    precise float v = s - a;
+    precise float e = (a - (s - v)) + (b - v);
+    return vec2(s, e);
+}
+
+/**
+ * Split a float into two floats with 12 significant bits each.
+ */
+vec2 npSplit(in float a)
+{
+    precise float t = 4097.0 * a;
+    precise float hi = t - (t - a);
+    precise float lo = a - hi;
+    return vec2(hi, lo);
+}
+
+/**
+ * Compute p = fl(a * b) and the rounding error e with a * b = p + e.
+ */
+vec2 npTwoProd(in float a, in float b)
+{
+    vec2 aSplit = npSplit(a);
+    vec2 bSplit = npSplit(b);
+    precise float p = a * b;
+    precise float e = ((aSplit.x * bSplit.x - p) + aSplit.x * bSplit.y + aSplit.y * bSplit.x) + aSplit.y * bSplit.y;
+    return vec2(p, e);
+}
+
+// Component wise versions for vec3.
+
+void npQuickTwoSum(in vec3 a, in vec3 b, out vec3 s, out vec3 e)
+{
+    precise vec3 sum = a + b;
+    precise vec3 error = b - (sum - a);
+    s = sum;
+    e = error;
+}
+
+void npTwoSum(in vec3 a, in vec3 b, out vec3 s, out vec3 e)
+{
+    precise vec3 sum = a + b;
+    precise vec3 v = sum - a;
+    precise vec3 error = (a - (sum - v)) + (b - v);
+    s = sum;
+    e = error;
+}
+
+void npSplit(in vec3 a, out vec3 hi, out vec3 lo)
+{
+    precise vec3 t = 4097.0 * a;
+    precise vec3 high = t - (t - a);
+    precise vec3 low = a - high;
+    hi = high;
+    lo = low;
+}
+
+void npTwoProd(in vec3 a, in vec3 b, out vec3 p, out vec3 e)
+{
+    vec3 aHi, aLo, bHi, bLo;
+    npSplit(a, aHi, aLo);
+    npSplit(b, bHi, bLo);
+    precise vec3 product = a * b;
+    precise vec3 error = ((aHi * bHi - product) + aHi * bLo + aLo * bHi) + aLo * bLo;
+    p = product;
+    e = error;
+}
+
+// ------------------------------
+// Scalars
+// ------------------------------
+
+/**
+ * Convert a float to a double-float.
+ */
+vec2 npDF(in float a)
+{
+    return vec2(a, 0.0);
+}
+
+/**
+ * Add two double-floats.
+ */
+vec2 npDFAdd(in vec2 a, in vec2 b)
+{
+    vec2 s = npTwoSum(a.x, b.x);
+    vec2 t = npTwoSum(a.y, b.y);
+    precise float e = s.y + t.x;
+    s = npQuickTwoSum(s.x, e);
+    precise float f = s.y + t.y;
+    return npQuickTwoSum(s.x, f);
+}
+
+/**
+ * Subtract two double-floats.
+ */
+vec2 npDFSub(in vec2 a, in vec2 b)
+{
+    return npDFAdd(a, -b);
+}
+
+/**
+ * Multiply two double-floats.
+ */
+vec2 npDFMul(in vec2 a, in vec2 b)
+{
+    vec2 p = npTwoProd(a.x, b.x);
+    precise float e = p.y + (a.x * b.y + a.y * b.x);
+    return npQuickTwoSum(p.x, e);
+}
+
+/**
+ * Divide two double-floats.
+ */
+vec2 npDFDiv(in vec2 a, in vec2 b)
+{
+    // Long division: the quotient of the leading floats and a correction from the remainder.
+    float q1 = a.x / b.x;
+    vec2 r = npDFSub(a, npDFMul(b, npDF(q1)));
+    float q2 = r.x / b.x;
+    r = npDFSub(r, npDFMul(b, npDF(q2)));
+    float q3 = r.x / b.x;
+
+    vec2 q = npQuickTwoSum(q1, q2);
+    return npDFAdd(q, npDF(q3));
+}
+
+/**
+ * Compute the square root of a double-float.
+ */
+vec2 npDFSqrt(in vec2 a)
+{
+    if(a.x <= 0.0)
+        return vec2(0.0);
+
+    // Karp's method: sqrt(a) = a * x + (a - (a * x)^2) * x / 2 with x = 1 / sqrt(a)
+    float x = inversesqrt(a.x);
+    float ax = a.x * x;
+    vec2 difference = npDFSub(a, npTwoProd(ax, ax));
+    return npDFAdd(npDF(ax), npDF(difference.x * x * 0.5));
+}
+
+// ------------------------------
+// 3D vectors
+// ------------------------------
+
+/**
+ * Create a double-float vector from its high and low parts.
+ */
+npDFVec3 npDFVec(in vec3 hi, in vec3 lo)
+{
+    npDFVec3 result;
+    result.hi = hi;
+    result.lo = lo;
+    return result;
+}
+
+/**
+ * Add two double-float vectors.
+ */
+npDFVec3 npDFAdd(in npDFVec3 a, in npDFVec3 b)
+{
+    vec3 s, e, t, f;
+    npTwoSum(a.hi, b.hi, s, e);
+    npTwoSum(a.lo, b.lo, t, f);
+    precise vec3 e2 = e + t;
+    npQuickTwoSum(s, e2, s, e);
+    precise vec3 e3 = e + f;
+    npQuickTwoSum(s, e3, s, e);
+    return npDFVec(s, e);
+}
+
+/**
+ * Subtract two double-float vectors.
+ */
+npDFVec3 npDFSub(in npDFVec3 a, in npDFVec3 b)
+{
+    return npDFAdd(a, npDFVec(-b.hi, -b.lo));
+}
+
+/**
+ * Multiply a double-float vector by a double-float.
+ */
+npDFVec3 npDFMul(in npDFVec3 a, in vec2 b)
+{
+    vec3 p, e;
+    npTwoProd(a.hi, vec3(b.x), p, e);
+    precise vec3 e2 = e + (a.hi * b.y + a.lo * b.x);
+    npQuickTwoSum(p, e2, p, e);
+    return npDFVec(p, e);
+}
+
+/**
+ * Compute the dot product of two double-float vectors.
+ */
+vec2 npDFDot(in npDFVec3 a, in npDFVec3 b)
+{
+    vec3 p, e;
+    npTwoProd(a.hi, b.hi, p, e);
+    precise vec3 e2 = e + (a.hi * b.lo + a.lo * b.hi);
+    npQuickTwoSum(p, e2, p, e);
+
+    vec2 result = npDFAdd(vec2(p.x, e.x), vec2(p.y, e.y));
+    return npDFAdd(result, vec2(p.z, e.z));
+}
+
+#endif // NP_DOUBLE_FLOAT_GLSL
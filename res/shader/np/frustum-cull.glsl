@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+#define NP_CULL_GROUP_SIZE 256
+
+layout (local_size_x = NP_CULL_GROUP_SIZE) in;
+
+#include </np/particlecount.glsl>
+
+/**
+ * Frustum culling of the particles of a ParticleSystem (see ParticleSystem::enableFrustumCulling()).
+ *
+ * The frustum planes are extracted from the view projection matrix once per work group. A particle is visible if
+ * its bounding sphere is not completely behind one of the planes. The visible particles of a work group are
+ * counted in shared memory, so each work group appends its particles to the visible instances with a single
+ * atomic operation on the instance count of the draw command.
+ */
+
+/**
+ * The positions in the first three components.
+ */
+layout (std430, binding = 0) readonly buffer NPCullPositions
+{
+    vec4 npCullPositions[];
+};
+
+layout (std430, binding = 1) writeonly buffer NPCullVisibleInstances
+{
+    uint npCullVisibleInstances[];
+};
+
+/**
+ * The DrawElementsIndirectCommand. The instance count is zero before the dispatch.
+ */
+layout (std430, binding = 2) coherent buffer NPCullCommand
+{
+    uint npCullIndexCount;
+    uint npCullInstanceCount;
+    uint npCullFirstIndex;
+    uint npCullBaseVertex;
+    uint npCullBaseInstance;
+};
+
+uniform mat4 npCullViewProjectionMatrix;
+uniform float npCullRadius;
+uniform uint npCullParticleCount;
+uniform bool npCullDynamic;
+
+shared vec4 frustumPlanes[6];
+shared uint groupVisibleCount;
+shared uint groupFirstInstance;
+
+void main()
+{
+    // Left, right, bottom, top, near and far plane: the fourth row of the matrix plus or minus one of the others
+    if(gl_LocalInvocationIndex < 6)
+    {
+        uint axis = gl_LocalInvocationIndex / 2u;
+        float side = (gl_LocalInvocationIndex % 2u) == 0u ? 1.0 : -1.0;
+
+        mat4 m = npCullViewProjectionMatrix;
+        vec4 plane = vec4(m[0][3], m[1][3], m[2][3], m[3][3])
+                     + side * vec4(m[0][axis], m[1][axis], m[2][axis], m[3][axis]);
+
+        frustumPlanes[gl_LocalInvocationIndex] = plane / length(plane.xyz);
+    }
+
+    if(gl_LocalInvocationIndex == 0)
+        groupVisibleCount = 0u;
+
+    barrier();
+
+    uint particle = (gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) * NP_CULL_GROUP_SIZE + gl_LocalInvocationIndex;
+
+    bool visible = particle < npCullParticleCount && (!npCullDynamic || npIsParticleAlive(particle));
+
+    if(visible)
+    {
+        vec3 position = npCullPositions[particle].xyz;
+        for(int i = 0; i < 6; ++i)
+            visible = visible && dot(frustumPlanes[i].xyz, position) + frustumPlanes[i].w >= -npCullRadius;
+    }
+
+    uint groupSlot = 0u;
+    if(visible)
+        groupSlot = atomicAdd(groupVisibleCount, 1u);
+
+    barrier();
+
+    if(gl_LocalInvocationIndex == 0 && groupVisibleCount > 0u)
+        groupFirstInstance = atomicAdd(npCullInstanceCount, groupVisibleCount);
+
+    barrier();
+
+    if(visible)
+        npCullVisibleInstances[groupFirstInstance + groupSlot] = particle;
+}
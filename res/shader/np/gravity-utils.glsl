@@ -10,6 +10,8 @@
 #ifndef NP_GRAVITY_UTILS_GLSL
 #define NP_GRAVITY_UTILS_GLSL
 
+#include </np/double-float.glsl>
+
 // ---------
 // Constants
 // ---------
@@ -67,4 +69,28 @@ dvec3 npCalcAcceleration(in dvec3 attractedPosition, in dvec3 attractorPosition,
     return r * (attractorMass / divisor);
 }
 
+/**
+ * Calculate the acceleration caused by an attractor in emulated double precision (see double-float.glsl).
+ *
+ * This method calculates the acceleration an attractor impacts on a body. The distance is not cubed like in the
+ * other overloads since the cube of astronomical distances exceeds the range of float.
+ *
+ * @note To provide greater flexibility and optimisation possibilities, this method does not take
+ *       the gravitational constant (np_gravitational_constant) into account!
+ *
+ * @param particlePosition The position of the attracted body.
+ * @param attractorPosition The position of the attractor.
+ * @param attractorMass The mass of the attractor.
+ * @param softeningFactor A softening factor used to prevent the acceleration from becoming infinite if
+ *                        the distance between attracted and attractor is virtually zero.
+ */
+npDFVec3 npDFCalcAcceleration(in npDFVec3 attractedPosition, in npDFVec3 attractorPosition, in vec2 attractorMass, in float softeningFactor)
+{
+    // Calculate acceleration
+    npDFVec3 r = npDFSub(attractorPosition, attractedPosition);
+    vec2 distanceSquare = npDFAdd(npDFDot(r, r), npDF(softeningFactor * softeningFactor));
+    vec2 distance = npDFSqrt(distanceSquare);
+    return npDFMul(r, npDFDiv(npDFDiv(attractorMass, distanceSquare), distance));
+}
+
 #endif // NP_GRAVITY_UTILS_GLSL
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/neighborgrid.glsl>
+
+/**
+ * First stage of the NeighborGrid build: count the particles per cell.
+ *
+ * Each particle stores its cell and its rank within the cell, which is its offset
+ * from the cell start after the prefix sum.
+ */
+
+layout (std430, binding = 4) buffer NPGridPositions
+{
+    vec4 npGridPositions[];
+};
+
+layout (std430, binding = 5) buffer NPGridCellCounts
+{
+    uint npGridCellCounts[];
+};
+
+layout (std430, binding = 8) buffer NPGridParticleCells
+{
+    uvec2 npGridParticleCells[];
+};
+
+uniform uint npGridParticleCount;
+
+void main()
+{
+    uint particle = npGetGlobalInvocationIndex();
+
+    if(particle >= npGridParticleCount)
+        return;
+
+    uint cell = npGridCellIndex(npGridPositions[particle].xyz);
+    uint rank = atomicAdd(npGridCellCounts[cell], 1u);
+
+    npGridParticleCells[particle] = uvec2(cell, rank);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+#define NP_GRID_SCAN_GROUP_SIZE 256
+
+layout (local_size_x = NP_GRID_SCAN_GROUP_SIZE) in;
+
+#include </np/neighborgrid.glsl>
+
+/**
+ * Second stage of the NeighborGrid build: prefix sum over the cell counts.
+ *
+ * The cell table is much smaller than the particle count, so the first work group scans the whole
+ * table and all other work groups return immediately. Every invocation sums a contiguous range of
+ * cells, the range sums are scanned in shared memory. The counts are reset for the next build.
+ */
+
+layout (std430, binding = 5) buffer NPGridCellCounts
+{
+    uint npGridCellCounts[];
+};
+
+shared uint rangeOffsets[NP_GRID_SCAN_GROUP_SIZE];
+
+void main()
+{
+    if(gl_WorkGroupID.x != 0)
+        return;
+
+    uint rangeSize = (npGridCellCount + NP_GRID_SCAN_GROUP_SIZE - 1) / NP_GRID_SCAN_GROUP_SIZE;
+    uint first = min(gl_LocalInvocationIndex * rangeSize, npGridCellCount);
+    uint last = min(first + rangeSize, npGridCellCount);
+
+    uint sum = 0;
+    for(uint c = first; c < last; ++c)
+        sum += npGridCellCounts[c];
+    rangeOffsets[gl_LocalInvocationIndex] = sum;
+
+    barrier();
+
+    // Exclusive scan of the range sums
+    if(gl_LocalInvocationIndex == 0)
+    {
+        uint offset = 0;
+        for(uint i = 0; i < NP_GRID_SCAN_GROUP_SIZE; ++i)
+        {
+            uint rangeSum = rangeOffsets[i];
+            rangeOffsets[i] = offset;
+            offset += rangeSum;
+        }
+    }
+
+    barrier();
+
+    uint offset = rangeOffsets[gl_LocalInvocationIndex];
+    for(uint c = first; c < last; ++c)
+    {
+        uint count = npGridCellCounts[c];
+        npGridCellStarts[c] = offset;
+        offset += count;
+        npGridCellEnds[c] = offset;
+        npGridCellCounts[c] = 0;
+    }
+}
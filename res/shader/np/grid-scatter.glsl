@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/neighborgrid.glsl>
+
+/**
+ * Third stage of the NeighborGrid build: write the particle indices sorted by cell.
+ */
+
+layout (std430, binding = 8) buffer NPGridParticleCells
+{
+    uvec2 npGridParticleCells[];
+};
+
+uniform uint npGridParticleCount;
+
+void main()
+{
+    uint particle = npGetGlobalInvocationIndex();
+
+    if(particle >= npGridParticleCount)
+        return;
+
+    uvec2 cell = npGridParticleCells[particle];
+    npGridParticleIndices[npGridCellStarts[cell.x] + cell.y] = particle;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_NEIGHBORGRID_GLSL
+#define NP_NEIGHBORGRID_GLSL
+
+/**
+ * Cell tables of a NeighborGrid.
+ *
+ * The particles of cell c are npGridParticleIndices[npGridCellStarts[c]] to
+ * npGridParticleIndices[npGridCellEnds[c] - 1]. The uniforms are set by NeighborGrid::setUniforms(),
+ * the buffers are storage buffers of the ParticleSystem and bound automatically.
+ *
+ * Binding points 4 to 9 are reserved for the NeighborGrid.
+ *
+ * @code
+ * uint cells[27];
+ * uint cellCount = npGridNeighborCells(position, cells);
+ * for(uint c = 0; c < cellCount; ++c)
+ *     for(uint n = npGridCellStarts[cells[c]]; n < npGridCellEnds[cells[c]]; ++n)
+ *         interact(npGridParticleIndices[n]);
+ * @endcode
+ */
+
+layout (std430, binding = 6) buffer NPGridCellStarts
+{
+    uint npGridCellStarts[];
+};
+
+layout (std430, binding = 7) buffer NPGridCellEnds
+{
+    uint npGridCellEnds[];
+};
+
+layout (std430, binding = 9) buffer NPGridParticleIndices
+{
+    uint npGridParticleIndices[];
+};
+
+/**
+ * The minimum corner of a uniform grid. Positions outside of the grid are clamped to the border cells.
+ */
+uniform vec3 npGridOrigin;
+
+/**
+ * The edge length of a cell.
+ */
+uniform float npGridCellSize;
+
+/**
+ * The number of cells along each axis of a uniform grid.
+ */
+uniform uvec3 npGridDimensions;
+
+/**
+ * True if cells are hashed into a table of npGridCellCount entries instead of a bounded uniform grid.
+ */
+uniform bool npGridHashed;
+
+/**
+ * The number of cells of the uniform grid or entries of the hash table (a power of two).
+ */
+uniform uint npGridCellCount;
+
+/**
+ * Get the integer coordinate of the cell containing a position.
+ */
+ivec3 npGridCellCoordinate(in vec3 position)
+{
+    return ivec3(floor((position - npGridOrigin) / npGridCellSize));
+}
+
+/**
+ * Get the table index of a cell. The coordinate has to be inside of a uniform grid.
+ */
+uint npGridCellIndex(in ivec3 cell)
+{
+    if(npGridHashed)
+    {
+        uvec3 c = uvec3(cell);
+        return ((c.x * 73856093u) ^ (c.y * 19349663u) ^ (c.z * 83492791u)) & (npGridCellCount - 1u);
+    }
+
+    uvec3 c = uvec3(cell);
+    return (c.z * npGridDimensions.y + c.y) * npGridDimensions.x + c.x;
+}
+
+/**
+ * Get the table index of the cell a particle is sorted into.
+ */
+uint npGridCellIndex(in vec3 position)
+{
+    ivec3 cell = npGridCellCoordinate(position);
+
+    if(!npGridHashed)
+        cell = clamp(cell, ivec3(0), ivec3(npGridDimensions) - 1);
+
+    return npGridCellIndex(cell);
+}
+
+/**
+ * Get the table indices of the cells adjacent to the cell containing a position (including the cell itself).
+ *
+ * Cells outside of a uniform grid are skipped. Duplicates caused by hash collisions are removed,
+ * so no particle is visited twice.
+ *
+ * @return The number of cells written to @p cells.
+ */
+uint npGridNeighborCells(in vec3 position, out uint cells[27])
+{
+    ivec3 center = npGridCellCoordinate(position);
+    if(!npGridHashed)
+        center = clamp(center, ivec3(0), ivec3(npGridDimensions) - 1);
+
+    uint count = 0;
+    for(int x = -1; x <= 1; ++x)
+    {
+        for(int y = -1; y <= 1; ++y)
+        {
+            for(int z = -1; z <= 1; ++z)
+            {
+                ivec3 cell = center + ivec3(x, y, z);
+
+                if(!npGridHashed && (any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, ivec3(npGridDimensions)))))
+                    continue;
+
+                uint index = npGridCellIndex(cell);
+
+                bool duplicate = false;
+                if(npGridHashed)
+                {
+                    for(uint i = 0; i < count; ++i)
+                        duplicate = duplicate || cells[i] == index;
+                }
+
+                if(!duplicate)
+                    cells[count++] = index;
+            }
+        }
+    }
+
+    return count;
+}
+
+#endif // NP_NEIGHBORGRID_GLSL
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_PARTICLE_MESH_GLSL
+#define NP_PARTICLE_MESH_GLSL
+
+/**
+ * GPU counterpart of the deposit and interpolation stages of the PMGravitySolver.
+ *
+ * The buffers and uniforms are bound and set by PMGravityGPU. The grid element (x, y, z) is
+ * stored at index (x * npPMGridSize + y) * npPMGridSize + z, the grid is periodic.
+ */
+
+/**
+ * Mass per grid cell. The floats are stored as uint bits, so they can be accumulated with atomicCompSwap().
+ */
+layout (binding = 2) buffer PMDensity
+{
+    uint npPMDensity[];
+};
+
+/**
+ * Acceleration (xyz) and potential (w) per grid cell.
+ */
+layout (binding = 3) buffer PMField
+{
+    vec4 npPMField[];
+};
+
+/**
+ * The number of grid cells along each axis. Always a power of two.
+ */
+uniform uint npPMGridSize;
+
+/**
+ * The minimum corner of the periodic box.
+ */
+uniform vec3 npPMBoxOrigin;
+
+/**
+ * The edge length of a grid cell.
+ */
+uniform float npPMCellSize;
+
+/**
+ * True for triangular shaped cloud, false for cloud in cell assignment.
+ */
+uniform bool npPMUseTSC;
+
+/**
+ * Compute the cells and weights a body is assigned to.
+ *
+ * The body is spread over the 2³ (CIC) or 3³ (TSC) cells starting at @p baseCell. The weight of
+ * cell baseCell + (i, j, k) is weights[i].x * weights[j].y * weights[k].z.
+ *
+ * @return The width of the stencil (2 or 3).
+ */
+uint npPMStencil(in vec3 position, out ivec3 baseCell, out vec3 weights[3])
+{
+    // Position in grid units. Cell i covers [i, i + 1), its center is at i + 0.5.
+    vec3 gridPosition = (position - npPMBoxOrigin) / npPMCellSize;
+
+    if(npPMUseTSC)
+    {
+        vec3 cell = floor(gridPosition);
+        vec3 d = gridPosition - cell - 0.5;
+
+        baseCell = ivec3(cell) - 1;
+        weights[0] = 0.5 * (0.5 - d) * (0.5 - d);
+        weights[1] = 0.75 - d * d;
+        weights[2] = 0.5 * (0.5 + d) * (0.5 + d);
+        return 3;
+    }
+
+    vec3 shifted = gridPosition - 0.5;
+    vec3 cell = floor(shifted);
+    vec3 d = shifted - cell;
+
+    baseCell = ivec3(cell);
+    weights[0] = 1.0 - d;
+    weights[1] = d;
+    weights[2] = vec3(0.0);
+    return 2;
+}
+
+/**
+ * Get the index of a grid cell. Cells outside of the grid are wrapped periodically.
+ */
+uint npPMCellIndex(in ivec3 cell)
+{
+    // The conversion to uint preserves the bit pattern, so negative cells wrap as well.
+    uvec3 wrapped = uvec3(cell) & (npPMGridSize - 1);
+    return (wrapped.x * npPMGridSize + wrapped.y) * npPMGridSize + wrapped.z;
+}
+
+/**
+ * Assign the mass of a body to the density grid.
+ */
+void npPMDeposit(in vec3 position, in float mass)
+{
+    ivec3 baseCell;
+    vec3 weights[3];
+    uint width = npPMStencil(position, baseCell, weights);
+
+    for(uint i = 0; i < width; ++i)
+    {
+        for(uint j = 0; j < width; ++j)
+        {
+            for(uint k = 0; k < width; ++k)
+            {
+                uint cellIndex = npPMCellIndex(baseCell + ivec3(i, j, k));
+                float value = mass * weights[i].x * weights[j].y * weights[k].z;
+
+                // Atomic float addition: retry until no other invocation changed the cell in between.
+                uint current = npPMDensity[cellIndex];
+                uint expected;
+                do
+                {
+                    expected = current;
+                    current = atomicCompSwap(npPMDensity[cellIndex], expected, floatBitsToUint(uintBitsToFloat(expected) + value));
+                } while(current != expected);
+            }
+        }
+    }
+}
+
+/**
+ * Interpolate the acceleration field at a position.
+ */
+vec3 npPMInterpolate(in vec3 position)
+{
+    ivec3 baseCell;
+    vec3 weights[3];
+    uint width = npPMStencil(position, baseCell, weights);
+
+    vec3 acceleration = vec3(0.0);
+    for(uint i = 0; i < width; ++i)
+    {
+        for(uint j = 0; j < width; ++j)
+        {
+            for(uint k = 0; k < width; ++k)
+            {
+                uint cellIndex = npPMCellIndex(baseCell + ivec3(i, j, k));
+                acceleration += npPMField[cellIndex].xyz * (weights[i].x * weights[j].y * weights[k].z);
+            }
+        }
+    }
+
+    return acceleration;
+}
+
+#endif // NP_PARTICLE_MESH_GLSL
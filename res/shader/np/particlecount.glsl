@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_PARTICLECOUNT_GLSL
+#define NP_PARTICLECOUNT_GLSL
+
+/**
+ * Dynamic particle counts (see ParticleSystem::setAliveCount()).
+ *
+ * The alive particles occupy the first npGetAliveCount() slots. The Actions of such ParticleSystems are dispatched
+ * for the alive particles only, but the last work group is partially filled, so slots have to be checked against
+ * the alive count. Killed particles are removed by the next ParticleCompactor pass and have to be skipped until then.
+ */
+
+/**
+ * The alive count. Bound to binding point 0 by the engine.
+ */
+layout (binding = 0, offset = 0) uniform atomic_uint npAliveCount;
+
+layout (std430, binding = 24) buffer NPParticleAlive
+{
+    uint npParticleAlive[];
+};
+
+/**
+ * Get the number of alive particles.
+ */
+uint npGetAliveCount()
+{
+    return atomicCounter(npAliveCount);
+}
+
+/**
+ * Check if the particle at @p slot is alive.
+ */
+bool npIsParticleAlive(in uint slot)
+{
+    return slot < npGetAliveCount() && npParticleAlive[slot] != 0u;
+}
+
+/**
+ * Kill the particle at @p slot.
+ */
+void npKillParticle(in uint slot)
+{
+    npParticleAlive[slot] = 0u;
+}
+
+#endif // NP_PARTICLECOUNT_GLSL
@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#define NP_PRIMITIVE_GROUP_SIZE 256
+#define NP_PRIMITIVE_ITEMS_PER_INVOCATION 8u
+
+layout (local_size_x = NP_PRIMITIVE_GROUP_SIZE) in;
+
+/**
+ * Single pass scan, reduction and stream compaction with decoupled look-back (see ParallelPrimitives).
+ *
+ * Each work group processes a tile of NP_PRIMITIVE_GROUP_SIZE * NP_PRIMITIVE_ITEMS_PER_INVOCATION items:
+ * 1. The tile index is taken from the tile counter, so tiles are processed in launch order.
+ * 2. Every invocation scans its items, the work group scans the invocation aggregates in shared memory.
+ * 3. The tile aggregate is published. The first invocation looks back at the preceding tiles and combines their
+ *    aggregates until it finds a tile which has published its inclusive prefix. Then the inclusive prefix of the
+ *    own tile is published.
+ * 4. Every invocation writes its items, starting from the prefix of the tile and of the invocation.
+ *
+ * Items are 32 bit words which are interpreted according to npPrimitiveType. For segmented scans, the carried
+ * values are pairs of a value and a flag whether a segment head was passed: a head discards everything before it.
+ */
+
+// Modes, see ParallelPrimitives::gpu_modes
+#define NP_PM_EXCLUSIVE_SCAN 0u
+#define NP_PM_INCLUSIVE_SCAN 1u
+#define NP_PM_REDUCE 2u
+#define NP_PM_COMPACT 3u
+
+// Types
+#define NP_PT_UINT 0u
+#define NP_PT_INT 1u
+#define NP_PT_FLOAT 2u
+
+// Operations, see primitive_operations
+#define NP_PO_SUM 0u
+#define NP_PO_MIN 1u
+#define NP_PO_MAX 2u
+
+// Tile status
+#define NP_TILE_AGGREGATE 1u
+#define NP_TILE_PREFIX 2u
+
+layout (std430, binding = 0) readonly buffer NPPrimitiveInput
+{
+    uint npPrimitiveInput[];
+};
+
+/**
+ * Segment heads of segmented scans or flags of the compaction.
+ */
+layout (std430, binding = 1) readonly buffer NPPrimitiveFlags
+{
+    uint npPrimitiveFlags[];
+};
+
+layout (std430, binding = 2) writeonly buffer NPPrimitiveOutput
+{
+    uint npPrimitiveOutput[];
+};
+
+/**
+ * The reduction or the number of kept items of the compaction.
+ */
+layout (std430, binding = 3) writeonly buffer NPPrimitiveResult
+{
+    uint npPrimitiveResult[];
+};
+
+/**
+ * The tile counter, followed by status, aggregate and inclusive prefix of each tile. Cleared before the dispatch.
+ */
+layout (std430, binding = 4) coherent volatile buffer NPPrimitiveTiles
+{
+    uint npPrimitiveTileCounter;
+    uint npPrimitiveTiles[];
+};
+
+uniform uint npPrimitiveMode;
+uniform uint npPrimitiveType;
+uniform uint npPrimitiveOperation;
+uniform bool npPrimitiveSegmented;
+uniform uint npPrimitiveCount;
+uniform uint npPrimitiveTileCount;
+
+shared uint tileIndex;
+shared uint scanValues[NP_PRIMITIVE_GROUP_SIZE];
+shared bool scanHeads[NP_PRIMITIVE_GROUP_SIZE];
+shared uint tilePrefix;
+
+/**
+ * Get the identity of the operation.
+ */
+uint npPrimitiveIdentity()
+{
+    if(npPrimitiveOperation == NP_PO_MIN)
+    {
+        if(npPrimitiveType == NP_PT_FLOAT)
+            return 0x7F800000u;
+        return npPrimitiveType == NP_PT_INT ? 0x7FFFFFFFu : 0xFFFFFFFFu;
+    }
+
+    if(npPrimitiveOperation == NP_PO_MAX)
+    {
+        if(npPrimitiveType == NP_PT_FLOAT)
+            return 0xFF800000u;
+        return npPrimitiveType == NP_PT_INT ? 0x80000000u : 0u;
+    }
+
+    return 0u;
+}
+
+/**
+ * Combine two values.
+ */
+uint npPrimitiveCombine(in uint a, in uint b)
+{
+    if(npPrimitiveType == NP_PT_FLOAT)
+    {
+        float x = uintBitsToFloat(a);
+        float y = uintBitsToFloat(b);
+        if(npPrimitiveOperation == NP_PO_MIN)
+            return floatBitsToUint(min(x, y));
+        if(npPrimitiveOperation == NP_PO_MAX)
+            return floatBitsToUint(max(x, y));
+        return floatBitsToUint(x + y);
+    }
+
+    if(npPrimitiveType == NP_PT_INT)
+    {
+        int x = int(a);
+        int y = int(b);
+        if(npPrimitiveOperation == NP_PO_MIN)
+            return uint(min(x, y));
+        if(npPrimitiveOperation == NP_PO_MAX)
+            return uint(max(x, y));
+        return uint(x + y);
+    }
+
+    if(npPrimitiveOperation == NP_PO_MIN)
+        return min(a, b);
+    if(npPrimitiveOperation == NP_PO_MAX)
+        return max(a, b);
+    return a + b;
+}
+
+/**
+ * Get the value scanned for an item. The compaction scans the number of kept items.
+ */
+uint npPrimitiveLoad(in uint item)
+{
+    if(item >= npPrimitiveCount)
+        return npPrimitiveIdentity();
+
+    if(npPrimitiveMode == NP_PM_COMPACT)
+        return npPrimitiveFlags[item] != 0u ? 1u : 0u;
+
+    return npPrimitiveInput[item];
+}
+
+/**
+ * Check if an item starts a segment.
+ */
+bool npPrimitiveIsHead(in uint item)
+{
+    return npPrimitiveSegmented && item < npPrimitiveCount && npPrimitiveFlags[item] != 0u;
+}
+
+/**
+ * Publish the status and value of a tile. The value is visible before the status.
+ */
+void npPrimitivePublish(in uint tile, in uint status, in uint value)
+{
+    npPrimitiveTiles[tile * 3u + status] = value;
+    memoryBarrierBuffer();
+    atomicExchange(npPrimitiveTiles[tile * 3u], status);
+}
+
+void main()
+{
+    if(gl_LocalInvocationIndex == 0)
+        tileIndex = atomicAdd(npPrimitiveTileCounter, 1u);
+
+    barrier();
+
+    // The dispatch may have more work groups than tiles
+    uint tile = tileIndex;
+    if(tile >= npPrimitiveTileCount)
+        return;
+
+    uint firstItem = (tile * NP_PRIMITIVE_GROUP_SIZE + gl_LocalInvocationIndex) * NP_PRIMITIVE_ITEMS_PER_INVOCATION;
+    uint identity = npPrimitiveIdentity();
+
+    // Scan the items of this invocation
+    uint value = identity;
+    bool head = false;
+    for(uint i = 0; i < NP_PRIMITIVE_ITEMS_PER_INVOCATION; ++i)
+    {
+        if(npPrimitiveIsHead(firstItem + i))
+        {
+            value = identity;
+            head = true;
+        }
+        value = npPrimitiveCombine(value, npPrimitiveLoad(firstItem + i));
+    }
+
+    // Inclusive scan of the invocation aggregates
+    scanValues[gl_LocalInvocationIndex] = value;
+    scanHeads[gl_LocalInvocationIndex] = head;
+    barrier();
+
+    for(uint stride = 1; stride < NP_PRIMITIVE_GROUP_SIZE; stride <<= 1)
+    {
+        uint leftValue = identity;
+        bool leftHead = false;
+        if(gl_LocalInvocationIndex >= stride)
+        {
+            leftValue = scanValues[gl_LocalInvocationIndex - stride];
+            leftHead = scanHeads[gl_LocalInvocationIndex - stride];
+        }
+        barrier();
+
+        if(!head)
+            value = npPrimitiveCombine(leftValue, value);
+        head = head || leftHead;
+
+        scanValues[gl_LocalInvocationIndex] = value;
+        scanHeads[gl_LocalInvocationIndex] = head;
+        barrier();
+    }
+
+    // Look back
+    if(gl_LocalInvocationIndex == NP_PRIMITIVE_GROUP_SIZE - 1)
+    {
+        uint prefix = identity;
+
+        // Nothing before a segment head contributes to the following items, so the inclusive prefix of a tile
+        // with a head is known immediately.
+        if(tile == 0u || head)
+            npPrimitivePublish(tile, NP_TILE_PREFIX, value);
+        else
+            npPrimitivePublish(tile, NP_TILE_AGGREGATE, value);
+
+        // The items before the first head still need the prefix of the preceding tiles
+        if(tile != 0u)
+        {
+            for(int predecessor = int(tile) - 1; predecessor >= 0; --predecessor)
+            {
+                uint status;
+                do
+                {
+                    status = atomicOr(npPrimitiveTiles[predecessor * 3], 0u);
+                }
+                while(status == 0u);
+
+                memoryBarrierBuffer();
+
+                if(status == NP_TILE_PREFIX)
+                {
+                    prefix = npPrimitiveCombine(npPrimitiveTiles[predecessor * 3 + 2], prefix);
+                    break;
+                }
+
+                prefix = npPrimitiveCombine(npPrimitiveTiles[predecessor * 3 + 1], prefix);
+            }
+
+            if(!head)
+                npPrimitivePublish(tile, NP_TILE_PREFIX, npPrimitiveCombine(prefix, value));
+        }
+
+        tilePrefix = prefix;
+
+        // The inclusive prefix of the last tile is the reduction of all items
+        if(tile == npPrimitiveTileCount - 1u && (npPrimitiveMode == NP_PM_REDUCE || npPrimitiveMode == NP_PM_COMPACT))
+            npPrimitiveResult[0] = head ? value : npPrimitiveCombine(prefix, value);
+    }
+
+    barrier();
+
+    if(npPrimitiveMode == NP_PM_REDUCE)
+        return;
+
+    // The prefix of this invocation: the tile prefix combined with the preceding invocations of the tile
+    value = tilePrefix;
+    if(gl_LocalInvocationIndex > 0)
+    {
+        uint left = scanValues[gl_LocalInvocationIndex - 1];
+        value = scanHeads[gl_LocalInvocationIndex - 1] ? left : npPrimitiveCombine(value, left);
+    }
+
+    for(uint i = 0; i < NP_PRIMITIVE_ITEMS_PER_INVOCATION; ++i)
+    {
+        uint item = firstItem + i;
+        if(item >= npPrimitiveCount)
+            break;
+
+        if(npPrimitiveIsHead(item))
+            value = identity;
+
+        uint inclusive = npPrimitiveCombine(value, npPrimitiveLoad(item));
+
+        if(npPrimitiveMode == NP_PM_COMPACT)
+        {
+            if(inclusive != value)
+                npPrimitiveOutput[value] = npPrimitiveInput[item];
+        }
+        else
+        {
+            npPrimitiveOutput[item] = npPrimitiveMode == NP_PM_INCLUSIVE_SCAN ? inclusive : value;
+        }
+
+        value = inclusive;
+    }
+}
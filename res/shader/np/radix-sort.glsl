@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#define NP_RADIX_GROUP_SIZE 256u
+#define NP_RADIX_ITEMS_PER_INVOCATION 8u
+#define NP_RADIX_TILE_SIZE (NP_RADIX_GROUP_SIZE * NP_RADIX_ITEMS_PER_INVOCATION)
+#define NP_RADIX_BITS 4u
+#define NP_RADIX_DIGITS 16u
+#define NP_RADIX_MAX_PASSES 8u
+
+layout (local_size_x = 256) in;
+
+/**
+ * Onesweep least significant digit radix sort (see RadixSorter).
+ *
+ * The histogram mode counts the digits of all passes. Each work group counts a tile in shared memory and adds its
+ * counts to the global digit counts.
+ *
+ * The scatter mode sorts the keys by the digit of npRadixPass. Each work group processes a tile of
+ * NP_RADIX_TILE_SIZE keys:
+ * 1. The tile index is taken from the tile counter of the pass, so tiles are processed in launch order.
+ * 2. Every invocation counts the digits of its consecutive keys in its column of the rank counts. The exclusive
+ *    scan of the rank counts in digit-major order yields the position of each key in the tile sorted by the digit.
+ *    Keys with equal digits keep their order, so the sort is stable.
+ * 3. Invocation d looks back at the counts of digit d in the preceding tiles, see ParallelPrimitives. Status and
+ *    count are packed into one word, so a single atomic operation publishes both.
+ * 4. The keys and values are sorted within the tile in shared memory and written from there, so consecutive
+ *    invocations write consecutive items of each digit.
+ *
+ * The first pass reads the keys of the caller and generates the permutation, the keys are mapped to unsigned
+ * integers whose order is the sort order. The last pass maps them back.
+ */
+
+// Modes
+#define NP_RM_HISTOGRAM 0u
+#define NP_RM_SCATTER 1u
+
+// Key types, see RadixSorter::gpu_key_types
+#define NP_RK_UINT 0u
+#define NP_RK_FLOAT 1u
+
+// Look-back status in the two most significant bits
+#define NP_RADIX_AGGREGATE 0x40000000u
+#define NP_RADIX_PREFIX 0x80000000u
+#define NP_RADIX_STATUS_MASK 0xC0000000u
+#define NP_RADIX_COUNT_MASK 0x3FFFFFFFu
+
+layout (std430, binding = 0) readonly buffer NPRadixKeysIn
+{
+    uint npRadixKeysIn[];
+};
+
+layout (std430, binding = 1) readonly buffer NPRadixValuesIn
+{
+    uint npRadixValuesIn[];
+};
+
+layout (std430, binding = 2) writeonly buffer NPRadixKeysOut
+{
+    uint npRadixKeysOut[];
+};
+
+layout (std430, binding = 3) writeonly buffer NPRadixValuesOut
+{
+    uint npRadixValuesOut[];
+};
+
+/**
+ * The digit counts of all passes, the tile counter of each pass and the look-back states of each pass, tile and
+ * digit. Cleared before the histogram.
+ */
+layout (std430, binding = 4) coherent volatile buffer NPRadixStates
+{
+    uint npRadixDigitCounts[NP_RADIX_MAX_PASSES * NP_RADIX_DIGITS];
+    uint npRadixTileCounters[NP_RADIX_MAX_PASSES];
+    uint npRadixTiles[];
+};
+
+uniform uint npRadixMode;
+uniform uint npRadixKeyType;
+uniform bool npRadixDescending;
+uniform uint npRadixCount;
+uniform uint npRadixTileCount;
+uniform uint npRadixPass;
+uniform uint npRadixPassCount;
+
+shared uint tileIndex;
+
+/**
+ * The rank counts of each digit and invocation. Reused for the keys and values sorted within the tile.
+ */
+shared uint rankCounts[NP_RADIX_DIGITS * NP_RADIX_GROUP_SIZE];
+shared uint scanSums[NP_RADIX_GROUP_SIZE];
+
+/**
+ * The global position of the first key of each digit in the tile minus its position in the tile.
+ */
+shared uint digitOffsets[NP_RADIX_DIGITS];
+
+/**
+ * Map a key to an unsigned integer in sort order.
+ */
+uint npRadixEncode(in uint key)
+{
+    if(npRadixKeyType == NP_RK_FLOAT)
+        key = (key & 0x80000000u) != 0u ? ~key : key | 0x80000000u;
+
+    return npRadixDescending ? ~key : key;
+}
+
+/**
+ * Map an encoded key back.
+ */
+uint npRadixDecode(in uint key)
+{
+    if(npRadixDescending)
+        key = ~key;
+
+    if(npRadixKeyType == NP_RK_FLOAT)
+        key = (key & 0x80000000u) != 0u ? key & 0x7FFFFFFFu : ~key;
+
+    return key;
+}
+
+/**
+ * Get the digit of an encoded key in a pass.
+ */
+uint npRadixDigit(in uint key, in uint pass)
+{
+    return (key >> (pass * NP_RADIX_BITS)) & (NP_RADIX_DIGITS - 1u);
+}
+
+/**
+ * Count the digits of all passes.
+ */
+void npRadixHistogram()
+{
+    uint tile = gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x;
+    if(tile >= npRadixTileCount)
+        return;
+
+    for(uint i = gl_LocalInvocationIndex; i < NP_RADIX_MAX_PASSES * NP_RADIX_DIGITS; i += NP_RADIX_GROUP_SIZE)
+        rankCounts[i] = 0u;
+
+    barrier();
+
+    for(uint i = 0; i < NP_RADIX_ITEMS_PER_INVOCATION; ++i)
+    {
+        uint item = tile * NP_RADIX_TILE_SIZE + i * NP_RADIX_GROUP_SIZE + gl_LocalInvocationIndex;
+        if(item >= npRadixCount)
+            break;
+
+        uint key = npRadixEncode(npRadixKeysIn[item]);
+        for(uint pass = 0; pass < npRadixPassCount; ++pass)
+            atomicAdd(rankCounts[pass * NP_RADIX_DIGITS + npRadixDigit(key, pass)], 1u);
+    }
+
+    barrier();
+
+    for(uint i = gl_LocalInvocationIndex; i < npRadixPassCount * NP_RADIX_DIGITS; i += NP_RADIX_GROUP_SIZE)
+    {
+        if(rankCounts[i] != 0u)
+            atomicAdd(npRadixDigitCounts[i], rankCounts[i]);
+    }
+}
+
+/**
+ * Sort the keys by the digit of one pass.
+ */
+void npRadixScatter()
+{
+    if(gl_LocalInvocationIndex == 0)
+        tileIndex = atomicAdd(npRadixTileCounters[npRadixPass], 1u);
+
+    barrier();
+
+    // The dispatch may have more work groups than tiles
+    uint tile = tileIndex;
+    if(tile >= npRadixTileCount)
+        return;
+
+    uint tileItemCount = min(npRadixCount - tile * NP_RADIX_TILE_SIZE, NP_RADIX_TILE_SIZE);
+    uint firstItem = tile * NP_RADIX_TILE_SIZE + gl_LocalInvocationIndex * NP_RADIX_ITEMS_PER_INVOCATION;
+
+    for(uint digit = 0; digit < NP_RADIX_DIGITS; ++digit)
+        rankCounts[digit * NP_RADIX_GROUP_SIZE + gl_LocalInvocationIndex] = 0u;
+
+    // Load consecutive keys and count their digits in the own column
+    uint keys[NP_RADIX_ITEMS_PER_INVOCATION];
+    uint values[NP_RADIX_ITEMS_PER_INVOCATION];
+    uint ranks[NP_RADIX_ITEMS_PER_INVOCATION];
+
+    for(uint i = 0; i < NP_RADIX_ITEMS_PER_INVOCATION; ++i)
+    {
+        uint item = firstItem + i;
+        if(item >= npRadixCount)
+            break;
+
+        if(npRadixPass == 0u)
+        {
+            keys[i] = npRadixEncode(npRadixKeysIn[item]);
+            values[i] = item;
+        }
+        else
+        {
+            keys[i] = npRadixKeysIn[item];
+            values[i] = npRadixValuesIn[item];
+        }
+
+        uint column = npRadixDigit(keys[i], npRadixPass) * NP_RADIX_GROUP_SIZE + gl_LocalInvocationIndex;
+        ranks[i] = rankCounts[column]++;
+    }
+
+    barrier();
+
+    // Exclusive scan of the rank counts: every invocation scans a row of NP_RADIX_DIGITS counts, the work group
+    // scans the row sums.
+    uint rowStart = gl_LocalInvocationIndex * NP_RADIX_DIGITS;
+    uint sum = 0u;
+    for(uint i = 0; i < NP_RADIX_DIGITS; ++i)
+    {
+        uint count = rankCounts[rowStart + i];
+        rankCounts[rowStart + i] = sum;
+        sum += count;
+    }
+
+    scanSums[gl_LocalInvocationIndex] = sum;
+    barrier();
+
+    for(uint stride = 1; stride < NP_RADIX_GROUP_SIZE; stride <<= 1)
+    {
+        uint left = gl_LocalInvocationIndex >= stride ? scanSums[gl_LocalInvocationIndex - stride] : 0u;
+        barrier();
+
+        sum += left;
+        scanSums[gl_LocalInvocationIndex] = sum;
+        barrier();
+    }
+
+    uint rowPrefix = gl_LocalInvocationIndex > 0 ? scanSums[gl_LocalInvocationIndex - 1] : 0u;
+    for(uint i = 0; i < NP_RADIX_DIGITS; ++i)
+        rankCounts[rowStart + i] += rowPrefix;
+
+    barrier();
+
+    // Look back
+    if(gl_LocalInvocationIndex < NP_RADIX_DIGITS)
+    {
+        uint digit = gl_LocalInvocationIndex;
+        uint tileStart = rankCounts[digit * NP_RADIX_GROUP_SIZE];
+        uint tileEnd = digit + 1u < NP_RADIX_DIGITS ? rankCounts[(digit + 1u) * NP_RADIX_GROUP_SIZE] : tileItemCount;
+        uint tileCount = tileEnd - tileStart;
+
+        uint stateBase = npRadixPass * npRadixTileCount * NP_RADIX_DIGITS + digit;
+        uint prefix = 0u;
+
+        if(tile == 0u)
+        {
+            atomicExchange(npRadixTiles[stateBase], NP_RADIX_PREFIX | tileCount);
+        }
+        else
+        {
+            atomicExchange(npRadixTiles[stateBase + tile * NP_RADIX_DIGITS], NP_RADIX_AGGREGATE | tileCount);
+
+            for(int predecessor = int(tile) - 1; predecessor >= 0; --predecessor)
+            {
+                uint state;
+                do
+                {
+                    state = atomicOr(npRadixTiles[stateBase + uint(predecessor) * NP_RADIX_DIGITS], 0u);
+                }
+                while((state & NP_RADIX_STATUS_MASK) == 0u);
+
+                prefix += state & NP_RADIX_COUNT_MASK;
+                if((state & NP_RADIX_PREFIX) != 0u)
+                    break;
+            }
+
+            atomicExchange(npRadixTiles[stateBase + tile * NP_RADIX_DIGITS], NP_RADIX_PREFIX | (prefix + tileCount));
+        }
+
+        // The global start of the digit: all keys with smaller digits and the digit in the preceding tiles
+        uint digitStart = prefix;
+        for(uint smaller = 0; smaller < digit; ++smaller)
+            digitStart += npRadixDigitCounts[npRadixPass * NP_RADIX_DIGITS + smaller];
+
+        digitOffsets[digit] = digitStart - tileStart;
+    }
+
+    // Position of each key in the tile sorted by the digit
+    for(uint i = 0; i < NP_RADIX_ITEMS_PER_INVOCATION; ++i)
+    {
+        if(firstItem + i >= npRadixCount)
+            break;
+
+        uint digit = npRadixDigit(keys[i], npRadixPass);
+        ranks[i] += rankCounts[digit * NP_RADIX_GROUP_SIZE + gl_LocalInvocationIndex];
+    }
+
+    barrier();
+
+    // Sort within the tile, the rank counts are reused for the keys and values
+    for(uint i = 0; i < NP_RADIX_ITEMS_PER_INVOCATION; ++i)
+    {
+        if(firstItem + i >= npRadixCount)
+            break;
+
+        rankCounts[ranks[i]] = keys[i];
+        rankCounts[NP_RADIX_TILE_SIZE + ranks[i]] = values[i];
+    }
+
+    barrier();
+
+    bool lastPass = npRadixPass + 1u == npRadixPassCount;
+    for(uint i = 0; i < NP_RADIX_ITEMS_PER_INVOCATION; ++i)
+    {
+        uint position = i * NP_RADIX_GROUP_SIZE + gl_LocalInvocationIndex;
+        if(position >= tileItemCount)
+            break;
+
+        uint key = rankCounts[position];
+        uint item = digitOffsets[npRadixDigit(key, npRadixPass)] + position;
+
+        npRadixKeysOut[item] = lastPass ? npRadixDecode(key) : key;
+        npRadixValuesOut[item] = rankCounts[NP_RADIX_TILE_SIZE + position];
+    }
+}
+
+void main()
+{
+    if(npRadixMode == NP_RM_HISTOGRAM)
+        npRadixHistogram();
+    else
+        npRadixScatter();
+}
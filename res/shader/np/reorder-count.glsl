@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/spacefillingcurve.glsl>
+
+/**
+ * First pass of the SpatialReorderer: count the particles per cell.
+ *
+ * Each particle stores the key of its cell and its rank within the cell, which is its offset
+ * from the first slot of the cell after the prefix sum.
+ */
+
+layout (std430, binding = 15) buffer NPReorderPositions
+{
+    vec4 npReorderPositions[];
+};
+
+layout (std430, binding = 16) buffer NPReorderCellCounts
+{
+    uint npReorderCellCounts[];
+};
+
+layout (std430, binding = 18) buffer NPReorderParticleKeys
+{
+    uvec2 npReorderParticleKeys[];
+};
+
+uniform uint npReorderParticleCount;
+
+void main()
+{
+    uint particle = npGetGlobalInvocationIndex();
+
+    if(particle >= npReorderParticleCount)
+        return;
+
+    uint key = npReorderKey(npReorderPositions[particle].xyz);
+    uint rank = atomicAdd(npReorderCellCounts[key], 1u);
+
+    npReorderParticleKeys[particle] = uvec2(key, rank);
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+
+/**
+ * Last pass of the SpatialReorderer: gather one buffer into the scratch buffer.
+ *
+ * The buffer is accessed as 32 bit words, so any item type can be permuted. The scratch buffer is
+ * copied back by the SpatialReorderer after the dispatch.
+ */
+
+layout (std430, binding = 19) buffer NPReorderPermutation
+{
+    uint npReorderPermutation[];
+};
+
+layout (std430, binding = 22) buffer NPReorderSource
+{
+    uint npReorderSource[];
+};
+
+layout (std430, binding = 23) buffer NPReorderScratch
+{
+    uint npReorderScratch[];
+};
+
+uniform uint npReorderParticleCount;
+
+/**
+ * The size of one item of the source buffer in 32 bit words.
+ */
+uniform uint npReorderWordsPerItem;
+
+void main()
+{
+    uint slot = npGetGlobalInvocationIndex();
+
+    if(slot >= npReorderParticleCount)
+        return;
+
+    uint source = npReorderPermutation[slot] * npReorderWordsPerItem;
+    uint destination = slot * npReorderWordsPerItem;
+
+    for(uint w = 0; w < npReorderWordsPerItem; ++w)
+        npReorderScratch[destination + w] = npReorderSource[source + w];
+}
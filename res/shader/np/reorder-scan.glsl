@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+#define NP_REORDER_SCAN_GROUP_SIZE 256
+
+layout (local_size_x = NP_REORDER_SCAN_GROUP_SIZE) in;
+
+#include </np/spacefillingcurve.glsl>
+
+/**
+ * Second pass of the SpatialReorderer: prefix sum over the cell counts.
+ *
+ * Works like the scan of the NeighborGrid (np/grid-scan.glsl), but is dispatched as a single work group
+ * (see SpatialReorderer::SCAN_DISPATCH_BUFFER) which scans the whole table: every invocation sums a
+ * contiguous range of cells. The counts are reset for the next sort.
+ */
+
+layout (std430, binding = 16) buffer NPReorderCellCounts
+{
+    uint npReorderCellCounts[];
+};
+
+layout (std430, binding = 17) buffer NPReorderCellStarts
+{
+    uint npReorderCellStarts[];
+};
+
+shared uint rangeOffsets[NP_REORDER_SCAN_GROUP_SIZE];
+
+void main()
+{
+    uint rangeSize = (npReorderCellCount + NP_REORDER_SCAN_GROUP_SIZE - 1) / NP_REORDER_SCAN_GROUP_SIZE;
+    uint first = min(gl_LocalInvocationIndex * rangeSize, npReorderCellCount);
+    uint last = min(first + rangeSize, npReorderCellCount);
+
+    uint sum = 0;
+    for(uint c = first; c < last; ++c)
+        sum += npReorderCellCounts[c];
+    rangeOffsets[gl_LocalInvocationIndex] = sum;
+
+    barrier();
+
+    // Exclusive scan of the range sums
+    if(gl_LocalInvocationIndex == 0)
+    {
+        uint offset = 0;
+        for(uint i = 0; i < NP_REORDER_SCAN_GROUP_SIZE; ++i)
+        {
+            uint rangeSum = rangeOffsets[i];
+            rangeOffsets[i] = offset;
+            offset += rangeSum;
+        }
+    }
+
+    barrier();
+
+    uint offset = rangeOffsets[gl_LocalInvocationIndex];
+    for(uint c = first; c < last; ++c)
+    {
+        npReorderCellStarts[c] = offset;
+        offset += npReorderCellCounts[c];
+        npReorderCellCounts[c] = 0;
+    }
+}
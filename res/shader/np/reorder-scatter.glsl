@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 256) in;
+
+#include </np/globalinvocationindex.glsl>
+
+/**
+ * Third pass of the SpatialReorderer: compute the permutation.
+ *
+ * The permutation holds the old slot of the particle moved to each new slot. The slot of each
+ * particle id is updated, the ids themselves are permuted by the gather.
+ */
+
+layout (std430, binding = 17) buffer NPReorderCellStarts
+{
+    uint npReorderCellStarts[];
+};
+
+layout (std430, binding = 18) buffer NPReorderParticleKeys
+{
+    uvec2 npReorderParticleKeys[];
+};
+
+layout (std430, binding = 19) buffer NPReorderPermutation
+{
+    uint npReorderPermutation[];
+};
+
+layout (std430, binding = 20) buffer NPReorderParticleIds
+{
+    uint npReorderParticleIds[];
+};
+
+layout (std430, binding = 21) buffer NPReorderParticleSlots
+{
+    uint npReorderParticleSlots[];
+};
+
+uniform uint npReorderParticleCount;
+
+void main()
+{
+    uint particle = npGetGlobalInvocationIndex();
+
+    if(particle >= npReorderParticleCount)
+        return;
+
+    uvec2 key = npReorderParticleKeys[particle];
+    uint slot = npReorderCellStarts[key.x] + key.y;
+
+    npReorderPermutation[slot] = particle;
+    npReorderParticleSlots[npReorderParticleIds[particle]] = slot;
+}
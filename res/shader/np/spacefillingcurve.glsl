@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_SPACEFILLINGCURVE_GLSL
+#define NP_SPACEFILLINGCURVE_GLSL
+
+/**
+ * Space filling curve keys of a SpatialReorderer.
+ *
+ * The uniforms are set by SpatialReorderer::setUniforms(). The keys equal SpatialReorderer::getKey().
+ *
+ * Binding points 15 to 23 are reserved for the SpatialReorderer.
+ */
+
+/**
+ * The minimum corner of the sorted cube. Positions outside of the cube are clamped to the border cells.
+ */
+uniform vec3 npReorderOrigin;
+
+/**
+ * The edge length of the sorted cube.
+ */
+uniform float npReorderSize;
+
+/**
+ * The number of bits of the cell coordinates.
+ */
+uniform uint npReorderBitsPerAxis;
+
+/**
+ * True for Hilbert keys, false for Morton keys.
+ */
+uniform bool npReorderHilbert;
+
+/**
+ * The number of cells (2^(3 * npReorderBitsPerAxis)).
+ */
+uniform uint npReorderCellCount;
+
+/**
+ * Interleave the bits of three cell coordinates, x being the most significant of each triple.
+ */
+uint npReorderInterleave(in uvec3 cell)
+{
+    uint key = 0u;
+    for(int bit = int(npReorderBitsPerAxis) - 1; bit >= 0; --bit)
+        key = (key << 3) | (((cell.x >> bit) & 1u) << 2) | (((cell.y >> bit) & 1u) << 1) | ((cell.z >> bit) & 1u);
+    return key;
+}
+
+/**
+ * Transform cell coordinates so their interleaved bits are the Hilbert index (Skilling's algorithm).
+ */
+uvec3 npReorderHilbertTranspose(in uvec3 cell)
+{
+    uint highestBit = 1u << (npReorderBitsPerAxis - 1u);
+
+    // Inverse undo
+    for(uint q = highestBit; q > 1u; q >>= 1)
+    {
+        uint p = q - 1u;
+        for(int i = 0; i < 3; ++i)
+        {
+            if((cell[i] & q) != 0u)
+            {
+                cell.x ^= p;
+            }
+            else
+            {
+                uint t = (cell.x ^ cell[i]) & p;
+                cell.x ^= t;
+                cell[i] ^= t;
+            }
+        }
+    }
+
+    // Gray encode
+    cell.y ^= cell.x;
+    cell.z ^= cell.y;
+
+    uint t = 0u;
+    for(uint q = highestBit; q > 1u; q >>= 1)
+    {
+        if((cell.z & q) != 0u)
+            t ^= q - 1u;
+    }
+
+    return cell ^ uvec3(t);
+}
+
+/**
+ * Get the key of the cell containing a position.
+ */
+uint npReorderKey(in vec3 position)
+{
+    float cellsPerAxis = float(1u << npReorderBitsPerAxis);
+    uvec3 cell = uvec3(clamp((position - npReorderOrigin) / npReorderSize * cellsPerAxis, vec3(0.0), vec3(cellsPerAxis - 1.0)));
+
+    if(npReorderHilbert)
+        cell = npReorderHilbertTranspose(cell);
+
+    return npReorderInterleave(cell);
+}
+
+#endif // NP_SPACEFILLINGCURVE_GLSL
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 128) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/sph.glsl>
+
+/**
+ * Density pass of the SPHPipeline: sum the poly6 kernel over the neighbors and evaluate the equation of state.
+ */
+void main()
+{
+    uint slot = npGetGlobalInvocationIndex();
+
+    if(slot >= npSPHParticleCount)
+        return;
+
+    uint particle = npGridParticleIndices[slot];
+    vec3 position = npSPHPositions[particle].xyz;
+    float h2 = npSPHSmoothingLength * npSPHSmoothingLength;
+
+    uint cells[27];
+    uint cellCount = npGridNeighborCells(position, cells);
+
+    float density = 0.0;
+    for(uint c = 0; c < cellCount; ++c)
+    {
+        uint end = npGridCellEnds[cells[c]];
+        for(uint n = npGridCellStarts[cells[c]]; n < end; ++n)
+        {
+            vec3 d = position - npSPHPositions[npGridParticleIndices[n]].xyz;
+            float r2 = dot(d, d);
+
+            if(r2 < h2)
+            {
+                float w = h2 - r2;
+                density += w * w * w;
+            }
+        }
+    }
+
+    density *= npSPHParticleMass * npSPHPoly6Factor;
+    npSPHDensities[particle] = vec2(density, max(0.0, npSPHStiffness * (density - npSPHRestDensity)));
+}
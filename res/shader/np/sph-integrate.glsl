@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 128) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/sph.glsl>
+
+/**
+ * Integration pass of the SPHPipeline: semi-implicit Euler integration and reflection at the bounds.
+ */
+void main()
+{
+    uint particle = npGetGlobalInvocationIndex();
+
+    if(particle >= npSPHParticleCount)
+        return;
+
+    vec3 velocity = npSPHVelocities[particle].xyz + npSPHAccelerations[particle].xyz * npSPHTimeStep;
+    vec3 position = npSPHPositions[particle].xyz + velocity * npSPHTimeStep;
+
+    // Reflect the velocity at the bounds
+    bvec3 outside = bvec3(ivec3(lessThan(position, npSPHBoundsMin)) | ivec3(greaterThan(position, npSPHBoundsMax)));
+    velocity = mix(velocity, -npSPHBoundaryDamping * velocity, outside);
+    position = clamp(position, npSPHBoundsMin, npSPHBoundsMax);
+
+    npSPHPositions[particle].xyz = position;
+    npSPHVelocities[particle].xyz = velocity;
+}
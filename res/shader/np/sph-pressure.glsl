@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+layout (local_size_x = 128) in;
+
+#include </np/globalinvocationindex.glsl>
+#include </np/sph.glsl>
+
+/**
+ * Pressure pass of the SPHPipeline: symmetric pressure force with the spiky kernel gradient.
+ * Overwrites the accelerations.
+ */
+void main()
+{
+    uint slot = npGetGlobalInvocationIndex();
+
+    if(slot >= npSPHParticleCount)
+        return;
+
+    uint particle = npGridParticleIndices[slot];
+    vec3 position = npSPHPositions[particle].xyz;
+    vec2 densityPressure = npSPHDensities[particle];
+    float h = npSPHSmoothingLength;
+
+    uint cells[27];
+    uint cellCount = npGridNeighborCells(position, cells);
+
+    vec3 acceleration = vec3(0.0);
+    for(uint c = 0; c < cellCount; ++c)
+    {
+        uint end = npGridCellEnds[cells[c]];
+        for(uint n = npGridCellStarts[cells[c]]; n < end; ++n)
+        {
+            uint neighbor = npGridParticleIndices[n];
+            vec3 d = position - npSPHPositions[neighbor].xyz;
+            float r2 = dot(d, d);
+
+            if(r2 < h * h && neighbor != particle && r2 > 0.0)
+            {
+                float r = sqrt(r2);
+                vec2 neighborDensityPressure = npSPHDensities[neighbor];
+                float w = h - r;
+                acceleration += d * ((densityPressure.y + neighborDensityPressure.y) / (2.0 * neighborDensityPressure.x) * w * w / r);
+            }
+        }
+    }
+
+    acceleration *= npSPHParticleMass * npSPHSpikyGradientFactor / densityPressure.x;
+    npSPHAccelerations[particle] = vec4(acceleration, 0.0);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef NP_SPH_GLSL
+#define NP_SPH_GLSL
+
+/**
+ * Particle attributes and parameters shared by the passes of the SPHPipeline.
+ *
+ * The uniforms are set by SPHPipeline::setUniforms(). The neighbor passes process the particles in
+ * the order of the NeighborGrid, so the invocations of a work group visit the same cells.
+ */
+
+#include </np/neighborgrid.glsl>
+
+layout (std430, binding = 0) buffer SPHPositions
+{
+    vec4 npSPHPositions[];
+};
+
+layout (std430, binding = 1) buffer SPHVelocities
+{
+    vec4 npSPHVelocities[];
+};
+
+/**
+ * Density (x) and pressure (y) per particle.
+ */
+layout (std430, binding = 2) buffer SPHDensities
+{
+    vec2 npSPHDensities[];
+};
+
+layout (std430, binding = 3) buffer SPHAccelerations
+{
+    vec4 npSPHAccelerations[];
+};
+
+uniform uint npSPHParticleCount;
+uniform float npSPHSmoothingLength;
+uniform float npSPHParticleMass;
+uniform float npSPHRestDensity;
+uniform float npSPHStiffness;
+uniform float npSPHViscosity;
+uniform float npSPHBoundaryDamping;
+uniform float npSPHTimeStep;
+uniform vec3 npSPHGravity;
+uniform vec3 npSPHBoundsMin;
+uniform vec3 npSPHBoundsMax;
+
+/**
+ * Normalisation factors of the smoothing kernels: poly6, gradient of spiky and laplacian of viscosity.
+ */
+uniform float npSPHPoly6Factor;
+uniform float npSPHSpikyGradientFactor;
+uniform float npSPHViscosityLaplacianFactor;
+
+#endif // NP_SPH_GLSL
@@ -13,6 +13,7 @@
 
 #include </np/vertex-inputs.glsl>
 #include </np/uniforms.glsl>
+#include </np/culling.glsl>
 
 buffer Positions
 {
@@ -28,5 +29,5 @@ buffer Positions
  */
 void main()
 {
-    gl_Position = np_viewProjectionMatrix * vec4(np_in_position + positions[gl_InstanceID].xyz, 1.0);
+    gl_Position = np_viewProjectionMatrix * vec4(np_in_position + positions[npGetParticleIndex()].xyz, 1.0);
 }
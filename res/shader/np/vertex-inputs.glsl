@@ -23,4 +23,13 @@
  */
 in vec3 np_in_position;
 
+/**
+ * The index of the particle drawn by the current instance.
+ *
+ * Set up by the RenderSystem as instanced attribute which counts the instances, starting at the base instance. For
+ * ParticleSystem%s in a ParticlePool, whose draws are batched, it is the slot of the particle in the pool storages.
+ * Use npGetParticleIndex() (see np/culling.glsl) instead of reading it directly.
+ */
+in uint np_in_particleIndex;
+
 #endif // NP_VERTEX_INPUTS_GLSL
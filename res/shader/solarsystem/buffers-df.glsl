@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#ifndef SOLARSYSTEM_BUFFERS_DF_HPP
+#define SOLARSYSTEM_BUFFERS_DF_HPP
+
+#define planetCount 10
+
+/**
+ * A vec4 of double-floats: the value of each component is hi + lo (see /np/double-float.glsl).
+ */
+struct DoubleFloat4
+{
+    vec4 hi;
+    vec4 lo;
+};
+
+/**
+ * Buffer to store positions (xyz) and masses (w).
+ */
+layout(std430, binding = 0) buffer Positions
+{
+    DoubleFloat4 positions[planetCount];
+};
+
+/**
+ * Buffer to store velocities (xyz). w is unused.
+ */
+layout(std430, binding = 1) buffer Velocities
+{
+    DoubleFloat4 velocities[planetCount];
+};
+
+/**
+ * Uniform buffer that stores colors of the planets.
+ */
+layout(std140) uniform Colors
+{
+    vec4 colors[planetCount];
+};
+
+#endif // SOLARSYSTEM_BUFFERS_DF_HPP
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#version 430
+
+#extension GL_ARB_shading_language_include : require
+
+#include </np/gravity-utils.glsl>
+
+#include </solarsystem/buffers-df.glsl>
+
+/**
+ * Half of the time step of 900 s.
+ */
+#define halfTimestep 450.0
+
+/**
+ * NP_GRAVITATIONAL_CONSTANT * 900 s split into a double-float.
+ */
+const vec2 gravitationalConstantTimestep = vec2(6.006455777e-08, 2.228033982e-15);
+
+/**
+ * Update the planets using the improved euler integration in emulated double precision.
+ *
+ * Counterpart of update.glsl which only uses fp32 arithmetic.
+ */
+layout(local_size_x = planetCount) in;
+void main()
+{
+    uint planet = gl_LocalInvocationIndex;
+
+    npDFVec3 position = npDFVec(positions[planet].hi.xyz, positions[planet].lo.xyz);
+    npDFVec3 oldVelocity = npDFVec(velocities[planet].hi.xyz, velocities[planet].lo.xyz);
+
+    npDFVec3 acceleration = npDFVec(vec3(0), vec3(0));
+
+    for(int i = 0; i < planetCount; ++i)
+    {
+        npDFVec3 attractorPosition = npDFVec(positions[i].hi.xyz, positions[i].lo.xyz);
+        vec2 attractorMass = vec2(positions[i].hi.w, positions[i].lo.w);
+        acceleration = npDFAdd(acceleration, npDFCalcAcceleration(position, attractorPosition, attractorMass, 1));
+    }
+
+    npDFVec3 newVelocity = npDFAdd(oldVelocity, npDFMul(acceleration, gravitationalConstantTimestep));
+    position = npDFAdd(position, npDFMul(npDFAdd(newVelocity, oldVelocity), npDF(halfTimestep)));
+
+    // Fix sun position
+    if(planet == 0)
+        position = npDFVec(vec3(0), vec3(0));
+
+    // All planets have to read the old positions before they are overwritten.
+    barrier();
+
+    positions[planet].hi.xyz = position.hi;
+    positions[planet].lo.xyz = position.lo;
+    velocities[planet].hi.xyz = newVelocity.hi;
+    velocities[planet].lo.xyz = newVelocity.lo;
+}
@@ -18,6 +18,26 @@
  * - -verlet-no-shared:         Verlet integration withouth shared memory optimization.
  * - -verlet-shared:            Verlet integration with shared memory optimization.
  * - -verlet-shared-buffering:  Verlet integration with shared memory optimization and client-side double buffering.
+ * - -cpu:                      Update the particles on the CPU instead of the GPU. Can be combined with the switches above.
+ * - -isa-scalar, -isa-sse, -isa-avx2, -isa-avx512:
+ *                              Instruction set used on the CPU. By default, the best instruction set supported by the CPU is used.
+ * - -barnes-hut:               Update the particles on the CPU using the Barnes-Hut algorithm (O(N log N)) instead of the direct sum.
+ * - -fmm:                      Update the particles on the CPU using the fast multipole method (O(N)) instead of the direct sum.
+ * - -theta=<value>:            Opening angle of the Barnes-Hut algorithm and the fast multipole method. Defaults to 0.5.
+ * - -quadrupole:               Use quadrupole moments in addition to monopoles in the Barnes-Hut algorithm.
+ * - -order=<value>:            Expansion order of the fast multipole method. Defaults to 4.
+ * - -pm:                       Update the particles using the particle-mesh method (O(N + G log G)) in a periodic box.
+ *                              On the GPU, mass assignment and interpolation run in compute shaders while the field is
+ *                              solved on the CPU. Always uses improved Euler integration on the GPU.
+ * - -tsc:                      Use triangular shaped cloud instead of cloud in cell mass assignment for the particle-mesh method.
+ * - -grid=<size>:              Number of grid cells along each axis of the particle-mesh method. Defaults to 64.
+ * - -block-steps:              Integrate with hierarchical block time steps (leapfrog, direct sum). Only the particles
+ *                              whose time step ends are kicked in an update. Works on the GPU and with -cpu.
+ * - -rungs=<count>:            Number of time step levels below the finest of the block time steps. Defaults to 5.
+ * - -reorder=<interval>:        Sort the particles along a Hilbert curve every <interval> updates, so particles close in
+ *                              space are close in memory.
+ * - -cull:                     Cull the particles against the view frustum on the GPU before drawing them.
+ * - -particles=<count>:        Number of particles in interactive mode. Defaults to 1200.
  *
  * # Interactive simulation
  *
@@ -53,14 +73,25 @@
 #include "gpuprogramservice.hpp"
 #include "particlesystem.hpp"
 #include "buffer.hpp"
+#include "glstate.hpp"
 #include "rendersystem.hpp"
 #include "computesystem.hpp"
 #include "computeprogram.hpp"
 
+#include "gravitycpukernel.hpp"
+#include "directgravitysolver.hpp"
+#include "barneshutsolver.hpp"
+#include "fmmsolver.hpp"
+#include "pmgravitysolver.hpp"
+#include "pmgravitygpu.hpp"
+#include "blocktimestepper.hpp"
+#include "spatialreorderer.hpp"
+
 #include "gpuclock.hpp"
 #include "cpuclock.hpp"
 
 #include <iostream>
+#include <random>
 #include <glm/glm.hpp>
 #include <GLFW/glfw3.h>
 
@@ -103,6 +134,70 @@ ParticleIntegrationType particleIntegrationType = PIT_EULER_NO_SHARED;
 // This flag toggles benchmark mode. It can be set via '-benchmark' command line switch.
 bool benchmarkMode = false;
 
+// This flag selects the CPU compute backend. It can be set via '-cpu' command line switch.
+bool cpuMode = false;
+
+// The instruction set used by the CPU kernel. It can be set via '-isa-*' command line switches.
+instruction_sets cpuInstructionSet = NP_ISA_BEST;
+
+// Solvers used to compute accelerations on the CPU.
+enum CPUSolverType
+{
+    CST_DIRECT,
+    CST_BARNES_HUT,
+    CST_FMM
+};
+
+// The solver used on the CPU. It can be set via '-barnes-hut' and '-fmm' command line switches.
+CPUSolverType cpuSolverType = CST_DIRECT;
+
+// Opening angle of the tree based solvers. It can be set via '-theta=<value>' command line switch.
+float treeTheta = 0.5;
+
+// Barnes-Hut parameters. They can be set via '-quadrupole' command line switch.
+bool barnesHutQuadrupole = false;
+
+// FMM parameters. They can be set via '-order=<value>' command line switch.
+unsigned fmmOrder = 4;
+
+// This flag selects the particle-mesh method. It can be set via '-pm' command line switch.
+bool pmMode = false;
+
+// Particle-mesh parameters. They can be set via '-tsc' and '-grid=<size>' command line switches.
+mass_assignments pmAssignment = NP_MA_CIC;
+unsigned pmGridSize = 64;
+
+// This flag selects block time steps. It can be set via '-block-steps' command line switch.
+bool blockStepsMode = false;
+
+// The finest rung of the block time steps. It can be set via '-rungs=<count>' command line switch.
+unsigned blockMaxRung = 5;
+
+// The number of updates between two spatial sorts, 0 disables the sort. It can be set via '-reorder=<interval>' command line switch.
+unsigned reorderInterval = 0;
+
+// Set to true to cull the particles against the view frustum. It can be set via '-cull' command line switch.
+bool frustumCulling = false;
+
+// The number of particles in interactive mode. It can be set via '-particles=<count>' command line switch.
+int particleCount = 1200;
+
+// The CPU kernel if the CPU compute backend is used.
+GravityCPUKernel* cpuKernel = nullptr;
+
+// The FMM solver if it is used by the CPU kernel. Its phase times are reported by the benchmark.
+FMMSolver* fmmSolver = nullptr;
+
+// The particle-mesh solver and its GPU stages if the particle-mesh method is used on the GPU.
+PMGravitySolver* pmSolver = nullptr;
+PMGravityGPU* pmGravityGPU = nullptr;
+
+// The block time stepper if block time steps are used.
+BlockTimeStepper* blockTimeStepper = nullptr;
+
+// The spatial reorderer if the particles are sorted.
+SpatialReorderer* spatialReorderer = nullptr;
+
 uint localWorkGroupSize = 0;
 
 // --------
@@ -115,6 +210,9 @@ void preUpdateListener(const ParticleSystem* particleSystem, const ComputeSystem
     ComputeProgram* computeProgram = computeSystem->getCurrentComputeProgram();
     computeProgram->setUniform("timeStep", timeStep);
     computeProgram->setUniform("particleCount", particleSystem->getParticleCount());
+
+    if(cpuKernel)
+        cpuKernel->setTimeStep(timeStep);
 }
 
 // post update listener for double buffered Verlet integration.
@@ -159,10 +257,14 @@ void keyEventCallback(int keycode, int action, int modifiers)
         timeStep -= timeStepChangeResolution;
         // Prevent time step from becoming negative.
         timeStep = (timeStep > 0)?timeStep:0;
+        if(blockTimeStepper)
+            blockTimeStepper->setTimeStep(timeStep);
         break;
     // Increase time step
     case GLFW_KEY_M:
         timeStep += timeStepChangeResolution;
+        if(blockTimeStepper)
+            blockTimeStepper->setTimeStep(timeStep);
         break;
     // Switch fragment color routine
     case GLFW_KEY_1:
@@ -210,7 +312,7 @@ int main(int argc, char* argv[])
     engine->useDepthTest(false);
 
     // Enable blending
-    glEnable(GL_BLEND);
+    GlState::getInstance()->setCapability(GL_BLEND, true);
     glBlendFunc(GL_ONE, GL_ONE);
     glBlendEquation(GL_FUNC_ADD);
 
@@ -223,10 +325,73 @@ int main(int argc, char* argv[])
     if(!gpuService->createRenderProgram("gravity-render", "/gravity/vertex.glsl", "/gravity/fragment.glsl"))
         return -1;
 
+    // Block time steps bring their own leapfrog integration and use the velocities of the Euler integration.
+    if(blockStepsMode)
+    {
+        if(pmMode || cpuSolverType != CST_DIRECT || particleIntegrationType != PIT_EULER_NO_SHARED)
+            std::cerr << "Warning: block time steps always use the direct sum and their own integration.\n";
+        pmMode = false;
+        particleIntegrationType = PIT_EULER_NO_SHARED;
+
+        BlockTimeStepParameters parameters;
+        parameters.timeStep = timeStep;
+        parameters.maxRung = blockMaxRung;
+        blockTimeStepper = new BlockTimeStepper(parameters);
+    }
+
+    // The particle-mesh method on the GPU assigns the masses in a separate action and only provides an Euler update shader.
+    if(pmMode && !cpuMode)
+    {
+        if(particleIntegrationType != PIT_EULER_NO_SHARED)
+            std::cerr << "Warning: the particle-mesh method on the GPU only supports improved Euler integration.\n";
+        particleIntegrationType = PIT_EULER_NO_SHARED;
+        updateShader = "/gravity/pm-update-euler.glsl";
+
+        if(!gpuService->createComputeProgram("gravity-pm-deposit", "/gravity/pm-deposit.glsl"))
+            return -1;
+
+        pmSolver = new PMGravitySolver(pmGridSize, glm::vec3(-50, -50, -50), 100, pmAssignment);
+        pmGravityGPU = new PMGravityGPU(*pmSolver);
+    }
+
     if(!gpuService->createComputeProgram("gravity-update", updateShader))
         return -1;
     localWorkGroupSize = gpuService->getComputeProgram("gravity-update")->getNumWorkItemsPerGroup();
 
+    // The particles start in the cube from (-50, -50, -50) to (50, 50, 50). The rungs of the block time steps are per particle state.
+    if(reorderInterval > 0)
+    {
+        spatialReorderer = new SpatialReorderer(glm::vec3(-50, -50, -50), 100, NP_SFC_HILBERT);
+        if(blockTimeStepper)
+            spatialReorderer->addPerParticleBuffer(BlockTimeStepper::RUNGS_BUFFER);
+    }
+
+    // Run the update on the CPU. The block time stepper registers its own CPU kernels.
+    if(cpuMode && !blockTimeStepper)
+    {
+        gravity_integrators integrator = NP_GI_EULER;
+        if(particleIntegrationType == PIT_VERLET_NO_SHARED || particleIntegrationType == PIT_VERLET_SHARED)
+            integrator = NP_GI_VERLET;
+        else if(particleIntegrationType == PIT_VERLET_SHARED_DOUBLE_BUFFERING)
+            integrator = NP_GI_VERLET_DOUBLE_BUFFERED;
+
+        GravitySolver* solver;
+        if(pmMode)
+            solver = new PMGravitySolver(pmGridSize, glm::vec3(-50, -50, -50), 100, pmAssignment);
+        else if(cpuSolverType == CST_BARNES_HUT)
+            solver = new BarnesHutSolver(treeTheta, barnesHutQuadrupole);
+        else if(cpuSolverType == CST_FMM)
+            solver = fmmSolver = new FMMSolver(fmmOrder, treeTheta);
+        else
+            solver = new DirectGravitySolver(0.1f, cpuInstructionSet);
+
+        cpuKernel = new GravityCPUKernel(solver, integrator);
+        engine->getComputeSystem().registerCPUKernel(*gpuService->getComputeProgram("gravity-update"), cpuKernel);
+    }
+
+    if(cpuMode)
+        engine->setComputeBackend(NP_CB_CPU);
+
     // Create material
     MaterialManager* materialManager = engine->getMaterialManager();
     materialManager->createMaterial("gravity-material", "gravity-render", NP_RT_POINTS);
@@ -240,7 +405,7 @@ int main(int argc, char* argv[])
     }
 
     // Create particle system
-    ParticleSystem* pSys = createParticleSystem(1200);
+    ParticleSystem* pSys = createParticleSystem(particleCount);
     pSys->preRenderSignal.connect(preRenderListener);
 
     GPUClock clock;
@@ -277,6 +442,48 @@ void parseCommandLineSwitch(std::string cliSwitch)
 {
     if(cliSwitch == "-benchmark")
         benchmarkMode = true;
+    else if(cliSwitch == "-cpu")
+        cpuMode = true;
+    else if(cliSwitch == "-isa-scalar")
+        cpuInstructionSet = NP_ISA_SCALAR;
+    else if(cliSwitch == "-isa-sse")
+        cpuInstructionSet = NP_ISA_SSE;
+    else if(cliSwitch == "-isa-avx2")
+        cpuInstructionSet = NP_ISA_AVX2;
+    else if(cliSwitch == "-isa-avx512")
+        cpuInstructionSet = NP_ISA_AVX512;
+    else if(cliSwitch == "-barnes-hut")
+    {
+        cpuMode = true;
+        cpuSolverType = CST_BARNES_HUT;
+    }
+    else if(cliSwitch == "-fmm")
+    {
+        cpuMode = true;
+        cpuSolverType = CST_FMM;
+    }
+    else if(cliSwitch == "-quadrupole")
+        barnesHutQuadrupole = true;
+    else if(cliSwitch.compare(0, 7, "-theta=") == 0)
+        treeTheta = std::stof(cliSwitch.substr(7));
+    else if(cliSwitch.compare(0, 7, "-order=") == 0)
+        fmmOrder = std::stoi(cliSwitch.substr(7));
+    else if(cliSwitch == "-pm")
+        pmMode = true;
+    else if(cliSwitch == "-tsc")
+        pmAssignment = NP_MA_TSC;
+    else if(cliSwitch.compare(0, 6, "-grid=") == 0)
+        pmGridSize = std::stoi(cliSwitch.substr(6));
+    else if(cliSwitch == "-block-steps")
+        blockStepsMode = true;
+    else if(cliSwitch.compare(0, 7, "-rungs=") == 0)
+        blockMaxRung = std::stoi(cliSwitch.substr(7));
+    else if(cliSwitch.compare(0, 9, "-reorder=") == 0)
+        reorderInterval = std::stoi(cliSwitch.substr(9));
+    else if(cliSwitch == "-cull")
+        frustumCulling = true;
+    else if(cliSwitch.compare(0, 11, "-particles=") == 0)
+        particleCount = std::stoi(cliSwitch.substr(11));
     else if(cliSwitch == "-euler-no-shared")
     {
         particleIntegrationType = PIT_EULER_NO_SHARED;
@@ -312,6 +519,21 @@ void parseCommandLineSwitch(std::string cliSwitch)
                   << "    -verlet-no-shared\tuse Verlet integration without shared memory\n"
                   << "    -verlet-shared\tuse Verlet integration with shared memory\n"
                   << "    -verlet-shared-double-buffer\tuse Verlet integration with shared memory and double buffering\n"
+                  << "    -cpu\t\tupdate particles on the CPU\n"
+                  << "    -isa-scalar, -isa-sse, -isa-avx2, -isa-avx512\tinstruction set used on the CPU (default: best supported)\n"
+                  << "    -barnes-hut\t\tupdate particles on the CPU using the Barnes-Hut algorithm\n"
+                  << "    -fmm\t\tupdate particles on the CPU using the fast multipole method\n"
+                  << "    -theta=<value>\topening angle of the Barnes-Hut algorithm and the fast multipole method (default: 0.5)\n"
+                  << "    -quadrupole\t\tuse quadrupole moments in the Barnes-Hut algorithm\n"
+                  << "    -order=<value>\texpansion order of the fast multipole method (default: 4)\n"
+                  << "    -pm\t\t\tupdate particles using the particle-mesh method in a periodic box\n"
+                  << "    -tsc\t\tuse triangular shaped cloud mass assignment for the particle-mesh method\n"
+                  << "    -grid=<size>\tgrid cells per axis of the particle-mesh method (default: 64)\n"
+                  << "    -block-steps\tintegrate with hierarchical block time steps\n"
+                  << "    -rungs=<count>\ttime step levels of the block time steps (default: 5)\n"
+                  << "    -reorder=<interval>\tsort the particles along a Hilbert curve every <interval> updates\n"
+                  << "    -cull\t\tcull the particles against the view frustum before drawing\n"
+                  << "    -particles=<count>\tnumber of particles in interactive mode (default: 1200)\n"
                   << "    -help\t\tprint this help text.\n";
         exit(0);
     }
@@ -360,41 +582,80 @@ ParticleSystem* createParticleSystem(int particleCount)
     Buffer<ParticlePosition>* pPositions  = pSys->addParticleAttribute<ParticlePosition>("ParticlePositions");
     Buffer<glm::vec4>* pVelocities = pSys->addParticleAttribute<glm::vec4>("ParticleProperties");
 
-    Action* action = pSys->appendAction(*gpuService->getComputeProgram("gravity-update"));
+    // Block time steps append their own actions
+    if(blockTimeStepper)
+    {
+        blockTimeStepper->attach(pSys);
+    }
+    else
+    {
+        // The particle-mesh method assigns the masses to its grid before the update
+        Action* depositAction = nullptr;
+        if(pmGravityGPU)
+        {
+            depositAction = pSys->appendAction(*gpuService->getComputeProgram("gravity-pm-deposit"));
+            depositAction->preUpdateSignal.connect(preUpdateListener);
+        }
+
+        Action* action = pSys->appendAction(*gpuService->getComputeProgram("gravity-update"));
+
+        action->preUpdateSignal.connect(preUpdateListener);
 
-    action->preUpdateSignal.connect(preUpdateListener);
+        if(pmGravityGPU)
+            pmGravityGPU->connect(*depositAction, *action);
 
-    if(particleIntegrationType == PIT_VERLET_SHARED_DOUBLE_BUFFERING)
-        action->postUpdateSignal.connect(postUpdateListener);
+        if(particleIntegrationType == PIT_VERLET_SHARED_DOUBLE_BUFFERING)
+            action->postUpdateSignal.connect(postUpdateListener);
+    }
+
+    // Sort after the integration, so all per particle state exists
+    if(spatialReorderer)
+        spatialReorderer->attach(pSys, reorderInterval);
+
+    // The sprites shrink with the distance, a radius of one encloses them
+    if(frustumCulling)
+        pSys->enableFrustumCulling("ParticlePositions", 1.0f);
 
     // Provide initial data
     ParticlePosition* pPositionData = pPositions->map();
     glm::vec4* pPropertyData = pVelocities->map();
 
-    srand(time(nullptr));
-    for(size_t i = 0; i < pSys->getParticleCount(); ++i)
+    // Each chunk draws from its own generator seeded with the chunk's first index, so the
+    // initial conditions do not depend on the number of threads.
+    const unsigned seed = time(nullptr);
+    const unsigned initGrainSize = 4096;
+
+    engine->getThreadPool().parallelFor(0, pSys->getParticleCount(), [=](unsigned first, unsigned last)
     {
-        // Position
-        pPositionData[i].position = glm::vec3(
-                    random() % 100 - 50,
-                    random() % 100 - 50,
-                    random() % 100 - 50);
-        // Mass
-        pPositionData[i].mass = random() % 200 + 50;
-
-        // Velocity
-        pPropertyData[i] = glm::vec4(random() % 50 - 25, random() % 50 - 25, random() % 50 - 25, 0);
-
-        // Encode initial velocity as position if Verlet integration is used
-        if(particleIntegrationType == PIT_VERLET_NO_SHARED || particleIntegrationType == PIT_VERLET_SHARED || particleIntegrationType == PIT_VERLET_SHARED_DOUBLE_BUFFERING)
-        {
-            pPropertyData[i] = glm::vec4(pPositionData[i].position, 0) + pPropertyData[i] * 0.001f;
+        std::mt19937 generator(seed + first);
+        std::uniform_int_distribution<int> positionDistribution(-50, 49);
+        std::uniform_int_distribution<int> massDistribution(50, 249);
+        std::uniform_int_distribution<int> velocityDistribution(-25, 24);
 
-            // Store mass in positions and properties so it does not get lost for the shader after swapping the buffers
-            if(particleIntegrationType == PIT_VERLET_SHARED_DOUBLE_BUFFERING)
-                pPropertyData[i][3] = pPositionData[i].mass;
+        for(unsigned i = first; i < last; ++i)
+        {
+            // Position
+            pPositionData[i].position = glm::vec3(
+                        positionDistribution(generator),
+                        positionDistribution(generator),
+                        positionDistribution(generator));
+            // Mass
+            pPositionData[i].mass = massDistribution(generator);
+
+            // Velocity
+            pPropertyData[i] = glm::vec4(velocityDistribution(generator), velocityDistribution(generator), velocityDistribution(generator), 0);
+
+            // Encode initial velocity as position if Verlet integration is used
+            if(particleIntegrationType == PIT_VERLET_NO_SHARED || particleIntegrationType == PIT_VERLET_SHARED || particleIntegrationType == PIT_VERLET_SHARED_DOUBLE_BUFFERING)
+            {
+                pPropertyData[i] = glm::vec4(pPositionData[i].position, 0) + pPropertyData[i] * 0.001f;
+
+                // Store mass in positions and properties so it does not get lost for the shader after swapping the buffers
+                if(particleIntegrationType == PIT_VERLET_SHARED_DOUBLE_BUFFERING)
+                    pPropertyData[i][3] = pPositionData[i].mass;
+            }
         }
-    }
+    }, initGrainSize);
 
     pPositions->unmap();
     pVelocities->unmap();
@@ -416,6 +677,7 @@ double cpuUpdateTime;
 double gpuUpdateTime;
 double cpuCleanUpTime;
 double gpuCleanUpTime;
+FMMSolver::PhaseTimes fmmPhaseTimes;
 
 
 // Benchmark listeners
@@ -441,6 +703,17 @@ void benchmarkPostUpdateListener(ParticleSystem*, const ComputeSystem*)
     cpuUpdateTime += cpuClock.getElapsedTime();
     gpuUpdateTime += gpuClock.getElapsedTime();
 
+    if(fmmSolver)
+    {
+        const FMMSolver::PhaseTimes& phaseTimes = fmmSolver->getPhaseTimes();
+        fmmPhaseTimes.treeBuild += phaseTimes.treeBuild;
+        fmmPhaseTimes.upwardPass += phaseTimes.upwardPass;
+        fmmPhaseTimes.traversal += phaseTimes.traversal;
+        fmmPhaseTimes.m2l += phaseTimes.m2l;
+        fmmPhaseTimes.p2p += phaseTimes.p2p;
+        fmmPhaseTimes.downwardPass += phaseTimes.downwardPass;
+    }
+
     gpuClock.start();
     cpuClock.start();
 }
@@ -479,7 +752,16 @@ void updateBenchmark()
         std::cout << "Verlet, shared memory, double buffering";
         break;
     }
-    std::cout << ", local work group size: " << localWorkGroupSize << "\n";
+    if(blockTimeStepper)
+        std::cout << ", block time steps with " << blockTimeStepper->getParameters().maxRung + 1 << " rungs"
+                  << (cpuMode ? " (CPU)\n" : " (GPU)\n");
+    else if(cpuMode)
+        std::cout << ", CPU threads: " << engine->getThreadPool().getThreadCount()
+                  << ", solver: " << cpuKernel->getSolver()->getName() << "\n";
+    else if(pmSolver)
+        std::cout << ", local work group size: " << localWorkGroupSize << ", solver: " << pmSolver->getName() << " (GPU assignment)\n";
+    else
+        std::cout << ", local work group size: " << localWorkGroupSize << "\n";
 
     std::cout << "# particles\tCPU set up time\tGPU set up\tCPU update\tGPU update\tCPU clean up\tGPU clean up\tTotal time\test. FPS\test. GFLOPS/s\test. FLOPS/particle\n";
 
@@ -488,9 +770,9 @@ void updateBenchmark()
     {
         ParticleSystem* pSys = createParticleSystem(updateBenchmarkParticleCounts[i]);
 
-        Action* action = pSys->getActions()[0];
-        action->preUpdateSignal.connect(benchmarkPreUpdateListener);
-        action->postUpdateSignal.connect(benchmarkPostUpdateListener);
+        // Measure from the first to the last action, e.g. including the mass assignment of the particle-mesh method
+        pSys->getActions().front()->preUpdateSignal.connect(benchmarkPreUpdateListener);
+        pSys->getActions().back()->postUpdateSignal.connect(benchmarkPostUpdateListener);
 
         // Reset times
         cpuSetUpTime = 0;
@@ -499,6 +781,7 @@ void updateBenchmark()
         gpuUpdateTime = 0;
         cpuCleanUpTime = 0;
         gpuCleanUpTime = 0;
+        fmmPhaseTimes = FMMSolver::PhaseTimes();
 
         // Clear OpenGL queue
         glFinish();
@@ -539,9 +822,18 @@ void updateBenchmark()
                   << fpsClock.getElapsedTime() << "\t"
                   << 1.0 / ((fpsClock.getElapsedTime()) / runsPerConfiguration) << "\t"
 
-                  << (getFlopsPerUpdate(updateBenchmarkParticleCounts[i]) * runsPerConfiguration) / (gpuUpdateTime * 1000000000) << "\t"
+                  << (getFlopsPerUpdate(updateBenchmarkParticleCounts[i]) * runsPerConfiguration) / ((cpuMode ? cpuUpdateTime : gpuUpdateTime) * 1000000000) << "\t"
                   << getFlopsPerUpdate(updateBenchmarkParticleCounts[i]) / updateBenchmarkParticleCounts[i] << "\n";
 
+        if(fmmSolver)
+            std::cout << "\tFMM phases (tree build, upward pass, traversal, M2L, P2P, downward pass):\t"
+                      << fmmPhaseTimes.treeBuild / runsPerConfiguration << "\t"
+                      << fmmPhaseTimes.upwardPass / runsPerConfiguration << "\t"
+                      << fmmPhaseTimes.traversal / runsPerConfiguration << "\t"
+                      << fmmPhaseTimes.m2l / runsPerConfiguration << "\t"
+                      << fmmPhaseTimes.p2p / runsPerConfiguration << "\t"
+                      << fmmPhaseTimes.downwardPass / runsPerConfiguration << "\n";
+
 
 
         engine->deleteParticleSystem(pSys);
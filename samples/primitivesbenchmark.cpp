@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+/**
+ * This application benchmarks the ParallelPrimitives.
+ *
+ * For item counts from 1K up to 100M, an exclusive scan, a segmented inclusive scan, a reduction and a stream
+ * compaction of random unsigned integers are run on the GPU and on the CPU. Each primitive is warmed up once and
+ * then run 10 times. The throughput is reported in items per second. The GPU results are read back once per
+ * configuration and compared to the CPU results.
+ *
+ * Command line switches:
+ * - -max=<count>:        The largest item count to benchmark. Defaults to 100000000.
+ **/
+
+#include "engine.hpp"
+#include "gpuprogramservice.hpp"
+#include "threadpool.hpp"
+#include "parallelprimitives.hpp"
+
+#include "cpuclock.hpp"
+
+#include <functional>
+#include <iostream>
+#include <random>
+
+using namespace nparticles;
+
+const uint itemCounts[] =
+{
+    1000,
+    10000,
+    100000,
+    1000000,
+    10000000,
+    100000000
+};
+
+const uint runsPerConfiguration = 10;
+
+CPUClock benchmarkClock;
+
+/**
+ * Get the throughput of a primitive in items per second.
+ */
+double measure(uint itemCount, bool gpu, const std::function<void()>& primitive)
+{
+    // Warm up
+    primitive();
+
+    if(gpu)
+        glFinish();
+    benchmarkClock.start();
+
+    for(uint r = 0; r < runsPerConfiguration; ++r)
+        primitive();
+
+    if(gpu)
+        glFinish();
+    benchmarkClock.stop();
+
+    return itemCount * runsPerConfiguration / benchmarkClock.getElapsedTime();
+}
+
+/**
+ * Compare the first @p count items of a GPU buffer to the CPU result.
+ */
+bool matches(Buffer<GLuint>& buffer, const std::vector<GLuint>& expected, uint count)
+{
+    const GLuint* data = buffer.map();
+    bool equal = std::equal(data, data + count, expected.begin());
+    buffer.unmap();
+    return equal;
+}
+
+int main(int argc, char* argv[])
+{
+    uint maxItemCount = 100000000;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string cliSwitch = argv[i];
+        if(cliSwitch.compare(0, 5, "-max=") == 0)
+            maxItemCount = std::stoi(cliSwitch.substr(5));
+        else
+        {
+            std::cerr << "No such command line option: " << cliSwitch << ".\n"
+                      << "Available options are:\n"
+                      << "    -max=<count>\tlargest item count to benchmark (default: 100000000)\n";
+            return 0;
+        }
+    }
+
+    Engine* engine = Engine::getInstance();
+    engine->init(640, 480, false, false);
+
+    GPUProgramService* gpuService = engine->getGPUProgramService();
+    gpuService->addSourceDirectory("../res/shader/np", "/np");
+
+    ThreadPool& threadPool = engine->getThreadPool();
+    ParallelPrimitives primitives(threadPool);
+
+    std::cout << "\n"
+              << "+----------------------------+\n"
+              << "| Parallel primitives        |\n"
+              << "+----------------------------+\n"
+              << "\n";
+
+    std::cout << "The CPU versions use " << threadPool.getThreadCount() << " threads.\n"
+              << "All throughputs are given in items per second.\n\n";
+
+    std::cout << "# items\tdevice\tscan\tsegmented scan\treduce\tcompact\tvalidation\n";
+
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<GLuint> valueDistribution(0, 15);
+    std::bernoulli_distribution flagDistribution(0.25);
+
+    for(uint c = 0; c < sizeof(itemCounts) / sizeof(itemCounts[0]) && itemCounts[c] <= maxItemCount; ++c)
+    {
+        const uint count = itemCounts[c];
+
+        // Random values, the flags are segment heads and compaction flags at the same time
+        std::vector<GLuint> values(count);
+        std::vector<GLuint> flags(count);
+        for(uint i = 0; i < count; ++i)
+        {
+            values[i] = valueDistribution(generator);
+            flags[i] = flagDistribution(generator);
+        }
+
+        // CPU
+        std::vector<GLuint> scanned(count);
+        std::vector<GLuint> segmented(count);
+        std::vector<GLuint> compacted(count);
+        GLuint reduced = 0;
+        uint keptCount = 0;
+
+        double cpuScan = measure(count, false, [&] { primitives.scan(values.data(), scanned.data(), count); });
+        double cpuSegmented = measure(count, false, [&] { primitives.segmentedScan(values.data(), flags.data(), segmented.data(), count, NP_ST_INCLUSIVE); });
+        double cpuReduce = measure(count, false, [&] { reduced = primitives.reduce(values.data(), count); });
+        double cpuCompact = measure(count, false, [&] { keptCount = primitives.compact(values.data(), flags.data(), compacted.data(), count); });
+
+        std::cout << count << "\tCPU\t" << cpuScan << "\t" << cpuSegmented << "\t" << cpuReduce << "\t" << cpuCompact << "\t-" << std::endl;
+
+        // GPU
+        Buffer<GLuint> valueBuffer(count, GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY);
+        Buffer<GLuint> flagBuffer(count, GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY);
+        Buffer<GLuint> outputBuffer(count, GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY);
+        Buffer<GLuint> resultBuffer(1, GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY);
+        valueBuffer.setData(values.data());
+        flagBuffer.setData(flags.data());
+
+        bool valid = true;
+
+        double gpuScan = measure(count, true, [&] { primitives.scan(valueBuffer, outputBuffer); });
+        valid = valid && matches(outputBuffer, scanned, count);
+
+        double gpuSegmented = measure(count, true, [&] { primitives.segmentedScan(valueBuffer, flagBuffer, outputBuffer, NP_ST_INCLUSIVE); });
+        valid = valid && matches(outputBuffer, segmented, count);
+
+        double gpuReduce = measure(count, true, [&] { primitives.reduce(valueBuffer, resultBuffer); });
+        valid = valid && matches(resultBuffer, std::vector<GLuint>(1, reduced), 1);
+
+        double gpuCompact = measure(count, true, [&] { primitives.compact(valueBuffer, flagBuffer, outputBuffer, resultBuffer); });
+        valid = valid && matches(resultBuffer, std::vector<GLuint>(1, keptCount), 1) && matches(outputBuffer, compacted, keptCount);
+
+        std::cout << count << "\tGPU\t" << gpuScan << "\t" << gpuSegmented << "\t" << gpuReduce << "\t" << gpuCompact << "\t"
+                  << (valid ? "passed" : "FAILED") << std::endl;
+    }
+
+    engine->terminate();
+    std::cout << "\nBenchmark completed successfully.\n";
+    return 0;
+}
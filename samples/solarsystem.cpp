@@ -23,10 +23,20 @@
  * - Space: toggle pause mode
  * - v: toggle v-sync
  * - t: draw trajectories (camera should not be moved in this mode to avoid visual artifacts!)
+ *
+ * Command line switches:
+ * - -cpu:           Update the planets on the CPU instead of the GPU.
+ * - -double-float:  Store positions and velocities as double-floats (pairs of floats, see res/shader/np/double-float.glsl)
+ *                   and update them with emulated double precision. This runs at fp32 throughput on GPUs with slow
+ *                   or without native fp64 support. By default, native double precision is used.
  **/
 
+#include <vector>
+#include <iostream>
+
 #include "engine.hpp"
 #include "particlesystem.hpp"
+#include "cpukernel.hpp"
 
 using namespace nparticles;
 
@@ -48,6 +58,25 @@ enum Planets
     PLANET_COUNT
 };
 
+/**
+ * A glm::dvec4 stored as double-float: the value of each component is hi + lo.
+ *
+ * Layout of the buffers used by update-df.glsl.
+ */
+struct DoubleFloat4
+{
+    DoubleFloat4(const glm::dvec4& value = glm::dvec4(0))
+        : hi(value),
+          lo(value - glm::dvec4(hi))
+    {
+    }
+
+    glm::dvec4 toDouble() const { return glm::dvec4(hi) + glm::dvec4(lo); }
+
+    glm::vec4 hi;
+    glm::vec4 lo;
+};
+
 
 /**
  * Initialise the simulation, i.e. its particles
@@ -102,6 +131,108 @@ void initSolarSystem(glm::dvec4* positions, glm::dvec4* velocities, glm::vec4* c
     colors[PLUTO] = glm::vec4(0.8, 0.7, 0.5, 1);
 }
 
+/**
+ * CPU counterpart of update.glsl and update-df.glsl.
+ *
+ * Updates the planets using the improved euler integration. Double-float buffers are converted
+ * to double precision for the integration.
+ */
+class SolarSystemCPUKernel : public CPUKernel
+{
+public:
+    SolarSystemCPUKernel(bool doubleFloat)
+        : CPUKernel(kernel_function(), PLANET_COUNT),
+          mDoubleFloat(doubleFloat)
+    {
+    }
+
+    void beginUpdate(ParticleSystem* particleSystem, ThreadPool&)
+    {
+        if(mDoubleFloat)
+        {
+            DoubleFloat4* positions = ((Buffer<DoubleFloat4>*)particleSystem->getParticleAttributeBuffer("Positions"))->map();
+            mPositions.clear();
+            for(unsigned i = 0; i < particleSystem->getParticleCount(); ++i)
+                mPositions.push_back(positions[i].toDouble());
+        }
+        else
+        {
+            glm::dvec4* positions = ((Buffer<glm::dvec4>*)particleSystem->getParticleAttributeBuffer("Positions"))->map();
+            mPositions.assign(positions, positions + particleSystem->getParticleCount());
+        }
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const double gravitationalConstant = 6.67384e-11;
+        const double timeStep = 900;
+        const double softeningFactor = 1;
+
+        for(unsigned i = first; i < last; ++i)
+        {
+            // Fix sun position
+            if(i == SUN)
+                continue;
+
+            glm::dvec3 position(mPositions[i]);
+            glm::dvec4 velocity = getVelocity(particleSystem, i);
+            glm::dvec3 oldVelocity(velocity);
+            glm::dvec3 acceleration(0, 0, 0);
+
+            for(const glm::dvec4& attractor : mPositions)
+            {
+                glm::dvec3 r = glm::dvec3(attractor) - position;
+                double distanceSquare = glm::dot(r, r) + softeningFactor * softeningFactor;
+                acceleration += r * (attractor.w / std::sqrt(distanceSquare * distanceSquare * distanceSquare));
+            }
+
+            glm::dvec3 newVelocity = oldVelocity + gravitationalConstant * acceleration * timeStep;
+            position += (newVelocity + oldVelocity) * 0.5 * timeStep;
+
+            setPlanet(particleSystem, i, glm::dvec4(position, mPositions[i].w), glm::dvec4(newVelocity, velocity.w));
+        }
+    }
+
+private:
+    /**
+     * Read the velocity of a planet from the Velocities buffer.
+     */
+    glm::dvec4 getVelocity(ParticleSystem* particleSystem, unsigned planet) const
+    {
+        if(mDoubleFloat)
+            return ((Buffer<DoubleFloat4>*)particleSystem->getParticleAttributeBuffer("Velocities"))->map()[planet].toDouble();
+
+        return ((Buffer<glm::dvec4>*)particleSystem->getParticleAttributeBuffer("Velocities"))->map()[planet];
+    }
+
+    /**
+     * Write position and velocity of a planet to the Positions and Velocities buffers.
+     */
+    void setPlanet(ParticleSystem* particleSystem, unsigned planet, const glm::dvec4& position, const glm::dvec4& velocity) const
+    {
+        if(mDoubleFloat)
+        {
+            ((Buffer<DoubleFloat4>*)particleSystem->getParticleAttributeBuffer("Positions"))->map()[planet] = DoubleFloat4(position);
+            ((Buffer<DoubleFloat4>*)particleSystem->getParticleAttributeBuffer("Velocities"))->map()[planet] = DoubleFloat4(velocity);
+        }
+        else
+        {
+            ((Buffer<glm::dvec4>*)particleSystem->getParticleAttributeBuffer("Positions"))->map()[planet] = position;
+            ((Buffer<glm::dvec4>*)particleSystem->getParticleAttributeBuffer("Velocities"))->map()[planet] = velocity;
+        }
+    }
+
+    /**
+     * True if the buffers store double-floats.
+     */
+    bool mDoubleFloat;
+
+    /**
+     * Positions and masses of the planets before the update.
+     */
+    std::vector<glm::dvec4> mPositions;
+};
+
 // Control pause mode
 bool paused = true;
 bool vSync = true;
@@ -134,8 +265,28 @@ void keyListener(int keycode, int action, int modifiers)
 /**
  * Main method setting up and running the simulation.
   */
-int main()
+int main(int argc, char* argv[])
 {
+    bool cpuMode = false;
+    bool doubleFloat = false;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string cliSwitch = argv[i];
+        if(cliSwitch == "-cpu")
+            cpuMode = true;
+        else if(cliSwitch == "-double-float")
+            doubleFloat = true;
+        else
+        {
+            std::cerr << "No such command line option: " << cliSwitch << ".\n"
+                      << "Available options are:\n"
+                      << "    -cpu\t\t\tupdate planets on the CPU\n"
+                      << "    -double-float\t\tuse emulated instead of native double precision\n";
+            return 0;
+        }
+    }
+
     Engine* engine = Engine::getInstance();
     engine->init(1440, 900, false);
     engine->keyEventSignal.connect(keyListener);
@@ -152,16 +303,22 @@ int main()
     gpuProgramService->addSourceDirectory("../res/shader/np", "/np");
 
     if(!gpuProgramService->createRenderProgram("renderer",
-                                               "/solarsystem/vertex.glsl",
+                                               doubleFloat ? "/solarsystem/vertex-df.glsl" : "/solarsystem/vertex.glsl",
                                                "/solarsystem/fragment.glsl",
                                                "/solarsystem/tessellationcontrol.glsl",
                                                "/solarsystem/tesselationevaluation.glsl")
             ) // if(render program creation failed)
         return -1;
 
-    if(!gpuProgramService->createComputeProgram("updater", "/solarsystem/update.glsl"))
+    if(!gpuProgramService->createComputeProgram("updater", doubleFloat ? "/solarsystem/update-df.glsl" : "/solarsystem/update.glsl"))
         return -1;
 
+    if(cpuMode)
+    {
+        engine->getComputeSystem().registerCPUKernel(*gpuProgramService->getComputeProgram("updater"), new SolarSystemCPUKernel(doubleFloat));
+        engine->setComputeBackend(NP_CB_CPU);
+    }
+
     // Set up mesh and material
     const Material* material = engine->getMaterialManager()->createMaterial("material", "renderer");
     const Mesh* mesh = engine->getMeshManager()->createIcosahedron("icosaeder");
@@ -169,17 +326,28 @@ int main()
     // Set up the particle system.
     ParticleSystem* pSys = engine->createParticleSystem(PLANET_COUNT, *mesh, *material);
     UniformBuffer<glm::vec4>* colorBuffer = pSys->addUniformBuffer<glm::vec4>("Colors", PLANET_COUNT);
-    auto positionBuffer = pSys->addParticleAttribute<glm::dvec4>("Positions");
-    auto velocityBuffer = pSys->addParticleAttribute<glm::dvec4>("Velocities");
 
     pSys->appendAction(*gpuProgramService->getComputeProgram("updater"));
 
     // Initialise buffers of the particle system.
-    initSolarSystem(positionBuffer->map(), velocityBuffer->map(), colorBuffer->map());
-    positionBuffer->unmap();
-    velocityBuffer->unmap();
+    std::vector<glm::dvec4> positions(PLANET_COUNT);
+    std::vector<glm::dvec4> velocities(PLANET_COUNT);
+    initSolarSystem(positions.data(), velocities.data(), colorBuffer->map());
     colorBuffer->unmap();
 
+    if(doubleFloat)
+    {
+        std::vector<DoubleFloat4> positionData(positions.begin(), positions.end());
+        std::vector<DoubleFloat4> velocityData(velocities.begin(), velocities.end());
+        pSys->addParticleAttribute<DoubleFloat4>("Positions")->setData(positionData.data());
+        pSys->addParticleAttribute<DoubleFloat4>("Velocities")->setData(velocityData.data());
+    }
+    else
+    {
+        pSys->addParticleAttribute<glm::dvec4>("Positions")->setData(positions.data());
+        pSys->addParticleAttribute<glm::dvec4>("Velocities")->setData(velocities.data());
+    }
+
     RenderSystem& renderSystem = engine->getRenderSystem();
 
     // Main loop
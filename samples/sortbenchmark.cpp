@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+/**
+ * This application benchmarks the RadixSorter.
+ *
+ * For 1M, 16M and 64M keys, random keys are sorted on the GPU and on the CPU:
+ * - 32 bit unsigned integer keys in ascending order.
+ * - 16 bit unsigned integer keys in ascending order, e.g. grid cells or species.
+ * - Floating point keys in descending order, e.g. view depths for back to front rendering.
+ *
+ * Each sort is warmed up once and then run 10 times on the unsorted keys. The throughput is reported in keys per
+ * second, restoring the unsorted keys is not measured. The GPU results are read back once per configuration and
+ * compared to the CPU results. Both sorts are stable, so the permutations have to be equal.
+ *
+ * Command line switches:
+ * - -max=<count>:        The largest key count to benchmark. Defaults to 64000000.
+ **/
+
+#include "engine.hpp"
+#include "gpuprogramservice.hpp"
+#include "threadpool.hpp"
+#include "radixsorter.hpp"
+
+#include "cpuclock.hpp"
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <random>
+
+using namespace nparticles;
+
+const uint keyCounts[] =
+{
+    1000000,
+    16000000,
+    64000000
+};
+
+const uint runsPerConfiguration = 10;
+
+CPUClock benchmarkClock;
+
+/**
+ * Get the throughput of a sort in keys per second. The keys are restored before each run.
+ */
+double measure(uint keyCount, bool gpu, const std::function<void()>& restore, const std::function<void()>& sort)
+{
+    double elapsedTime = 0.0;
+
+    // Warm up
+    restore();
+    sort();
+
+    for(uint r = 0; r < runsPerConfiguration; ++r)
+    {
+        restore();
+
+        if(gpu)
+            glFinish();
+        benchmarkClock.start();
+
+        sort();
+
+        if(gpu)
+            glFinish();
+        benchmarkClock.stop();
+
+        elapsedTime += benchmarkClock.getElapsedTime();
+    }
+
+    return keyCount * runsPerConfiguration / elapsedTime;
+}
+
+/**
+ * Compare the first @p count items of a GPU buffer to the CPU result.
+ */
+template<typename T>
+bool matches(Buffer<T>& buffer, const std::vector<T>& expected, uint count)
+{
+    const T* data = buffer.map();
+    bool equal = std::memcmp(data, expected.data(), count * sizeof(T)) == 0;
+    buffer.unmap();
+    return equal;
+}
+
+/**
+ * Benchmark the sort of one key type on the CPU and the GPU and print a line for each.
+ */
+template<typename T>
+void benchmark(const std::string& name, const std::vector<T>& unsortedKeys,
+               const std::function<bool(Buffer<T>&, Buffer<GLuint>&)>& gpuSort,
+               const std::function<void(T*, GLuint*)>& cpuSort)
+{
+    const uint count = unsortedKeys.size();
+
+    // CPU
+    std::vector<T> keys(count);
+    std::vector<GLuint> permutation(count);
+
+    double cpuKeysPerSecond = measure(count, false,
+                                      [&] { keys = unsortedKeys; },
+                                      [&] { cpuSort(keys.data(), permutation.data()); });
+
+    std::cout << count << "\t" << name << "\tCPU\t" << cpuKeysPerSecond << "\t-" << std::endl;
+
+    // GPU
+    Buffer<T> unsortedKeyBuffer(count, GL_INVALID_VALUE, -1, GL_STATIC_COPY);
+    Buffer<T> keyBuffer(count, GL_INVALID_VALUE, -1, GL_DYNAMIC_COPY);
+    Buffer<GLuint> permutationBuffer(count, GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY);
+    unsortedKeyBuffer.setData(const_cast<T*>(unsortedKeys.data()));
+
+    double gpuKeysPerSecond = measure(count, true,
+                                      [&] { keyBuffer.copyData(unsortedKeyBuffer); },
+                                      [&] { gpuSort(keyBuffer, permutationBuffer); });
+
+    bool valid = matches(keyBuffer, keys, count) && matches(permutationBuffer, permutation, count);
+
+    std::cout << count << "\t" << name << "\tGPU\t" << gpuKeysPerSecond << "\t" << (valid ? "passed" : "FAILED") << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    uint maxKeyCount = 64000000;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string cliSwitch = argv[i];
+        if(cliSwitch.compare(0, 5, "-max=") == 0)
+            maxKeyCount = std::stoi(cliSwitch.substr(5));
+        else
+        {
+            std::cerr << "No such command line option: " << cliSwitch << ".\n"
+                      << "Available options are:\n"
+                      << "    -max=<count>\tlargest key count to benchmark (default: 64000000)\n";
+            return 0;
+        }
+    }
+
+    Engine* engine = Engine::getInstance();
+    engine->init(640, 480, false, false);
+
+    GPUProgramService* gpuService = engine->getGPUProgramService();
+    gpuService->addSourceDirectory("../res/shader/np", "/np");
+
+    ThreadPool& threadPool = engine->getThreadPool();
+    RadixSorter sorter(threadPool);
+
+    std::cout << "\n"
+              << "+----------------------------+\n"
+              << "| Radix sort                 |\n"
+              << "+----------------------------+\n"
+              << "\n";
+
+    std::cout << "The CPU version uses " << threadPool.getThreadCount() << " threads.\n"
+              << "All throughputs are given in keys per second.\n\n";
+
+    std::cout << "# keys\tkeys\tdevice\tthroughput\tvalidation\n";
+
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<GLuint> keyDistribution;
+    std::uniform_real_distribution<GLfloat> depthDistribution(-1000.0f, 1000.0f);
+
+    for(uint c = 0; c < sizeof(keyCounts) / sizeof(keyCounts[0]) && keyCounts[c] <= maxKeyCount; ++c)
+    {
+        const uint count = keyCounts[c];
+
+        std::vector<GLuint> uintKeys(count);
+        std::vector<GLuint> shortKeys(count);
+        std::vector<GLfloat> floatKeys(count);
+        for(uint i = 0; i < count; ++i)
+        {
+            uintKeys[i] = keyDistribution(generator);
+            shortKeys[i] = uintKeys[i] >> 16;
+            floatKeys[i] = depthDistribution(generator);
+        }
+
+        benchmark<GLuint>("uint32", uintKeys,
+                          [&](Buffer<GLuint>& keys, Buffer<GLuint>& permutation) { return sorter.sort(keys, permutation); },
+                          [&](GLuint* keys, GLuint* permutation) { sorter.sort(keys, permutation, count); });
+
+        benchmark<GLuint>("uint16", shortKeys,
+                          [&](Buffer<GLuint>& keys, Buffer<GLuint>& permutation) { return sorter.sort(keys, permutation, NP_SO_ASCENDING, 16); },
+                          [&](GLuint* keys, GLuint* permutation) { sorter.sort(keys, permutation, count, NP_SO_ASCENDING, 16); });
+
+        benchmark<GLfloat>("float desc", floatKeys,
+                           [&](Buffer<GLfloat>& keys, Buffer<GLuint>& permutation) { return sorter.sort(keys, permutation, NP_SO_DESCENDING); },
+                           [&](GLfloat* keys, GLuint* permutation) { sorter.sort(keys, permutation, count, NP_SO_DESCENDING); });
+    }
+
+    engine->terminate();
+    std::cout << "\nBenchmark completed successfully.\n";
+    return 0;
+}
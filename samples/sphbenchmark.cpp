@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+/**
+ * This application benchmarks the update throughput of the SPHPipeline.
+ *
+ * It subsequentially simulates blocks of water with different particle counts. Each
+ * configuration is warmed up for 10 updates and then updated 50 times. The throughput
+ * is reported in particles updated per second, the time per update is split into the
+ * neighbor grid build and the SPH passes.
+ *
+ * Command line switches:
+ * - -cpu:                Update the particles on the CPU instead of the GPU.
+ * - -max=<count>:        The largest particle count to benchmark. Defaults to 4194304.
+ **/
+
+#include "engine.hpp"
+#include "particlesystem.hpp"
+#include "computesystem.hpp"
+#include "gpuprogramservice.hpp"
+#include "threadpool.hpp"
+#include "sphpipeline.hpp"
+
+#include "cpuclock.hpp"
+
+#include <cmath>
+#include <iostream>
+
+using namespace nparticles;
+
+const uint particleCounts[] =
+{
+    1024,
+    4096,
+    16384,
+    65536,
+    262144,
+    1048576,
+    2097152,
+    4194304
+};
+
+// Clocks
+CPUClock passClock;
+CPUClock totalClock;
+
+// Time variables
+double gridTime;
+double sphTime;
+
+// Benchmark listeners. The grid build ends with the first SPH pass.
+void gridPreUpdateListener(ParticleSystem*, const ComputeSystem*)
+{
+    glFinish();
+    passClock.start();
+}
+
+void sphPreUpdateListener(ParticleSystem*, const ComputeSystem*)
+{
+    glFinish();
+    passClock.stop();
+    gridTime += passClock.getElapsedTime();
+    passClock.start();
+}
+
+void sphPostUpdateListener(ParticleSystem*, const ComputeSystem*)
+{
+    glFinish();
+    passClock.stop();
+    sphTime += passClock.getElapsedTime();
+}
+
+int main(int argc, char* argv[])
+{
+    bool cpuMode = false;
+    uint maxParticleCount = 4194304;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string cliSwitch = argv[i];
+        if(cliSwitch == "-cpu")
+            cpuMode = true;
+        else if(cliSwitch.compare(0, 5, "-max=") == 0)
+            maxParticleCount = std::stoi(cliSwitch.substr(5));
+        else
+        {
+            std::cerr << "No such command line option: " << cliSwitch << ".\n"
+                      << "Available options are:\n"
+                      << "    -cpu\t\tupdate particles on the CPU\n"
+                      << "    -max=<count>\tlargest particle count to benchmark (default: 4194304)\n";
+            return 0;
+        }
+    }
+
+    Engine* engine = Engine::getInstance();
+    engine->init(640, 480, false, false);
+
+    GPUProgramService* gpuService = engine->getGPUProgramService();
+    gpuService->addSourceDirectory("../res/shader/np", "/np");
+
+    if(cpuMode)
+        engine->setComputeBackend(NP_CB_CPU);
+
+    const Material* material = engine->getMaterialManager()->getDefaultMaterial();
+    const Mesh* mesh = engine->getMeshManager()->getDefaultMesh();
+
+    const uint warmUpRuns = 10;
+    const uint runsPerConfiguration = 50;
+
+    std::cout << "\n"
+              << "+----------------------------+\n"
+              << "| SPH pipeline - Benchmark   |\n"
+              << "+----------------------------+\n"
+              << "\n";
+
+    std::cout << "Starting benchmark on the " << (cpuMode ? "CPU" : "GPU");
+    if(cpuMode)
+        std::cout << " (" << engine->getThreadPool().getThreadCount() << " threads)";
+    std::cout << ".\nAll times are given in seconds.\n\n";
+
+    std::cout << "# particles\tgrid build\tSPH passes\ttotal update\tparticles/s\n";
+
+    for(uint c = 0; c < sizeof(particleCounts) / sizeof(particleCounts[0]) && particleCounts[c] <= maxParticleCount; ++c)
+    {
+        // A block of water in the corner of a box twice as wide, so the fluid keeps moving
+        SPHParameters parameters;
+        uint width = std::ceil(std::cbrt((double)particleCounts[c]));
+        float blockSize = width * std::cbrt(parameters.particleMass / parameters.restDensity);
+        parameters.boundsMin = glm::vec3(0, 0, 0);
+        parameters.boundsMax = glm::vec3(2.0f * blockSize, 1.5f * blockSize, 2.0f * blockSize);
+
+        SPHPipeline* pipeline = new SPHPipeline(parameters);
+
+        ParticleSystem* pSys = engine->createParticleSystem(particleCounts[c], *mesh, *material);
+        if(!pipeline->attach(pSys))
+        {
+            engine->terminate();
+            return -1;
+        }
+
+        pipeline->initialiseBlock(pSys, parameters.boundsMin, width);
+
+        for(uint r = 0; r < warmUpRuns; ++r)
+            engine->updateAllParticleSystems();
+
+        // The first action builds the grid, the SPH passes start with the density pass.
+        const ParticleSystem::particle_actions& actions = pSys->getActions();
+        actions.front()->preUpdateSignal.connect(gridPreUpdateListener);
+        actions[actions.size() - 4]->preUpdateSignal.connect(sphPreUpdateListener);
+        actions.back()->postUpdateSignal.connect(sphPostUpdateListener);
+
+        gridTime = 0;
+        sphTime = 0;
+
+        glFinish();
+        totalClock.start();
+
+        for(uint r = 0; r < runsPerConfiguration; ++r)
+            engine->updateAllParticleSystems();
+
+        glFinish();
+        totalClock.stop();
+
+        double updateTime = totalClock.getElapsedTime() / runsPerConfiguration;
+
+        std::cout << particleCounts[c] << "\t"
+                  << gridTime / runsPerConfiguration << "\t"
+                  << sphTime / runsPerConfiguration << "\t"
+                  << updateTime << "\t"
+                  << particleCounts[c] / updateTime << std::endl;
+
+        engine->deleteParticleSystem(pSys);
+        delete pipeline;
+    }
+
+    engine->terminate();
+    std::cout << "\nBenchmark completed successfully.\n";
+    return 0;
+}
@@ -13,7 +13,11 @@ namespace nparticles
 {
 
 Action::Action(ComputeProgram& computeProgram)
-    : mComputeProgram(computeProgram)
+    : mComputeProgram(computeProgram),
+      mIndirectDispatchBuffer(nullptr),
+      mIndirectDispatchOffset(0),
+      mUpdateInterval(1),
+      mUpdatesUntilExecution(0)
 {
 }
 
@@ -21,4 +25,58 @@ Action::~Action()
 {
 }
 
+void Action::addRead(const std::string& bufferName)
+{
+    mReads.insert(bufferName);
+}
+
+void Action::addWrite(const std::string& bufferName)
+{
+    mWrites.insert(bufferName);
+}
+
+void Action::setIndirectDispatchBuffer(const BufferBase* buffer, unsigned offset)
+{
+    mIndirectDispatchBuffer = buffer;
+    mIndirectDispatchOffset = offset;
+}
+
+void Action::setUpdateInterval(unsigned interval)
+{
+    mUpdateInterval = (interval > 0) ? interval : 1;
+    mUpdatesUntilExecution = 0;
+}
+
+bool Action::countUpdate()
+{
+    if(mUpdatesUntilExecution > 0)
+    {
+        --mUpdatesUntilExecution;
+        return false;
+    }
+
+    mUpdatesUntilExecution = mUpdateInterval - 1;
+    return true;
+}
+
+bool Action::conflictsWith(const Action& other) const
+{
+    if(!hasDeclaredAccesses() || !other.hasDeclaredAccesses())
+        return true;
+
+    for(auto& bufferName : mWrites)
+    {
+        if(other.mReads.count(bufferName) || other.mWrites.count(bufferName))
+            return true;
+    }
+
+    for(auto& bufferName : mReads)
+    {
+        if(other.mWrites.count(bufferName))
+            return true;
+    }
+
+    return false;
+}
+
 } // namespace nparticles
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "actiongraph.hpp"
+
+#include "action.hpp"
+#include "particlesystem.hpp"
+
+namespace nparticles
+{
+
+ActionGraph::ActionGraph()
+{
+}
+
+void ActionGraph::clear()
+{
+    mNodes.clear();
+}
+
+unsigned ActionGraph::addAction(ParticleSystem* particleSystem, Action* action, CPUKernel* kernel)
+{
+    unsigned index = mNodes.size();
+
+    Node node;
+    node.particleSystem = particleSystem;
+    node.action = action;
+    node.kernel = kernel;
+
+    for(unsigned i = 0; i < index; ++i)
+    {
+        if(dependsOn(node, mNodes[i]))
+        {
+            node.predecessors.push_back(i);
+            mNodes[i].successors.push_back(index);
+        }
+    }
+
+    mNodes.push_back(node);
+    return index;
+}
+
+bool ActionGraph::dependsOn(const Node& node, const Node& earlier) const
+{
+    if(node.kernel && node.kernel == earlier.kernel)
+        return true;
+
+    if(node.particleSystem != earlier.particleSystem)
+    {
+        // Systems in the same ParticlePool share the attribute storages, which cannot be mapped while the GPU uses them
+        ParticlePool* pool = node.particleSystem->getParticlePool();
+        return pool && pool == earlier.particleSystem->getParticlePool() && (node.kernel == nullptr) != (earlier.kernel == nullptr);
+    }
+
+    // Buffers cannot be mapped for the CPU while the GPU uses them.
+    if((node.kernel == nullptr) != (earlier.kernel == nullptr))
+        return true;
+
+    return node.action->conflictsWith(*earlier.action);
+}
+
+} // namespace nparticles
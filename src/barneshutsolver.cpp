@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "barneshutsolver.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+BarnesHutSolver::BarnesHutSolver(float theta, bool useQuadrupole, float softeningFactor, unsigned leafSize)
+    : GravitySolver(softeningFactor),
+      mTheta(theta),
+      mUseQuadrupole(useQuadrupole),
+      mOctree(leafSize)
+{
+}
+
+void BarnesHutSolver::computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool)
+{
+    mOctree.build(bodies, bodyCount, threadPool);
+
+    if(bodyCount == 0)
+        return;
+
+    // Moments bottom up, one level at a time
+    const std::vector<std::vector<unsigned> >& levels = mOctree.getLevels();
+    mMoments.resize(mOctree.getNodes().size());
+
+    for(unsigned level = levels.size(); level-- > 0;)
+    {
+        const std::vector<unsigned>& nodes = levels[level];
+        threadPool.parallelFor(0, nodes.size(), [&](unsigned first, unsigned last)
+        {
+            for(unsigned n = first; n < last; ++n)
+                computeMoments(nodes[n]);
+        }, 64);
+    }
+
+    const std::vector<unsigned>& leaves = mOctree.getLeaves();
+    threadPool.parallelFor(0, leaves.size(), [&](unsigned first, unsigned last)
+    {
+        InteractionList list;
+
+        for(unsigned l = first; l < last; ++l)
+            evaluateLeaf(leaves[l], accelerations, list);
+    }, 16);
+}
+
+std::string BarnesHutSolver::getName() const
+{
+    std::stringstream name;
+    name << "Barnes-Hut (theta " << mTheta << (mUseQuadrupole ? ", quadrupole" : ", monopole") << ")";
+    return name.str();
+}
+
+void BarnesHutSolver::computeMoments(unsigned nodeIndex)
+{
+    const Octree::Node& node = mOctree.getNodes()[nodeIndex];
+    const std::vector<glm::vec4>& sortedBodies = mOctree.getSortedBodies();
+    Moments& moments = mMoments[nodeIndex];
+
+    float mass = 0;
+    glm::vec3 weightedPosition(0, 0, 0);
+
+    if(node.childCount == 0)
+    {
+        for(unsigned i = node.firstBody; i < node.firstBody + node.bodyCount; ++i)
+        {
+            mass += sortedBodies[i].w;
+            weightedPosition += glm::vec3(sortedBodies[i]) * sortedBodies[i].w;
+        }
+    }
+    else
+    {
+        for(unsigned c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+        {
+            mass += mMoments[c].mass;
+            weightedPosition += mMoments[c].centerOfMass * mMoments[c].mass;
+        }
+    }
+
+    moments.mass = mass;
+    moments.centerOfMass = mass > 0 ? weightedPosition / mass : glm::vec3(sortedBodies[node.firstBody]);
+
+    std::fill(moments.quadrupole, moments.quadrupole + 6, 0.0f);
+    if(!mUseQuadrupole)
+        return;
+
+    // Q_ij = sum m * (3 * x_i * x_j - |x|² * delta_ij), x relative to the center of mass.
+    // Children contribute their own tensor shifted by the parallel axis theorem.
+    auto addPointMass = [&moments](const glm::vec3& x, float m)
+    {
+        float r2 = glm::dot(x, x);
+        moments.quadrupole[0] += m * (3 * x.x * x.x - r2);
+        moments.quadrupole[1] += m * (3 * x.x * x.y);
+        moments.quadrupole[2] += m * (3 * x.x * x.z);
+        moments.quadrupole[3] += m * (3 * x.y * x.y - r2);
+        moments.quadrupole[4] += m * (3 * x.y * x.z);
+        moments.quadrupole[5] += m * (3 * x.z * x.z - r2);
+    };
+
+    if(node.childCount == 0)
+    {
+        for(unsigned i = node.firstBody; i < node.firstBody + node.bodyCount; ++i)
+            addPointMass(glm::vec3(sortedBodies[i]) - moments.centerOfMass, sortedBodies[i].w);
+    }
+    else
+    {
+        for(unsigned c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+        {
+            addPointMass(mMoments[c].centerOfMass - moments.centerOfMass, mMoments[c].mass);
+            for(unsigned q = 0; q < 6; ++q)
+                moments.quadrupole[q] += mMoments[c].quadrupole[q];
+        }
+    }
+}
+
+void BarnesHutSolver::evaluateLeaf(unsigned leafIndex, glm::vec3* accelerations, InteractionList& list) const
+{
+    const float softeningSquare = mSofteningFactor * mSofteningFactor;
+    const float thetaSquare = mTheta * mTheta;
+
+    const std::vector<Octree::Node>& nodes = mOctree.getNodes();
+    const std::vector<glm::vec4>& sortedBodies = mOctree.getSortedBodies();
+
+    const Octree::Node& leaf = nodes[leafIndex];
+    const unsigned leafFirst = leaf.firstBody;
+    const unsigned leafLast = leaf.firstBody + leaf.bodyCount;
+
+    // Bounding box of the leaf's bodies
+    glm::vec3 leafMin(sortedBodies[leafFirst]);
+    glm::vec3 leafMax(sortedBodies[leafFirst]);
+    for(unsigned i = leafFirst + 1; i < leafLast; ++i)
+    {
+        leafMin = glm::min(leafMin, glm::vec3(sortedBodies[i]));
+        leafMax = glm::max(leafMax, glm::vec3(sortedBodies[i]));
+    }
+
+    // Build the interaction list. Nodes are accepted if they are small enough seen from the closest
+    // point of the leaf's bounding box. Their monopoles are treated like bodies of opened leaves.
+    list.x.clear();
+    list.y.clear();
+    list.z.clear();
+    list.mass.clear();
+    for(unsigned c = 0; c < 3; ++c)
+        list.quadrupoleCenter[c].clear();
+    for(unsigned q = 0; q < 6; ++q)
+        list.quadrupole[q].clear();
+
+    // Each visited node pushes at most 8 children, so the stack never exceeds 7 * MAX_LEVEL + 8 entries.
+    unsigned stack[8 * Octree::MAX_LEVEL + 8];
+    unsigned stackSize = 0;
+    stack[stackSize++] = 0;
+
+    while(stackSize > 0)
+    {
+        unsigned nodeIndex = stack[--stackSize];
+        const Octree::Node& node = nodes[nodeIndex];
+        const Moments& moments = mMoments[nodeIndex];
+
+        glm::vec3 distance = glm::max(glm::max(leafMin - moments.centerOfMass, glm::vec3(0, 0, 0)), moments.centerOfMass - leafMax);
+
+        if(node.size * node.size < thetaSquare * glm::dot(distance, distance))
+        {
+            list.x.push_back(moments.centerOfMass.x);
+            list.y.push_back(moments.centerOfMass.y);
+            list.z.push_back(moments.centerOfMass.z);
+            list.mass.push_back(moments.mass);
+
+            if(mUseQuadrupole)
+            {
+                for(unsigned c = 0; c < 3; ++c)
+                    list.quadrupoleCenter[c].push_back(moments.centerOfMass[c]);
+                for(unsigned q = 0; q < 6; ++q)
+                    list.quadrupole[q].push_back(moments.quadrupole[q]);
+            }
+        }
+        else if(node.childCount == 0)
+        {
+            for(unsigned j = node.firstBody; j < node.firstBody + node.bodyCount; ++j)
+            {
+                list.x.push_back(sortedBodies[j].x);
+                list.y.push_back(sortedBodies[j].y);
+                list.z.push_back(sortedBodies[j].z);
+                list.mass.push_back(sortedBodies[j].w);
+            }
+        }
+        else
+        {
+            for(unsigned c = 0; c < node.childCount; ++c)
+                stack[stackSize++] = node.firstChild + c;
+        }
+    }
+
+    // Evaluate the interaction list for each body of the leaf
+    const unsigned listSize = list.x.size();
+    const float* x = list.x.data();
+    const float* y = list.y.data();
+    const float* z = list.z.data();
+    const float* mass = list.mass.data();
+
+    for(unsigned i = leafFirst; i < leafLast; ++i)
+    {
+        const float px = sortedBodies[i].x;
+        const float py = sortedBodies[i].y;
+        const float pz = sortedBodies[i].z;
+
+        float ax = 0, ay = 0, az = 0;
+
+        // Plain loop over structure of arrays, so the compiler can vectorise it.
+        for(unsigned j = 0; j < listSize; ++j)
+        {
+            float rx = x[j] - px;
+            float ry = y[j] - py;
+            float rz = z[j] - pz;
+            float distanceSquare = rx * rx + ry * ry + rz * rz + softeningSquare;
+
+            // Skip self interaction if the softening factor is zero.
+            float inverseDistance = distanceSquare > 0 ? 1.0f / std::sqrt(distanceSquare) : 0.0f;
+            float scale = mass[j] * inverseDistance * inverseDistance * inverseDistance;
+
+            ax += rx * scale;
+            ay += ry * scale;
+            az += rz * scale;
+        }
+
+        // a = Q * d / |d|^5 - 5/2 * (d^T * Q * d) * d / |d|^7 with d pointing from the node to the body.
+        const unsigned quadrupoleCount = list.quadrupole[0].size();
+        const float* cx = list.quadrupoleCenter[0].data();
+        const float* cy = list.quadrupoleCenter[1].data();
+        const float* cz = list.quadrupoleCenter[2].data();
+        const float* qxx = list.quadrupole[0].data();
+        const float* qxy = list.quadrupole[1].data();
+        const float* qxz = list.quadrupole[2].data();
+        const float* qyy = list.quadrupole[3].data();
+        const float* qyz = list.quadrupole[4].data();
+        const float* qzz = list.quadrupole[5].data();
+
+        for(unsigned j = 0; j < quadrupoleCount; ++j)
+        {
+            float dx = px - cx[j];
+            float dy = py - cy[j];
+            float dz = pz - cz[j];
+
+            float qdx = qxx[j] * dx + qxy[j] * dy + qxz[j] * dz;
+            float qdy = qxy[j] * dx + qyy[j] * dy + qyz[j] * dz;
+            float qdz = qxz[j] * dx + qyz[j] * dy + qzz[j] * dz;
+
+            float inverseDistance = 1.0f / std::sqrt(dx * dx + dy * dy + dz * dz + softeningSquare);
+            float inverseDistance2 = inverseDistance * inverseDistance;
+            float inverseDistance5 = inverseDistance2 * inverseDistance2 * inverseDistance;
+            float radial = 2.5f * (dx * qdx + dy * qdy + dz * qdz) * inverseDistance5 * inverseDistance2;
+
+            ax += qdx * inverseDistance5 - dx * radial;
+            ay += qdy * inverseDistance5 - dy * radial;
+            az += qdz * inverseDistance5 - dz * radial;
+        }
+
+        glm::vec3 acceleration(ax, ay, az);
+        accelerations[mOctree.getBodyIndex(i)] = acceleration;
+    }
+}
+
+} // namespace nparticles
@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "blocktimestepper.hpp"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "engine.hpp"
+#include "particlesystem.hpp"
+#include "computeprogram.hpp"
+#include "computesystem.hpp"
+#include "gpuprogramservice.hpp"
+#include "cpukernel.hpp"
+#include "threadpool.hpp"
+#include "logger.hpp"
+
+namespace nparticles
+{
+
+const char* const BlockTimeStepper::RUNGS_BUFFER = "NPBlockRungs";
+const char* const BlockTimeStepper::ACTIVE_INDICES_BUFFER = "NPBlockActiveIndices";
+const char* const BlockTimeStepper::DISPATCH_BUFFER = "NPBlockDispatch";
+
+const unsigned BlockTimeStepper::UNASSIGNED_RUNG = 0xFFFFFFFF;
+const unsigned BlockTimeStepper::KICK_GROUP_SIZE = 128;
+
+namespace
+{
+
+/**
+ * Base class of the CPU kernels of the time stepper. The time stepper and the sub-step are set by the
+ * pre update listener of the Action, so one kernel serves all BlockTimeSteppers.
+ */
+class BlockCPUKernel : public CPUKernel
+{
+public:
+    BlockCPUKernel(unsigned grainSize)
+        : CPUKernel(kernel_function(), grainSize),
+          mStepper(nullptr),
+          mSubStep(0)
+    {
+    }
+
+    void setStepper(const BlockTimeStepper* stepper, unsigned subStep)
+    {
+        mStepper = stepper;
+        mSubStep = subStep;
+    }
+
+protected:
+    glm::vec4* getPositions(ParticleSystem* particleSystem) const
+    {
+        return ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(mStepper->getPositionsAttribute()))->map();
+    }
+
+    glm::vec4* getVelocities(ParticleSystem* particleSystem) const
+    {
+        return ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(mStepper->getVelocitiesAttribute()))->map();
+    }
+
+    GLuint* getStorage(ParticleSystem* particleSystem, const char* name) const
+    {
+        return ((Buffer<GLuint>*)particleSystem->getStorageBuffer(name))->map();
+    }
+
+    const BlockTimeStepper* mStepper;
+    unsigned mSubStep;
+};
+
+/**
+ * CPU counterpart of block-compact.glsl. The list is compacted sequentially in beginUpdate(), so the active
+ * particles stay in index order. There is no per particle work.
+ */
+class BlockCompactKernel : public BlockCPUKernel
+{
+public:
+    BlockCompactKernel()
+        : BlockCPUKernel(std::numeric_limits<unsigned>::max())
+    {
+    }
+
+    void beginUpdate(ParticleSystem* particleSystem, ThreadPool&)
+    {
+        GLuint* rungs = getStorage(particleSystem, BlockTimeStepper::RUNGS_BUFFER);
+        GLuint* activeIndices = getStorage(particleSystem, BlockTimeStepper::ACTIVE_INDICES_BUFFER);
+        GLuint* dispatch = getStorage(particleSystem, BlockTimeStepper::DISPATCH_BUFFER);
+
+        unsigned activeCount = 0;
+        for(unsigned i = 0; i < particleSystem->getParticleCount(); ++i)
+        {
+            if(mStepper->isActive(rungs[i], mSubStep))
+                activeIndices[activeCount++] = i;
+        }
+
+        dispatch[0] = (activeCount + BlockTimeStepper::KICK_GROUP_SIZE - 1) / BlockTimeStepper::KICK_GROUP_SIZE;
+        dispatch[3] = activeCount;
+    }
+
+    unsigned getWorkItemCount(ParticleSystem*) const
+    {
+        return 0;
+    }
+};
+
+/**
+ * CPU counterpart of block-kick.glsl. Only the active particles are processed, each of them sums the
+ * accelerations of all particles.
+ */
+class BlockKickKernel : public BlockCPUKernel
+{
+public:
+    BlockKickKernel()
+        : BlockCPUKernel(16)
+    {
+    }
+
+    unsigned getWorkItemCount(ParticleSystem* particleSystem) const
+    {
+        return getStorage(particleSystem, BlockTimeStepper::DISPATCH_BUFFER)[3];
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const glm::vec4* positions = getPositions(particleSystem);
+        glm::vec4* velocities = getVelocities(particleSystem);
+        GLuint* rungs = getStorage(particleSystem, BlockTimeStepper::RUNGS_BUFFER);
+        const GLuint* activeIndices = getStorage(particleSystem, BlockTimeStepper::ACTIVE_INDICES_BUFFER);
+
+        const unsigned particleCount = particleSystem->getParticleCount();
+        const float softeningSquare = mStepper->getParameters().softening * mStepper->getParameters().softening;
+
+        for(unsigned slot = first; slot < last; ++slot)
+        {
+            const unsigned particle = activeIndices[slot];
+            const glm::vec3 position(positions[particle]);
+
+            glm::vec3 acceleration(0, 0, 0);
+            for(unsigned i = 0; i < particleCount; ++i)
+            {
+                glm::vec3 r = glm::vec3(positions[i]) - position;
+                float distanceSquare = glm::dot(r, r) + softeningSquare;
+                acceleration += r * (positions[i].w / std::sqrt(distanceSquare * distanceSquare * distanceSquare));
+            }
+
+            const unsigned oldRung = rungs[particle];
+            const unsigned newRung = mStepper->selectRung(glm::length(acceleration), oldRung, mSubStep);
+
+            // Close the half kick of the previous step and open the half kick of the next one
+            float oldTimeStep = (oldRung == BlockTimeStepper::UNASSIGNED_RUNG) ? 0.0f : mStepper->getRungTimeStep(oldRung);
+            float kickTime = 0.5f * (oldTimeStep + mStepper->getRungTimeStep(newRung));
+
+            velocities[particle] += glm::vec4(acceleration * kickTime, 0);
+            rungs[particle] = newRung;
+        }
+    }
+};
+
+/**
+ * CPU counterpart of block-drift.glsl.
+ */
+class BlockDriftKernel : public BlockCPUKernel
+{
+public:
+    BlockDriftKernel()
+        : BlockCPUKernel(4096)
+    {
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        glm::vec4* positions = getPositions(particleSystem);
+        const glm::vec4* velocities = getVelocities(particleSystem);
+        const float timeStep = mStepper->getParameters().timeStep;
+
+        for(unsigned i = first; i < last; ++i)
+            positions[i] += glm::vec4(glm::vec3(velocities[i]) * timeStep, 0);
+    }
+
+    void endUpdate(ParticleSystem* particleSystem, ThreadPool&)
+    {
+        GLuint* dispatch = getStorage(particleSystem, BlockTimeStepper::DISPATCH_BUFFER);
+        dispatch[0] = 0;
+        dispatch[3] = 0;
+    }
+};
+
+/**
+ * Get a compute program of the time stepper. The program is created and its CPU kernel registered on first use.
+ */
+template<typename Kernel>
+ComputeProgram* getBlockProgram(const std::string& id, const std::string& sourceFile)
+{
+    Engine* engine = Engine::getInstance();
+    GPUProgramService* gpuService = engine->getGPUProgramService();
+
+    ComputeProgram* computeProgram = gpuService->getComputeProgram(id);
+    if(computeProgram)
+        return computeProgram;
+
+    computeProgram = gpuService->createComputeProgram(id, sourceFile);
+    if(!computeProgram)
+        return nullptr;
+
+    engine->getComputeSystem().registerCPUKernel(*computeProgram, new Kernel());
+    return computeProgram;
+}
+
+} // anonymous namespace
+
+BlockTimeStepParameters::BlockTimeStepParameters()
+    : timeStep(0.001f),
+      maxRung(5),
+      accuracy(0.025f),
+      softening(0.1f)
+{
+}
+
+BlockTimeStepper::BlockTimeStepper(const BlockTimeStepParameters& parameters, const std::string& positionsAttribute, const std::string& velocitiesAttribute)
+    : mParameters(parameters),
+      mPositionsAttribute(positionsAttribute),
+      mVelocitiesAttribute(velocitiesAttribute)
+{
+    // The sub-step counts to 2^maxRung in an unsigned integer
+    if(mParameters.maxRung > 30)
+    {
+        Logger::getInstance()->logWarning("BlockTimeStepper: maximum rung clamped to 30.");
+        mParameters.maxRung = 30;
+    }
+}
+
+bool BlockTimeStepper::attach(ParticleSystem* particleSystem)
+{
+    if(particleSystem->getStorageBuffer(RUNGS_BUFFER))
+    {
+        Logger::getInstance()->logWarning("BlockTimeStepper: particle system already has a block time stepper.");
+        return false;
+    }
+
+    if(!particleSystem->getParticleAttributeBuffer(mPositionsAttribute) || !particleSystem->getParticleAttributeBuffer(mVelocitiesAttribute))
+    {
+        Logger::getInstance()->logWarning("BlockTimeStepper: particle system has no attribute \"" + mPositionsAttribute + "\" or \"" + mVelocitiesAttribute + "\".");
+        return false;
+    }
+
+    ComputeProgram* compactProgram = getBlockProgram<BlockCompactKernel>("np-block-compact", "/np/block-compact.glsl");
+    ComputeProgram* kickProgram = getBlockProgram<BlockKickKernel>("np-block-kick", "/np/block-kick.glsl");
+    ComputeProgram* driftProgram = getBlockProgram<BlockDriftKernel>("np-block-drift", "/np/block-drift.glsl");
+
+    if(!compactProgram || !kickProgram || !driftProgram)
+    {
+        Logger::getInstance()->logWarning("BlockTimeStepper: cannot create compute programs. Is \"/np\" added to the GPUProgramService?");
+        return false;
+    }
+
+    const unsigned particleCount = particleSystem->getParticleCount();
+
+    std::vector<GLuint> rungs(particleCount, UNASSIGNED_RUNG);
+    GLuint dispatch[4] = {0, 1, 1, 0};
+
+    particleSystem->addStorageBuffer<GLuint>(RUNGS_BUFFER, particleCount, GL_UNSIGNED_INT, 1)->setData(rungs.data());
+    particleSystem->addStorageBuffer<GLuint>(ACTIVE_INDICES_BUFFER, particleCount, GL_UNSIGNED_INT, 1);
+    BufferBase* dispatchBuffer = particleSystem->addStorageBuffer<GLuint>(DISPATCH_BUFFER, 4, GL_UNSIGNED_INT, 1);
+    ((Buffer<GLuint>*)dispatchBuffer)->setData(dispatch);
+
+    mSubSteps[particleSystem] = 0;
+
+    for(ComputeProgram* computeProgram : {compactProgram, kickProgram, driftProgram})
+    {
+        Action* action = particleSystem->appendAction(*computeProgram);
+
+        action->preUpdateSignal.connect([this, computeProgram](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+        {
+            setUniforms(*computeProgram, particleSystem);
+
+            BlockCPUKernel* kernel = (BlockCPUKernel*)computeSystem->getCurrentCPUKernel();
+            if(kernel)
+            {
+                kernel->setStepper(this, getSubStep(particleSystem));
+            }
+            else
+            {
+                computeProgram->bindShaderStorageBuffer("NPBlockPositions", particleSystem->getParticleAttributeBuffer(mPositionsAttribute));
+                computeProgram->bindShaderStorageBuffer("NPBlockVelocities", particleSystem->getParticleAttributeBuffer(mVelocitiesAttribute));
+            }
+        });
+    }
+
+    // Declare the buffer accesses of the passes (see ActionGraph)
+    const ParticleSystem::particle_actions& actions = particleSystem->getActions();
+    Action* compactAction = actions[actions.size() - 3];
+    Action* kickAction = actions[actions.size() - 2];
+    Action* driftAction = actions.back();
+
+    compactAction->addRead(RUNGS_BUFFER);
+    compactAction->addWrite(ACTIVE_INDICES_BUFFER);
+    compactAction->addWrite(DISPATCH_BUFFER);
+
+    kickAction->addRead(mPositionsAttribute);
+    kickAction->addRead(ACTIVE_INDICES_BUFFER);
+    kickAction->addRead(DISPATCH_BUFFER);
+    kickAction->addWrite(mVelocitiesAttribute);
+    kickAction->addWrite(RUNGS_BUFFER);
+
+    driftAction->addRead(mVelocitiesAttribute);
+    driftAction->addWrite(mPositionsAttribute);
+    driftAction->addWrite(DISPATCH_BUFFER);
+
+    // Only the compacted particles are kicked
+    kickAction->setIndirectDispatchBuffer(dispatchBuffer);
+
+    driftAction->postUpdateSignal.connect([this](ParticleSystem* particleSystem, const ComputeSystem*)
+    {
+        advanceSubStep(particleSystem);
+    });
+
+    return true;
+}
+
+void BlockTimeStepper::setUniforms(const ShaderProgram& program, ParticleSystem* particleSystem) const
+{
+    program.setUniform("npBlockParticleCount", particleSystem->getParticleCount());
+    program.setUniform("npBlockSubStep", getSubStep(particleSystem));
+    program.setUniform("npBlockMaxRung", mParameters.maxRung);
+    program.setUniform("npBlockTimeStep", mParameters.timeStep);
+    program.setUniform("npBlockAccuracy", mParameters.accuracy);
+    program.setUniform("npBlockSoftening", mParameters.softening);
+}
+
+float BlockTimeStepper::getRungTimeStep(unsigned rung) const
+{
+    return mParameters.timeStep * (float)(1u << (mParameters.maxRung - rung));
+}
+
+unsigned BlockTimeStepper::selectRung(float acceleration, unsigned oldRung, unsigned subStep) const
+{
+    int rung = 0;
+    if(acceleration > 0.0f)
+    {
+        float criterion = std::sqrt(2.0f * mParameters.accuracy * mParameters.softening / acceleration);
+        float largestTimeStep = getRungTimeStep(0);
+        rung = std::ceil(std::log2(largestTimeStep / criterion));
+        rung = std::min(std::max(rung, 0), (int)mParameters.maxRung);
+    }
+
+    // Coarser rungs are only allowed if they are synchronised with the current sub-step
+    unsigned limit = (oldRung == UNASSIGNED_RUNG) ? mParameters.maxRung : oldRung;
+    while((unsigned)rung < limit && !isActive(rung, subStep))
+        ++rung;
+
+    return rung;
+}
+
+bool BlockTimeStepper::isActive(unsigned rung, unsigned subStep) const
+{
+    if(rung == UNASSIGNED_RUNG)
+        return true;
+
+    return (subStep & ((1u << (mParameters.maxRung - rung)) - 1u)) == 0;
+}
+
+unsigned BlockTimeStepper::getSubStep(ParticleSystem* particleSystem) const
+{
+    auto subStepIter = mSubSteps.find(particleSystem);
+    if(subStepIter == mSubSteps.end())
+        return 0;
+
+    return subStepIter->second;
+}
+
+void BlockTimeStepper::advanceSubStep(ParticleSystem* particleSystem)
+{
+    unsigned& subStep = mSubSteps[particleSystem];
+    subStep = (subStep + 1) & ((1u << mParameters.maxRung) - 1u);
+}
+
+} // namespace nparticles
@@ -9,23 +9,62 @@
 
 #include "buffer.hpp"
 
+#include <algorithm>
+#include <cstring>
+
 namespace nparticles
 {
 
-BufferBase::BufferBase(int itemCount)
+BufferBase::BufferBase(int itemCount, GLsizeiptr itemSize)
     : mBufferHandle(0),
+      mStorageOffset(0),
+      mOwnsStorage(true),
+      mStorage(nullptr),
+      mMappedViewCount(0),
       mItemCount(itemCount),
+      mItemSize(itemSize),
       mGlTypeInfo(GL_INVALID_ENUM, -1),
+      mMapPointer(nullptr),
+      mBindOffset(0),
+      mBindSize(0),
+      mMapOffset(0),
+      mMapSize(0),
       mCurrentlyBound(false),
       mCurrentTarget(0),
       mCurrentIndex(0)
 {
-    glGenBuffers(1, &mBufferHandle);
+    // Names created by glGenBuffers() are no buffer objects until they are bound
+    if(GlState::getInstance()->usesDirectStateAccess())
+        glCreateBuffers(1, &mBufferHandle);
+    else
+        glGenBuffers(1, &mBufferHandle);
+}
+
+BufferBase::BufferBase(BufferBase& storage, GLintptr offset, int itemCount, GLsizeiptr itemSize)
+    : mBufferHandle(storage.mBufferHandle),
+      mStorageOffset(storage.mStorageOffset + offset),
+      mOwnsStorage(false),
+      mStorage(storage.mStorage ? storage.mStorage : &storage),
+      mMappedViewCount(0),
+      mItemCount(itemCount),
+      mItemSize(itemSize),
+      mGlTypeInfo(storage.mGlTypeInfo),
+      mMapPointer(nullptr),
+      mBindOffset(storage.mStorageOffset + offset),
+      mBindSize(itemCount * itemSize),
+      mMapOffset(0),
+      mMapSize(0),
+      mCurrentlyBound(false),
+      mCurrentTarget(0),
+      mCurrentIndex(0)
+{
+    // Views bind only their range, so bindBase() and bindBases() need no special handling
 }
 
 BufferBase::~BufferBase()
 {
-    glDeleteBuffers(1, &mBufferHandle);
+    if(mOwnsStorage)
+        GlState::getInstance()->deleteBuffer(mBufferHandle);
 }
 
 void BufferBase::bind(GLenum target)
@@ -33,7 +72,10 @@ void BufferBase::bind(GLenum target)
     // First unbind if necessary.
     unbind();
 
-    glBindBuffer(target, mBufferHandle);
+    if(!mDirtyRanges.empty())
+        uploadDirtyRanges();
+
+    GlState::getInstance()->bindBuffer(target, mBufferHandle);
 
     mCurrentTarget = target;
     mCurrentIndex = 0;
@@ -45,22 +87,358 @@ void BufferBase::bindBase(GLenum target, GLuint index)
     // First unbind if necessary;
     unbind();
 
-    glBindBufferBase(target, index, mBufferHandle);
+    if(!mDirtyRanges.empty())
+        uploadDirtyRanges();
+
+    if(mBindSize > 0)
+        GlState::getInstance()->bindBufferRange(target, index, mBufferHandle, mBindOffset, mBindSize);
+    else
+        GlState::getInstance()->bindBufferBase(target, index, mBufferHandle);
 
     mCurrentTarget = target;
     mCurrentIndex = index;
     mCurrentlyBound = true;
 }
 
+void BufferBase::bindBases(GLenum target, GLuint first, GLsizei count, BufferBase* const* buffers)
+{
+    if(!GLEW_ARB_multi_bind)
+    {
+        for(GLsizei i = 0; i < count; ++i)
+            buffers[i]->bindBase(target, first + i);
+        return;
+    }
+
+    std::vector<GLuint> handles(count);
+    std::vector<GLintptr> offsets(count);
+    std::vector<GLsizeiptr> sizes(count);
+    bool ranged = false;
+
+    for(GLsizei i = 0; i < count; ++i)
+    {
+        BufferBase* buffer = buffers[i];
+        buffer->unbind();
+
+        if(!buffer->mDirtyRanges.empty())
+            buffer->uploadDirtyRanges();
+
+        handles[i] = buffer->mBufferHandle;
+        offsets[i] = buffer->mBindOffset;
+        sizes[i] = buffer->mBindSize > 0 ? buffer->mBindSize : buffer->mItemCount * buffer->mItemSize;
+        ranged = ranged || buffer->mBindSize > 0;
+
+        buffer->mCurrentTarget = target;
+        buffer->mCurrentIndex = first + i;
+        buffer->mCurrentlyBound = true;
+    }
+
+    // Ranges are only needed for buffers consisting of several regions
+    if(ranged)
+        GlState::getInstance()->bindBuffers(target, first, count, handles.data(), offsets.data(), sizes.data());
+    else
+        GlState::getInstance()->bindBuffers(target, first, count, handles.data());
+}
+
+void BufferBase::allocateStorage(GLenum target, GLenum usage, bool clientStorage)
+{
+    GlState* glState = GlState::getInstance();
+
+    if(glState->usesDirectStateAccess())
+    {
+        // Immutable storage has no usage hint. Only staging buffers opt into client memory, buffers read by shaders
+        // stay in device memory even if the application maps them.
+        GLbitfield flags = GL_DYNAMIC_STORAGE_BIT | GL_MAP_READ_BIT | GL_MAP_WRITE_BIT;
+        if(clientStorage)
+            flags |= GL_CLIENT_STORAGE_BIT;
+
+        glNamedBufferStorage(mBufferHandle, mItemCount * mItemSize, nullptr, flags);
+        return;
+    }
+
+    // Safe OpenGL buffer binding. The shadowed binding is exact, even for element arrays bound to a vertex array.
+    GLuint previouslyBoundBuffer = glState->getBoundBuffer(target);
+
+    glState->bindBuffer(target, mBufferHandle);
+    glBufferData(target, mItemCount * mItemSize, nullptr, usage);
+
+    // Restore OpenGL buffer binding
+    glState->bindBuffer(target, previouslyBoundBuffer);
+}
+
+void BufferBase::setDataRaw(GLintptr offset, GLsizeiptr size, const void* data)
+{
+    if(GlState::getInstance()->usesDirectStateAccess())
+    {
+        glNamedBufferSubData(mBufferHandle, mStorageOffset + offset, size, data);
+        return;
+    }
+
+    GlState::getInstance()->bindBuffer(GL_COPY_WRITE_BUFFER, mBufferHandle);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, mStorageOffset + offset, size, data);
+}
+
+void* BufferBase::mapRaw()
+{
+    if(mMapPointer)
+    {
+        if(mMapOffset != 0 || mMapSize != mItemCount * mItemSize)
+        {
+            Logger::getInstance()->logWarning("Buffer: cannot map the whole buffer while a range of it is mapped.");
+            return nullptr;
+        }
+        return mMapPointer;
+    }
+
+    return mapRangeRaw(0, mItemCount * mItemSize, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+}
+
+void* BufferBase::mapRangeRaw(GLintptr offset, GLsizeiptr size, GLbitfield access)
+{
+    if(mMapPointer)
+    {
+        Logger::getInstance()->logWarning("Buffer: cannot map a range of a buffer which is already mapped.");
+        return nullptr;
+    }
+
+    if(offset < 0 || size <= 0 || offset + size > mItemCount * mItemSize)
+    {
+        Logger::getInstance()->logWarning("Buffer: attempt to map a range outside of the buffer.");
+        return nullptr;
+    }
+
+    uploadDirtyRanges();
+
+    // Views share the mapping of the whole storage, since OpenGL maps only one range of a buffer at a time
+    if(mStorage)
+    {
+        const GLsizeiptr storageSize = mStorage->mItemCount * mStorage->mItemSize;
+        if(!mStorage->mMapPointer)
+        {
+            if(!mStorage->mapRangeRaw(0, storageSize, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT))
+                return nullptr;
+        }
+        else if(mStorage->mMappedViewCount == 0)
+        {
+            Logger::getInstance()->logWarning("Buffer: cannot map a view while its storage is mapped directly.");
+            return nullptr;
+        }
+
+        ++mStorage->mMappedViewCount;
+        mMapPointer = static_cast<char*>(mStorage->mMapPointer) + mStorageOffset + offset;
+        mMapOffset = offset;
+        mMapSize = size;
+        return mMapPointer;
+    }
+
+    if(GlState::getInstance()->usesDirectStateAccess())
+        mMapPointer = glMapNamedBufferRange(mBufferHandle, mStorageOffset + offset, size, access);
+    else
+    {
+        GlState::getInstance()->bindBuffer(GL_COPY_READ_BUFFER, mBufferHandle);
+        mMapPointer = glMapBufferRange(GL_COPY_READ_BUFFER, mStorageOffset + offset, size, access);
+    }
+
+    mMapOffset = offset;
+    mMapSize = size;
+    return mMapPointer;
+}
+
+void BufferBase::flushMappedRangeRaw(GLintptr offset, GLsizeiptr size)
+{
+    if(!mMapPointer || offset < mMapOffset || offset + size > mMapOffset + mMapSize)
+    {
+        Logger::getInstance()->logWarning("Buffer: attempt to flush a range which is not mapped.");
+        return;
+    }
+
+    // The shared mapping of a view is not flushed explicitly
+    if(mStorage)
+        return;
+
+    // The offset is relative to the mapped range
+    if(GlState::getInstance()->usesDirectStateAccess())
+        glFlushMappedNamedBufferRange(mBufferHandle, offset - mMapOffset, size);
+    else
+    {
+        GlState::getInstance()->bindBuffer(GL_COPY_READ_BUFFER, mBufferHandle);
+        glFlushMappedBufferRange(GL_COPY_READ_BUFFER, offset - mMapOffset, size);
+    }
+}
+
+void BufferBase::unmap()
+{
+    if(!mMapPointer)
+        return;
+
+    if(mStorage)
+    {
+        mMapPointer = nullptr;
+        mMapOffset = 0;
+        mMapSize = 0;
+
+        // The storage stays mapped while other views use the mapping
+        if(--mStorage->mMappedViewCount == 0)
+            mStorage->unmap();
+        return;
+    }
+
+    if(GlState::getInstance()->usesDirectStateAccess())
+        glUnmapNamedBuffer(mBufferHandle);
+    else
+    {
+        GlState::getInstance()->bindBuffer(GL_COPY_READ_BUFFER, mBufferHandle);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+    }
+
+    mMapPointer = nullptr;
+    mMapOffset = 0;
+    mMapSize = 0;
+}
+
+void BufferBase::copyData(const BufferBase& source)
+{
+    // The copy overwrites this buffer, the edits of the source have to be copied along
+    discardDirtyRanges();
+    source.uploadDirtyRanges();
+
+    copyRange(source, 0, 0, mItemCount * mItemSize);
+}
+
+void BufferBase::copyData(const BufferBase& source, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+{
+    source.uploadDirtyRanges();
+    uploadDirtyRanges();
+
+    copyRange(source, readOffset, writeOffset, size);
+}
+
+void BufferBase::clearData()
+{
+    discardDirtyRanges();
+
+    clearData(0, mItemCount * mItemSize);
+}
+
+void BufferBase::clearData(GLintptr offset, GLsizeiptr size)
+{
+    if(offset < 0 || size <= 0 || offset + size > mItemCount * mItemSize)
+    {
+        Logger::getInstance()->logWarning("Buffer: attempt to clear a range outside of the buffer.");
+        return;
+    }
+
+    uploadDirtyRanges();
+
+    // Views clear only their range of the storage
+    if(GlState::getInstance()->usesDirectStateAccess())
+    {
+        glClearNamedBufferSubData(mBufferHandle, GL_R8UI, mStorageOffset + offset, size, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+        return;
+    }
+
+    GlState::getInstance()->bindBuffer(GL_COPY_WRITE_BUFFER, mBufferHandle);
+    glClearBufferSubData(GL_COPY_WRITE_BUFFER, GL_R8UI, mStorageOffset + offset, size, GL_RED_INTEGER, GL_UNSIGNED_BYTE, nullptr);
+}
+
+void* BufferBase::editRangeRaw(GLintptr offset, GLsizeiptr size)
+{
+    if(offset < 0 || size <= 0 || offset + size > mItemCount * mItemSize)
+    {
+        Logger::getInstance()->logWarning("Buffer: attempt to edit a range outside of the buffer.");
+        return nullptr;
+    }
+
+    // The ranges neither overlap nor touch, so their ends are sorted as well. Find the ones touching the new range.
+    auto first = std::lower_bound(mDirtyRanges.begin(), mDirtyRanges.end(), offset,
+                                  [](const DirtyRange& range, GLintptr value) { return range.offset + (GLintptr)range.data.size() < value; });
+    auto last = first;
+    while(last != mDirtyRanges.end() && last->offset <= offset + size)
+        ++last;
+
+    if(first == last)
+    {
+        first = mDirtyRanges.insert(first, DirtyRange());
+        first->offset = offset;
+        first->data.resize(size);
+        return first->data.data();
+    }
+
+    // Merge the touched ranges and the new range into the first touched range
+    const GLintptr begin = std::min(offset, first->offset);
+    const GLintptr end = std::max(offset + size, (last - 1)->offset + (GLintptr)(last - 1)->data.size());
+
+    std::vector<char> merged(end - begin);
+    for(auto range = first; range != last; ++range)
+        std::memcpy(merged.data() + (range->offset - begin), range->data.data(), range->data.size());
+
+    first->offset = begin;
+    first->data.swap(merged);
+    mDirtyRanges.erase(first + 1, last);
+
+    return first->data.data() + (offset - begin);
+}
+
+void BufferBase::uploadDirtyRanges() const
+{
+    if(mDirtyRanges.empty())
+        return;
+
+    // The storage of a view may be mapped by other views, the edits are written through the mapping then
+    if(mStorage && mStorage->mMapPointer && mStorage->mMappedViewCount > 0)
+    {
+        for(const auto& range : mDirtyRanges)
+            std::memcpy(static_cast<char*>(mStorage->mMapPointer) + mStorageOffset + range.offset, range.data.data(), range.data.size());
+
+        mDirtyRanges.clear();
+        return;
+    }
+
+    if(mMapPointer)
+    {
+        Logger::getInstance()->logWarning("Buffer: cannot upload dirty ranges while the buffer is mapped.");
+        return;
+    }
+
+    if(GlState::getInstance()->usesDirectStateAccess())
+    {
+        for(const auto& range : mDirtyRanges)
+            glNamedBufferSubData(mBufferHandle, mStorageOffset + range.offset, range.data.size(), range.data.data());
+    }
+    else
+    {
+        GlState::getInstance()->bindBuffer(GL_COPY_WRITE_BUFFER, mBufferHandle);
+        for(const auto& range : mDirtyRanges)
+            glBufferSubData(GL_COPY_WRITE_BUFFER, mStorageOffset + range.offset, range.data.size(), range.data.data());
+    }
+
+    mDirtyRanges.clear();
+}
+
+void BufferBase::copyRange(const BufferBase& source, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size)
+{
+    if(GlState::getInstance()->usesDirectStateAccess())
+    {
+        glCopyNamedBufferSubData(source.mBufferHandle, mBufferHandle, source.mStorageOffset + readOffset, mStorageOffset + writeOffset, size);
+        return;
+    }
+
+    GlState* glState = GlState::getInstance();
+    glState->bindBuffer(GL_COPY_READ_BUFFER, source.mBufferHandle);
+    glState->bindBuffer(GL_COPY_WRITE_BUFFER, mBufferHandle);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, source.mStorageOffset + readOffset, mStorageOffset + writeOffset, size);
+}
+
 void BufferBase::unbind()
 {
     if(!mCurrentlyBound)
         return;
 
     if(mCurrentIndex > 0)
-        glBindBufferBase(mCurrentTarget, mCurrentIndex, 0);
+        GlState::getInstance()->bindBufferBase(mCurrentTarget, mCurrentIndex, 0);
     else
-        glBindBuffer(mCurrentTarget, 0);
+        GlState::getInstance()->bindBuffer(mCurrentTarget, 0);
+
+    mCurrentlyBound = false;
 }
 
 }
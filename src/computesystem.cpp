@@ -12,47 +12,373 @@
 #include "particlesystem.hpp"
 #include "action.hpp"
 #include "computeprogram.hpp"
+#include "cpukernel.hpp"
+#include "glstate.hpp"
+
+#include <algorithm>
+#include <deque>
 
 namespace nparticles
 {
 
 void ComputeSystem::updateParticleSystem(ParticleSystem* particleSystem)
 {
-    for(auto action : particleSystem->getActions())
+    updateParticleSystems(std::set<ParticleSystem*>{particleSystem});
+}
+
+void ComputeSystem::updateParticleSystems(const std::set<ParticleSystem*>& particleSystems)
+{
+    // Build the dependencies of this update
+    mActionGraph.clear();
+    for(auto particleSystem : particleSystems)
+    {
+        for(auto action : particleSystem->getActions())
+        {
+            // Actions with an update interval are skipped in between
+            if(!action->countUpdate())
+                continue;
+
+            CPUKernel* kernel = nullptr;
+            if(mBackend == NP_CB_CPU)
+                kernel = getCPUKernel(action->getComputeProgram());
+
+            mActionGraph.addAction(particleSystem, action, kernel);
+        }
+    }
+
+    const std::vector<ActionGraph::Node>& nodes = mActionGraph.getNodes();
+
+    // State of the particle systems during the update
+    struct SystemState
+    {
+        unsigned remainingActions = 0;
+        bool attributesMapped = false;
+        bool dispatchedOnGPU = false;
+    };
+    std::map<ParticleSystem*, SystemState> systemStates;
+
+    std::vector<unsigned> pendingPredecessors(nodes.size());
+    std::deque<unsigned> readyNodes;
+    for(unsigned i = 0; i < nodes.size(); ++i)
+    {
+        ++systemStates[nodes[i].particleSystem].remainingActions;
+
+        pendingPredecessors[i] = nodes[i].predecessors.size();
+        if(pendingPredecessors[i] == 0)
+            readyNodes.push_back(i);
+    }
+
+    // A GPU Action's results are visible to other Actions after the next barrier with the bits they read them by.
+    // GPU nodes store the barrier epoch they were dispatched in and each group of barrier bits the epoch after the
+    // last barrier including it, so a dispatch is covered by a group if its epoch is before that.
+    const GLbitfield barrierGroups[] = {GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT,
+                                       GL_COMMAND_BARRIER_BIT,
+                                       GL_ATOMIC_COUNTER_BARRIER_BIT,
+                                       GL_BUFFER_UPDATE_BARRIER_BIT};
+    const unsigned numBarrierGroups = sizeof(barrierGroups) / sizeof(barrierGroups[0]);
+    std::vector<unsigned> groupBarrierEpochs(numBarrierGroups, 1);
+    std::vector<unsigned> dispatchEpochs(nodes.size(), 0);
+    unsigned barrierEpoch = 1;
+    bool anyDispatchedOnGPU = false;
+
+    // Issue a barrier with the groups of the required bits that do not cover a dispatch of the given nodes yet
+    auto issueBarrier = [&](const std::vector<unsigned>& dispatchedNodes, const std::vector<GLbitfield>& requiredBits)
+    {
+        GLbitfield barriers = 0;
+        for(unsigned i = 0; i < dispatchedNodes.size(); ++i)
+        {
+            for(unsigned group = 0; group < numBarrierGroups; ++group)
+            {
+                bool covered = dispatchEpochs[dispatchedNodes[i]] < groupBarrierEpochs[group];
+                if((requiredBits[i] & barrierGroups[group]) && !covered)
+                    barriers |= barrierGroups[group];
+            }
+        }
+
+        if(!barriers)
+            return;
+
+        glMemoryBarrier(barriers);
+        ++barrierEpoch;
+        for(unsigned group = 0; group < numBarrierGroups; ++group)
+        {
+            if(barriers & barrierGroups[group])
+                groupBarrierEpochs[group] = barrierEpoch;
+        }
+    };
+
+    // CPU nodes running on the ThreadPool
+    std::vector<ThreadPool::task_handle> runningTasks;
+    std::vector<unsigned> runningNodes;
+
+    unsigned finishedNodes = 0;
+
+    auto finishNode = [&](unsigned index)
+    {
+        for(auto successor : nodes[index].successors)
+        {
+            if(--pendingPredecessors[successor] == 0)
+                readyNodes.push_back(successor);
+        }
+
+        SystemState& state = systemStates[nodes[index].particleSystem];
+        if(--state.remainingActions == 0 && state.attributesMapped)
+        {
+            mapParticleAttributes(nodes[index].particleSystem, false);
+            state.attributesMapped = false;
+        }
+
+        ++finishedNodes;
+    };
+
+    while(finishedNodes < nodes.size())
+    {
+        // Start all nodes whose predecessors are finished. GPU nodes finish immediately and may add new ready
+        // nodes, so independent dispatches of different systems are issued between two barriers.
+        while(!readyNodes.empty())
+        {
+            unsigned index = readyNodes.front();
+            readyNodes.pop_front();
+
+            const ActionGraph::Node& node = nodes[index];
+            SystemState& state = systemStates[node.particleSystem];
+
+            // Indirect dispatches read their work group counts written by previous Actions as commands. Systems with
+            // a dynamic particle count are dispatched indirectly and read the alive count as atomic counter. CPU
+            // kernels read the data written by the shaders through mapped buffers.
+            GLbitfield requiredBits = GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT;
+            if(!node.kernel && node.action->getIndirectDispatchBuffer())
+                requiredBits |= GL_COMMAND_BARRIER_BIT;
+            if(!node.kernel && node.particleSystem->getAliveCountBuffer())
+                requiredBits |= GL_COMMAND_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT;
+            if(node.kernel)
+                requiredBits |= GL_BUFFER_UPDATE_BARRIER_BIT;
+
+            issueBarrier(node.predecessors, std::vector<GLbitfield>(node.predecessors.size(), requiredBits));
+
+            // Attribute buffers have to be mapped for CPU kernels and must not be mapped while the GPU uses them.
+            if(state.attributesMapped != (node.kernel != nullptr))
+            {
+                state.attributesMapped = (node.kernel != nullptr);
+                mapParticleAttributes(node.particleSystem, state.attributesMapped);
+            }
+
+            if(node.kernel)
+            {
+                mCurrentComputeProgram = &node.action->getComputeProgram();
+                mCurrentCPUKernel = node.kernel;
+
+                // Invoke pre update signal
+                node.action->preUpdateSignal.emit(node.particleSystem, this);
+
+                ParticleSystem* particleSystem = node.particleSystem;
+                CPUKernel* kernel = node.kernel;
+                runningTasks.push_back(mThreadPool.submit([this, particleSystem, kernel]
+                                                          {
+                                                              runCPUKernel(particleSystem, kernel);
+                                                          }));
+                runningNodes.push_back(index);
+            }
+            else
+            {
+                // Systems in the same pool share the attribute storages. Their CPU nodes have finished (see
+                // ActionGraph), but they may still be mapped.
+                ParticlePool* pool = node.particleSystem->getParticlePool();
+                if(pool)
+                {
+                    for(auto& stateIter : systemStates)
+                    {
+                        if(stateIter.second.attributesMapped && stateIter.first->getParticlePool() == pool)
+                        {
+                            mapParticleAttributes(stateIter.first, false);
+                            stateIter.second.attributesMapped = false;
+                        }
+                    }
+                }
+
+                dispatchOnGPU(node.particleSystem, node.action);
+                dispatchEpochs[index] = barrierEpoch;
+                state.dispatchedOnGPU = true;
+                anyDispatchedOnGPU = true;
+
+                finishNode(index);
+            }
+        }
+
+        if(runningTasks.empty())
+            continue;
+
+        // Process jobs until a CPU node is finished
+        unsigned finished = mThreadPool.waitAny(runningTasks);
+        unsigned index = runningNodes[finished];
+
+        runningTasks[finished] = runningTasks.back();
+        runningTasks.pop_back();
+        runningNodes[finished] = runningNodes.back();
+        runningNodes.pop_back();
+
+        mCurrentComputeProgram = &nodes[index].action->getComputeProgram();
+        mCurrentCPUKernel = nodes[index].kernel;
+
+        // Invoke post update signal
+        nodes[index].action->postUpdateSignal.emit(nodes[index].particleSystem, this);
+
+        finishNode(index);
+    }
+
+    if(anyDispatchedOnGPU)
     {
-        mCurrentComputeProgram = &action->getComputeProgram();
-        mCurrentComputeProgram->bind();
+        // Synchronise. The indirect draw commands of systems with a dynamic particle count are read by the RenderSystem.
+        std::vector<unsigned> dispatchedNodes;
+        std::vector<GLbitfield> requiredBits;
+        for(unsigned i = 0; i < nodes.size(); ++i)
+        {
+            if(dispatchEpochs[i] == 0)
+                continue;
 
-        bindParticleBuffers(particleSystem, mCurrentComputeProgram);
+            dispatchedNodes.push_back(i);
+            requiredBits.push_back(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+            if(nodes[i].particleSystem->getAliveCountBuffer())
+                requiredBits.back() |= GL_COMMAND_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT;
+        }
 
-        // Invoke pre update signal
-        action->preUpdateSignal.emit(particleSystem, this);
+        issueBarrier(dispatchedNodes, requiredBits);
 
-        // Activate subroutines. Dot this after the preUpdateSignal so user selected subroutines are activated.
-        mCurrentComputeProgram->activateSubroutines();
+        // Disable compute program
+        GlState::getInstance()->useProgram(0);
+
+        for(auto& stateIter : systemStates)
+        {
+            if(stateIter.second.dispatchedOnGPU)
+                unbindParticleBuffers(stateIter.first);
+        }
+    }
+
+    mCurrentComputeProgram = nullptr;
+    mCurrentCPUKernel = nullptr;
+}
+
+void ComputeSystem::dispatchOnGPU(ParticleSystem* particleSystem, Action* action)
+{
+    mCurrentComputeProgram = &action->getComputeProgram();
+    mCurrentCPUKernel = nullptr;
+    mCurrentComputeProgram->bind();
 
+    bindParticleBuffers(particleSystem, mCurrentComputeProgram);
+
+    // Invoke pre update signal
+    action->preUpdateSignal.emit(particleSystem, this);
+
+    // Activate subroutines. Dot this after the preUpdateSignal so user selected subroutines are activated.
+    mCurrentComputeProgram->activateSubroutines();
+
+    const BufferBase* indirectBuffer = action->getIndirectDispatchBuffer();
+    GLintptr indirectOffset = action->getIndirectDispatchOffset();
+
+    // With a dynamic particle count, the work group counts for the alive particles are kept on the GPU.
+    if(!indirectBuffer && particleSystem->getAliveCountBuffer())
+    {
+        int commandOffset = particleSystem->getDispatchCommandOffset(mCurrentComputeProgram->getNumWorkItemsPerGroup());
+        if(commandOffset >= 0)
+        {
+            indirectBuffer = particleSystem->getAliveCountBuffer();
+            indirectOffset = commandOffset;
+        }
+    }
+
+    if(indirectBuffer)
+    {
+        // Bind the handle directly, so the buffer keeps its shader storage binding. It stays bound, so consecutive
+        // indirect dispatches from the same buffer do not rebind it.
+        GlState::getInstance()->bindBuffer(GL_DISPATCH_INDIRECT_BUFFER, indirectBuffer->getHandle());
+        glDispatchComputeIndirect(indirectOffset);
+    }
+    else
+    {
         // Dispatch enough work groups to cover all particles.
         glDispatchCompute(ceil((float)particleSystem->getParticleCount() / (float)mCurrentComputeProgram->getNumWorkItemsPerGroup()), 1, 1);
+    }
 
-        // Synchronise
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    action->postUpdateSignal.emit(particleSystem, this);
+}
 
-        action->postUpdateSignal.emit(particleSystem, this);
+void ComputeSystem::runCPUKernel(ParticleSystem* particleSystem, CPUKernel* kernel)
+{
+    kernel->beginUpdate(particleSystem, mThreadPool);
+
+    mThreadPool.parallelFor(0, kernel->getWorkItemCount(particleSystem),
+                            [particleSystem, kernel](unsigned first, unsigned last)
+                            {
+                                kernel->update(particleSystem, first, last);
+                            },
+                            kernel->getGrainSize());
+
+    kernel->endUpdate(particleSystem, mThreadPool);
+}
+
+void ComputeSystem::mapParticleAttributes(ParticleSystem* particleSystem, bool mapped)
+{
+    for(auto attributeIter : particleSystem->getParticleAttributeBuffers())
+    {
+        if(mapped)
+            attributeIter.second->mapRaw();
+        else
+            attributeIter.second->unmap();
+    }
+
+    for(auto storageIter : particleSystem->getStorageBuffers())
+    {
+        if(mapped)
+            storageIter.second->mapRaw();
+        else
+            storageIter.second->unmap();
+    }
 
-    } // for(actions)
+    AtomicCounterBuffer* aliveCountBuffer = particleSystem->getAliveCountBuffer();
+    if(aliveCountBuffer)
+    {
+        if(mapped)
+            aliveCountBuffer->mapRaw();
+        else
+            aliveCountBuffer->unmap();
+    }
+}
+
+void ComputeSystem::registerCPUKernel(const ComputeProgram& computeProgram, CPUKernel* kernel)
+{
+    auto kernelIter = mCPUKernels.find(&computeProgram);
+    if(kernelIter != mCPUKernels.end())
+    {
+        Logger::getInstance()->logWarning("ComputeSystem: CPU kernel registered for a compute program which already has one. Previous kernel is deleted!");
+        delete kernelIter->second;
+    }
+
+    mCPUKernels[&computeProgram] = kernel;
+}
+
+CPUKernel* ComputeSystem::getCPUKernel(const ComputeProgram& computeProgram) const
+{
+    auto kernelIter = mCPUKernels.find(&computeProgram);
 
-    // Disable compute program
-    glUseProgram(0);
+    if(kernelIter == mCPUKernels.end())
+        return nullptr;
 
-    unbindParticleBuffers(particleSystem);
+    return kernelIter->second;
 }
 
-ComputeSystem::ComputeSystem()
+ComputeSystem::ComputeSystem(ThreadPool& threadPool)
+    : mCurrentComputeProgram(nullptr),
+      mCurrentCPUKernel(nullptr),
+      mBackend(NP_CB_GPU),
+      mThreadPool(threadPool)
 {
 }
 
 ComputeSystem::~ComputeSystem()
 {
+    for(auto kernelIter : mCPUKernels)
+        delete kernelIter.second;
+    mCPUKernels.clear();
 }
 
 } // namespace nparticles
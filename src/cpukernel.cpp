@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "cpukernel.hpp"
+
+#include "particlesystem.hpp"
+
+namespace nparticles
+{
+
+CPUKernel::CPUKernel(kernel_function function, unsigned grainSize)
+    : mFunction(function),
+      mGrainSize(grainSize)
+{
+}
+
+CPUKernel::~CPUKernel()
+{
+}
+
+void CPUKernel::beginUpdate(ParticleSystem*, ThreadPool&)
+{
+}
+
+unsigned CPUKernel::getWorkItemCount(ParticleSystem* particleSystem) const
+{
+    return particleSystem->getAliveCount();
+}
+
+void CPUKernel::update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+{
+    if(mFunction)
+        mFunction(particleSystem, first, last);
+}
+
+void CPUKernel::endUpdate(ParticleSystem*, ThreadPool&)
+{
+}
+
+} // namespace nparticles
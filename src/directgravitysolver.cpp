@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "directgravitysolver.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+std::string instructionSetToString(instruction_sets instructionSet)
+{
+    switch(instructionSet)
+    {
+    case NP_ISA_SCALAR: return "scalar";
+    case NP_ISA_SSE:    return "SSE";
+    case NP_ISA_AVX2:   return "AVX2";
+    case NP_ISA_AVX512: return "AVX-512";
+    default: return "best";
+    }
+}
+
+instruction_sets getBestInstructionSet()
+{
+    // The SIMD implementations are only compiled on x86 (see src/CMakeLists.txt).
+#ifdef NP_X86_SIMD
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx512f"))
+        return NP_ISA_AVX512;
+
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return NP_ISA_AVX2;
+
+    if(__builtin_cpu_supports("sse"))
+        return NP_ISA_SSE;
+#endif
+
+    return NP_ISA_SCALAR;
+}
+
+DirectGravitySolver::DirectGravitySolver(float softeningFactor, instruction_sets instructionSet)
+    : GravitySolver(softeningFactor),
+      mInstructionSet(instructionSet),
+      mAccelerationFunction(directgravity::computeAccelerationsScalar),
+      mBodies{nullptr, nullptr, nullptr, nullptr, 0}
+{
+    // Fall back to the best supported instruction set if the requested one is not available.
+    instruction_sets bestInstructionSet = getBestInstructionSet();
+    if(mInstructionSet > bestInstructionSet)
+        mInstructionSet = bestInstructionSet;
+
+    switch(mInstructionSet)
+    {
+#ifdef NP_X86_SIMD
+    case NP_ISA_SSE:
+        mAccelerationFunction = directgravity::computeAccelerationsSSE;
+        break;
+    case NP_ISA_AVX2:
+        mAccelerationFunction = directgravity::computeAccelerationsAVX2;
+        break;
+    case NP_ISA_AVX512:
+        mAccelerationFunction = directgravity::computeAccelerationsAVX512;
+        break;
+#endif
+    default:
+        mAccelerationFunction = directgravity::computeAccelerationsScalar;
+        break;
+    }
+}
+
+void DirectGravitySolver::computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool)
+{
+    copyBodies(bodies, bodyCount, threadPool);
+
+    float softeningSquare = mSofteningFactor * mSofteningFactor;
+    threadPool.parallelFor(0, bodyCount, [&](unsigned first, unsigned last)
+    {
+        mAccelerationFunction(mBodies, first, last, softeningSquare, accelerations);
+    }, TARGET_BLOCK_SIZE);
+}
+
+std::string DirectGravitySolver::getName() const
+{
+    return "direct (" + instructionSetToString(mInstructionSet) + ")";
+}
+
+void DirectGravitySolver::copyBodies(const glm::vec4* bodies, unsigned bodyCount, ThreadPool& threadPool)
+{
+    reserve(bodyCount);
+
+    float* x = (float*)mBodies.x;
+    float* y = (float*)mBodies.y;
+    float* z = (float*)mBodies.z;
+    float* mass = (float*)mBodies.mass;
+
+    // Convert to structure of arrays layout
+    threadPool.parallelFor(0, bodyCount, [=](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+        {
+            x[i] = bodies[i].x;
+            y[i] = bodies[i].y;
+            z[i] = bodies[i].z;
+            mass[i] = bodies[i].w;
+        }
+    });
+
+    // Padding bodies are massless and do not contribute to any acceleration.
+    for(unsigned i = bodyCount; i < mBodies.count; ++i)
+    {
+        x[i] = 0;
+        y[i] = 0;
+        z[i] = 0;
+        mass[i] = 0;
+    }
+}
+
+void DirectGravitySolver::reserve(unsigned count)
+{
+    unsigned paddedCount = ((count + TILE_SIZE - 1) / TILE_SIZE) * TILE_SIZE;
+
+    if(paddedCount == mBodies.count)
+        return;
+
+    // Allocate 16 additional floats to align the arrays to 64 bytes.
+    mStorage.resize(4 * paddedCount + 16);
+    float* storage = mStorage.data();
+    storage += (16 - (reinterpret_cast<std::uintptr_t>(storage) / sizeof(float)) % 16) % 16;
+
+    mBodies.x = storage;
+    mBodies.y = storage + paddedCount;
+    mBodies.z = storage + 2 * paddedCount;
+    mBodies.mass = storage + 3 * paddedCount;
+    mBodies.count = paddedCount;
+}
+
+namespace directgravity
+{
+
+void computeAccelerationsScalar(const DirectGravitySolver::BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations)
+{
+    const unsigned blockSize = DirectGravitySolver::TARGET_BLOCK_SIZE;
+    const unsigned tileSize = DirectGravitySolver::TILE_SIZE;
+
+    float ax[blockSize], ay[blockSize], az[blockSize];
+
+    for(unsigned blockFirst = first; blockFirst < last; blockFirst += blockSize)
+    {
+        unsigned blockCount = std::min(blockSize, last - blockFirst);
+
+        std::fill(ax, ax + blockCount, 0.0f);
+        std::fill(ay, ay + blockCount, 0.0f);
+        std::fill(az, az + blockCount, 0.0f);
+
+        // Tiles of attractors stay in the L1 cache while all targets of the block are processed.
+        for(unsigned tile = 0; tile < bodies.count; tile += tileSize)
+        {
+            for(unsigned t = 0; t < blockCount; ++t)
+            {
+                float px = bodies.x[blockFirst + t];
+                float py = bodies.y[blockFirst + t];
+                float pz = bodies.z[blockFirst + t];
+
+                float sumX = 0, sumY = 0, sumZ = 0;
+
+                for(unsigned j = tile; j < tile + tileSize; ++j)
+                {
+                    float rx = bodies.x[j] - px;
+                    float ry = bodies.y[j] - py;
+                    float rz = bodies.z[j] - pz;
+                    float distanceSquare = rx * rx + ry * ry + rz * rz + softeningSquare;
+
+                    // Skip self interaction if the softening factor is zero.
+                    if(distanceSquare > 0)
+                    {
+                        float inverseDistance = 1.0f / std::sqrt(distanceSquare);
+                        float scale = bodies.mass[j] * inverseDistance * inverseDistance * inverseDistance;
+                        sumX += rx * scale;
+                        sumY += ry * scale;
+                        sumZ += rz * scale;
+                    }
+                }
+
+                ax[t] += sumX;
+                ay[t] += sumY;
+                az[t] += sumZ;
+            }
+        }
+
+        for(unsigned t = 0; t < blockCount; ++t)
+            accelerations[blockFirst + t] = glm::vec3(ax[t], ay[t], az[t]);
+    }
+}
+
+} // namespace directgravity
+
+} // namespace nparticles
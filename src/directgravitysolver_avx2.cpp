@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+// AVX2 / FMA implementation of the DirectGravitySolver.
+// Only the functions of this file are compiled for the instruction set (see the target attributes), the inline
+// functions of the included headers are compiled for the baseline instruction set. Otherwise the linker could keep
+// their copies of this file for the whole program.
+
+#include "directgravitysolver.hpp"
+
+#include <algorithm>
+
+#include <immintrin.h>
+
+namespace nparticles
+{
+namespace directgravity
+{
+
+namespace
+{
+
+/**
+ * Accumulate the acceleration of 8 targets caused by one attractor.
+ */
+__attribute__((target("avx2,fma")))
+inline void interact(__m256 px, __m256 py, __m256 pz,
+                     __m256 attractorX, __m256 attractorY, __m256 attractorZ, __m256 attractorMass,
+                     __m256 softeningSquare, __m256& ax, __m256& ay, __m256& az)
+{
+    const __m256 threeHalves = _mm256_set1_ps(1.5f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+
+    __m256 rx = _mm256_sub_ps(attractorX, px);
+    __m256 ry = _mm256_sub_ps(attractorY, py);
+    __m256 rz = _mm256_sub_ps(attractorZ, pz);
+
+    __m256 distanceSquare = _mm256_fmadd_ps(rx, rx, _mm256_fmadd_ps(ry, ry, _mm256_fmadd_ps(rz, rz, softeningSquare)));
+
+    // 12 bit approximation refined by one Newton-Raphson step.
+    __m256 inverseDistance = _mm256_rsqrt_ps(distanceSquare);
+    __m256 halfDistanceSquare = _mm256_mul_ps(half, distanceSquare);
+    inverseDistance = _mm256_mul_ps(inverseDistance, _mm256_fnmadd_ps(_mm256_mul_ps(halfDistanceSquare, inverseDistance), inverseDistance, threeHalves));
+
+    // Mask out self interaction (only relevant if the softening factor is zero).
+    inverseDistance = _mm256_and_ps(inverseDistance, _mm256_cmp_ps(distanceSquare, _mm256_setzero_ps(), _CMP_GT_OQ));
+
+    __m256 scale = _mm256_mul_ps(attractorMass, _mm256_mul_ps(inverseDistance, _mm256_mul_ps(inverseDistance, inverseDistance)));
+
+    ax = _mm256_fmadd_ps(rx, scale, ax);
+    ay = _mm256_fmadd_ps(ry, scale, ay);
+    az = _mm256_fmadd_ps(rz, scale, az);
+}
+
+} // anonymous namespace
+
+__attribute__((target("avx2,fma")))
+void computeAccelerationsAVX2(const DirectGravitySolver::BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations)
+{
+    const unsigned width = 8;
+    const unsigned unroll = 2;
+    const unsigned blockSize = DirectGravitySolver::TARGET_BLOCK_SIZE;
+    const unsigned tileSize = DirectGravitySolver::TILE_SIZE;
+
+    alignas(32) float tx[blockSize], ty[blockSize], tz[blockSize];
+    alignas(32) float ax[blockSize], ay[blockSize], az[blockSize];
+
+    const __m256 eps2 = _mm256_set1_ps(softeningSquare);
+
+    for(unsigned blockFirst = first; blockFirst < last; blockFirst += blockSize)
+    {
+        unsigned blockCount = std::min(blockSize, last - blockFirst);
+        unsigned vectorCount = ((blockCount + width * unroll - 1) / (width * unroll)) * unroll;
+
+        // Stage targets. Unused lanes are zero and their results are discarded.
+        for(unsigned t = 0; t < vectorCount * width; ++t)
+        {
+            bool valid = t < blockCount;
+            tx[t] = valid ? bodies.x[blockFirst + t] : 0.0f;
+            ty[t] = valid ? bodies.y[blockFirst + t] : 0.0f;
+            tz[t] = valid ? bodies.z[blockFirst + t] : 0.0f;
+            ax[t] = ay[t] = az[t] = 0.0f;
+        }
+
+        for(unsigned tile = 0; tile < bodies.count; tile += tileSize)
+        {
+            for(unsigned v = 0; v < vectorCount; v += unroll)
+            {
+                const unsigned o0 = v * width;
+                const unsigned o1 = o0 + width;
+
+                __m256 px0 = _mm256_load_ps(tx + o0), py0 = _mm256_load_ps(ty + o0), pz0 = _mm256_load_ps(tz + o0);
+                __m256 px1 = _mm256_load_ps(tx + o1), py1 = _mm256_load_ps(ty + o1), pz1 = _mm256_load_ps(tz + o1);
+
+                __m256 ax0 = _mm256_load_ps(ax + o0), ay0 = _mm256_load_ps(ay + o0), az0 = _mm256_load_ps(az + o0);
+                __m256 ax1 = _mm256_load_ps(ax + o1), ay1 = _mm256_load_ps(ay + o1), az1 = _mm256_load_ps(az + o1);
+
+                for(unsigned j = tile; j < tile + tileSize; ++j)
+                {
+                    __m256 x = _mm256_broadcast_ss(bodies.x + j);
+                    __m256 y = _mm256_broadcast_ss(bodies.y + j);
+                    __m256 z = _mm256_broadcast_ss(bodies.z + j);
+                    __m256 m = _mm256_broadcast_ss(bodies.mass + j);
+
+                    interact(px0, py0, pz0, x, y, z, m, eps2, ax0, ay0, az0);
+                    interact(px1, py1, pz1, x, y, z, m, eps2, ax1, ay1, az1);
+                }
+
+                _mm256_store_ps(ax + o0, ax0); _mm256_store_ps(ay + o0, ay0); _mm256_store_ps(az + o0, az0);
+                _mm256_store_ps(ax + o1, ax1); _mm256_store_ps(ay + o1, ay1); _mm256_store_ps(az + o1, az1);
+            }
+        }
+
+        for(unsigned t = 0; t < blockCount; ++t)
+            accelerations[blockFirst + t] = glm::vec3(ax[t], ay[t], az[t]);
+    }
+}
+
+} // namespace directgravity
+} // namespace nparticles
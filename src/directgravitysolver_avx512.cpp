@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+// AVX-512 implementation of the DirectGravitySolver.
+// Only the functions of this file are compiled for the instruction set (see the target attributes), the inline
+// functions of the included headers are compiled for the baseline instruction set. Otherwise the linker could keep
+// their copies of this file for the whole program.
+
+#include "directgravitysolver.hpp"
+
+#include <algorithm>
+
+#include <immintrin.h>
+
+namespace nparticles
+{
+namespace directgravity
+{
+
+namespace
+{
+
+/**
+ * Accumulate the acceleration of 16 targets caused by one attractor.
+ */
+__attribute__((target("avx512f")))
+inline void interact(__m512 px, __m512 py, __m512 pz,
+                     __m512 attractorX, __m512 attractorY, __m512 attractorZ, __m512 attractorMass,
+                     __m512 softeningSquare, __m512& ax, __m512& ay, __m512& az)
+{
+    const __m512 threeHalves = _mm512_set1_ps(1.5f);
+    const __m512 half = _mm512_set1_ps(0.5f);
+
+    __m512 rx = _mm512_sub_ps(attractorX, px);
+    __m512 ry = _mm512_sub_ps(attractorY, py);
+    __m512 rz = _mm512_sub_ps(attractorZ, pz);
+
+    __m512 distanceSquare = _mm512_fmadd_ps(rx, rx, _mm512_fmadd_ps(ry, ry, _mm512_fmadd_ps(rz, rz, softeningSquare)));
+
+    // 14 bit approximation refined by one Newton-Raphson step. Lanes of self interactions
+    // (only possible if the softening factor is zero) are masked to zero.
+    __mmask16 valid = _mm512_cmp_ps_mask(distanceSquare, _mm512_setzero_ps(), _CMP_GT_OQ);
+    __m512 inverseDistance = _mm512_maskz_rsqrt14_ps(valid, distanceSquare);
+    __m512 halfDistanceSquare = _mm512_mul_ps(half, distanceSquare);
+    inverseDistance = _mm512_mul_ps(inverseDistance, _mm512_fnmadd_ps(_mm512_mul_ps(halfDistanceSquare, inverseDistance), inverseDistance, threeHalves));
+
+    __m512 scale = _mm512_mul_ps(attractorMass, _mm512_mul_ps(inverseDistance, _mm512_mul_ps(inverseDistance, inverseDistance)));
+
+    ax = _mm512_fmadd_ps(rx, scale, ax);
+    ay = _mm512_fmadd_ps(ry, scale, ay);
+    az = _mm512_fmadd_ps(rz, scale, az);
+}
+
+} // anonymous namespace
+
+__attribute__((target("avx512f")))
+void computeAccelerationsAVX512(const DirectGravitySolver::BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations)
+{
+    const unsigned width = 16;
+    const unsigned unroll = 4;
+    const unsigned blockSize = DirectGravitySolver::TARGET_BLOCK_SIZE;
+    const unsigned tileSize = DirectGravitySolver::TILE_SIZE;
+
+    alignas(64) float tx[blockSize], ty[blockSize], tz[blockSize];
+    alignas(64) float ax[blockSize], ay[blockSize], az[blockSize];
+
+    const __m512 eps2 = _mm512_set1_ps(softeningSquare);
+
+    for(unsigned blockFirst = first; blockFirst < last; blockFirst += blockSize)
+    {
+        unsigned blockCount = std::min(blockSize, last - blockFirst);
+        unsigned vectorCount = ((blockCount + width * unroll - 1) / (width * unroll)) * unroll;
+
+        // Stage targets. Unused lanes are zero and their results are discarded.
+        for(unsigned t = 0; t < vectorCount * width; ++t)
+        {
+            bool valid = t < blockCount;
+            tx[t] = valid ? bodies.x[blockFirst + t] : 0.0f;
+            ty[t] = valid ? bodies.y[blockFirst + t] : 0.0f;
+            tz[t] = valid ? bodies.z[blockFirst + t] : 0.0f;
+            ax[t] = ay[t] = az[t] = 0.0f;
+        }
+
+        for(unsigned tile = 0; tile < bodies.count; tile += tileSize)
+        {
+            for(unsigned v = 0; v < vectorCount; v += unroll)
+            {
+                const unsigned o0 = v * width;
+                const unsigned o1 = o0 + width;
+                const unsigned o2 = o1 + width;
+                const unsigned o3 = o2 + width;
+
+                __m512 px0 = _mm512_load_ps(tx + o0), py0 = _mm512_load_ps(ty + o0), pz0 = _mm512_load_ps(tz + o0);
+                __m512 px1 = _mm512_load_ps(tx + o1), py1 = _mm512_load_ps(ty + o1), pz1 = _mm512_load_ps(tz + o1);
+                __m512 px2 = _mm512_load_ps(tx + o2), py2 = _mm512_load_ps(ty + o2), pz2 = _mm512_load_ps(tz + o2);
+                __m512 px3 = _mm512_load_ps(tx + o3), py3 = _mm512_load_ps(ty + o3), pz3 = _mm512_load_ps(tz + o3);
+
+                __m512 ax0 = _mm512_load_ps(ax + o0), ay0 = _mm512_load_ps(ay + o0), az0 = _mm512_load_ps(az + o0);
+                __m512 ax1 = _mm512_load_ps(ax + o1), ay1 = _mm512_load_ps(ay + o1), az1 = _mm512_load_ps(az + o1);
+                __m512 ax2 = _mm512_load_ps(ax + o2), ay2 = _mm512_load_ps(ay + o2), az2 = _mm512_load_ps(az + o2);
+                __m512 ax3 = _mm512_load_ps(ax + o3), ay3 = _mm512_load_ps(ay + o3), az3 = _mm512_load_ps(az + o3);
+
+                for(unsigned j = tile; j < tile + tileSize; ++j)
+                {
+                    __m512 x = _mm512_set1_ps(bodies.x[j]);
+                    __m512 y = _mm512_set1_ps(bodies.y[j]);
+                    __m512 z = _mm512_set1_ps(bodies.z[j]);
+                    __m512 m = _mm512_set1_ps(bodies.mass[j]);
+
+                    interact(px0, py0, pz0, x, y, z, m, eps2, ax0, ay0, az0);
+                    interact(px1, py1, pz1, x, y, z, m, eps2, ax1, ay1, az1);
+                    interact(px2, py2, pz2, x, y, z, m, eps2, ax2, ay2, az2);
+                    interact(px3, py3, pz3, x, y, z, m, eps2, ax3, ay3, az3);
+                }
+
+                _mm512_store_ps(ax + o0, ax0); _mm512_store_ps(ay + o0, ay0); _mm512_store_ps(az + o0, az0);
+                _mm512_store_ps(ax + o1, ax1); _mm512_store_ps(ay + o1, ay1); _mm512_store_ps(az + o1, az1);
+                _mm512_store_ps(ax + o2, ax2); _mm512_store_ps(ay + o2, ay2); _mm512_store_ps(az + o2, az2);
+                _mm512_store_ps(ax + o3, ax3); _mm512_store_ps(ay + o3, ay3); _mm512_store_ps(az + o3, az3);
+            }
+        }
+
+        for(unsigned t = 0; t < blockCount; ++t)
+            accelerations[blockFirst + t] = glm::vec3(ax[t], ay[t], az[t]);
+    }
+}
+
+} // namespace directgravity
+} // namespace nparticles
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+// SSE implementation of the DirectGravitySolver.
+// Only the functions of this file are compiled for the instruction set (see the target attributes), the inline
+// functions of the included headers are compiled for the baseline instruction set. Otherwise the linker could keep
+// their copies of this file for the whole program.
+
+#include "directgravitysolver.hpp"
+
+#include <algorithm>
+
+#include <xmmintrin.h>
+
+namespace nparticles
+{
+namespace directgravity
+{
+
+namespace
+{
+
+/**
+ * Accumulate the acceleration of 4 targets caused by one attractor.
+ */
+__attribute__((target("sse2")))
+inline void interact(__m128 px, __m128 py, __m128 pz,
+                     __m128 attractorX, __m128 attractorY, __m128 attractorZ, __m128 attractorMass,
+                     __m128 softeningSquare, __m128& ax, __m128& ay, __m128& az)
+{
+    const __m128 threeHalves = _mm_set1_ps(1.5f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    __m128 rx = _mm_sub_ps(attractorX, px);
+    __m128 ry = _mm_sub_ps(attractorY, py);
+    __m128 rz = _mm_sub_ps(attractorZ, pz);
+
+    __m128 distanceSquare = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, rx), _mm_mul_ps(ry, ry)), _mm_add_ps(_mm_mul_ps(rz, rz), softeningSquare));
+
+    // 12 bit approximation refined by one Newton-Raphson step.
+    __m128 inverseDistance = _mm_rsqrt_ps(distanceSquare);
+    __m128 halfDistanceSquare = _mm_mul_ps(half, distanceSquare);
+    inverseDistance = _mm_mul_ps(inverseDistance, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(halfDistanceSquare, inverseDistance), inverseDistance)));
+
+    // Mask out self interaction (only relevant if the softening factor is zero).
+    inverseDistance = _mm_and_ps(inverseDistance, _mm_cmpgt_ps(distanceSquare, _mm_setzero_ps()));
+
+    __m128 scale = _mm_mul_ps(attractorMass, _mm_mul_ps(inverseDistance, _mm_mul_ps(inverseDistance, inverseDistance)));
+
+    ax = _mm_add_ps(_mm_mul_ps(rx, scale), ax);
+    ay = _mm_add_ps(_mm_mul_ps(ry, scale), ay);
+    az = _mm_add_ps(_mm_mul_ps(rz, scale), az);
+}
+
+} // anonymous namespace
+
+__attribute__((target("sse2")))
+void computeAccelerationsSSE(const DirectGravitySolver::BodyArrays& bodies, unsigned first, unsigned last, float softeningSquare, glm::vec3* accelerations)
+{
+    const unsigned width = 4;
+    const unsigned unroll = 2;
+    const unsigned blockSize = DirectGravitySolver::TARGET_BLOCK_SIZE;
+    const unsigned tileSize = DirectGravitySolver::TILE_SIZE;
+
+    alignas(16) float tx[blockSize], ty[blockSize], tz[blockSize];
+    alignas(16) float ax[blockSize], ay[blockSize], az[blockSize];
+
+    const __m128 eps2 = _mm_set1_ps(softeningSquare);
+
+    for(unsigned blockFirst = first; blockFirst < last; blockFirst += blockSize)
+    {
+        unsigned blockCount = std::min(blockSize, last - blockFirst);
+        unsigned vectorCount = ((blockCount + width * unroll - 1) / (width * unroll)) * unroll;
+
+        // Stage targets. Unused lanes are zero and their results are discarded.
+        for(unsigned t = 0; t < vectorCount * width; ++t)
+        {
+            bool valid = t < blockCount;
+            tx[t] = valid ? bodies.x[blockFirst + t] : 0.0f;
+            ty[t] = valid ? bodies.y[blockFirst + t] : 0.0f;
+            tz[t] = valid ? bodies.z[blockFirst + t] : 0.0f;
+            ax[t] = ay[t] = az[t] = 0.0f;
+        }
+
+        for(unsigned tile = 0; tile < bodies.count; tile += tileSize)
+        {
+            for(unsigned v = 0; v < vectorCount; v += unroll)
+            {
+                const unsigned o0 = v * width;
+                const unsigned o1 = o0 + width;
+
+                __m128 px0 = _mm_load_ps(tx + o0), py0 = _mm_load_ps(ty + o0), pz0 = _mm_load_ps(tz + o0);
+                __m128 px1 = _mm_load_ps(tx + o1), py1 = _mm_load_ps(ty + o1), pz1 = _mm_load_ps(tz + o1);
+
+                __m128 ax0 = _mm_load_ps(ax + o0), ay0 = _mm_load_ps(ay + o0), az0 = _mm_load_ps(az + o0);
+                __m128 ax1 = _mm_load_ps(ax + o1), ay1 = _mm_load_ps(ay + o1), az1 = _mm_load_ps(az + o1);
+
+                for(unsigned j = tile; j < tile + tileSize; ++j)
+                {
+                    __m128 x = _mm_load1_ps(bodies.x + j);
+                    __m128 y = _mm_load1_ps(bodies.y + j);
+                    __m128 z = _mm_load1_ps(bodies.z + j);
+                    __m128 m = _mm_load1_ps(bodies.mass + j);
+
+                    interact(px0, py0, pz0, x, y, z, m, eps2, ax0, ay0, az0);
+                    interact(px1, py1, pz1, x, y, z, m, eps2, ax1, ay1, az1);
+                }
+
+                _mm_store_ps(ax + o0, ax0); _mm_store_ps(ay + o0, ay0); _mm_store_ps(az + o0, az0);
+                _mm_store_ps(ax + o1, ax1); _mm_store_ps(ay + o1, ay1); _mm_store_ps(az + o1, az1);
+            }
+        }
+
+        for(unsigned t = 0; t < blockCount; ++t)
+            accelerations[blockFirst + t] = glm::vec3(ax[t], ay[t], az[t]);
+    }
+}
+
+} // namespace directgravity
+} // namespace nparticles
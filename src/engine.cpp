@@ -9,16 +9,23 @@
 
 #include "engine.hpp"
 
+#include <algorithm>
+
 #include "logger.hpp"
+#include "material.hpp"
+#include "particlepool.hpp"
 #include "particlesystem.hpp"
 
 namespace nparticles
 {
 
 Engine::Engine()
-    : mRenderSystem(),
+    : mThreadPool(),
+      mComputeSystem(mThreadPool),
+      mRenderSystem(),
       mWindow(nullptr),
-      mGPUProgramService()
+      mGPUProgramService(),
+      mReadbackQueue()
 {
 }
 
@@ -28,6 +35,11 @@ Engine::~Engine()
     for(auto pSys : mParticleSystems)
         delete pSys;
     mParticleSystems.clear();
+
+    // The pools own the storage of the pooled attributes, so they are deleted after the systems
+    for(auto pool : mParticlePools)
+        delete pool;
+    mParticlePools.clear();
 }
 
 void Engine::staticKeyCallback(GLFWwindow* window, int key, int, int action, int modifier)
@@ -146,8 +158,7 @@ void Engine::terminate()
 
 void Engine::updateAllParticleSystems()
 {
-    for(auto pSys : mParticleSystems)
-        mComputeSystem.updateParticleSystem(pSys);
+    mComputeSystem.updateParticleSystems(mParticleSystems);
 }
 
 void Engine::drawAllParticleSystems()
@@ -158,9 +169,22 @@ void Engine::drawAllParticleSystems()
     mRenderSystem.setViewProjectionMatrix(mCamera.getViewProjectionMatrix());
     mRenderSystem.setNormalMatrix(mCamera.getNormalMatrix());
 
-    // iterate all particle systems and call renderSystem.drawParticleSystem(psys);
-    for(auto pSys : mParticleSystems)
-        mRenderSystem.drawParticleSystem(pSys);
+    // Sort the systems so the ones which can share a draw call are adjacent
+    std::vector<ParticleSystem*> particleSystems(mParticleSystems.begin(), mParticleSystems.end());
+    std::stable_sort(particleSystems.begin(), particleSystems.end(), [](const ParticleSystem* a, const ParticleSystem* b)
+    {
+        const RenderProgram* programA = a->getMaterial()->getRenderProgram();
+        const RenderProgram* programB = b->getMaterial()->getRenderProgram();
+        if(programA != programB)
+            return programA < programB;
+        if(a->getMesh() != b->getMesh())
+            return a->getMesh() < b->getMesh();
+        if(a->getMaterial() != b->getMaterial())
+            return a->getMaterial() < b->getMaterial();
+        return a->getParticlePool() < b->getParticlePool();
+    });
+
+    mRenderSystem.drawParticleSystems(particleSystems);
 
     mRenderSystem.endFrame();
 }
@@ -168,6 +192,7 @@ void Engine::drawAllParticleSystems()
 void Engine::processEvents()
 {
     glfwPollEvents();
+    mReadbackQueue.poll();
 }
 
 bool Engine::windowClosed()
@@ -175,18 +200,27 @@ bool Engine::windowClosed()
     return glfwWindowShouldClose(mWindow);
 }
 
-ParticleSystem* Engine::createParticleSystem(int particleCount, const Mesh& mesh, const Material& material)
+ParticleSystem* Engine::createParticleSystem(int particleCount, const Mesh& mesh, const Material& material, ParticlePool* particlePool)
 {
-    ParticleSystem* pSys = new ParticleSystem(particleCount, mesh, material);
+    ParticleSystem* pSys = new ParticleSystem(particleCount, mesh, material, particlePool);
     mParticleSystems.insert(pSys);
     return pSys;
 }
 
+ParticlePool* Engine::createParticlePool(int capacity)
+{
+    ParticlePool* pool = new ParticlePool(capacity);
+    mParticlePools.push_back(pool);
+    return pool;
+}
+
 void Engine::deleteParticleSystem(ParticleSystem* particleSystem)
 {
     auto pSysIter = mParticleSystems.find(particleSystem);
     if(pSysIter != mParticleSystems.end())
     {
+        mRenderSystem.removeParticleSystem(particleSystem);
+        mComputeSystem.removeParticleSystem(particleSystem);
         delete particleSystem;
         mParticleSystems.erase(pSysIter);
     }
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "fft.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+namespace
+{
+
+// Number of neighbouring strided lines gathered at once, so each cache line fetched is used for several lines.
+const unsigned LINE_BATCH_SIZE = 8;
+
+} // anonymous namespace
+
+FFT::FFT(unsigned size)
+    : mSize(0)
+{
+    if(!setSize(size))
+        setSize(1);
+}
+
+bool FFT::setSize(unsigned size)
+{
+    if(size == 0 || (size & (size - 1)) != 0)
+        return false;
+
+    if(size == mSize)
+        return true;
+
+    mSize = size;
+
+    mTwiddles.resize(size / 2);
+    for(unsigned k = 0; k < size / 2; ++k)
+    {
+        double angle = -2.0 * M_PI * k / size;
+        mTwiddles[k] = std::complex<float>(std::cos(angle), std::sin(angle));
+    }
+
+    unsigned bits = 0;
+    while((1u << bits) < size)
+        ++bits;
+
+    mBitReversal.resize(size);
+    for(unsigned i = 0; i < size; ++i)
+    {
+        unsigned reversed = 0;
+        for(unsigned b = 0; b < bits; ++b)
+            reversed |= ((i >> b) & 1) << (bits - 1 - b);
+        mBitReversal[i] = reversed;
+    }
+
+    return true;
+}
+
+void FFT::transform(std::complex<float>* data, bool inverse) const
+{
+    for(unsigned i = 0; i < mSize; ++i)
+    {
+        if(i < mBitReversal[i])
+            std::swap(data[i], data[mBitReversal[i]]);
+    }
+
+    // The inverse transform uses the conjugated twiddle factors.
+    const float sign = inverse ? -1.0f : 1.0f;
+
+    for(unsigned length = 2; length <= mSize; length *= 2)
+    {
+        const unsigned half = length / 2;
+        const unsigned twiddleStep = mSize / length;
+
+        for(unsigned start = 0; start < mSize; start += length)
+        {
+            for(unsigned j = 0; j < half; ++j)
+            {
+                // Complex multiplication written out, std::complex handles NaN and infinity
+                // cases which makes it much slower.
+                const float wr = mTwiddles[j * twiddleStep].real();
+                const float wi = sign * mTwiddles[j * twiddleStep].imag();
+
+                std::complex<float>& a = data[start + j];
+                std::complex<float>& b = data[start + j + half];
+
+                const float br = b.real() * wr - b.imag() * wi;
+                const float bi = b.real() * wi + b.imag() * wr;
+
+                b = std::complex<float>(a.real() - br, a.imag() - bi);
+                a = std::complex<float>(a.real() + br, a.imag() + bi);
+            }
+        }
+    }
+}
+
+void FFT::transform3D(std::complex<float>* data, bool inverse, ThreadPool& threadPool) const
+{
+    const unsigned size = mSize;
+    const unsigned planeSize = size * size;
+
+    // Transform lineCount neighbouring lines whose elements are stride apart.
+    auto transformStrided = [this, size, inverse](std::complex<float>* first, unsigned stride, unsigned lineCount, std::vector<std::complex<float> >& buffer)
+    {
+        buffer.resize(lineCount * size);
+
+        for(unsigned i = 0; i < size; ++i)
+        {
+            for(unsigned l = 0; l < lineCount; ++l)
+                buffer[l * size + i] = first[i * stride + l];
+        }
+
+        for(unsigned l = 0; l < lineCount; ++l)
+            transform(&buffer[l * size], inverse);
+
+        for(unsigned i = 0; i < size; ++i)
+        {
+            for(unsigned l = 0; l < lineCount; ++l)
+                first[i * stride + l] = buffer[l * size + i];
+        }
+    };
+
+    // z lines are contiguous.
+    threadPool.parallelFor(0, planeSize, [&](unsigned first, unsigned last)
+    {
+        for(unsigned line = first; line < last; ++line)
+            transform(data + line * size, inverse);
+    });
+
+    // y lines, one plane of constant x per task.
+    threadPool.parallelFor(0, size, [&](unsigned first, unsigned last)
+    {
+        std::vector<std::complex<float> > buffer;
+
+        for(unsigned x = first; x < last; ++x)
+        {
+            for(unsigned z = 0; z < size; z += LINE_BATCH_SIZE)
+                transformStrided(data + x * planeSize + z, size, std::min(LINE_BATCH_SIZE, size - z), buffer);
+        }
+    }, 1);
+
+    // x lines, one plane of constant y per task.
+    threadPool.parallelFor(0, size, [&](unsigned first, unsigned last)
+    {
+        std::vector<std::complex<float> > buffer;
+
+        for(unsigned y = first; y < last; ++y)
+        {
+            for(unsigned z = 0; z < size; z += LINE_BATCH_SIZE)
+                transformStrided(data + y * size + z, planeSize, std::min(LINE_BATCH_SIZE, size - z), buffer);
+        }
+    }, 1);
+}
+
+} // namespace nparticles
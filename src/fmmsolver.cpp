@@ -0,0 +1,504 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "fmmsolver.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "threadpool.hpp"
+#include "cpuclock.hpp"
+
+namespace nparticles
+{
+
+namespace
+{
+
+// The traversal is run in parallel for the subtrees rooted on this level (8³ = 512 subtrees at most).
+const unsigned TRAVERSAL_TASK_LEVEL = 3;
+
+// Number of terms of an expansion of MAX_ORDER, used for temporary arrays on the stack.
+const unsigned MAX_TERM_COUNT = (FMMSolver::MAX_ORDER + 1) * (FMMSolver::MAX_ORDER + 2) * (FMMSolver::MAX_ORDER + 3) / 6;
+
+} // anonymous namespace
+
+FMMSolver::FMMSolver(unsigned order, float theta, float softeningFactor, unsigned leafSize)
+    : GravitySolver(softeningFactor),
+      mOrder(0),
+      mTheta(theta),
+      mOctree(leafSize)
+{
+    mPhaseTimes.treeBuild = 0;
+    mPhaseTimes.upwardPass = 0;
+    mPhaseTimes.traversal = 0;
+    mPhaseTimes.m2l = 0;
+    mPhaseTimes.p2p = 0;
+    mPhaseTimes.downwardPass = 0;
+
+    setOrder(order);
+}
+
+void FMMSolver::setOrder(unsigned order)
+{
+    order = std::min(std::max(order, 1u), MAX_ORDER);
+    if(order == mOrder)
+        return;
+
+    mOrder = order;
+    initTerms();
+}
+
+std::string FMMSolver::getName() const
+{
+    std::stringstream name;
+    name << "FMM (order " << mOrder << ", theta " << mTheta << ")";
+    return name.str();
+}
+
+void FMMSolver::computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool)
+{
+    CPUClock clock;
+
+    clock.start();
+    mOctree.build(bodies, bodyCount, threadPool);
+    clock.stop();
+    mPhaseTimes.treeBuild = clock.getElapsedTime();
+
+    if(bodyCount == 0)
+        return;
+
+    const std::vector<Octree::Node>& nodes = mOctree.getNodes();
+    const std::vector<std::vector<unsigned> >& levels = mOctree.getLevels();
+    const std::vector<glm::vec4>& sortedBodies = mOctree.getSortedBodies();
+    const unsigned termCount = getTermCount(mOrder);
+
+    // Upward pass: P2M and M2M, bottom up one level at a time
+    clock.start();
+
+    mX.resize(bodyCount);
+    mY.resize(bodyCount);
+    mZ.resize(bodyCount);
+    mMass.resize(bodyCount);
+    threadPool.parallelFor(0, bodyCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+        {
+            mX[i] = sortedBodies[i].x;
+            mY[i] = sortedBodies[i].y;
+            mZ[i] = sortedBodies[i].z;
+            mMass[i] = sortedBodies[i].w;
+        }
+    });
+
+    mMultipoles.assign(nodes.size() * termCount, 0.0);
+    mRadii.resize(nodes.size());
+
+    for(unsigned level = levels.size(); level-- > 0;)
+    {
+        const std::vector<unsigned>& levelNodes = levels[level];
+        threadPool.parallelFor(0, levelNodes.size(), [&](unsigned first, unsigned last)
+        {
+            for(unsigned n = first; n < last; ++n)
+                upward(levelNodes[n]);
+        }, 16);
+    }
+
+    clock.stop();
+    mPhaseTimes.upwardPass = clock.getElapsedTime();
+
+    // Traversal. Each task only collects interactions for targets in its own subtree, so the
+    // M2L and P2P phases can process the tasks in parallel without synchronisation.
+    clock.start();
+
+    mTasks.clear();
+    collectTraversalTasks(0);
+
+    threadPool.parallelFor(0, mTasks.size(), [&](unsigned first, unsigned last)
+    {
+        for(unsigned t = first; t < last; ++t)
+            traverse(mTasks[t].node, 0, mTasks[t]);
+    }, 1);
+
+    clock.stop();
+    mPhaseTimes.traversal = clock.getElapsedTime();
+
+    // M2L
+    clock.start();
+
+    mLocals.assign(nodes.size() * termCount, 0.0);
+    threadPool.parallelFor(0, mTasks.size(), [&](unsigned first, unsigned last)
+    {
+        for(unsigned t = first; t < last; ++t)
+        {
+            for(const std::pair<unsigned, unsigned>& interaction : mTasks[t].m2l)
+                multipoleToLocal(interaction.first, interaction.second);
+        }
+    }, 1);
+
+    clock.stop();
+    mPhaseTimes.m2l = clock.getElapsedTime();
+
+    // P2P
+    clock.start();
+
+    mNearField.assign(bodyCount, glm::vec3(0, 0, 0));
+    threadPool.parallelFor(0, mTasks.size(), [&](unsigned first, unsigned last)
+    {
+        for(unsigned t = first; t < last; ++t)
+        {
+            for(const std::pair<unsigned, unsigned>& interaction : mTasks[t].p2p)
+                particleToParticle(interaction.first, interaction.second);
+        }
+    }, 1);
+
+    clock.stop();
+    mPhaseTimes.p2p = clock.getElapsedTime();
+
+    // Downward pass: L2L and L2P, top down one level at a time
+    clock.start();
+
+    for(unsigned level = 0; level < levels.size(); ++level)
+    {
+        const std::vector<unsigned>& levelNodes = levels[level];
+        threadPool.parallelFor(0, levelNodes.size(), [&](unsigned first, unsigned last)
+        {
+            for(unsigned n = first; n < last; ++n)
+                downward(levelNodes[n], accelerations);
+        }, 16);
+    }
+
+    clock.stop();
+    mPhaseTimes.downwardPass = clock.getElapsedTime();
+}
+
+void FMMSolver::initTerms()
+{
+    const unsigned termCount = getTermCount(mOrder);
+    const unsigned dimension = mOrder + 1;
+
+    // Terms sorted by degree, so the terms up to degree d are the first getTermCount(d) terms.
+    mTerms.clear();
+    mTermIndices.assign(dimension * dimension * dimension, -1);
+    for(unsigned degree = 0; degree <= mOrder; ++degree)
+    {
+        for(unsigned kx = degree + 1; kx-- > 0;)
+        {
+            for(unsigned ky = degree - kx + 1; ky-- > 0;)
+            {
+                Term term = {{kx, ky, degree - kx - ky}, degree};
+                mTermIndices[(term.k[0] * dimension + term.k[1]) * dimension + term.k[2]] = mTerms.size();
+                mTerms.push_back(term);
+            }
+        }
+    }
+
+    auto termIndex = [&](unsigned kx, unsigned ky, unsigned kz) -> int
+    {
+        if(kx + ky + kz > mOrder)
+            return -1;
+        return mTermIndices[(kx * dimension + ky) * dimension + kz];
+    };
+
+    mSigns.resize(termCount);
+    for(unsigned axis = 0; axis < 3; ++axis)
+        mLowerTerms[axis].resize(termCount);
+    mSumTerms.resize(termCount * termCount);
+
+    for(unsigned t = 0; t < termCount; ++t)
+    {
+        const unsigned* k = mTerms[t].k;
+        mSigns[t] = mTerms[t].degree % 2 == 0 ? 1.0 : -1.0;
+
+        mLowerTerms[0][t] = k[0] > 0 ? termIndex(k[0] - 1, k[1], k[2]) : -1;
+        mLowerTerms[1][t] = k[1] > 0 ? termIndex(k[0], k[1] - 1, k[2]) : -1;
+        mLowerTerms[2][t] = k[2] > 0 ? termIndex(k[0], k[1], k[2] - 1) : -1;
+
+        for(unsigned s = 0; s < termCount; ++s)
+        {
+            const unsigned* n = mTerms[s].k;
+            mSumTerms[t * termCount + s] = termIndex(k[0] + n[0], k[1] + n[1], k[2] + n[2]);
+        }
+    }
+}
+
+void FMMSolver::computePowers(const glm::dvec3& d, double* powers) const
+{
+    // d^k / k! = d^(k - e_i) / (k - e_i)! * d_i / k_i
+    const unsigned termCount = getTermCount(mOrder);
+
+    powers[0] = 1;
+    for(unsigned t = 1; t < termCount; ++t)
+    {
+        const unsigned* k = mTerms[t].k;
+        unsigned axis = k[0] > 0 ? 0 : (k[1] > 0 ? 1 : 2);
+        powers[t] = powers[mLowerTerms[axis][t]] * d[axis] / k[axis];
+    }
+}
+
+void FMMSolver::computeDerivatives(const glm::dvec3& r, double* derivatives) const
+{
+    // The derivatives D_n of the softened kernel 1 / sqrt(r² + eps²) satisfy
+    //     |n| * (r² + eps²) * D_n + (2|n| - 1) * sum_i n_i * r_i * D_(n - e_i) + (|n| - 1) * sum_i n_i * (n_i - 1) * D_(n - 2e_i) = 0
+    const unsigned termCount = getTermCount(mOrder);
+    const double distanceSquare = glm::dot(r, r) + (double)mSofteningFactor * mSofteningFactor;
+
+    derivatives[0] = 1.0 / std::sqrt(distanceSquare);
+    for(unsigned t = 1; t < termCount; ++t)
+    {
+        const unsigned* n = mTerms[t].k;
+        const double degree = mTerms[t].degree;
+
+        double first = 0;
+        double second = 0;
+        for(unsigned axis = 0; axis < 3; ++axis)
+        {
+            if(n[axis] == 0)
+                continue;
+
+            int lower = mLowerTerms[axis][t];
+            first += n[axis] * r[axis] * derivatives[lower];
+            if(n[axis] > 1)
+                second += n[axis] * (n[axis] - 1.0) * derivatives[mLowerTerms[axis][lower]];
+        }
+
+        derivatives[t] = -((2 * degree - 1) * first + (degree - 1) * second) / (degree * distanceSquare);
+    }
+}
+
+void FMMSolver::upward(unsigned nodeIndex)
+{
+    const Octree::Node& node = mOctree.getNodes()[nodeIndex];
+    const unsigned termCount = getTermCount(mOrder);
+    const glm::dvec3 center(node.center);
+    double* multipole = &mMultipoles[nodeIndex * termCount];
+    double powers[MAX_TERM_COUNT];
+    float radius = 0;
+
+    if(node.childCount == 0)
+    {
+        // P2M: M_k = sum m * (y - c)^k / k!
+        for(unsigned i = node.firstBody; i < node.firstBody + node.bodyCount; ++i)
+        {
+            glm::dvec3 d = glm::dvec3(mX[i], mY[i], mZ[i]) - center;
+            computePowers(d, powers);
+
+            for(unsigned t = 0; t < termCount; ++t)
+                multipole[t] += mMass[i] * powers[t];
+
+            radius = std::max(radius, (float)std::sqrt(glm::dot(d, d)));
+        }
+    }
+    else
+    {
+        // M2M: M_k = sum_(j <= k) M_child_j * s^(k - j) / (k - j)! with s = c_child - c
+        const unsigned dimension = mOrder + 1;
+
+        for(unsigned c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+        {
+            const double* childMultipole = &mMultipoles[c * termCount];
+            glm::dvec3 s = glm::dvec3(mOctree.getNodes()[c].center) - center;
+            computePowers(s, powers);
+
+            for(unsigned t = 0; t < termCount; ++t)
+            {
+                const unsigned* k = mTerms[t].k;
+                double sum = 0;
+
+                for(unsigned jx = 0; jx <= k[0]; ++jx)
+                {
+                    for(unsigned jy = 0; jy <= k[1]; ++jy)
+                    {
+                        for(unsigned jz = 0; jz <= k[2]; ++jz)
+                        {
+                            int j = mTermIndices[(jx * dimension + jy) * dimension + jz];
+                            int m = mTermIndices[((k[0] - jx) * dimension + k[1] - jy) * dimension + k[2] - jz];
+                            sum += childMultipole[j] * powers[m];
+                        }
+                    }
+                }
+
+                multipole[t] += sum;
+            }
+
+            radius = std::max(radius, (float)std::sqrt(glm::dot(s, s)) + mRadii[c]);
+        }
+    }
+
+    mRadii[nodeIndex] = radius;
+}
+
+void FMMSolver::collectTraversalTasks(unsigned nodeIndex)
+{
+    const Octree::Node& node = mOctree.getNodes()[nodeIndex];
+
+    if(node.level == TRAVERSAL_TASK_LEVEL || node.childCount == 0)
+    {
+        mTasks.push_back(TraversalTask());
+        mTasks.back().node = nodeIndex;
+        return;
+    }
+
+    for(unsigned c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+        collectTraversalTasks(c);
+}
+
+void FMMSolver::traverse(unsigned target, unsigned source, TraversalTask& task) const
+{
+    const Octree::Node& targetNode = mOctree.getNodes()[target];
+    const Octree::Node& sourceNode = mOctree.getNodes()[source];
+
+    glm::vec3 distance = targetNode.center - sourceNode.center;
+
+    if(mRadii[target] + mRadii[source] < mTheta * std::sqrt(glm::dot(distance, distance)))
+    {
+        task.m2l.push_back(std::make_pair(target, source));
+    }
+    else if(targetNode.childCount == 0 && sourceNode.childCount == 0)
+    {
+        task.p2p.push_back(std::make_pair(target, source));
+    }
+    else if(sourceNode.childCount == 0 || (targetNode.childCount > 0 && targetNode.size >= sourceNode.size))
+    {
+        // Split the larger node
+        for(unsigned c = targetNode.firstChild; c < targetNode.firstChild + targetNode.childCount; ++c)
+            traverse(c, source, task);
+    }
+    else
+    {
+        for(unsigned c = sourceNode.firstChild; c < sourceNode.firstChild + sourceNode.childCount; ++c)
+            traverse(target, c, task);
+    }
+}
+
+void FMMSolver::multipoleToLocal(unsigned target, unsigned source)
+{
+    // L_n = -sum_k (-1)^|k| * M_k * D_(k + n)(z - c)
+    const unsigned termCount = getTermCount(mOrder);
+    const double* multipole = &mMultipoles[source * termCount];
+    double* local = &mLocals[target * termCount];
+    double derivatives[MAX_TERM_COUNT];
+    double signedMultipole[MAX_TERM_COUNT];
+
+    glm::dvec3 r = glm::dvec3(mOctree.getNodes()[target].center) - glm::dvec3(mOctree.getNodes()[source].center);
+    computeDerivatives(r, derivatives);
+
+    for(unsigned k = 0; k < termCount; ++k)
+        signedMultipole[k] = mSigns[k] * multipole[k];
+
+    for(unsigned n = 0; n < termCount; ++n)
+    {
+        // Only terms with |k| + |n| <= order contribute.
+        const unsigned count = getTermCount(mOrder - mTerms[n].degree);
+        const int* sums = &mSumTerms[n * termCount];
+        double sum = 0;
+
+        for(unsigned k = 0; k < count; ++k)
+            sum += signedMultipole[k] * derivatives[sums[k]];
+
+        local[n] -= sum;
+    }
+}
+
+void FMMSolver::particleToParticle(unsigned target, unsigned source)
+{
+    const Octree::Node& targetNode = mOctree.getNodes()[target];
+    const Octree::Node& sourceNode = mOctree.getNodes()[source];
+    const float softeningSquare = mSofteningFactor * mSofteningFactor;
+
+    const float* x = &mX[sourceNode.firstBody];
+    const float* y = &mY[sourceNode.firstBody];
+    const float* z = &mZ[sourceNode.firstBody];
+    const float* mass = &mMass[sourceNode.firstBody];
+    const unsigned sourceCount = sourceNode.bodyCount;
+
+    for(unsigned i = targetNode.firstBody; i < targetNode.firstBody + targetNode.bodyCount; ++i)
+    {
+        const float px = mX[i];
+        const float py = mY[i];
+        const float pz = mZ[i];
+
+        float ax = 0, ay = 0, az = 0;
+
+        // Plain loop over structure of arrays, so the compiler can vectorise it.
+        for(unsigned j = 0; j < sourceCount; ++j)
+        {
+            float rx = x[j] - px;
+            float ry = y[j] - py;
+            float rz = z[j] - pz;
+            float distanceSquare = rx * rx + ry * ry + rz * rz + softeningSquare;
+
+            // Skip self interaction if the softening factor is zero.
+            float inverseDistance = distanceSquare > 0 ? 1.0f / std::sqrt(distanceSquare) : 0.0f;
+            float scale = mass[j] * inverseDistance * inverseDistance * inverseDistance;
+
+            ax += rx * scale;
+            ay += ry * scale;
+            az += rz * scale;
+        }
+
+        mNearField[i] += glm::vec3(ax, ay, az);
+    }
+}
+
+void FMMSolver::downward(unsigned nodeIndex, glm::vec3* accelerations)
+{
+    const Octree::Node& node = mOctree.getNodes()[nodeIndex];
+    const unsigned termCount = getTermCount(mOrder);
+    const glm::dvec3 center(node.center);
+    const double* local = &mLocals[nodeIndex * termCount];
+    double powers[MAX_TERM_COUNT];
+
+    if(node.childCount > 0)
+    {
+        // L2L: L_child_n = sum_(k >= n) L_k * s^(k - n) / (k - n)! with s = c_child - c
+        for(unsigned c = node.firstChild; c < node.firstChild + node.childCount; ++c)
+        {
+            double* childLocal = &mLocals[c * termCount];
+            computePowers(glm::dvec3(mOctree.getNodes()[c].center) - center, powers);
+
+            for(unsigned n = 0; n < termCount; ++n)
+            {
+                const unsigned count = getTermCount(mOrder - mTerms[n].degree);
+                const int* sums = &mSumTerms[n * termCount];
+                double sum = 0;
+
+                for(unsigned m = 0; m < count; ++m)
+                    sum += local[sums[m]] * powers[m];
+
+                childLocal[n] += sum;
+            }
+        }
+        return;
+    }
+
+    // L2P: a_i = -sum_n L_(n + e_i) * (x - c)^n / n!
+    const unsigned count = getTermCount(mOrder - 1);
+    // Terms 1 to 3 are e_x, e_y and e_z.
+    const int* sums[3] = {&mSumTerms[1 * termCount], &mSumTerms[2 * termCount], &mSumTerms[3 * termCount]};
+
+    for(unsigned i = node.firstBody; i < node.firstBody + node.bodyCount; ++i)
+    {
+        computePowers(glm::dvec3(mX[i], mY[i], mZ[i]) - center, powers);
+
+        glm::dvec3 acceleration(0, 0, 0);
+        for(unsigned e = 0; e < 3; ++e)
+        {
+            double sum = 0;
+            for(unsigned n = 0; n < count; ++n)
+                sum += local[sums[e][n]] * powers[n];
+            acceleration[e] = -sum;
+        }
+
+        accelerations[mOctree.getBodyIndex(i)] = glm::vec3(acceleration) + mNearField[i];
+    }
+}
+
+} // namespace nparticles
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "glstate.hpp"
+
+#include "glutils.hpp"
+
+namespace nparticles
+{
+
+namespace
+{
+
+/**
+ * Get the glGet() name of the binding of a buffer target.
+ */
+GLenum getBindingName(GLenum target)
+{
+    switch(target)
+    {
+    case GL_ARRAY_BUFFER:
+        return GL_ARRAY_BUFFER_BINDING;
+    case GL_ELEMENT_ARRAY_BUFFER:
+        return GL_ELEMENT_ARRAY_BUFFER_BINDING;
+    case GL_ATOMIC_COUNTER_BUFFER:
+        return GL_ATOMIC_COUNTER_BUFFER_BINDING;
+    case GL_DISPATCH_INDIRECT_BUFFER:
+        return GL_DISPATCH_INDIRECT_BUFFER_BINDING;
+    case GL_DRAW_INDIRECT_BUFFER:
+        return GL_DRAW_INDIRECT_BUFFER_BINDING;
+    case GL_PIXEL_PACK_BUFFER:
+        return GL_PIXEL_PACK_BUFFER_BINDING;
+    case GL_PIXEL_UNPACK_BUFFER:
+        return GL_PIXEL_UNPACK_BUFFER_BINDING;
+    case GL_SHADER_STORAGE_BUFFER:
+        return GL_SHADER_STORAGE_BUFFER_BINDING;
+    case GL_TRANSFORM_FEEDBACK_BUFFER:
+        return GL_TRANSFORM_FEEDBACK_BUFFER_BINDING;
+    case GL_UNIFORM_BUFFER:
+        return GL_UNIFORM_BUFFER_BINDING;
+    default:
+        // The copy and texture buffer targets are their own binding names
+        return target;
+    }
+}
+
+} // anonymous namespace
+
+GlState::GlState()
+    : mDirectStateAccess(false),
+      mDefaultsValid(true),
+      mProgram(0),
+      mProgramKnown(true),
+      mVertexArray(0),
+      mVertexArrayKnown(true)
+{
+}
+
+GlState::~GlState()
+{
+}
+
+void GlState::bindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint& binding = getBufferBinding(target);
+
+    if(binding == buffer)
+        return;
+
+    glBindBuffer(target, buffer);
+    binding = buffer;
+}
+
+void GlState::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+    auto bindingIter = mIndexedBindings.find(std::make_pair(target, index));
+
+    if(bindingIter != mIndexedBindings.end())
+    {
+        if(bindingIter->second.buffer == buffer && bindingIter->second.size == 0)
+            return;
+    }
+    else if(mDefaultsValid && buffer == 0)
+        return;
+
+    glBindBufferBase(target, index, buffer);
+
+    IndexedBinding binding = { buffer, 0, 0 };
+    mIndexedBindings[std::make_pair(target, index)] = binding;
+    getBufferBinding(target) = buffer;
+}
+
+void GlState::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+    auto bindingIter = mIndexedBindings.find(std::make_pair(target, index));
+
+    if(bindingIter != mIndexedBindings.end() && bindingIter->second.buffer == buffer
+            && bindingIter->second.offset == offset && bindingIter->second.size == size)
+        return;
+
+    glBindBufferRange(target, index, buffer, offset, size);
+
+    IndexedBinding binding = { buffer, offset, size };
+    mIndexedBindings[std::make_pair(target, index)] = binding;
+    getBufferBinding(target) = buffer;
+}
+
+void GlState::bindBuffers(GLenum target, GLuint first, GLsizei count, const GLuint* buffers, const GLintptr* offsets, const GLsizeiptr* sizes)
+{
+    // The generic binding is not changed by the multi bind functions
+    if(offsets && sizes)
+        glBindBuffersRange(target, first, count, buffers, offsets, sizes);
+    else
+        glBindBuffersBase(target, first, count, buffers);
+
+    for(GLsizei i = 0; i < count; ++i)
+    {
+        IndexedBinding binding = { buffers[i], (offsets && sizes) ? offsets[i] : 0, (offsets && sizes) ? sizes[i] : 0 };
+        mIndexedBindings[std::make_pair(target, first + i)] = binding;
+    }
+}
+
+GLuint GlState::getBoundBuffer(GLenum target)
+{
+    return getBufferBinding(target);
+}
+
+void GlState::deleteBuffer(GLuint buffer)
+{
+    glDeleteBuffers(1, &buffer);
+
+    // OpenGL resets all bindings of the deleted buffer in the current context
+    for(auto& bindingIter : mBufferBindings)
+    {
+        if(bindingIter.second == buffer)
+            bindingIter.second = 0;
+    }
+
+    for(auto& bindingIter : mElementArrayBindings)
+    {
+        if(bindingIter.second == buffer)
+            bindingIter.second = 0;
+    }
+
+    for(auto& bindingIter : mIndexedBindings)
+    {
+        if(bindingIter.second.buffer == buffer)
+        {
+            bindingIter.second.buffer = 0;
+            bindingIter.second.offset = 0;
+            bindingIter.second.size = 0;
+        }
+    }
+}
+
+void GlState::useProgram(GLuint program)
+{
+    if(mProgramKnown && mProgram == program)
+        return;
+
+    glUseProgram(program);
+    mProgram = program;
+    mProgramKnown = true;
+}
+
+GLuint GlState::getCurrentProgram()
+{
+    if(!mProgramKnown)
+    {
+        mProgram = glutils::glGet(GL_CURRENT_PROGRAM);
+        mProgramKnown = true;
+    }
+
+    return mProgram;
+}
+
+void GlState::deleteProgram(GLuint program)
+{
+    // A program in use is only flagged for deletion, so its name is not reused while it is current
+    glDeleteProgram(program);
+}
+
+void GlState::bindVertexArray(GLuint vertexArray)
+{
+    if(mVertexArrayKnown && mVertexArray == vertexArray)
+        return;
+
+    glBindVertexArray(vertexArray);
+    mVertexArray = vertexArray;
+    mVertexArrayKnown = true;
+}
+
+GLuint GlState::getBoundVertexArray()
+{
+    if(!mVertexArrayKnown)
+    {
+        mVertexArray = glutils::glGet(GL_VERTEX_ARRAY_BINDING);
+        mVertexArrayKnown = true;
+    }
+
+    return mVertexArray;
+}
+
+void GlState::setVertexArrayElementBuffer(GLuint vertexArray, GLuint buffer)
+{
+    auto bindingIter = mElementArrayBindings.find(vertexArray);
+    if(bindingIter != mElementArrayBindings.end() && bindingIter->second == buffer)
+        return;
+
+    glVertexArrayElementBuffer(vertexArray, buffer);
+    mElementArrayBindings[vertexArray] = buffer;
+}
+
+void GlState::deleteVertexArray(GLuint vertexArray)
+{
+    glDeleteVertexArrays(1, &vertexArray);
+
+    // The name may be reused by a new vertex array, which has no element array buffer
+    mElementArrayBindings.erase(vertexArray);
+
+    if(mVertexArrayKnown && mVertexArray == vertexArray)
+        mVertexArray = 0;
+}
+
+void GlState::setCapability(GLenum capability, bool enabled)
+{
+    if(isEnabled(capability) == enabled)
+        return;
+
+    if(enabled)
+        glEnable(capability);
+    else
+        glDisable(capability);
+
+    mCapabilities[capability] = enabled;
+}
+
+bool GlState::isEnabled(GLenum capability)
+{
+    auto capabilityIter = mCapabilities.find(capability);
+    if(capabilityIter != mCapabilities.end())
+        return capabilityIter->second;
+
+    bool enabled;
+    if(mDefaultsValid)
+        enabled = capability == GL_DITHER || capability == GL_MULTISAMPLE;
+    else
+        enabled = glIsEnabled(capability);
+
+    mCapabilities[capability] = enabled;
+    return enabled;
+}
+
+void GlState::invalidate()
+{
+    mDefaultsValid = false;
+    mBufferBindings.clear();
+    mElementArrayBindings.clear();
+    mIndexedBindings.clear();
+    mProgramKnown = false;
+    mVertexArrayKnown = false;
+    mCapabilities.clear();
+}
+
+GLuint& GlState::getBufferBinding(GLenum target)
+{
+    // The element array buffer binding is part of the vertex array object
+    std::map<GLuint, GLuint>& bindings = (target == GL_ELEMENT_ARRAY_BUFFER) ? mElementArrayBindings : mBufferBindings;
+    const GLuint key = (target == GL_ELEMENT_ARRAY_BUFFER) ? getBoundVertexArray() : target;
+
+    auto bindingIter = bindings.find(key);
+    if(bindingIter != bindings.end())
+        return bindingIter->second;
+
+    GLuint& binding = bindings[key];
+    binding = mDefaultsValid ? 0 : glutils::glGet(getBindingName(target));
+    return binding;
+}
+
+} // namespace nparticles
@@ -9,9 +9,12 @@
 
 #include "gpusystem.hpp"
 
+#include "logger.hpp"
 #include "particlesystem.hpp"
 #include "shaderprogram.hpp"
 
+#include <algorithm>
+
 namespace nparticles
 {
 
@@ -25,39 +28,138 @@ GPUSystem::~GPUSystem()
 
 void GPUSystem::bindParticleBuffers(ParticleSystem* particleSystem, ShaderProgram* shaderProgram)
 {
-    // Bind particle attributes
-    ParticleSystem::particle_attribute_buffers attributeBuffers = particleSystem->getParticleAttributeBuffers();
-    for(auto attributeIter : attributeBuffers)
-        shaderProgram->bindShaderStorageBuffer(attributeIter.first, attributeIter.second);
-
-    // Bind atomic counters
-    ParticleSystem::atomic_counter_buffers atomicCounterBuffers = particleSystem->getAtomicCounterBuffers();
-    for(auto atomicCounterIter : atomicCounterBuffers)
-        shaderProgram->bindAtomicCounterBuffer(atomicCounterIter.first, atomicCounterIter.second);
-
-    // Bind uniform buffers
-    ParticleSystem::uniform_buffers uniformBuffers = particleSystem->getUniformBuffers();
-    for(auto uniformIter : uniformBuffers)
-        shaderProgram->bindUniformBuffer(uniformIter.first, uniformIter.second);
+    // Look up the binding table and rebuild it if the buffers of the system changed
+    auto tableIter = mBindingTables.find(std::make_pair(shaderProgram, particleSystem));
+    if(tableIter == mBindingTables.end())
+    {
+        tableIter = mBindingTables.insert(std::make_pair(std::make_pair(shaderProgram, particleSystem), BindingTable())).first;
+        buildBindingTable(particleSystem, shaderProgram, tableIter->second);
+    }
+    else if(tableIter->second.generation != particleSystem->getBufferGeneration())
+        buildBindingTable(particleSystem, shaderProgram, tableIter->second);
+
+    for(auto& run : tableIter->second.runs)
+        BufferBase::bindBases(run.target, run.first, run.buffers.size(), run.buffers.data());
+
+    // Bind the alive count. It uses a fixed binding point (see np/particlecount.glsl), so shaders which
+    // do not declare it are not queried.
+    if(particleSystem->getAliveCountBuffer())
+        particleSystem->getAliveCountBuffer()->bindBase(GL_ATOMIC_COUNTER_BUFFER, 0);
 }
 
 void GPUSystem::unbindParticleBuffers(ParticleSystem* particleSystem)
 {
-    // Bind particle attributes
-    ParticleSystem::particle_attribute_buffers attributeBuffers = particleSystem->getParticleAttributeBuffers();
-    for(auto attributeIter : attributeBuffers)
+    // Unbind particle attributes
+    for(auto& attributeIter : particleSystem->getParticleAttributeBuffers())
         attributeIter.second->unbind();
 
-    // Bind atomic counters
-    ParticleSystem::atomic_counter_buffers atomicCounterBuffers = particleSystem->getAtomicCounterBuffers();
-    for(auto atomicCounterIter : atomicCounterBuffers)
+    // Unbind atomic counters
+    for(auto& atomicCounterIter : particleSystem->getAtomicCounterBuffers())
         atomicCounterIter.second->unbind();
 
-    // Bind uniform buffers
-    ParticleSystem::uniform_buffers uniformBuffers = particleSystem->getUniformBuffers();
-    for(auto uniformIter : uniformBuffers)
+    if(particleSystem->getAliveCountBuffer())
+        particleSystem->getAliveCountBuffer()->unbind();
+
+    // Unbind uniform buffers
+    for(auto& uniformIter : particleSystem->getUniformBuffers())
         uniformIter.second->unbind();
+
+    // Unbind storage buffers
+    for(auto& storageIter : particleSystem->getStorageBuffers())
+        storageIter.second->unbind();
 }
 
+void GPUSystem::removeParticleSystem(const ParticleSystem* particleSystem)
+{
+    auto tableIter = mBindingTables.begin();
+    while(tableIter != mBindingTables.end())
+    {
+        if(tableIter->first.second == particleSystem)
+            tableIter = mBindingTables.erase(tableIter);
+        else
+            ++tableIter;
+    }
+}
+
+void GPUSystem::buildBindingTable(ParticleSystem* particleSystem, const ShaderProgram* shaderProgram, BindingTable& table)
+{
+    struct Binding
+    {
+        GLenum target;
+        GLint index;
+        BufferBase* buffer;
+    };
+
+    // Collect the bindings in the order they were bound one by one, so later buffers win on shared indices
+    std::vector<Binding> bindings;
+
+    for(auto& attributeIter : particleSystem->getParticleAttributeBuffers())
+    {
+        GLint index = shaderProgram->getBufferBinding(GL_SHADER_STORAGE_BUFFER, attributeIter.first);
+        if(index != -1)
+            bindings.push_back({GL_SHADER_STORAGE_BUFFER, index, attributeIter.second});
+    }
+
+    for(auto& atomicCounterIter : particleSystem->getAtomicCounterBuffers())
+    {
+        GLint index = shaderProgram->getBufferBinding(GL_ATOMIC_COUNTER_BUFFER, atomicCounterIter.first);
+        if(index != -1)
+            bindings.push_back({GL_ATOMIC_COUNTER_BUFFER, index, atomicCounterIter.second});
+        else
+            Logger::getInstance()->logWarning("GPUSystem: cannot bind atomic counter buffer. No atomic counter uniform named \"" + atomicCounterIter.first + "\".");
+    }
+
+    for(auto& uniformIter : particleSystem->getUniformBuffers())
+    {
+        GLint index = shaderProgram->getBufferBinding(GL_UNIFORM_BUFFER, uniformIter.first);
+        if(index != -1)
+            bindings.push_back({GL_UNIFORM_BUFFER, index, uniformIter.second});
+        else
+            Logger::getInstance()->logWarning("GPUSystem: cannot bind uniform buffer. No uniform block named \"" + uniformIter.first + "\".");
+    }
+
+    for(auto& storageIter : particleSystem->getStorageBuffers())
+    {
+        GLint index = shaderProgram->getBufferBinding(GL_SHADER_STORAGE_BUFFER, storageIter.first);
+        if(index != -1)
+            bindings.push_back({GL_SHADER_STORAGE_BUFFER, index, storageIter.second});
+    }
+
+    std::stable_sort(bindings.begin(), bindings.end(), [](const Binding& a, const Binding& b)
+    {
+        return a.target < b.target || (a.target == b.target && a.index < b.index);
+    });
+
+    // Group consecutive indices into runs. Indices are not filled up with other buffers, since this would
+    // overwrite bindings made outside of the table.
+    table.runs.clear();
+    for(auto& binding : bindings)
+    {
+        if(!table.runs.empty())
+        {
+            BindingRun& run = table.runs.back();
+            const GLuint next = run.first + run.buffers.size();
+
+            if(run.target == binding.target && next - 1 == (GLuint)binding.index)
+            {
+                run.buffers.back() = binding.buffer;
+                continue;
+            }
+            if(run.target == binding.target && next == (GLuint)binding.index)
+            {
+                run.buffers.push_back(binding.buffer);
+                continue;
+            }
+        }
+
+        BindingRun run;
+        run.target = binding.target;
+        run.first = binding.index;
+        run.buffers.push_back(binding.buffer);
+        table.runs.push_back(run);
+    }
+
+    table.generation = particleSystem->getBufferGeneration();
+}
 
 } // namespace nparticles
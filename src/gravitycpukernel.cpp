@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "gravitycpukernel.hpp"
+
+#include "gravitysolver.hpp"
+#include "particlesystem.hpp"
+#include "buffer.hpp"
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+GravityCPUKernel::GravityCPUKernel(GravitySolver* solver, gravity_integrators integrator, std::string positionsAttribute, std::string propertiesAttribute)
+    : CPUKernel(kernel_function(), 4096),
+      mSolver(solver),
+      mIntegrator(integrator),
+      mPositionsAttribute(positionsAttribute),
+      mPropertiesAttribute(propertiesAttribute),
+      mTimeStep(0.001f)
+{
+}
+
+GravityCPUKernel::~GravityCPUKernel()
+{
+    delete mSolver;
+}
+
+void GravityCPUKernel::beginUpdate(ParticleSystem* particleSystem, ThreadPool& threadPool)
+{
+    glm::vec4* positions = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(mPositionsAttribute))->map();
+    unsigned particleCount = particleSystem->getParticleCount();
+
+    mAccelerations.resize(particleCount);
+    mSolver->computeAccelerations(positions, particleCount, mAccelerations.data(), threadPool);
+}
+
+void GravityCPUKernel::update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+{
+    glm::vec4* positions = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(mPositionsAttribute))->map();
+    glm::vec4* properties = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(mPropertiesAttribute))->map();
+
+    for(unsigned i = first; i < last; ++i)
+    {
+        glm::vec3 position(positions[i]);
+        float mass = positions[i].w;
+        glm::vec3 acceleration = mAccelerations[i];
+
+        switch(mIntegrator)
+        {
+        case NP_GI_EULER:
+        {
+            glm::vec3 oldVelocity(properties[i]);
+            glm::vec3 newVelocity = oldVelocity + acceleration * mTimeStep;
+            positions[i] = glm::vec4(position + 0.5f * (oldVelocity + newVelocity) * mTimeStep, mass);
+            properties[i] = glm::vec4(newVelocity, properties[i].w);
+            break;
+        }
+        case NP_GI_VERLET:
+            positions[i] = glm::vec4(2.0f * position - glm::vec3(properties[i]) + acceleration * mTimeStep * mTimeStep, mass);
+            properties[i] = glm::vec4(position, properties[i].w);
+            break;
+        case NP_GI_VERLET_DOUBLE_BUFFERED:
+            properties[i] = glm::vec4(2.0f * position - glm::vec3(properties[i]) + acceleration * mTimeStep * mTimeStep, properties[i].w);
+            break;
+        }
+    }
+}
+
+} // namespace nparticles
@@ -14,27 +14,18 @@ namespace nparticles
 
 Mesh::Mesh(size_t vertexCount, glm::vec3* vertices, size_t indexCount, GLuint* indices)
     : mVertexBuffer(vertexCount, GL_INVALID_VALUE, -1, GL_STATIC_DRAW, GL_ARRAY_BUFFER),
-      mIndexBuffer(indexCount, GL_INVALID_VALUE, -1, GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER)
+      mIndexBuffer(indexCount, GL_INVALID_VALUE, -1, GL_STATIC_DRAW, GL_ELEMENT_ARRAY_BUFFER),
+      mGeneration(0)
 {
-    glGenVertexArrays(1, &mVao);
+    static unsigned generationCounter = 0;
+    mGeneration = ++generationCounter;
+
     mVertexBuffer.setData(vertices);
     mIndexBuffer.setData(indices);
 }
 
 Mesh::~Mesh()
 {
-    glDeleteVertexArrays(1, &mVao);
-}
-
-void Mesh::bind() const
-{
-    glBindVertexArray(mVao);
-}
-
-void Mesh::unbind() const
-{
-    // Maybe we have to add a isBound check... not sure about that.
-    glBindVertexArray(0);
 }
 
 } // namespace nparticles
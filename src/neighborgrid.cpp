@@ -0,0 +1,360 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "neighborgrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "engine.hpp"
+#include "particlesystem.hpp"
+#include "computeprogram.hpp"
+#include "computesystem.hpp"
+#include "gpuprogramservice.hpp"
+#include "cpukernel.hpp"
+#include "threadpool.hpp"
+#include "logger.hpp"
+
+namespace nparticles
+{
+
+const char* const NeighborGrid::CELL_COUNTS_BUFFER = "NPGridCellCounts";
+const char* const NeighborGrid::CELL_STARTS_BUFFER = "NPGridCellStarts";
+const char* const NeighborGrid::CELL_ENDS_BUFFER = "NPGridCellEnds";
+const char* const NeighborGrid::PARTICLE_CELLS_BUFFER = "NPGridParticleCells";
+const char* const NeighborGrid::PARTICLE_INDICES_BUFFER = "NPGridParticleIndices";
+
+namespace
+{
+
+// The number of cells summed by one task of the CPU prefix sum.
+const unsigned SCAN_BLOCK_SIZE = 16384;
+
+/**
+ * Base class of the CPU kernels building the grid. The grid is set by the pre update listener
+ * of the Action, so one kernel serves all NeighborGrids.
+ */
+class GridCPUKernel : public CPUKernel
+{
+public:
+    GridCPUKernel(unsigned grainSize)
+        : CPUKernel(kernel_function(), grainSize),
+          mGrid(nullptr)
+    {
+    }
+
+    void setGrid(const NeighborGrid* grid) { mGrid = grid; }
+
+protected:
+    const NeighborGrid* mGrid;
+};
+
+/**
+ * CPU counterpart of grid-count.glsl. The cells are determined in parallel, the ranks are assigned
+ * sequentially, so the particles of each cell stay in index order.
+ */
+class GridCountKernel : public GridCPUKernel
+{
+public:
+    GridCountKernel()
+        : GridCPUKernel(4096)
+    {
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        glm::vec4* positions = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(mGrid->getPositionsAttribute()))->map();
+        glm::uvec2* particleCells = ((Buffer<glm::uvec2>*)particleSystem->getStorageBuffer(NeighborGrid::PARTICLE_CELLS_BUFFER))->map();
+
+        for(unsigned i = first; i < last; ++i)
+            particleCells[i].x = mGrid->getCellIndex(glm::vec3(positions[i]));
+    }
+
+    void endUpdate(ParticleSystem* particleSystem, ThreadPool&)
+    {
+        glm::uvec2* particleCells = ((Buffer<glm::uvec2>*)particleSystem->getStorageBuffer(NeighborGrid::PARTICLE_CELLS_BUFFER))->map();
+        GLuint* cellCounts = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::CELL_COUNTS_BUFFER))->map();
+
+        for(unsigned i = 0; i < particleSystem->getParticleCount(); ++i)
+            particleCells[i].y = cellCounts[particleCells[i].x]++;
+    }
+};
+
+/**
+ * CPU counterpart of grid-scan.glsl. The prefix sum runs in beginUpdate(), there is no per particle work.
+ */
+class GridScanKernel : public GridCPUKernel
+{
+public:
+    GridScanKernel()
+        : GridCPUKernel(std::numeric_limits<unsigned>::max())
+    {
+    }
+
+    void beginUpdate(ParticleSystem* particleSystem, ThreadPool& threadPool)
+    {
+        GLuint* cellCounts = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::CELL_COUNTS_BUFFER))->map();
+        GLuint* cellStarts = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::CELL_STARTS_BUFFER))->map();
+        GLuint* cellEnds = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::CELL_ENDS_BUFFER))->map();
+
+        const unsigned cellCount = mGrid->getCellCount();
+        const unsigned blockCount = (cellCount + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE;
+
+        // Sum the blocks, scan the block sums, then scan each block starting at its offset.
+        std::vector<unsigned> blockOffsets(blockCount);
+        threadPool.parallelFor(0, blockCount, [&](unsigned first, unsigned last)
+        {
+            for(unsigned b = first; b < last; ++b)
+            {
+                unsigned sum = 0;
+                for(unsigned c = b * SCAN_BLOCK_SIZE; c < std::min(cellCount, (b + 1) * SCAN_BLOCK_SIZE); ++c)
+                    sum += cellCounts[c];
+                blockOffsets[b] = sum;
+            }
+        }, 1);
+
+        unsigned offset = 0;
+        for(unsigned b = 0; b < blockCount; ++b)
+        {
+            unsigned sum = blockOffsets[b];
+            blockOffsets[b] = offset;
+            offset += sum;
+        }
+
+        threadPool.parallelFor(0, blockCount, [&](unsigned first, unsigned last)
+        {
+            for(unsigned b = first; b < last; ++b)
+            {
+                unsigned offset = blockOffsets[b];
+                for(unsigned c = b * SCAN_BLOCK_SIZE; c < std::min(cellCount, (b + 1) * SCAN_BLOCK_SIZE); ++c)
+                {
+                    cellStarts[c] = offset;
+                    offset += cellCounts[c];
+                    cellEnds[c] = offset;
+                    cellCounts[c] = 0;
+                }
+            }
+        }, 1);
+    }
+};
+
+/**
+ * CPU counterpart of grid-scatter.glsl.
+ */
+class GridScatterKernel : public GridCPUKernel
+{
+public:
+    GridScatterKernel()
+        : GridCPUKernel(4096)
+    {
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        glm::uvec2* particleCells = ((Buffer<glm::uvec2>*)particleSystem->getStorageBuffer(NeighborGrid::PARTICLE_CELLS_BUFFER))->map();
+        GLuint* cellStarts = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::CELL_STARTS_BUFFER))->map();
+        GLuint* particleIndices = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::PARTICLE_INDICES_BUFFER))->map();
+
+        for(unsigned i = first; i < last; ++i)
+            particleIndices[cellStarts[particleCells[i].x] + particleCells[i].y] = i;
+    }
+};
+
+/**
+ * Get a compute program of the grid build. The program is created and its CPU kernel registered on first use.
+ */
+template<typename Kernel>
+ComputeProgram* getGridProgram(const std::string& id, const std::string& sourceFile)
+{
+    Engine* engine = Engine::getInstance();
+    GPUProgramService* gpuService = engine->getGPUProgramService();
+
+    ComputeProgram* computeProgram = gpuService->getComputeProgram(id);
+    if(computeProgram)
+        return computeProgram;
+
+    computeProgram = gpuService->createComputeProgram(id, sourceFile);
+    if(!computeProgram)
+        return nullptr;
+
+    engine->getComputeSystem().registerCPUKernel(*computeProgram, new Kernel());
+    return computeProgram;
+}
+
+} // anonymous namespace
+
+NeighborGrid::NeighborGrid(const glm::vec3& origin, const glm::uvec3& dimensions, float cellSize, const std::string& positionsAttribute)
+    : mType(NP_NG_UNIFORM),
+      mOrigin(origin),
+      mDimensions(glm::max(dimensions, glm::uvec3(1, 1, 1))),
+      mCellSize(cellSize),
+      mCellCount(mDimensions.x * mDimensions.y * mDimensions.z),
+      mPositionsAttribute(positionsAttribute)
+{
+}
+
+NeighborGrid::NeighborGrid(float cellSize, unsigned tableSize, const std::string& positionsAttribute)
+    : mType(NP_NG_HASHED),
+      mOrigin(0, 0, 0),
+      mDimensions(0, 0, 0),
+      mCellSize(cellSize),
+      mCellCount(1),
+      mPositionsAttribute(positionsAttribute)
+{
+    while(mCellCount < tableSize)
+        mCellCount *= 2;
+}
+
+bool NeighborGrid::attach(ParticleSystem* particleSystem)
+{
+    if(particleSystem->getStorageBuffer(CELL_STARTS_BUFFER))
+    {
+        Logger::getInstance()->logWarning("NeighborGrid: particle system already has a neighbor grid.");
+        return false;
+    }
+
+    ComputeProgram* countProgram = getGridProgram<GridCountKernel>("np-grid-count", "/np/grid-count.glsl");
+    ComputeProgram* scanProgram = getGridProgram<GridScanKernel>("np-grid-scan", "/np/grid-scan.glsl");
+    ComputeProgram* scatterProgram = getGridProgram<GridScatterKernel>("np-grid-scatter", "/np/grid-scatter.glsl");
+
+    if(!countProgram || !scanProgram || !scatterProgram)
+    {
+        Logger::getInstance()->logWarning("NeighborGrid: cannot create compute programs. Is \"/np\" added to the GPUProgramService?");
+        return false;
+    }
+
+    const unsigned particleCount = particleSystem->getParticleCount();
+
+    // The counts are reset by the scan, so they only have to be cleared once.
+    std::vector<GLuint> zeros(mCellCount, 0);
+    particleSystem->addStorageBuffer<GLuint>(CELL_COUNTS_BUFFER, mCellCount, GL_UNSIGNED_INT, 1)->setData(zeros.data());
+    particleSystem->addStorageBuffer<GLuint>(CELL_STARTS_BUFFER, mCellCount, GL_UNSIGNED_INT, 1)->setData(zeros.data());
+    particleSystem->addStorageBuffer<GLuint>(CELL_ENDS_BUFFER, mCellCount, GL_UNSIGNED_INT, 1)->setData(zeros.data());
+    particleSystem->addStorageBuffer<glm::uvec2>(PARTICLE_CELLS_BUFFER, particleCount, GL_UNSIGNED_INT, 2);
+    particleSystem->addStorageBuffer<GLuint>(PARTICLE_INDICES_BUFFER, particleCount, GL_UNSIGNED_INT, 1);
+
+    for(ComputeProgram* computeProgram : {countProgram, scanProgram, scatterProgram})
+    {
+        Action* action = particleSystem->appendAction(*computeProgram);
+
+        action->preUpdateSignal.connect([this, computeProgram](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+        {
+            setUniforms(*computeProgram);
+            computeProgram->setUniform("npGridParticleCount", particleSystem->getParticleCount());
+
+            GridCPUKernel* kernel = (GridCPUKernel*)computeSystem->getCurrentCPUKernel();
+            if(kernel)
+                kernel->setGrid(this);
+            else
+                computeProgram->bindShaderStorageBuffer("NPGridPositions", particleSystem->getParticleAttributeBuffer(mPositionsAttribute));
+        });
+    }
+
+    // Declare the buffer accesses of the passes (see ActionGraph)
+    const ParticleSystem::particle_actions& actions = particleSystem->getActions();
+    Action* countAction = actions[actions.size() - 3];
+    Action* scanAction = actions[actions.size() - 2];
+    Action* scatterAction = actions.back();
+
+    countAction->addRead(mPositionsAttribute);
+    countAction->addWrite(CELL_COUNTS_BUFFER);
+    countAction->addWrite(PARTICLE_CELLS_BUFFER);
+
+    scanAction->addWrite(CELL_COUNTS_BUFFER);
+    scanAction->addWrite(CELL_STARTS_BUFFER);
+    scanAction->addWrite(CELL_ENDS_BUFFER);
+
+    scatterAction->addRead(PARTICLE_CELLS_BUFFER);
+    scatterAction->addRead(CELL_STARTS_BUFFER);
+    scatterAction->addWrite(PARTICLE_INDICES_BUFFER);
+
+    return true;
+}
+
+void NeighborGrid::setUniforms(const ShaderProgram& program) const
+{
+    program.setUniform("npGridOrigin", mOrigin);
+    program.setUniform("npGridCellSize", mCellSize);
+    program.setUniform("npGridDimensions", mDimensions);
+    program.setUniform("npGridHashed", mType == NP_NG_HASHED);
+    program.setUniform("npGridCellCount", mCellCount);
+}
+
+glm::ivec3 NeighborGrid::getCellCoordinate(const glm::vec3& position) const
+{
+    glm::vec3 cell = (position - mOrigin) / mCellSize;
+    return glm::ivec3(std::floor(cell.x), std::floor(cell.y), std::floor(cell.z));
+}
+
+unsigned NeighborGrid::getCellIndex(const glm::ivec3& cell) const
+{
+    if(mType == NP_NG_HASHED)
+        return (((unsigned)cell.x * 73856093u) ^ ((unsigned)cell.y * 19349663u) ^ ((unsigned)cell.z * 83492791u)) & (mCellCount - 1);
+
+    return ((unsigned)cell.z * mDimensions.y + (unsigned)cell.y) * mDimensions.x + (unsigned)cell.x;
+}
+
+unsigned NeighborGrid::getCellIndex(const glm::vec3& position) const
+{
+    glm::ivec3 cell = getCellCoordinate(position);
+
+    if(mType == NP_NG_UNIFORM)
+        cell = clampToGrid(cell);
+
+    return getCellIndex(cell);
+}
+
+glm::ivec3 NeighborGrid::clampToGrid(const glm::ivec3& cell) const
+{
+    return glm::ivec3(std::min(std::max(cell.x, 0), (int)mDimensions.x - 1),
+                      std::min(std::max(cell.y, 0), (int)mDimensions.y - 1),
+                      std::min(std::max(cell.z, 0), (int)mDimensions.z - 1));
+}
+
+unsigned NeighborGrid::getNeighborCells(const glm::vec3& position, unsigned cells[27]) const
+{
+    glm::ivec3 center = getCellCoordinate(position);
+    if(mType == NP_NG_UNIFORM)
+        center = clampToGrid(center);
+
+    unsigned count = 0;
+    for(int x = -1; x <= 1; ++x)
+    {
+        for(int y = -1; y <= 1; ++y)
+        {
+            for(int z = -1; z <= 1; ++z)
+            {
+                glm::ivec3 cell = center + glm::ivec3(x, y, z);
+
+                if(mType == NP_NG_UNIFORM &&
+                   (cell.x < 0 || cell.y < 0 || cell.z < 0 ||
+                    cell.x >= (int)mDimensions.x || cell.y >= (int)mDimensions.y || cell.z >= (int)mDimensions.z))
+                    continue;
+
+                unsigned index = getCellIndex(cell);
+
+                bool duplicate = false;
+                if(mType == NP_NG_HASHED)
+                {
+                    for(unsigned i = 0; i < count && !duplicate; ++i)
+                        duplicate = cells[i] == index;
+                }
+
+                if(!duplicate)
+                    cells[count++] = index;
+            }
+        }
+    }
+
+    return count;
+}
+
+} // namespace nparticles
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "octree.hpp"
+
+#include <algorithm>
+
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+namespace
+{
+
+// Spread the lower 21 bits of v so there are two zero bits between each of them.
+std::uint64_t expandBits(std::uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffull;
+    v = (v | v << 16) & 0x1f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+// Inverse of expandBits(): gather every third bit of v.
+std::uint64_t compactBits(std::uint64_t v)
+{
+    v &= 0x1249249249249249ull;
+    v = (v | v >> 2)  & 0x10c30c30c30c30c3ull;
+    v = (v | v >> 4)  & 0x100f00f00f00f00full;
+    v = (v | v >> 8)  & 0x1f0000ff0000ffull;
+    v = (v | v >> 16) & 0x1f00000000ffffull;
+    v = (v | v >> 32) & 0x1fffff;
+    return v;
+}
+
+} // anonymous namespace
+
+Octree::Octree(unsigned leafSize)
+    : mLeafSize(std::max(1u, leafSize)),
+      mRootMin(0, 0, 0),
+      mRootSize(0)
+{
+}
+
+void Octree::build(const glm::vec4* bodies, unsigned bodyCount, ThreadPool& threadPool)
+{
+    mNodes.clear();
+    mLeaves.clear();
+    mLevels.clear();
+
+    if(bodyCount == 0)
+    {
+        mKeys.clear();
+        mSortedBodies.clear();
+        return;
+    }
+
+    sortBodies(bodies, bodyCount, threadPool);
+
+    // Upper levels
+    std::vector<BuildTask> tasks;
+    mNodes.resize(1);
+    buildNode(mNodes, 0, 0, bodyCount, 0, &tasks);
+
+    // Subtrees. Each subtree is built into its own array with its root at index 0.
+    std::vector<std::vector<Node> > subtrees(tasks.size());
+    threadPool.parallelFor(0, tasks.size(), [&](unsigned first, unsigned last)
+    {
+        for(unsigned t = first; t < last; ++t)
+        {
+            subtrees[t].resize(1);
+            buildNode(subtrees[t], 0, tasks[t].firstBody, tasks[t].lastBody, tasks[t].level, nullptr);
+        }
+    }, 1);
+
+    // Append subtrees to the tree. The descendants of a subtree root are moved from index 1 to offset.
+    for(unsigned t = 0; t < tasks.size(); ++t)
+    {
+        unsigned offset = mNodes.size();
+        mNodes.insert(mNodes.end(), subtrees[t].begin() + 1, subtrees[t].end());
+
+        for(unsigned n = offset; n < mNodes.size(); ++n)
+        {
+            if(mNodes[n].childCount > 0)
+                mNodes[n].firstChild += offset - 1;
+        }
+
+        Node& root = mNodes[tasks[t].nodeIndex];
+        root = subtrees[t][0];
+        if(root.childCount > 0)
+            root.firstChild += offset - 1;
+    }
+
+    // Leaves and levels
+    for(unsigned n = 0; n < mNodes.size(); ++n)
+    {
+        if(mNodes[n].childCount == 0)
+            mLeaves.push_back(n);
+
+        if(mNodes[n].level >= mLevels.size())
+            mLevels.resize(mNodes[n].level + 1);
+        mLevels[mNodes[n].level].push_back(n);
+    }
+}
+
+void Octree::sortBodies(const glm::vec4* bodies, unsigned bodyCount, ThreadPool& threadPool)
+{
+    // Bounding box, reduced per chunk
+    unsigned chunkCount = std::min(bodyCount, threadPool.getThreadCount() * 4);
+    unsigned chunkSize = (bodyCount + chunkCount - 1) / chunkCount;
+    std::vector<glm::vec3> chunkMin(chunkCount, glm::vec3(bodies[0]));
+    std::vector<glm::vec3> chunkMax(chunkCount, glm::vec3(bodies[0]));
+
+    threadPool.parallelFor(0, bodyCount, [&](unsigned first, unsigned last)
+    {
+        unsigned chunk = first / chunkSize;
+        for(unsigned i = first; i < last; ++i)
+        {
+            chunkMin[chunk] = glm::min(chunkMin[chunk], glm::vec3(bodies[i]));
+            chunkMax[chunk] = glm::max(chunkMax[chunk], glm::vec3(bodies[i]));
+        }
+    }, chunkSize);
+
+    glm::vec3 min = chunkMin[0];
+    glm::vec3 max = chunkMax[0];
+    for(unsigned c = 1; c < chunkCount; ++c)
+    {
+        min = glm::min(min, chunkMin[c]);
+        max = glm::max(max, chunkMax[c]);
+    }
+
+    // Enlarge the root cube slightly so no body lies on its upper border
+    glm::vec3 extent = max - min;
+    mRootSize = std::max(std::max(extent.x, extent.y), extent.z) * 1.0001f + 1e-6f;
+    mRootMin = min;
+
+    // Morton keys
+    mKeys.resize(bodyCount);
+    const float scale = (1u << MAX_LEVEL) / mRootSize;
+    const std::uint64_t maxCoordinate = (1u << MAX_LEVEL) - 1;
+
+    threadPool.parallelFor(0, bodyCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+        {
+            glm::vec3 cell = (glm::vec3(bodies[i]) - mRootMin) * scale;
+            std::uint64_t x = std::min(maxCoordinate, (std::uint64_t)std::max(0.0f, cell.x));
+            std::uint64_t y = std::min(maxCoordinate, (std::uint64_t)std::max(0.0f, cell.y));
+            std::uint64_t z = std::min(maxCoordinate, (std::uint64_t)std::max(0.0f, cell.z));
+
+            mKeys[i].key = (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+            mKeys[i].index = i;
+        }
+    });
+
+    // Sort chunks in parallel, then merge pairs of chunks until the whole array is sorted
+    threadPool.parallelFor(0, bodyCount, [&](unsigned first, unsigned last)
+    {
+        std::sort(mKeys.begin() + first, mKeys.begin() + last);
+    }, chunkSize);
+
+    for(unsigned width = chunkSize; width < bodyCount; width *= 2)
+    {
+        unsigned pairCount = (bodyCount + 2 * width - 1) / (2 * width);
+        threadPool.parallelFor(0, pairCount, [&](unsigned first, unsigned last)
+        {
+            for(unsigned pair = first; pair < last; ++pair)
+            {
+                unsigned begin = pair * 2 * width;
+                unsigned middle = std::min(begin + width, bodyCount);
+                unsigned end = std::min(begin + 2 * width, bodyCount);
+                std::inplace_merge(mKeys.begin() + begin, mKeys.begin() + middle, mKeys.begin() + end);
+            }
+        }, 1);
+    }
+
+    // Gather bodies in Morton order for cache friendly traversal
+    mSortedBodies.resize(bodyCount);
+    threadPool.parallelFor(0, bodyCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+            mSortedBodies[i] = bodies[mKeys[i].index];
+    });
+}
+
+void Octree::buildNode(std::vector<Node>& nodes, unsigned nodeIndex, unsigned first, unsigned last, unsigned level, std::vector<BuildTask>* tasks)
+{
+    if(tasks && level == PARALLEL_BUILD_LEVEL && last - first > mLeafSize)
+    {
+        BuildTask task = {nodeIndex, first, last, level};
+        tasks->push_back(task);
+        return;
+    }
+
+    Node& node = nodes[nodeIndex];
+    node.size = mRootSize / (1u << level);
+    node.firstChild = 0;
+    node.childCount = 0;
+    node.firstBody = first;
+    node.bodyCount = last - first;
+    node.level = level;
+
+    // The cell coordinates of the node are the upper bits of the coordinates of its bodies.
+    std::uint64_t key = mKeys[first].key;
+    unsigned cellShift = MAX_LEVEL - level;
+    glm::vec3 cell((float)(compactBits(key >> 2) >> cellShift),
+                   (float)(compactBits(key >> 1) >> cellShift),
+                   (float)(compactBits(key) >> cellShift));
+    node.center = mRootMin + (cell + glm::vec3(0.5f, 0.5f, 0.5f)) * node.size;
+
+    if(last - first > mLeafSize && level < MAX_LEVEL)
+    {
+        // All keys of the node share the bits above shift. The next three bits select the child.
+        unsigned shift = 3 * (MAX_LEVEL - 1 - level);
+        unsigned childFirst[9];
+        childFirst[0] = first;
+        for(unsigned octant = 1; octant < 8; ++octant)
+        {
+            childFirst[octant] = std::partition_point(mKeys.begin() + childFirst[octant - 1], mKeys.begin() + last,
+                                                      [=](const BodyKey& body) { return ((body.key >> shift) & 7) < octant; })
+                                 - mKeys.begin();
+        }
+        childFirst[8] = last;
+
+        unsigned childCount = 0;
+        for(unsigned octant = 0; octant < 8; ++octant)
+            childCount += childFirst[octant + 1] > childFirst[octant];
+
+        unsigned firstChild = nodes.size();
+        node.firstChild = firstChild;
+        node.childCount = childCount;
+
+        // Note: node is invalidated by the resize.
+        nodes.resize(nodes.size() + childCount);
+
+        unsigned child = firstChild;
+        for(unsigned octant = 0; octant < 8; ++octant)
+        {
+            if(childFirst[octant + 1] > childFirst[octant])
+                buildNode(nodes, child++, childFirst[octant], childFirst[octant + 1], level + 1, tasks);
+        }
+    }
+}
+
+} // namespace nparticles
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "parallelprimitives.hpp"
+
+#include "engine.hpp"
+#include "computeprogram.hpp"
+#include "gpuprogramservice.hpp"
+#include "logger.hpp"
+
+namespace nparticles
+{
+
+const unsigned ParallelPrimitives::ALL_ITEMS = std::numeric_limits<unsigned>::max();
+const unsigned ParallelPrimitives::TILE_SIZE = 2048;
+const unsigned ParallelPrimitives::CPU_GRAIN_SIZE = 16384;
+
+namespace
+{
+
+/**
+ * The maximum number of work groups along one dimension of a dispatch.
+ */
+const unsigned MAX_GROUPS_PER_DIMENSION = 65535;
+
+/**
+ * Words per tile in the tile states: status, aggregate and inclusive prefix. The first word is the tile counter.
+ */
+const unsigned WORDS_PER_TILE = 3;
+
+} // anonymous namespace
+
+ParallelPrimitives::ParallelPrimitives(ThreadPool& threadPool)
+    : mThreadPool(threadPool),
+      mScanProgram(nullptr),
+      mTileStates(nullptr)
+{
+}
+
+ParallelPrimitives::~ParallelPrimitives()
+{
+    delete mTileStates;
+}
+
+bool ParallelPrimitives::dispatch(gpu_modes mode, unsigned type, primitive_operations operation, BufferBase& input, BufferBase* flags,
+                                  BufferBase* output, BufferBase* result, unsigned count)
+{
+    if(count == ALL_ITEMS)
+        count = input.getItemCount();
+
+    if(count > (unsigned)input.getItemCount() || (flags && count > (unsigned)flags->getItemCount())
+       || (output && count > (unsigned)output->getItemCount()) || (result && result->getItemCount() < 1))
+    {
+        Logger::getInstance()->logWarning("ParallelPrimitives: buffers are too small for " + std::to_string(count) + " items.");
+        return false;
+    }
+
+    if(output == &input)
+    {
+        Logger::getInstance()->logWarning("ParallelPrimitives: input and output have to be different buffers.");
+        return false;
+    }
+
+    if(count == 0)
+    {
+        // Nothing to reduce. A compaction keeps no items.
+        if(mode == GPU_REDUCE)
+            return false;
+        if(mode == GPU_COMPACT)
+            result->clearData();
+        return true;
+    }
+
+    if(!mScanProgram)
+    {
+        GPUProgramService* gpuService = Engine::getInstance()->getGPUProgramService();
+        mScanProgram = gpuService->getComputeProgram("np-primitive-scan");
+        if(!mScanProgram)
+            mScanProgram = gpuService->createComputeProgram("np-primitive-scan", "/np/primitive-scan.glsl");
+
+        if(!mScanProgram)
+        {
+            Logger::getInstance()->logWarning("ParallelPrimitives: cannot create compute program. Is \"/np\" added to the GPUProgramService?");
+            return false;
+        }
+    }
+
+    const unsigned tileCount = (count + TILE_SIZE - 1) / TILE_SIZE;
+
+    if(!mTileStates || (unsigned)mTileStates->getItemCount() < 1 + WORDS_PER_TILE * tileCount)
+    {
+        delete mTileStates;
+        mTileStates = new Buffer<GLuint>(1 + WORDS_PER_TILE * tileCount, GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY, GL_SHADER_STORAGE_BUFFER);
+    }
+
+    // All tiles start without status
+    mTileStates->clearData();
+
+    // Make previous shader writes to the buffers visible
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    mScanProgram->bind();
+    mScanProgram->setUniform("npPrimitiveMode", (unsigned)mode);
+    mScanProgram->setUniform("npPrimitiveType", type);
+    mScanProgram->setUniform("npPrimitiveOperation", (unsigned)operation);
+    mScanProgram->setUniform("npPrimitiveSegmented", flags != nullptr && mode != GPU_COMPACT);
+    mScanProgram->setUniform("npPrimitiveCount", count);
+    mScanProgram->setUniform("npPrimitiveTileCount", tileCount);
+
+    mScanProgram->bindShaderStorageBuffer("NPPrimitiveInput", &input);
+    mScanProgram->bindShaderStorageBuffer("NPPrimitiveTiles", mTileStates);
+    if(flags)
+        mScanProgram->bindShaderStorageBuffer("NPPrimitiveFlags", flags);
+    if(output)
+        mScanProgram->bindShaderStorageBuffer("NPPrimitiveOutput", output);
+    if(result)
+        mScanProgram->bindShaderStorageBuffer("NPPrimitiveResult", result);
+
+    // Tiles are assigned by the tile counter, so the work groups may be spread over two dimensions.
+    const unsigned groupsX = std::min(tileCount, MAX_GROUPS_PER_DIMENSION);
+    const unsigned groupsY = (tileCount + groupsX - 1) / groupsX;
+    glDispatchCompute(groupsX, groupsY, 1);
+
+    // The results are visible to shaders, commands, mappings and copies
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    input.unbind();
+    mTileStates->unbind();
+    if(flags)
+        flags->unbind();
+    if(output)
+        output->unbind();
+    if(result)
+        result->unbind();
+
+    mScanProgram->unbind();
+    return true;
+}
+
+unsigned ParallelPrimitives::getChunkCount(unsigned count) const
+{
+    const unsigned chunkCount = std::min((count + CPU_GRAIN_SIZE - 1) / CPU_GRAIN_SIZE, 4 * mThreadPool.getThreadCount());
+    return std::max(chunkCount, 1u);
+}
+
+} // namespace nparticles
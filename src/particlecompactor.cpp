@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "particlecompactor.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "engine.hpp"
+#include "particlesystem.hpp"
+#include "computeprogram.hpp"
+#include "computesystem.hpp"
+#include "gpuprogramservice.hpp"
+#include "cpukernel.hpp"
+#include "threadpool.hpp"
+#include "logger.hpp"
+
+namespace nparticles
+{
+
+const char* const ParticleCompactor::BLOCK_SUMS_BUFFER = "NPCompactBlockSums";
+const char* const ParticleCompactor::STATE_BUFFER = "NPCompactState";
+const char* const ParticleCompactor::PERMUTATION_BUFFER = "NPCompactPermutation";
+const char* const ParticleCompactor::SCRATCH_BUFFER = "NPCompactScratch";
+const unsigned ParticleCompactor::GROUP_SIZE = 256;
+
+namespace
+{
+
+/**
+ * Layout of the state buffer (see np/compact-scan.glsl).
+ */
+const unsigned STATE_OLD_ALIVE_COUNT = 0;
+const unsigned STATE_NEW_ALIVE_COUNT = 1;
+const unsigned STATE_SCATTER_GROUPS = 2;
+const unsigned STATE_SCAN_GROUPS = 5;
+const unsigned STATE_SIZE = 8;
+
+/**
+ * Get a compacted buffer by name: a particle attribute or a storage buffer.
+ */
+BufferBase* getCompactedBuffer(ParticleSystem* particleSystem, const std::string& name)
+{
+    BufferBase* buffer = particleSystem->getParticleAttributeBuffer(name);
+    if(!buffer)
+        buffer = particleSystem->getStorageBuffer(name);
+    return buffer;
+}
+
+/**
+ * Base class of the CPU kernels of the compaction.
+ */
+class CompactCPUKernel : public CPUKernel
+{
+public:
+    CompactCPUKernel(unsigned grainSize)
+        : CPUKernel(kernel_function(), grainSize)
+    {
+    }
+
+protected:
+    GLuint* getStorage(ParticleSystem* particleSystem, const char* name) const
+    {
+        return ((Buffer<GLuint>*)particleSystem->getStorageBuffer(name))->map();
+    }
+
+    unsigned getBlockCount(unsigned slotCount) const
+    {
+        return (slotCount + ParticleCompactor::GROUP_SIZE - 1) / ParticleCompactor::GROUP_SIZE;
+    }
+};
+
+/**
+ * CPU counterpart of compact-count.glsl. One work item per block.
+ */
+class CompactCountKernel : public CompactCPUKernel
+{
+public:
+    CompactCountKernel()
+        : CompactCPUKernel(16)
+    {
+    }
+
+    unsigned getWorkItemCount(ParticleSystem* particleSystem) const
+    {
+        return getBlockCount(particleSystem->getAliveCount());
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const GLuint* aliveFlags = getStorage(particleSystem, ParticleSystem::ALIVE_FLAGS_BUFFER);
+        GLuint* blockSums = getStorage(particleSystem, ParticleCompactor::BLOCK_SUMS_BUFFER);
+        const unsigned aliveCount = particleSystem->getAliveCount();
+
+        for(unsigned block = first; block < last; ++block)
+        {
+            unsigned end = std::min((block + 1) * ParticleCompactor::GROUP_SIZE, aliveCount);
+            unsigned sum = 0;
+            for(unsigned slot = block * ParticleCompactor::GROUP_SIZE; slot < end; ++slot)
+                sum += (aliveFlags[slot] != 0);
+            blockSums[block] = sum;
+        }
+    }
+};
+
+/**
+ * CPU counterpart of compact-scan.glsl. The prefix sum runs in beginUpdate(), there is no per particle work.
+ */
+class CompactScanKernel : public CompactCPUKernel
+{
+public:
+    CompactScanKernel()
+        : CompactCPUKernel(std::numeric_limits<unsigned>::max())
+    {
+    }
+
+    void beginUpdate(ParticleSystem* particleSystem, ThreadPool&)
+    {
+        GLuint* blockSums = getStorage(particleSystem, ParticleCompactor::BLOCK_SUMS_BUFFER);
+        GLuint* state = getStorage(particleSystem, ParticleCompactor::STATE_BUFFER);
+        GLuint* commands = particleSystem->getAliveCountBuffer()->map();
+
+        const unsigned oldAliveCount = commands[0];
+        const unsigned blockCount = getBlockCount(oldAliveCount);
+
+        unsigned offset = 0;
+        for(unsigned block = 0; block < blockCount; ++block)
+        {
+            unsigned sum = blockSums[block];
+            blockSums[block] = offset;
+            offset += sum;
+        }
+
+        state[STATE_OLD_ALIVE_COUNT] = oldAliveCount;
+        state[STATE_NEW_ALIVE_COUNT] = offset;
+        state[STATE_SCATTER_GROUPS] = blockCount;
+
+        // Alive count, instance count of the draw command and dispatch commands
+        commands[0] = offset;
+        commands[ParticleSystem::DRAW_COMMAND_OFFSET + 1] = offset;
+
+        const std::vector<unsigned>& groupSizes = particleSystem->getDispatchGroupSizes();
+        for(unsigned i = 0; i < groupSizes.size(); ++i)
+        {
+            GLuint* command = &commands[ParticleSystem::DISPATCH_COMMANDS_OFFSET + 3 * i];
+            command[0] = (offset + groupSizes[i] - 1) / groupSizes[i];
+            command[1] = 1;
+            command[2] = 1;
+        }
+    }
+
+    unsigned getWorkItemCount(ParticleSystem*) const
+    {
+        return 0;
+    }
+};
+
+/**
+ * CPU counterpart of compact-scatter.glsl. One work item per block.
+ */
+class CompactScatterKernel : public CompactCPUKernel
+{
+public:
+    CompactScatterKernel()
+        : CompactCPUKernel(16)
+    {
+    }
+
+    unsigned getWorkItemCount(ParticleSystem* particleSystem) const
+    {
+        return getStorage(particleSystem, ParticleCompactor::STATE_BUFFER)[STATE_SCATTER_GROUPS];
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        GLuint* aliveFlags = getStorage(particleSystem, ParticleSystem::ALIVE_FLAGS_BUFFER);
+        const GLuint* blockStarts = getStorage(particleSystem, ParticleCompactor::BLOCK_SUMS_BUFFER);
+        const GLuint* state = getStorage(particleSystem, ParticleCompactor::STATE_BUFFER);
+        GLuint* permutation = getStorage(particleSystem, ParticleCompactor::PERMUTATION_BUFFER);
+
+        for(unsigned block = first; block < last; ++block)
+        {
+            unsigned end = std::min((block + 1) * ParticleCompactor::GROUP_SIZE, state[STATE_OLD_ALIVE_COUNT]);
+            unsigned newSlot = blockStarts[block];
+
+            for(unsigned slot = block * ParticleCompactor::GROUP_SIZE; slot < end; ++slot)
+            {
+                if(aliveFlags[slot])
+                    permutation[newSlot++] = slot;
+
+                aliveFlags[slot] = (slot < state[STATE_NEW_ALIVE_COUNT]);
+            }
+        }
+    }
+};
+
+/**
+ * CPU counterpart of compact-gather.glsl. The items are gathered into the scratch buffer and copied back
+ * in endUpdate().
+ */
+class CompactGatherKernel : public CompactCPUKernel
+{
+public:
+    CompactGatherKernel()
+        : CompactCPUKernel(4096),
+          mSource(nullptr)
+    {
+    }
+
+    void setSource(BufferBase* source) { mSource = source; }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const char* source = (const char*)mSource->mapRaw();
+        char* scratch = (char*)particleSystem->getStorageBuffer(ParticleCompactor::SCRATCH_BUFFER)->mapRaw();
+        const GLuint* permutation = getStorage(particleSystem, ParticleCompactor::PERMUTATION_BUFFER);
+        const GLsizeiptr itemSize = mSource->getItemSize();
+
+        for(unsigned i = first; i < last; ++i)
+            std::memcpy(scratch + i * itemSize, source + permutation[i] * itemSize, itemSize);
+    }
+
+    void endUpdate(ParticleSystem* particleSystem, ThreadPool& threadPool)
+    {
+        char* source = (char*)mSource->mapRaw();
+        const char* scratch = (const char*)particleSystem->getStorageBuffer(ParticleCompactor::SCRATCH_BUFFER)->mapRaw();
+        const GLsizeiptr itemSize = mSource->getItemSize();
+
+        threadPool.parallelFor(0, particleSystem->getAliveCount(), [=](unsigned first, unsigned last)
+        {
+            std::memcpy(source + first * itemSize, scratch + first * itemSize, (last - first) * itemSize);
+        }, 16384);
+    }
+
+private:
+    BufferBase* mSource;
+};
+
+/**
+ * Get a compute program of the compaction. The program is created and its CPU kernel registered on first use.
+ */
+template<typename Kernel>
+ComputeProgram* getCompactProgram(const std::string& id, const std::string& sourceFile)
+{
+    Engine* engine = Engine::getInstance();
+    GPUProgramService* gpuService = engine->getGPUProgramService();
+
+    ComputeProgram* computeProgram = gpuService->getComputeProgram(id);
+    if(computeProgram)
+        return computeProgram;
+
+    computeProgram = gpuService->createComputeProgram(id, sourceFile);
+    if(!computeProgram)
+        return nullptr;
+
+    engine->getComputeSystem().registerCPUKernel(*computeProgram, new Kernel());
+    return computeProgram;
+}
+
+} // anonymous namespace
+
+ParticleCompactor::ParticleCompactor()
+{
+}
+
+void ParticleCompactor::addPerParticleBuffer(const std::string& name)
+{
+    mPerParticleBuffers.push_back(name);
+}
+
+bool ParticleCompactor::attach(ParticleSystem* particleSystem, unsigned interval)
+{
+    if(!particleSystem->getAliveCountBuffer())
+    {
+        Logger::getInstance()->logWarning("ParticleCompactor: particle system has no dynamic particle count. Call ParticleSystem::setAliveCount() first.");
+        return false;
+    }
+
+    if(particleSystem->getStorageBuffer(PERMUTATION_BUFFER))
+    {
+        Logger::getInstance()->logWarning("ParticleCompactor: particle system already has a particle compactor.");
+        return false;
+    }
+
+    const unsigned particleCount = particleSystem->getParticleCount();
+
+    // Collect the compacted buffers. The gather copies 32 bit words.
+    std::vector<std::string> compactedBuffers;
+    for(auto attributeIter : particleSystem->getParticleAttributeBuffers())
+        compactedBuffers.push_back(attributeIter.first);
+    compactedBuffers.insert(compactedBuffers.end(), mPerParticleBuffers.begin(), mPerParticleBuffers.end());
+
+    GLsizeiptr largestItemSize = sizeof(GLuint);
+    for(auto& name : compactedBuffers)
+    {
+        BufferBase* buffer = getCompactedBuffer(particleSystem, name);
+        if(!buffer || buffer->getItemCount() != (GLsizei)particleCount || buffer->getItemSize() % 4 != 0)
+        {
+            Logger::getInstance()->logWarning("ParticleCompactor: cannot compact buffer \"" + name + "\". It has to hold one item of a multiple of four bytes per particle.");
+            return false;
+        }
+
+        // Streamed attributes are rewritten every frame and cannot be copied
+        if(dynamic_cast<RingBufferBase*>(buffer))
+        {
+            Logger::getInstance()->logWarning("ParticleCompactor: cannot compact streamed attribute \"" + name + "\". Add it after the ParticleCompactor is attached.");
+            return false;
+        }
+        largestItemSize = std::max(largestItemSize, buffer->getItemSize());
+    }
+
+    ComputeProgram* countProgram = getCompactProgram<CompactCountKernel>("np-compact-count", "/np/compact-count.glsl");
+    ComputeProgram* scanProgram = getCompactProgram<CompactScanKernel>("np-compact-scan", "/np/compact-scan.glsl");
+    ComputeProgram* scatterProgram = getCompactProgram<CompactScatterKernel>("np-compact-scatter", "/np/compact-scatter.glsl");
+    ComputeProgram* gatherProgram = getCompactProgram<CompactGatherKernel>("np-compact-gather", "/np/compact-gather.glsl");
+
+    if(!countProgram || !scanProgram || !scatterProgram || !gatherProgram)
+    {
+        Logger::getInstance()->logWarning("ParticleCompactor: cannot create compute programs. Is \"/np\" added to the GPUProgramService?");
+        return false;
+    }
+
+    GLuint initialState[STATE_SIZE] = {0, 0, 0, 1, 1, 1, 1, 1};
+    const unsigned blockCount = (particleCount + GROUP_SIZE - 1) / GROUP_SIZE;
+
+    particleSystem->addStorageBuffer<GLuint>(BLOCK_SUMS_BUFFER, blockCount, GL_UNSIGNED_INT, 1);
+    particleSystem->addStorageBuffer<GLuint>(STATE_BUFFER, STATE_SIZE, GL_UNSIGNED_INT, 1)->setData(initialState);
+    particleSystem->addStorageBuffer<GLuint>(PERMUTATION_BUFFER, particleCount, GL_UNSIGNED_INT, 1);
+    particleSystem->addStorageBuffer<GLuint>(SCRATCH_BUFFER, particleCount * (largestItemSize / 4), GL_UNSIGNED_INT, 1);
+
+    // The count and the gather are dispatched for the alive particles. The scan writes their dispatch commands.
+    particleSystem->getDispatchCommandOffset(countProgram->getNumWorkItemsPerGroup());
+    particleSystem->getDispatchCommandOffset(gatherProgram->getNumWorkItemsPerGroup());
+
+    Action* countAction = particleSystem->appendAction(*countProgram);
+    countAction->setUpdateInterval(interval);
+    countAction->addRead(ParticleSystem::ALIVE_COUNT_BUFFER);
+    countAction->addRead(ParticleSystem::ALIVE_FLAGS_BUFFER);
+    countAction->addWrite(BLOCK_SUMS_BUFFER);
+
+    Action* scanAction = particleSystem->appendAction(*scanProgram);
+    scanAction->setUpdateInterval(interval);
+    scanAction->setIndirectDispatchBuffer(particleSystem->getStorageBuffer(STATE_BUFFER), STATE_SCAN_GROUPS * sizeof(GLuint));
+    scanAction->addWrite(BLOCK_SUMS_BUFFER);
+    scanAction->addWrite(STATE_BUFFER);
+    scanAction->addWrite(ParticleSystem::ALIVE_COUNT_BUFFER);
+
+    scanAction->preUpdateSignal.connect([scanProgram](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+    {
+        if(computeSystem->getCurrentCPUKernel())
+            return;
+
+        // The scan writes the alive count and the commands as shader storage
+        scanProgram->bindShaderStorageBuffer("NPCompactCommands", particleSystem->getAliveCountBuffer());
+
+        const std::vector<unsigned>& groupSizes = particleSystem->getDispatchGroupSizes();
+        scanProgram->setUniform("npCompactGroupSizeCount", (unsigned)groupSizes.size());
+        for(unsigned i = 0; i < groupSizes.size(); ++i)
+            scanProgram->setUniform("npCompactGroupSizes[" + std::to_string(i) + "]", groupSizes[i]);
+    });
+
+    Action* scatterAction = particleSystem->appendAction(*scatterProgram);
+    scatterAction->setUpdateInterval(interval);
+    scatterAction->setIndirectDispatchBuffer(particleSystem->getStorageBuffer(STATE_BUFFER), STATE_SCATTER_GROUPS * sizeof(GLuint));
+    scatterAction->addRead(BLOCK_SUMS_BUFFER);
+    scatterAction->addRead(STATE_BUFFER);
+    scatterAction->addWrite(ParticleSystem::ALIVE_FLAGS_BUFFER);
+    scatterAction->addWrite(PERMUTATION_BUFFER);
+
+    // One gather per compacted buffer. The buffers are looked up by name, so swapped attributes are handled.
+    for(auto& name : compactedBuffers)
+    {
+        Action* action = particleSystem->appendAction(*gatherProgram);
+        action->setUpdateInterval(interval);
+
+        action->addRead(ParticleSystem::ALIVE_COUNT_BUFFER);
+        action->addRead(PERMUTATION_BUFFER);
+        action->addWrite(SCRATCH_BUFFER);
+        action->addWrite(name);
+
+        action->preUpdateSignal.connect([gatherProgram, name](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+        {
+            BufferBase* buffer = getCompactedBuffer(particleSystem, name);
+
+            CompactGatherKernel* kernel = (CompactGatherKernel*)computeSystem->getCurrentCPUKernel();
+            if(kernel)
+            {
+                kernel->setSource(buffer);
+            }
+            else
+            {
+                gatherProgram->setUniform("npCompactWordsPerItem", (unsigned)(buffer->getItemSize() / 4));
+                gatherProgram->bindShaderStorageBuffer("NPCompactSource", buffer);
+            }
+        });
+
+        // On the GPU, the gathered items are copied back after the dispatch
+        action->postUpdateSignal.connect([name](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+        {
+            if(computeSystem->getCurrentCPUKernel())
+                return;
+
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            getCompactedBuffer(particleSystem, name)->copyData(*particleSystem->getStorageBuffer(SCRATCH_BUFFER));
+        });
+    }
+
+    return true;
+}
+
+} // namespace nparticles
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "particlepool.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#include "glutils.hpp"
+
+namespace nparticles
+{
+
+ParticlePool::ParticlePool(int capacity)
+    : mCapacity(0),
+      mGranularity(1)
+{
+    // Slots of 4 bytes, the smallest attribute size
+    GLint alignment = glutils::glGet(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT);
+    mGranularity = std::max(alignment / 4, 1);
+
+    mCapacity = (std::max(capacity, 0) + mGranularity - 1) / mGranularity * mGranularity;
+    if(mCapacity > 0)
+        mFreeRanges[0] = mCapacity;
+}
+
+ParticlePool::~ParticlePool()
+{
+    for(auto& storageIter : mAttributeStorages)
+        delete storageIter.second;
+    mAttributeStorages.clear();
+}
+
+int ParticlePool::allocate(int count)
+{
+    if(count <= 0)
+        return -1;
+
+    count = (count + mGranularity - 1) / mGranularity * mGranularity;
+
+    // First fit, the ranges are sorted by their first slot
+    for(auto rangeIter = mFreeRanges.begin(); rangeIter != mFreeRanges.end(); ++rangeIter)
+    {
+        if(rangeIter->second < count)
+            continue;
+
+        const int first = rangeIter->first;
+        const int remaining = rangeIter->second - count;
+        mFreeRanges.erase(rangeIter);
+        if(remaining > 0)
+            mFreeRanges[first + count] = remaining;
+
+        return first;
+    }
+
+    return -1;
+}
+
+void ParticlePool::release(int first, int count)
+{
+    if(first < 0 || count <= 0)
+        return;
+
+    count = (count + mGranularity - 1) / mGranularity * mGranularity;
+
+    auto rangeIter = mFreeRanges.insert(std::make_pair(first, count)).first;
+
+    // Merge with the following range
+    auto nextIter = std::next(rangeIter);
+    if(nextIter != mFreeRanges.end() && rangeIter->first + rangeIter->second == nextIter->first)
+    {
+        rangeIter->second += nextIter->second;
+        mFreeRanges.erase(nextIter);
+    }
+
+    // Merge with the preceding range
+    if(rangeIter != mFreeRanges.begin())
+    {
+        auto previousIter = std::prev(rangeIter);
+        if(previousIter->first + previousIter->second == rangeIter->first)
+        {
+            previousIter->second += rangeIter->second;
+            mFreeRanges.erase(rangeIter);
+        }
+    }
+}
+
+BufferBase* ParticlePool::getAttributeStorage(const std::string& name) const
+{
+    auto storageIter = mAttributeStorages.find(name);
+    if(storageIter == mAttributeStorages.end())
+        return nullptr;
+
+    return storageIter->second;
+}
+
+} // namespace nparticles
@@ -9,11 +9,22 @@
 
 #include "particlesystem.hpp"
 
+#include <algorithm>
+
 #include "action.hpp"
+#include "computeprogram.hpp"
+#include "mesh.hpp"
 
 namespace nparticles
 {
 
+const char* const ParticleSystem::ALIVE_COUNT_BUFFER = "npAliveCount";
+const char* const ParticleSystem::ALIVE_FLAGS_BUFFER = "NPParticleAlive";
+const unsigned ParticleSystem::DRAW_COMMAND_OFFSET = 1;
+const unsigned ParticleSystem::DISPATCH_COMMANDS_OFFSET = 6;
+const unsigned ParticleSystem::MAX_DISPATCH_GROUP_SIZES = 8;
+const char* const ParticleSystem::VISIBLE_INSTANCES_BUFFER = "NPVisibleInstances";
+
 bool ParticleSystem::swapParticleAttributes(const std::string& firstAttributeName, const std::string& secondAttributeName)
 {
     auto firstAttribute = mParticleAttributeBuffers.find(firstAttributeName);
@@ -33,6 +44,7 @@ bool ParticleSystem::swapParticleAttributes(const std::string& firstAttributeNam
     }
 
     std::swap(firstAttribute->second, secondAttribute->second);
+    updateBufferGeneration();
     return true;
 }
 
@@ -43,11 +55,125 @@ Action* ParticleSystem::appendAction(ComputeProgram& computeProgram)
     return action;
 }
 
+void ParticleSystem::setAliveCount(unsigned aliveCount)
+{
+    aliveCount = std::min(aliveCount, mParticleCount);
+
+    if(!mAliveCountBuffer)
+    {
+        mAliveCountBuffer = new AtomicCounterBuffer(DISPATCH_COMMANDS_OFFSET + 3 * MAX_DISPATCH_GROUP_SIZES);
+        addStorageBuffer<GLuint>(ALIVE_FLAGS_BUFFER, mParticleCount, GL_UNSIGNED_INT, 1);
+
+        // Prepare the dispatch commands of the existing Actions
+        for(auto action : mParticleActions)
+            getDispatchCommandOffset(action->getComputeProgram().getNumWorkItemsPerGroup());
+    }
+
+    // Alive count, DrawElementsIndirectCommand and DispatchIndirectCommands
+    std::vector<GLuint> commands(mAliveCountBuffer->getItemCount(), 0);
+    commands[0] = aliveCount;
+    commands[DRAW_COMMAND_OFFSET] = ((Mesh*)mMesh)->getIndexBuffer()->getItemCount();
+    commands[DRAW_COMMAND_OFFSET + 1] = aliveCount;
+
+    for(unsigned i = 0; i < mDispatchGroupSizes.size(); ++i)
+    {
+        GLuint* command = &commands[DISPATCH_COMMANDS_OFFSET + 3 * i];
+        command[0] = (aliveCount + mDispatchGroupSizes[i] - 1) / mDispatchGroupSizes[i];
+        command[1] = 1;
+        command[2] = 1;
+    }
+
+    mAliveCountBuffer->setData(commands.data());
+
+    std::vector<GLuint> aliveFlags(mParticleCount, 0);
+    std::fill(aliveFlags.begin(), aliveFlags.begin() + aliveCount, 1);
+    ((Buffer<GLuint>*)getStorageBuffer(ALIVE_FLAGS_BUFFER))->setData(aliveFlags.data());
+}
+
+unsigned ParticleSystem::getAliveCount()
+{
+    if(!mAliveCountBuffer)
+        return mParticleCount;
+
+    if(mAliveCountBuffer->isMapped())
+        return mAliveCountBuffer->map()[0];
+
+    unsigned aliveCount = mAliveCountBuffer->map()[0];
+    mAliveCountBuffer->unmap();
+    return aliveCount;
+}
+
+int ParticleSystem::getDispatchCommandOffset(unsigned groupSize)
+{
+    auto sizeIter = std::find(mDispatchGroupSizes.begin(), mDispatchGroupSizes.end(), groupSize);
+
+    if(sizeIter != mDispatchGroupSizes.end())
+        return (DISPATCH_COMMANDS_OFFSET + 3 * (sizeIter - mDispatchGroupSizes.begin())) * sizeof(GLuint);
+
+    if(mDispatchGroupSizes.size() < MAX_DISPATCH_GROUP_SIZES)
+        mDispatchGroupSizes.push_back(groupSize);
+    else
+        Logger::getInstance()->logWarning("ParticleSystem: too many work group sizes for indirect dispatches. Actions with " + std::to_string(groupSize) + " work items per group are dispatched for all particles.");
+
+    return -1;
+}
+
+bool ParticleSystem::enableFrustumCulling(const std::string& positionAttribute, float boundingRadius)
+{
+    BufferBase* positions = getParticleAttributeBuffer(positionAttribute);
+
+    if(!positions)
+    {
+        Logger::getInstance()->logWarning("ParticleSystem: cannot cull particles by attribute " + positionAttribute + " which does not exist.");
+        return false;
+    }
+
+    if(positions->getItemSize() != 4 * sizeof(GLfloat))
+    {
+        Logger::getInstance()->logWarning("ParticleSystem: cannot cull particles by attribute " + positionAttribute + " which does not have 16 byte items.");
+        return false;
+    }
+
+    mCullingPositionAttribute = positionAttribute;
+    mCullingRadius = boundingRadius;
+
+    if(!mVisibleInstancesBuffer)
+    {
+        mVisibleInstancesBuffer = new Buffer<GLuint>(mParticleCount, GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY, GL_SHADER_STORAGE_BUFFER);
+        mCullingCommandBuffer = new Buffer<GLuint>(5, GL_UNSIGNED_INT, 1, GL_DYNAMIC_DRAW, GL_SHADER_STORAGE_BUFFER);
+
+        // DrawElementsIndirectCommand without instances. Only the instance count changes, it is reset by each culling.
+        GLuint drawCommand[] = { (GLuint)((Mesh*)mMesh)->getIndexBuffer()->getItemCount(), 0, 0, 0, 0 };
+        mCullingCommandBuffer->setData(drawCommand);
+    }
+
+    return true;
+}
+
+void ParticleSystem::disableFrustumCulling()
+{
+    delete mVisibleInstancesBuffer;
+    delete mCullingCommandBuffer;
+    mVisibleInstancesBuffer = nullptr;
+    mCullingCommandBuffer = nullptr;
+    mCullingPositionAttribute.clear();
+}
+
 BufferBase* ParticleSystem::getParticleAttributeBuffer(const std::string& name)
 {
-    if(mParticleAttributeBuffers.find(name) == mParticleAttributeBuffers.end())
+    auto bufferIter = mParticleAttributeBuffers.find(name);
+
+    if(bufferIter == mParticleAttributeBuffers.end())
         return nullptr;
-    return mParticleAttributeBuffers[name];
+
+    return bufferIter->second;
+}
+
+void ParticleSystem::updateBufferGeneration()
+{
+    // Generations are unique across all systems, so a new system never matches bindings cached for a deleted one
+    static unsigned generationCounter = 0;
+    mBufferGeneration = ++generationCounter;
 }
 
 void ParticleSystem::emitPreRenderSignal(RenderSystem* renderSystem)
@@ -67,6 +193,7 @@ AtomicCounterBuffer* ParticleSystem::addAtomicCounterBuffer(const std::string& n
 
     AtomicCounterBuffer* newAtomicCounterBuffer = new AtomicCounterBuffer(itemCount);
     mAtomicCounterBuffers[name] = newAtomicCounterBuffer;
+    updateBufferGeneration();
     return newAtomicCounterBuffer;
 }
 
@@ -90,11 +217,41 @@ BufferBase* ParticleSystem::getUniformBuffer(const std::string& name)
     return bufferIter->second;
 }
 
-ParticleSystem::ParticleSystem(int particleCount, const Mesh& mesh, const Material& material)
+BufferBase* ParticleSystem::getStorageBuffer(const std::string& name)
+{
+    auto bufferIter = mStorageBuffers.find(name);
+
+    if(bufferIter == mStorageBuffers.end())
+        return nullptr;
+
+    return bufferIter->second;
+}
+
+ParticleSystem::ParticleSystem(int particleCount, const Mesh& mesh, const Material& material, ParticlePool* particlePool)
     : mParticleCount(particleCount),
+      mAliveCountBuffer(nullptr),
+      mCullingRadius(0.0f),
+      mVisibleInstancesBuffer(nullptr),
+      mCullingCommandBuffer(nullptr),
       mMesh(&mesh),
-      mMaterial(&material)
+      mMaterial(&material),
+      mBufferGeneration(0),
+      mParticlePool(nullptr),
+      mPoolOffset(0)
 {
+    updateBufferGeneration();
+
+    if(particlePool)
+    {
+        int first = particlePool->allocate(particleCount);
+        if(first != -1)
+        {
+            mParticlePool = particlePool;
+            mPoolOffset = first;
+        }
+        else
+            Logger::getInstance()->logWarning("ParticleSystem: the ParticlePool is full, the particle attributes are not pooled.");
+    }
 }
 
 ParticleSystem::~ParticleSystem()
@@ -114,6 +271,18 @@ ParticleSystem::~ParticleSystem()
 	for(auto atomicCounterBuffer : mAtomicCounterBuffers)
 		delete atomicCounterBuffer.second;
 	mAtomicCounterBuffers.clear();
+
+    for(auto storageBuffer : mStorageBuffers)
+        delete storageBuffer.second;
+    mStorageBuffers.clear();
+
+    delete mAliveCountBuffer;
+    delete mVisibleInstancesBuffer;
+    delete mCullingCommandBuffer;
+
+    // The attribute views are deleted, so the range can be reused
+    if(mParticlePool)
+        mParticlePool->release(mPoolOffset, mParticleCount);
 }
 
 } // namespace nparticles
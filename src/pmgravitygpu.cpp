@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "pmgravitygpu.hpp"
+
+#include <cstring>
+
+#include "action.hpp"
+#include "computeprogram.hpp"
+#include "computesystem.hpp"
+#include "engine.hpp"
+#include "pmgravitysolver.hpp"
+
+namespace nparticles
+{
+
+PMGravityGPU::PMGravityGPU(PMGravitySolver& solver)
+    : mSolver(solver),
+      mDensityBuffer(nullptr),
+      mFieldBuffer(nullptr)
+{
+}
+
+PMGravityGPU::~PMGravityGPU()
+{
+    delete mDensityBuffer;
+    delete mFieldBuffer;
+}
+
+void PMGravityGPU::connect(Action& depositAction, Action& updateAction)
+{
+    ComputeProgram& depositProgram = depositAction.getComputeProgram();
+    ComputeProgram& updateProgram = updateAction.getComputeProgram();
+
+    depositAction.preUpdateSignal.connect([this, &depositProgram](ParticleSystem*, const ComputeSystem*)
+    {
+        updateBuffers();
+
+        // Upload an empty grid
+        mSolver.clearDensity();
+        mDensityBuffer->setData(mSolver.getDensity());
+
+        depositProgram.bindShaderStorageBuffer("PMDensity", mDensityBuffer);
+        setUniforms(depositProgram);
+    });
+
+    depositAction.postUpdateSignal.connect([this](ParticleSystem*, const ComputeSystem*)
+    {
+        // Make the atomic writes of the deposit shader visible to the mapping
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        float* density = mDensityBuffer->map();
+        std::memcpy(mSolver.getDensity(), density, mSolver.getCellCount() * sizeof(float));
+        mDensityBuffer->unmap();
+        mDensityBuffer->unbind();
+
+        mSolver.solveField(Engine::getInstance()->getThreadPool());
+        mFieldBuffer->setData(mSolver.getField());
+    });
+
+    updateAction.preUpdateSignal.connect([this, &updateProgram](ParticleSystem*, const ComputeSystem*)
+    {
+        updateProgram.bindShaderStorageBuffer("PMField", mFieldBuffer);
+        setUniforms(updateProgram);
+    });
+
+    updateAction.postUpdateSignal.connect([this](ParticleSystem*, const ComputeSystem*)
+    {
+        mFieldBuffer->unbind();
+    });
+}
+
+void PMGravityGPU::updateBuffers()
+{
+    int cellCount = mSolver.getCellCount();
+
+    if(mDensityBuffer && mDensityBuffer->getItemCount() == cellCount)
+        return;
+
+    delete mDensityBuffer;
+    delete mFieldBuffer;
+
+    mDensityBuffer = new Buffer<float>(cellCount, GL_FLOAT, 1, GL_DYNAMIC_COPY);
+    mFieldBuffer = new Buffer<glm::vec4>(cellCount, GL_FLOAT, 4, GL_DYNAMIC_DRAW);
+}
+
+void PMGravityGPU::setUniforms(const ShaderProgram& program) const
+{
+    program.setUniform("npPMGridSize", (uint)mSolver.getGridSize());
+    program.setUniform("npPMBoxOrigin", mSolver.getBoxOrigin());
+    program.setUniform("npPMCellSize", mSolver.getCellSize());
+    program.setUniform("npPMUseTSC", mSolver.getMassAssignment() == NP_MA_TSC);
+}
+
+} // namespace nparticles
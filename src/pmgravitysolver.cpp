@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "pmgravitysolver.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+namespace
+{
+
+// The maximum grid size. 1024³ cells already need about 28 GB of memory.
+const unsigned MAX_GRID_SIZE = 1024;
+
+/**
+ * The cells and weights a body is assigned to.
+ *
+ * The body is spread over width³ cells starting at base. The weight of cell base + (i, j, k)
+ * is weights[0][i] * weights[1][j] * weights[2][k].
+ */
+struct Stencil
+{
+    int base[3];
+    float weights[3][3];
+    unsigned width;
+};
+
+Stencil computeStencil(const glm::vec3& position, const glm::vec3& boxOrigin, float inverseCellSize, mass_assignments assignment)
+{
+    Stencil stencil;
+
+    // Position in grid units. Cell i covers [i, i + 1), its center is at i + 0.5.
+    glm::vec3 gridPosition = (position - boxOrigin) * inverseCellSize;
+
+    for(unsigned axis = 0; axis < 3; ++axis)
+    {
+        if(assignment == NP_MA_TSC)
+        {
+            float cell = std::floor(gridPosition[axis]);
+            float d = gridPosition[axis] - cell - 0.5f;
+
+            stencil.base[axis] = (int)cell - 1;
+            stencil.weights[axis][0] = 0.5f * (0.5f - d) * (0.5f - d);
+            stencil.weights[axis][1] = 0.75f - d * d;
+            stencil.weights[axis][2] = 0.5f * (0.5f + d) * (0.5f + d);
+        }
+        else
+        {
+            float shifted = gridPosition[axis] - 0.5f;
+            float cell = std::floor(shifted);
+            float d = shifted - cell;
+
+            stencil.base[axis] = (int)cell;
+            stencil.weights[axis][0] = 1.0f - d;
+            stencil.weights[axis][1] = d;
+            stencil.weights[axis][2] = 0.0f;
+        }
+    }
+
+    stencil.width = assignment == NP_MA_TSC ? 3 : 2;
+    return stencil;
+}
+
+} // anonymous namespace
+
+PMGravitySolver::PMGravitySolver(unsigned gridSize, const glm::vec3& boxOrigin, float boxSize, mass_assignments assignment)
+    : GravitySolver(0.0f),
+      mGridSize(0),
+      mBoxOrigin(boxOrigin),
+      mBoxSize(boxSize),
+      mAssignment(assignment)
+{
+    setGridSize(gridSize);
+}
+
+void PMGravitySolver::computeAccelerations(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool)
+{
+    deposit(bodies, bodyCount, threadPool);
+    solveField(threadPool);
+    interpolate(bodies, bodyCount, accelerations, threadPool);
+}
+
+std::string PMGravitySolver::getName() const
+{
+    std::stringstream name;
+    name << "PM (" << mGridSize << "^3 grid, " << (mAssignment == NP_MA_TSC ? "TSC" : "CIC") << ")";
+    return name.str();
+}
+
+void PMGravitySolver::setGridSize(unsigned gridSize)
+{
+    unsigned size = 4;
+    while(size < gridSize && size < MAX_GRID_SIZE)
+        size *= 2;
+
+    mGridSize = size;
+    mFFT.setSize(size);
+}
+
+void PMGravitySolver::setBox(const glm::vec3& boxOrigin, float boxSize)
+{
+    mBoxOrigin = boxOrigin;
+    mBoxSize = boxSize;
+}
+
+void PMGravitySolver::clearDensity()
+{
+    mDensity.assign(getCellCount(), 0.0f);
+}
+
+void PMGravitySolver::deposit(const glm::vec4* bodies, unsigned bodyCount, ThreadPool& threadPool)
+{
+    clearDensity();
+
+    const unsigned size = mGridSize;
+    const unsigned mask = size - 1;
+    const float inverseCellSize = 1.0f / getCellSize();
+
+    // Several threads must not add to the same cell. The grid is split into slabs of two x planes,
+    // and each body is sorted into the slab its stencil starts in. A stencil covers at most three planes,
+    // so bodies of every second slab never touch the same cell and can be assigned in parallel.
+    const unsigned slabCount = size / 2;
+
+    std::vector<unsigned> bodySlabs(bodyCount);
+    threadPool.parallelFor(0, bodyCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+        {
+            Stencil stencil = computeStencil(glm::vec3(bodies[i]), mBoxOrigin, inverseCellSize, mAssignment);
+            bodySlabs[i] = ((unsigned)stencil.base[0] & mask) / 2;
+        }
+    });
+
+    mSlabStarts.assign(slabCount + 1, 0);
+    for(unsigned i = 0; i < bodyCount; ++i)
+        ++mSlabStarts[bodySlabs[i] + 1];
+    for(unsigned s = 0; s < slabCount; ++s)
+        mSlabStarts[s + 1] += mSlabStarts[s];
+
+    mSlabBodies.resize(bodyCount);
+    std::vector<unsigned> slabEnds(mSlabStarts.begin(), mSlabStarts.end() - 1);
+    for(unsigned i = 0; i < bodyCount; ++i)
+        mSlabBodies[slabEnds[bodySlabs[i]]++] = i;
+
+    for(unsigned parity = 0; parity < 2; ++parity)
+    {
+        threadPool.parallelFor(0, slabCount / 2, [&](unsigned first, unsigned last)
+        {
+            for(unsigned s = 2 * first + parity; s < 2 * last; s += 2)
+            {
+                for(unsigned b = mSlabStarts[s]; b < mSlabStarts[s + 1]; ++b)
+                {
+                    const glm::vec4& body = bodies[mSlabBodies[b]];
+                    Stencil stencil = computeStencil(glm::vec3(body), mBoxOrigin, inverseCellSize, mAssignment);
+
+                    for(unsigned i = 0; i < stencil.width; ++i)
+                    {
+                        unsigned x = (stencil.base[0] + i) & mask;
+                        float wx = body.w * stencil.weights[0][i];
+
+                        for(unsigned j = 0; j < stencil.width; ++j)
+                        {
+                            unsigned y = (stencil.base[1] + j) & mask;
+                            float wxy = wx * stencil.weights[1][j];
+                            float* row = &mDensity[(x * size + y) * size];
+
+                            for(unsigned k = 0; k < stencil.width; ++k)
+                                row[(stencil.base[2] + k) & mask] += wxy * stencil.weights[2][k];
+                        }
+                    }
+                }
+            }
+        }, 1);
+    }
+}
+
+void PMGravitySolver::solveField(ThreadPool& threadPool)
+{
+    const unsigned size = mGridSize;
+    const unsigned mask = size - 1;
+    const unsigned cellCount = getCellCount();
+    const float cellSize = getCellSize();
+
+    if(mDensity.size() != cellCount)
+        clearDensity();
+
+    // Mass per cell to density
+    mPotential.resize(cellCount);
+    const float inverseCellVolume = 1.0f / (cellSize * cellSize * cellSize);
+    threadPool.parallelFor(0, cellCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+            mPotential[i] = std::complex<float>(mDensity[i] * inverseCellVolume, 0.0f);
+    });
+
+    mFFT.transform3D(mPotential.data(), false, threadPool);
+
+    // Wave numbers and squared assignment windows per axis. Dividing by the window of the deposit
+    // and the interpolation compensates the smoothing of both.
+    const unsigned windowExponent = mAssignment == NP_MA_TSC ? 6 : 4;
+    std::vector<float> waveNumbers(size);
+    std::vector<float> windows(size);
+    for(unsigned i = 0; i < size; ++i)
+    {
+        int frequency = i <= size / 2 ? (int)i : (int)i - (int)size;
+        waveNumbers[i] = 2.0f * M_PI * frequency / mBoxSize;
+
+        float argument = 0.5f * waveNumbers[i] * cellSize;
+        float sinc = frequency == 0 ? 1.0f : std::sin(argument) / argument;
+        windows[i] = std::pow(sinc, (float)windowExponent);
+    }
+
+    // Poisson's equation: laplace(phi) = 4 * pi * rho  =>  phi(k) = -4 * pi * rho(k) / k²
+    // The mean density (k = 0) does not contribute in a periodic box.
+    const float normalisation = 1.0f / cellCount;
+    threadPool.parallelFor(0, size, [&](unsigned first, unsigned last)
+    {
+        for(unsigned x = first; x < last; ++x)
+        {
+            for(unsigned y = 0; y < size; ++y)
+            {
+                std::complex<float>* row = &mPotential[(x * size + y) * size];
+                float kxy = waveNumbers[x] * waveNumbers[x] + waveNumbers[y] * waveNumbers[y];
+                float wxy = windows[x] * windows[y];
+
+                for(unsigned z = 0; z < size; ++z)
+                {
+                    float kSquare = kxy + waveNumbers[z] * waveNumbers[z];
+                    float green = kSquare > 0 ? -4.0f * M_PI * normalisation / (kSquare * wxy * windows[z]) : 0.0f;
+                    row[z] *= green;
+                }
+            }
+        }
+    }, 1);
+
+    mFFT.transform3D(mPotential.data(), true, threadPool);
+
+    // Accelerations from the potential by four point central differences
+    mField.resize(cellCount);
+    const float scale = -1.0f / (12.0f * cellSize);
+    threadPool.parallelFor(0, size, [&](unsigned first, unsigned last)
+    {
+        auto potential = [&](unsigned x, unsigned y, unsigned z)
+        {
+            return mPotential[((x & mask) * size + (y & mask)) * size + (z & mask)].real();
+        };
+
+        for(unsigned x = first; x < last; ++x)
+        {
+            for(unsigned y = 0; y < size; ++y)
+            {
+                for(unsigned z = 0; z < size; ++z)
+                {
+                    // Adding size keeps the indices positive, they are wrapped by the mask.
+                    float ax = 8.0f * (potential(x + 1, y, z) - potential(x + size - 1, y, z)) - (potential(x + 2, y, z) - potential(x + size - 2, y, z));
+                    float ay = 8.0f * (potential(x, y + 1, z) - potential(x, y + size - 1, z)) - (potential(x, y + 2, z) - potential(x, y + size - 2, z));
+                    float az = 8.0f * (potential(x, y, z + 1) - potential(x, y, z + size - 1)) - (potential(x, y, z + 2) - potential(x, y, z + size - 2));
+
+                    mField[(x * size + y) * size + z] = glm::vec4(ax * scale, ay * scale, az * scale, potential(x, y, z));
+                }
+            }
+        }
+    }, 1);
+}
+
+void PMGravitySolver::interpolate(const glm::vec4* bodies, unsigned bodyCount, glm::vec3* accelerations, ThreadPool& threadPool) const
+{
+    const unsigned size = mGridSize;
+    const unsigned mask = size - 1;
+    const float inverseCellSize = 1.0f / getCellSize();
+
+    threadPool.parallelFor(0, bodyCount, [&](unsigned first, unsigned last)
+    {
+        for(unsigned b = first; b < last; ++b)
+        {
+            Stencil stencil = computeStencil(glm::vec3(bodies[b]), mBoxOrigin, inverseCellSize, mAssignment);
+            glm::vec3 acceleration(0, 0, 0);
+
+            for(unsigned i = 0; i < stencil.width; ++i)
+            {
+                unsigned x = (stencil.base[0] + i) & mask;
+
+                for(unsigned j = 0; j < stencil.width; ++j)
+                {
+                    unsigned y = (stencil.base[1] + j) & mask;
+                    float wxy = stencil.weights[0][i] * stencil.weights[1][j];
+                    const glm::vec4* row = &mField[(x * size + y) * size];
+
+                    for(unsigned k = 0; k < stencil.width; ++k)
+                        acceleration += glm::vec3(row[(stencil.base[2] + k) & mask]) * (wxy * stencil.weights[2][k]);
+                }
+            }
+
+            accelerations[b] = acceleration;
+        }
+    });
+}
+
+} // namespace nparticles
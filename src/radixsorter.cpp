@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "radixsorter.hpp"
+
+#include "engine.hpp"
+#include "computeprogram.hpp"
+#include "gpuprogramservice.hpp"
+#include "logger.hpp"
+
+#include <algorithm>
+#include <limits>
+
+namespace nparticles
+{
+
+const unsigned RadixSorter::ALL_ITEMS = std::numeric_limits<unsigned>::max();
+const unsigned RadixSorter::TILE_SIZE = 2048;
+const unsigned RadixSorter::RADIX_BITS = 4;
+const unsigned RadixSorter::CPU_RADIX_BITS = 8;
+const unsigned RadixSorter::CPU_GRAIN_SIZE = 65536;
+const unsigned RadixSorter::MAX_GPU_KEY_COUNT = (1u << 30) - 1;
+
+namespace
+{
+
+/**
+ * The maximum number of work groups along one dimension of a dispatch.
+ */
+const unsigned MAX_GROUPS_PER_DIMENSION = 65535;
+
+/**
+ * The number of digits of the GPU version.
+ */
+const unsigned GPU_DIGITS = 16;
+
+/**
+ * The maximum number of passes of the GPU version, which has space for the digit counts and a tile counter of
+ * each pass in front of the look-back states.
+ */
+const unsigned MAX_GPU_PASSES = 8;
+
+/**
+ * The number of digits of the CPU version.
+ */
+const unsigned CPU_DIGITS = 256;
+
+/**
+ * Modes of np/radix-sort.glsl.
+ */
+const unsigned GPU_HISTOGRAM = 0;
+const unsigned GPU_SCATTER = 1;
+
+/**
+ * Map a key to an unsigned integer in sort order. See np/radix-sort.glsl.
+ */
+inline GLuint encode(GLuint key, bool floatKeys, bool descending)
+{
+    if(floatKeys)
+        key = (key & 0x80000000u) ? ~key : key | 0x80000000u;
+
+    return descending ? ~key : key;
+}
+
+/**
+ * Map an encoded key back.
+ */
+inline GLuint decode(GLuint key, bool floatKeys, bool descending)
+{
+    if(descending)
+        key = ~key;
+
+    if(floatKeys)
+        key = (key & 0x80000000u) ? key & 0x7FFFFFFFu : ~key;
+
+    return key;
+}
+
+} // anonymous namespace
+
+RadixSorter::RadixSorter(ThreadPool& threadPool)
+    : mThreadPool(threadPool),
+      mSortProgram(nullptr),
+      mScratchKeys(nullptr),
+      mScratchPermutation(nullptr),
+      mSortStates(nullptr)
+{
+}
+
+RadixSorter::~RadixSorter()
+{
+    delete mScratchKeys;
+    delete mScratchPermutation;
+    delete mSortStates;
+}
+
+bool RadixSorter::sort(Buffer<GLuint>& keys, Buffer<GLuint>& permutation, sort_orders order, unsigned keyBits, unsigned count)
+{
+    return dispatch(keys, permutation, GPU_UINT_KEYS, order, keyBits, count);
+}
+
+bool RadixSorter::sort(Buffer<GLfloat>& keys, Buffer<GLuint>& permutation, sort_orders order, unsigned count)
+{
+    return dispatch(keys, permutation, GPU_FLOAT_KEYS, order, 32, count);
+}
+
+void RadixSorter::sort(GLuint* keys, GLuint* permutation, unsigned count, sort_orders order, unsigned keyBits)
+{
+    sortOnCPU(keys, permutation, count, false, order, keyBits);
+}
+
+void RadixSorter::sort(GLfloat* keys, GLuint* permutation, unsigned count, sort_orders order)
+{
+    sortOnCPU(reinterpret_cast<GLuint*>(keys), permutation, count, true, order, 32);
+}
+
+bool RadixSorter::dispatch(BufferBase& keys, BufferBase& permutation, gpu_key_types keyType, sort_orders order, unsigned keyBits, unsigned count)
+{
+    if(count == ALL_ITEMS)
+        count = keys.getItemCount();
+
+    if(keyBits == 0 || keyBits > 32)
+    {
+        Logger::getInstance()->logWarning("RadixSorter: cannot sort " + std::to_string(keyBits) + " key bits.");
+        return false;
+    }
+
+    if(count > (unsigned)keys.getItemCount() || count > (unsigned)permutation.getItemCount())
+    {
+        Logger::getInstance()->logWarning("RadixSorter: buffers are too small for " + std::to_string(count) + " keys.");
+        return false;
+    }
+
+    if(count > MAX_GPU_KEY_COUNT)
+    {
+        Logger::getInstance()->logWarning("RadixSorter: cannot sort more than " + std::to_string(MAX_GPU_KEY_COUNT) + " keys on the GPU.");
+        return false;
+    }
+
+    if(count == 0)
+        return true;
+
+    if(!mSortProgram)
+    {
+        GPUProgramService* gpuService = Engine::getInstance()->getGPUProgramService();
+        mSortProgram = gpuService->getComputeProgram("np-radix-sort");
+        if(!mSortProgram)
+            mSortProgram = gpuService->createComputeProgram("np-radix-sort", "/np/radix-sort.glsl");
+
+        if(!mSortProgram)
+        {
+            Logger::getInstance()->logWarning("RadixSorter: cannot create compute program. Is \"/np\" added to the GPUProgramService?");
+            return false;
+        }
+    }
+
+    const unsigned passCount = (keyBits + RADIX_BITS - 1) / RADIX_BITS;
+    const unsigned tileCount = (count + TILE_SIZE - 1) / TILE_SIZE;
+    const unsigned stateCount = MAX_GPU_PASSES * (GPU_DIGITS + 1) + passCount * tileCount * GPU_DIGITS;
+
+    // The scratch buffers receive a copy of all keys for an odd number of passes
+    if(!mScratchKeys || mScratchKeys->getItemCount() < keys.getItemCount())
+    {
+        delete mScratchKeys;
+        delete mScratchPermutation;
+        mScratchKeys = new Buffer<GLuint>(keys.getItemCount(), GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY, GL_SHADER_STORAGE_BUFFER);
+        mScratchPermutation = new Buffer<GLuint>(keys.getItemCount(), GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY, GL_SHADER_STORAGE_BUFFER);
+    }
+
+    if(!mSortStates || (unsigned)mSortStates->getItemCount() < stateCount)
+    {
+        delete mSortStates;
+        mSortStates = new Buffer<GLuint>(stateCount, GL_UNSIGNED_INT, 1, GL_DYNAMIC_COPY, GL_SHADER_STORAGE_BUFFER);
+    }
+
+    // No digits counted, no tiles started
+    mSortStates->clearData();
+
+    // Make previous shader writes to the keys visible
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    // The passes alternate between the scratch buffers and the caller's buffers and the last pass has to write to
+    // the caller's buffers. For an odd number of passes, the first pass reads a copy of the keys.
+    BufferBase* keysIn = &keys;
+    BufferBase* keysOut = mScratchKeys;
+    BufferBase* permutationIn = &permutation;
+    BufferBase* permutationOut = mScratchPermutation;
+
+    if(passCount % 2 == 1)
+    {
+        mScratchKeys->copyData(keys);
+        std::swap(keysIn, keysOut);
+        std::swap(permutationIn, permutationOut);
+    }
+
+    mSortProgram->bind();
+    mSortProgram->setUniform("npRadixKeyType", (unsigned)keyType);
+    mSortProgram->setUniform("npRadixDescending", order == NP_SO_DESCENDING);
+    mSortProgram->setUniform("npRadixCount", count);
+    mSortProgram->setUniform("npRadixTileCount", tileCount);
+    mSortProgram->setUniform("npRadixPassCount", passCount);
+    mSortProgram->bindShaderStorageBuffer("NPRadixStates", mSortStates);
+
+    // Tiles are assigned by their index, so the work groups may be spread over two dimensions.
+    const unsigned groupsX = std::min(tileCount, MAX_GROUPS_PER_DIMENSION);
+    const unsigned groupsY = (tileCount + groupsX - 1) / groupsX;
+
+    // Count the digits of all passes
+    mSortProgram->setUniform("npRadixMode", GPU_HISTOGRAM);
+    mSortProgram->setUniform("npRadixPass", 0u);
+    mSortProgram->bindShaderStorageBuffer("NPRadixKeysIn", keysIn);
+    glDispatchCompute(groupsX, groupsY, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    keysIn->unbind();
+
+    mSortProgram->setUniform("npRadixMode", GPU_SCATTER);
+    for(unsigned pass = 0; pass < passCount; ++pass)
+    {
+        mSortProgram->setUniform("npRadixPass", pass);
+        mSortProgram->bindShaderStorageBuffer("NPRadixKeysIn", keysIn);
+        mSortProgram->bindShaderStorageBuffer("NPRadixValuesIn", permutationIn);
+        mSortProgram->bindShaderStorageBuffer("NPRadixKeysOut", keysOut);
+        mSortProgram->bindShaderStorageBuffer("NPRadixValuesOut", permutationOut);
+
+        glDispatchCompute(groupsX, groupsY, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        keysIn->unbind();
+        permutationIn->unbind();
+        keysOut->unbind();
+        permutationOut->unbind();
+
+        std::swap(keysIn, keysOut);
+        std::swap(permutationIn, permutationOut);
+    }
+
+    // The sorted keys are visible to shaders, commands, mappings and copies
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    mSortStates->unbind();
+    mSortProgram->unbind();
+    return true;
+}
+
+void RadixSorter::sortOnCPU(GLuint* keys, GLuint* permutation, unsigned count, bool floatKeys, sort_orders order, unsigned keyBits)
+{
+    if(count == 0)
+        return;
+
+    keyBits = std::max(1u, std::min(keyBits, 32u));
+
+    const bool descending = order == NP_SO_DESCENDING;
+    const unsigned passCount = (keyBits + CPU_RADIX_BITS - 1) / CPU_RADIX_BITS;
+    const unsigned chunkCount = std::max(std::min((count + CPU_GRAIN_SIZE - 1) / CPU_GRAIN_SIZE, 4 * mThreadPool.getThreadCount()), 1u);
+    const unsigned chunkSize = (count + chunkCount - 1) / chunkCount;
+
+    if(mCPUScratchKeys.size() < count)
+    {
+        mCPUScratchKeys.resize(count);
+        mCPUScratchPermutation.resize(count);
+    }
+
+    // Encode the keys and start with the identity permutation
+    mThreadPool.parallelFor(0, count, [&](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+        {
+            keys[i] = encode(keys[i], floatKeys, descending);
+            permutation[i] = i;
+        }
+    }, CPU_GRAIN_SIZE);
+
+    GLuint* keysIn = keys;
+    GLuint* keysOut = mCPUScratchKeys.data();
+    GLuint* permutationIn = permutation;
+    GLuint* permutationOut = mCPUScratchPermutation.data();
+
+    // The digit counts of each chunk, turned into the position of the next key of each digit and chunk
+    std::vector<unsigned> offsets(chunkCount * CPU_DIGITS);
+
+    for(unsigned pass = 0; pass < passCount; ++pass)
+    {
+        const unsigned shift = pass * CPU_RADIX_BITS;
+        std::fill(offsets.begin(), offsets.end(), 0);
+
+        mThreadPool.parallelFor(0, chunkCount, [&](unsigned first, unsigned last)
+        {
+            for(unsigned chunk = first; chunk < last; ++chunk)
+            {
+                unsigned* chunkCounts = &offsets[chunk * CPU_DIGITS];
+                const unsigned end = std::min((chunk + 1) * chunkSize, count);
+                for(unsigned i = chunk * chunkSize; i < end; ++i)
+                    ++chunkCounts[(keysIn[i] >> shift) & (CPU_DIGITS - 1)];
+            }
+        }, 1);
+
+        // Skip the pass if all keys have the same digit
+        bool sameDigit = false;
+        for(unsigned digit = 0; digit < CPU_DIGITS; ++digit)
+        {
+            unsigned digitCount = 0;
+            for(unsigned chunk = 0; chunk < chunkCount; ++chunk)
+                digitCount += offsets[chunk * CPU_DIGITS + digit];
+
+            if(digitCount != 0)
+            {
+                sameDigit = digitCount == count;
+                break;
+            }
+        }
+
+        if(sameDigit)
+            continue;
+
+        // Keys of smaller digits come first, keys of equal digits keep the order of their chunks
+        unsigned offset = 0;
+        for(unsigned digit = 0; digit < CPU_DIGITS; ++digit)
+        {
+            for(unsigned chunk = 0; chunk < chunkCount; ++chunk)
+            {
+                unsigned digitCount = offsets[chunk * CPU_DIGITS + digit];
+                offsets[chunk * CPU_DIGITS + digit] = offset;
+                offset += digitCount;
+            }
+        }
+
+        mThreadPool.parallelFor(0, chunkCount, [&](unsigned first, unsigned last)
+        {
+            for(unsigned chunk = first; chunk < last; ++chunk)
+            {
+                unsigned* chunkOffsets = &offsets[chunk * CPU_DIGITS];
+                const unsigned end = std::min((chunk + 1) * chunkSize, count);
+                for(unsigned i = chunk * chunkSize; i < end; ++i)
+                {
+                    unsigned position = chunkOffsets[(keysIn[i] >> shift) & (CPU_DIGITS - 1)]++;
+                    keysOut[position] = keysIn[i];
+                    permutationOut[position] = permutationIn[i];
+                }
+            }
+        }, 1);
+
+        std::swap(keysIn, keysOut);
+        std::swap(permutationIn, permutationOut);
+    }
+
+    // Decode the keys, copying them back from the scratch arrays if the last pass wrote there
+    const bool copyBack = keysIn != keys;
+    mThreadPool.parallelFor(0, count, [&](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+        {
+            keys[i] = decode(keysIn[i], floatKeys, descending);
+            if(copyBack)
+                permutation[i] = permutationIn[i];
+        }
+    }, CPU_GRAIN_SIZE);
+}
+
+} // namespace nparticles
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "readbackqueue.hpp"
+
+#include "logger.hpp"
+
+namespace nparticles
+{
+
+namespace
+{
+
+/**
+ * The time waited for a fence in finish() before it is polled again, in nanoseconds.
+ */
+const GLuint64 FENCE_TIMEOUT = 1000000000;
+
+} // anonymous namespace
+
+ReadbackQueue::ReadbackQueue()
+{
+}
+
+ReadbackQueue::~ReadbackQueue()
+{
+    for(auto& readback : mPendingReadbacks)
+    {
+        glDeleteSync(readback.fence);
+        delete readback.staging;
+    }
+    mPendingReadbacks.clear();
+
+    for(auto staging : mFreeStagingBuffers)
+        delete staging;
+    mFreeStagingBuffers.clear();
+}
+
+bool ReadbackQueue::enqueue(const BufferBase& buffer, GLintptr offset, GLsizeiptr size, const resolve_function& resolve)
+{
+    if(offset < 0 || size <= 0 || offset + size > buffer.getItemCount() * buffer.getItemSize())
+    {
+        Logger::getInstance()->logWarning("ReadbackQueue: attempt to read a range outside of the buffer.");
+        return false;
+    }
+
+    // Reuse the smallest free staging buffer which is large enough
+    auto stagingIter = mFreeStagingBuffers.end();
+    for(auto iter = mFreeStagingBuffers.begin(); iter != mFreeStagingBuffers.end(); ++iter)
+    {
+        if((*iter)->getItemCount() >= size && (stagingIter == mFreeStagingBuffers.end() || (*iter)->getItemCount() < (*stagingIter)->getItemCount()))
+            stagingIter = iter;
+    }
+
+    Buffer<GLubyte>* staging = nullptr;
+    if(stagingIter != mFreeStagingBuffers.end())
+    {
+        staging = *stagingIter;
+        mFreeStagingBuffers.erase(stagingIter);
+    }
+    else
+        staging = new Buffer<GLubyte>(size, GL_UNSIGNED_BYTE, 1, GL_STREAM_READ, GL_COPY_WRITE_BUFFER, true);
+
+    // Shader writes have to be visible to the copy
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    staging->copyData(buffer, offset, 0, size);
+
+    Readback readback;
+    readback.staging = staging;
+    readback.size = size;
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.resolve = resolve;
+    mPendingReadbacks.push_back(readback);
+
+    return true;
+}
+
+void ReadbackQueue::poll()
+{
+    if(mPendingReadbacks.empty())
+        return;
+
+    // Make sure the fences are submitted, otherwise they are not signalled before the next flush
+    glFlush();
+
+    while(!mPendingReadbacks.empty())
+    {
+        Readback& readback = mPendingReadbacks.front();
+
+        GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if(status == GL_WAIT_FAILED)
+        {
+            discard(readback);
+            mPendingReadbacks.pop_front();
+            continue;
+        }
+
+        if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        resolve(readback);
+        mPendingReadbacks.pop_front();
+    }
+}
+
+void ReadbackQueue::finish()
+{
+    while(!mPendingReadbacks.empty())
+    {
+        Readback& readback = mPendingReadbacks.front();
+
+        GLenum status;
+        do
+        {
+            status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+        }
+        while(status == GL_TIMEOUT_EXPIRED);
+
+        // The copy may not have finished, so the staging buffer must not be read
+        if(status == GL_WAIT_FAILED)
+            discard(readback);
+        else
+            resolve(readback);
+
+        mPendingReadbacks.pop_front();
+    }
+}
+
+void ReadbackQueue::resolve(Readback& readback)
+{
+    glDeleteSync(readback.fence);
+
+    // The copy has finished, so mapping does not wait
+    const GLubyte* data = readback.staging->mapRange(0, readback.size, GL_MAP_READ_BIT);
+    readback.resolve(data, readback.size);
+    readback.staging->unmap();
+
+    mFreeStagingBuffers.push_back(readback.staging);
+}
+
+void ReadbackQueue::discard(Readback& readback)
+{
+    Logger::getInstance()->logError("ReadbackQueue: waiting for a readback failed, the readback is dropped.");
+
+    glDeleteSync(readback.fence);
+    delete readback.staging;
+}
+
+} // namespace nparticles
@@ -14,7 +14,13 @@ namespace nparticles
 
 GLint RenderProgram::getVertexAttributeLocation(const std::string& attributeName) const
 {
-    return glGetAttribLocation(mShaderProgram, attributeName.c_str());
+    auto locationIter = mVertexAttributeLocations.find(attributeName);
+    if(locationIter != mVertexAttributeLocations.end())
+        return locationIter->second;
+
+    GLint location = glGetAttribLocation(mShaderProgram, attributeName.c_str());
+    mVertexAttributeLocations[attributeName] = location;
+    return location;
 }
 
 void RenderProgram::setTessellationPatchSize(int patchSize)
@@ -27,6 +33,21 @@ void RenderProgram::setTessellationPatchSize(int patchSize)
     mTessellationPatchSize = patchSize;
 }
 
+bool RenderProgram::build()
+{
+    if(!ShaderProgram::build())
+        return false;
+
+    // Locations queried before linking are invalid
+    mVertexAttributeLocations.clear();
+
+    mViewProjectionMatrixUniform = getUniformHandle<glm::mat4>("np_viewProjectionMatrix");
+    mNormalMatrixUniform = getUniformHandle<glm::mat3>("np_normalMatrix");
+    mFrustumCullingUniform = getUniformHandle<bool>("np_frustumCulling");
+
+    return true;
+}
+
 RenderProgram::RenderProgram(std::string vertSrc, std::string fragSrc, std::string tscSrc, std::string tesSrc, std::string geoSrc)
     : mUseTesselation(false),
       mTessellationPatchSize(3)
@@ -9,13 +9,20 @@
 
 #include "rendersystem.hpp"
 
+#include "engine.hpp"
+#include "computeprogram.hpp"
+#include "glstate.hpp"
+#include "gpuprogramservice.hpp"
 #include "logger.hpp"
 #include "mesh.hpp"
 #include "material.hpp"
+#include "particlepool.hpp"
 #include "particlesystem.hpp"
 
 #include "glutils.hpp"
 
+#include <algorithm>
+
 namespace nparticles
 {
 void RenderSystem::setViewProjectionMatrix(const glm::mat4& viewProjectionMatrix)
@@ -29,6 +36,13 @@ void RenderSystem::setNormalMatrix(const glm::mat3& normalMatrix)
 }
 
 RenderSystem::RenderSystem()
+    : mCurrentVertexArray(nullptr),
+      mCurrentBufferGeneration(0),
+      mParticleIndexBuffer(nullptr),
+      mParticleIndexGeneration(0),
+      mDrawCommandBuffer(nullptr),
+      mDrawCommandOffset(0),
+      mCullingProgram(nullptr)
 {
 }
 
@@ -74,25 +88,43 @@ GLFWwindow* RenderSystem::init(int width, int height, bool fullscreen, bool debu
     glewExperimental = GL_TRUE;
     glewInit();
 
+    // Buffers and vertex arrays are edited by name if the context supports it
+    if(GLEW_VERSION_4_5 || GLEW_ARB_direct_state_access)
+    {
+        GlState::getInstance()->setDirectStateAccess(true);
+        Logger::getInstance()->logInfo("RenderSystem: using direct state access.");
+    }
+
     Logger::getInstance()->logInfo("RenderSystem: GLEW initialised.");
 
     // Register the debug message callback
     if(debug)
     {
-        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        GlState::getInstance()->setCapability(GL_DEBUG_OUTPUT_SYNCHRONOUS, true);
         glDebugMessageCallback(glutils::glDebugCallback, nullptr);
         glutils::setGlDebugLevel(GL_DEBUG_SEVERITY_LOW);
     }
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_PROGRAM_POINT_SIZE);
+    GlState* glState = GlState::getInstance();
+    glState->setCapability(GL_DEPTH_TEST, true);
+    glState->setCapability(GL_CULL_FACE, true);
+    glState->setCapability(GL_PROGRAM_POINT_SIZE, true);
 
     return mWindow;
 }
 
 void RenderSystem::terminate()
 {
+    // The vertex arrays have to be deleted while the context exists
+    for(auto& vertexArrayIter : mVertexArrays)
+        GlState::getInstance()->deleteVertexArray(vertexArrayIter.second.handle);
+    mVertexArrays.clear();
+
+    delete mParticleIndexBuffer;
+    mParticleIndexBuffer = nullptr;
+    delete mDrawCommandBuffer;
+    mDrawCommandBuffer = nullptr;
+
     glfwSetWindowShouldClose(mWindow, true);
     glfwTerminate();
     Logger::getInstance()->logInfo("RenderSystem: terminated.");
@@ -101,6 +133,9 @@ void RenderSystem::terminate()
 void RenderSystem::beginFrame()
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // The draws of the previous frame were issued, so their commands may be overwritten
+    mDrawCommandOffset = 0;
 }
 
 void RenderSystem::endFrame()
@@ -120,40 +155,64 @@ void RenderSystem::useVSync(bool vSync)
 
 void RenderSystem::useDepthTest(bool depthTest)
 {
-    if(depthTest)
-        glEnable(GL_DEPTH_TEST);
-    else
-        glDisable(GL_DEPTH_TEST);
+    GlState::getInstance()->setCapability(GL_DEPTH_TEST, depthTest);
+}
+
+void RenderSystem::removeParticleSystem(const ParticleSystem* particleSystem)
+{
+    GPUSystem::removeParticleSystem(particleSystem);
+
+    auto infoIter = mBatchInfos.begin();
+    while(infoIter != mBatchInfos.end())
+    {
+        if(infoIter->first.second == particleSystem)
+            infoIter = mBatchInfos.erase(infoIter);
+        else
+            ++infoIter;
+    }
 }
 
 void RenderSystem::drawParticleSystem(ParticleSystem* particleSystem)
 {
-    const Mesh* mesh = particleSystem->getMesh();
+    Mesh* mesh = (Mesh*)particleSystem->getMesh();
     const Material* material = particleSystem->getMaterial();
 
-    Buffer<glm::vec3>* vertexBuffer = ((Mesh*)mesh)->getVertexBuffer();
-    Buffer<GLuint>* indexBuffer = ((Mesh*)mesh)->getIndexBuffer();
+    Buffer<GLuint>* indexBuffer = mesh->getIndexBuffer();
+
+    // Cull before the material is bound, the culling is a compute dispatch
+    bool culled = particleSystem->usesFrustumCulling() && cullParticleSystem(particleSystem);
 
     // Bind and set up material
     mCurrentRenderProgram = material->getRenderProgram();
     mCurrentRenderProgram->bind();
-    mCurrentRenderProgram->setUniform("np_viewProjectionMatrix", mViewProjectionMatrix);
-    mCurrentRenderProgram->setUniform("np_normalMatrix", mNormalMatrix);
+    mCurrentRenderProgram->getViewProjectionMatrixUniform().set(mViewProjectionMatrix);
+    mCurrentRenderProgram->getNormalMatrixUniform().set(mNormalMatrix);
 
-    // Bind and setup geometry
-    mesh->bind();
-    setVertexAttribute("np_in_position", vertexBuffer);
-    indexBuffer->bind(GL_ELEMENT_ARRAY_BUFFER);
+    // Bind the geometry, the vertex array is set up once per Mesh and RenderProgram
+    mCurrentVertexArray = getVertexArray(mesh, mCurrentRenderProgram);
+    mCurrentBufferGeneration = particleSystem->getBufferGeneration();
+    GlState::getInstance()->bindVertexArray(mCurrentVertexArray->handle);
+    mesh->getVertexBuffer()->uploadDirtyRanges();
+    indexBuffer->uploadDirtyRanges();
+    setUpParticleIndexAttribute(particleSystem->getParticleCount());
 
     // Bind particle attributes, atomic counters and uniform buffers
     bindParticleBuffers(particleSystem, mCurrentRenderProgram);
 
+    // Bind the visible particles (see np/culling.glsl)
+    mCurrentRenderProgram->getFrustumCullingUniform().set(culled);
+    if(culled)
+        mCurrentRenderProgram->bindShaderStorageBuffer(ParticleSystem::VISIBLE_INSTANCES_BUFFER, particleSystem->getVisibleInstancesBuffer());
+
     // Emit pre render signal
     particleSystem->emitPreRenderSignal(this);
 
     // Activate subroutines. Dot his after the preRenderSignal so user selected subroutines are activated.
     mCurrentRenderProgram->activateSubroutines();
 
+    // Disable the attributes set for other ParticleSystems sharing the vertex array
+    releaseVertexAttributes();
+
     // Draw everything
     GLenum renderType = GL_TRIANGLES;
 
@@ -166,27 +225,435 @@ void RenderSystem::drawParticleSystem(ParticleSystem* particleSystem)
     else if(material->getRenderType() == NP_RT_POINTS)
         renderType = GL_POINTS;
 
-    glDrawElementsInstanced(renderType, indexBuffer->getItemCount(), indexBuffer->getGlType(), nullptr, particleSystem->getParticleCount());
+    AtomicCounterBuffer* aliveCountBuffer = particleSystem->getAliveCountBuffer();
+    if(culled)
+    {
+        // The instance count is the visible count written by the culling.
+        GlState::getInstance()->bindBuffer(GL_DRAW_INDIRECT_BUFFER, particleSystem->getCullingCommandBuffer()->getHandle());
+        glDrawElementsIndirect(renderType, indexBuffer->getGlType(), nullptr);
+    }
+    else if(aliveCountBuffer)
+    {
+        // The instance count is the alive count written on the GPU, so it is not read back.
+        GlState::getInstance()->bindBuffer(GL_DRAW_INDIRECT_BUFFER, aliveCountBuffer->getHandle());
+        glDrawElementsIndirect(renderType, indexBuffer->getGlType(), (const void*)(ParticleSystem::DRAW_COMMAND_OFFSET * sizeof(GLuint)));
+    }
+    else
+    {
+        glDrawElementsInstanced(renderType, indexBuffer->getItemCount(), indexBuffer->getGlType(), nullptr, particleSystem->getParticleCount());
+    }
 
     // emit post render signal
     particleSystem->emitPostRenderSignal(this);
 
     // Unbind all resources
-    // Attribute pointers
-    for(auto vertexAttributeBinding : mVertexAttributeBindings)
-        glDisableVertexAttribArray(vertexAttributeBinding);
-    mVertexAttributeBindings.clear();
-
-    // Unbind particle attributes, atomic counters and uniform buffers
+    // Particle attributes, atomic counters and uniform buffers
     unbindParticleBuffers(particleSystem);
+    if(culled)
+        particleSystem->getVisibleInstancesBuffer()->unbind();
 
-    // Mesh
-    indexBuffer->unbind();
-    mesh->unbind();
+    // The vertex array stays bound, so consecutive draws of the same Mesh and RenderProgram do not rebind it
+    mCurrentVertexArray = nullptr;
+    mCurrentBufferGeneration = 0;
 
     // Material
     mCurrentRenderProgram->unbind();
     mCurrentRenderProgram = nullptr;
 }
 
+void RenderSystem::drawParticleSystems(const std::vector<ParticleSystem*>& particleSystems)
+{
+    size_t first = 0;
+    while(first < particleSystems.size())
+    {
+        // Collect the following systems which can share the draw of the first one
+        size_t last = first + 1;
+        if(isBatchable(particleSystems[first]))
+        {
+            while(last < particleSystems.size() && isBatchable(particleSystems[last])
+                  && canShareDraw(particleSystems[first], particleSystems[last]))
+                ++last;
+        }
+
+        if(last - first > 1)
+            drawParticleSystemBatch(&particleSystems[first], last - first);
+        else
+            drawParticleSystem(particleSystems[first]);
+
+        first = last;
+    }
+}
+
+bool RenderSystem::isBatchable(ParticleSystem* particleSystem)
+{
+    ParticlePool* pool = particleSystem->getParticlePool();
+    if(!pool || particleSystem->usesFrustumCulling())
+        return false;
+
+    // Callbacks may set vertex attributes or bind buffers for their system only
+    if(!particleSystem->preRenderSignal.isEmpty() || !particleSystem->postRenderSignal.isEmpty())
+        return false;
+
+    // The remaining checks query the RenderProgram, so they are repeated only if the buffers of the system change
+    const RenderProgram* renderProgram = particleSystem->getMaterial()->getRenderProgram();
+    auto infoIter = mBatchInfos.find(std::make_pair(renderProgram, particleSystem));
+    if(infoIter != mBatchInfos.end() && infoIter->second.generation == particleSystem->getBufferGeneration())
+        return infoIter->second.batchable;
+
+    BatchInfo& info = mBatchInfos[std::make_pair(renderProgram, particleSystem)];
+    info.generation = particleSystem->getBufferGeneration();
+    info.batchable = renderProgram->getVertexAttributeLocation("np_in_particleIndex") != -1;
+
+    // All attributes have to be read from the pool storages
+    for(auto& attributeIter : particleSystem->getParticleAttributeBuffers())
+    {
+        BufferBase* storage = pool->getAttributeStorage(attributeIter.first);
+        info.batchable = info.batchable && storage && storage->getHandle() == attributeIter.second->getHandle();
+    }
+
+    // Buffers of the system which are not pooled must not be read
+    for(auto& atomicCounterIter : particleSystem->getAtomicCounterBuffers())
+        info.batchable = info.batchable && renderProgram->getBufferBinding(GL_ATOMIC_COUNTER_BUFFER, atomicCounterIter.first) == -1;
+
+    if(particleSystem->getAliveCountBuffer())
+        info.batchable = info.batchable && renderProgram->getBufferBinding(GL_ATOMIC_COUNTER_BUFFER, ParticleSystem::ALIVE_COUNT_BUFFER) == -1;
+
+    for(auto& uniformIter : particleSystem->getUniformBuffers())
+        info.batchable = info.batchable && renderProgram->getBufferBinding(GL_UNIFORM_BUFFER, uniformIter.first) == -1;
+
+    for(auto& storageIter : particleSystem->getStorageBuffers())
+        info.batchable = info.batchable && renderProgram->getBufferBinding(GL_SHADER_STORAGE_BUFFER, storageIter.first) == -1;
+
+    return info.batchable;
+}
+
+bool RenderSystem::canShareDraw(const ParticleSystem* first, const ParticleSystem* second) const
+{
+    if(first->getMesh() != second->getMesh() || first->getMaterial() != second->getMaterial()
+            || first->getParticlePool() != second->getParticlePool())
+        return false;
+
+    // Both read their attributes from the pool storages, so the attributes only have to have the same names
+    const ParticleSystem::particle_attribute_buffers& firstAttributes = first->getParticleAttributeBuffers();
+    const ParticleSystem::particle_attribute_buffers& secondAttributes = second->getParticleAttributeBuffers();
+
+    return firstAttributes.size() == secondAttributes.size()
+            && std::equal(firstAttributes.begin(), firstAttributes.end(), secondAttributes.begin(),
+                          [](const ParticleSystem::particle_attribute_buffers::value_type& a,
+                             const ParticleSystem::particle_attribute_buffers::value_type& b) { return a.first == b.first; });
+}
+
+void RenderSystem::drawParticleSystemBatch(ParticleSystem* const* particleSystems, size_t count)
+{
+    ParticleSystem* firstSystem = particleSystems[0];
+    Mesh* mesh = (Mesh*)firstSystem->getMesh();
+    const Material* material = firstSystem->getMaterial();
+    ParticlePool* pool = firstSystem->getParticlePool();
+
+    Buffer<GLuint>* indexBuffer = mesh->getIndexBuffer();
+
+    // DrawElementsIndirectCommands, the base instance is the first slot of the system in the pool
+    std::vector<GLuint> commands(5 * count, 0);
+    bool dynamicCount = false;
+    for(size_t i = 0; i < count; ++i)
+    {
+        GLuint* command = &commands[5 * i];
+        command[0] = indexBuffer->getItemCount();
+        command[1] = particleSystems[i]->getAliveCountBuffer() ? 0 : particleSystems[i]->getParticleCount();
+        command[4] = particleSystems[i]->getPoolOffset();
+        dynamicCount = dynamicCount || particleSystems[i]->getAliveCountBuffer();
+    }
+
+    const GLintptr commandOffset = writeDrawCommands(commands);
+
+    // The alive counts are written by shaders, copy them into the instance counts without reading them back
+    if(dynamicCount)
+    {
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        for(size_t i = 0; i < count; ++i)
+        {
+            AtomicCounterBuffer* aliveCountBuffer = particleSystems[i]->getAliveCountBuffer();
+            if(aliveCountBuffer)
+                mDrawCommandBuffer->copyData(*aliveCountBuffer, (ParticleSystem::DRAW_COMMAND_OFFSET + 1) * sizeof(GLuint),
+                                             commandOffset + (5 * i + 1) * sizeof(GLuint), sizeof(GLuint));
+        }
+    }
+
+    // Bind and set up material
+    mCurrentRenderProgram = material->getRenderProgram();
+    mCurrentRenderProgram->bind();
+    mCurrentRenderProgram->getViewProjectionMatrixUniform().set(mViewProjectionMatrix);
+    mCurrentRenderProgram->getNormalMatrixUniform().set(mNormalMatrix);
+    mCurrentRenderProgram->getFrustumCullingUniform().set(false);
+
+    // Bind the geometry, the particle index has to cover the slots of the whole pool
+    mCurrentVertexArray = getVertexArray(mesh, mCurrentRenderProgram);
+    GlState::getInstance()->bindVertexArray(mCurrentVertexArray->handle);
+    mesh->getVertexBuffer()->uploadDirtyRanges();
+    indexBuffer->uploadDirtyRanges();
+    setUpParticleIndexAttribute(pool->getCapacity());
+
+    // No callbacks set attributes for batched systems
+    releaseVertexAttributes();
+
+    // Bind the pool storages instead of the attribute views, the particle index addresses the slots of all systems
+    std::vector<BufferBase*> storages;
+    for(auto& attributeIter : firstSystem->getParticleAttributeBuffers())
+    {
+        GLint index = mCurrentRenderProgram->getBufferBinding(GL_SHADER_STORAGE_BUFFER, attributeIter.first);
+        if(index == -1)
+            continue;
+
+        BufferBase* storage = pool->getAttributeStorage(attributeIter.first);
+        storage->bindBase(GL_SHADER_STORAGE_BUFFER, index);
+        storages.push_back(storage);
+    }
+
+    // The views stage their edits themselves
+    for(size_t i = 0; i < count; ++i)
+    {
+        for(auto& attributeIter : particleSystems[i]->getParticleAttributeBuffers())
+            attributeIter.second->uploadDirtyRanges();
+    }
+
+    mCurrentRenderProgram->activateSubroutines();
+
+    GLenum renderType = GL_TRIANGLES;
+
+    if(mCurrentRenderProgram->usesTessellation())
+    {
+        renderType = GL_PATCHES;
+        glPatchParameteri(GL_PATCH_VERTICES, mCurrentRenderProgram->getTessellationPatchSize());
+    }
+    else if(material->getRenderType() == NP_RT_POINTS)
+        renderType = GL_POINTS;
+
+    GlState::getInstance()->bindBuffer(GL_DRAW_INDIRECT_BUFFER, mDrawCommandBuffer->getHandle());
+    glMultiDrawElementsIndirect(renderType, indexBuffer->getGlType(), (const void*)commandOffset, count, 0);
+
+    // Unbind all resources
+    for(auto storage : storages)
+        storage->unbind();
+
+    mCurrentVertexArray = nullptr;
+
+    mCurrentRenderProgram->unbind();
+    mCurrentRenderProgram = nullptr;
+}
+
+GLintptr RenderSystem::writeDrawCommands(const std::vector<GLuint>& commands)
+{
+    const GLsizei count = commands.size();
+
+    if(!mDrawCommandBuffer || mDrawCommandOffset + count > mDrawCommandBuffer->getItemCount())
+    {
+        // Commands of earlier draws in the buffer are still read, deleting it is deferred by OpenGL
+        GLsizei capacity = mDrawCommandBuffer ? 2 * mDrawCommandBuffer->getItemCount() : 0;
+        capacity = std::max(capacity, count);
+
+        delete mDrawCommandBuffer;
+        mDrawCommandBuffer = new Buffer<GLuint>(capacity, GL_UNSIGNED_INT, 1, GL_STREAM_DRAW, GL_DRAW_INDIRECT_BUFFER);
+        mDrawCommandOffset = 0;
+    }
+
+    mDrawCommandBuffer->setData(mDrawCommandOffset, count, commands.data());
+
+    const GLintptr offset = mDrawCommandOffset * sizeof(GLuint);
+    mDrawCommandOffset += count;
+    return offset;
+}
+
+void RenderSystem::setUpParticleIndexAttribute(unsigned instanceCount)
+{
+    if(!mParticleIndexBuffer || (unsigned)mParticleIndexBuffer->getItemCount() < instanceCount)
+    {
+        unsigned indexCount = mParticleIndexBuffer ? 2 * mParticleIndexBuffer->getItemCount() : 0;
+        indexCount = std::max(indexCount, instanceCount);
+
+        std::vector<GLuint> indices(indexCount);
+        for(unsigned i = 0; i < indexCount; ++i)
+            indices[i] = i;
+
+        // The vertex arrays referencing the old buffer are set up again, since they compare the generation
+        delete mParticleIndexBuffer;
+        mParticleIndexBuffer = new Buffer<GLuint>(indexCount, GL_UNSIGNED_INT, 1, GL_STATIC_DRAW, GL_ARRAY_BUFFER);
+        mParticleIndexBuffer->setData(indices.data());
+        ++mParticleIndexGeneration;
+    }
+
+    if(mCurrentVertexArray->particleIndexGeneration == mParticleIndexGeneration)
+        return;
+
+    mCurrentVertexArray->particleIndexGeneration = mParticleIndexGeneration;
+
+    // Vertex shaders which do not use npGetParticleIndex() have no particle index attribute
+    GLint location = mCurrentRenderProgram->getVertexAttributeLocation("np_in_particleIndex");
+    if(location == -1)
+        return;
+
+    if(GlState::getInstance()->usesDirectStateAccess())
+    {
+        GLuint vertexArray = mCurrentVertexArray->handle;
+        glVertexArrayVertexBuffer(vertexArray, location, mParticleIndexBuffer->getHandle(), 0, sizeof(GLuint));
+        glVertexArrayAttribIFormat(vertexArray, location, 1, GL_UNSIGNED_INT, 0);
+        glVertexArrayAttribBinding(vertexArray, location, location);
+        glVertexArrayBindingDivisor(vertexArray, location, 1);
+        glEnableVertexArrayAttrib(vertexArray, location);
+    }
+    else
+    {
+        GlState::getInstance()->bindBuffer(GL_ARRAY_BUFFER, mParticleIndexBuffer->getHandle());
+        glVertexAttribIPointer(location, 1, GL_UNSIGNED_INT, 0, nullptr);
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location);
+    }
+}
+
+RenderSystem::VertexArray* RenderSystem::getVertexArray(Mesh* mesh, const RenderProgram* renderProgram)
+{
+    auto vertexArrayIter = mVertexArrays.find(std::make_pair(mesh, renderProgram));
+    if(vertexArrayIter != mVertexArrays.end())
+    {
+        if(vertexArrayIter->second.meshGeneration == mesh->getGeneration())
+            return &vertexArrayIter->second;
+
+        // The vertex array references the buffers of a deleted Mesh
+        GlState::getInstance()->deleteVertexArray(vertexArrayIter->second.handle);
+        mVertexArrays.erase(vertexArrayIter);
+    }
+
+    VertexArray& vertexArray = mVertexArrays[std::make_pair(mesh, renderProgram)];
+    vertexArray.particleIndexGeneration = 0;
+    vertexArray.meshGeneration = mesh->getGeneration();
+
+    Buffer<glm::vec3>* vertexBuffer = mesh->getVertexBuffer();
+    Buffer<GLuint>* indexBuffer = mesh->getIndexBuffer();
+    GLint location = renderProgram->getVertexAttributeLocation("np_in_position");
+    if(location == -1)
+        Logger::getInstance()->logWarning("RenderSystem: RenderProgram has no vertex attribute \"np_in_position\"!");
+
+    GlState* glState = GlState::getInstance();
+    if(glState->usesDirectStateAccess())
+    {
+        glCreateVertexArrays(1, &vertexArray.handle);
+
+        if(location != -1)
+        {
+            glVertexArrayVertexBuffer(vertexArray.handle, location, vertexBuffer->getHandle(), 0, sizeof(glm::vec3));
+            glVertexArrayAttribFormat(vertexArray.handle, location, vertexBuffer->getGlBaseSize(), vertexBuffer->getGlType(), GL_FALSE, 0);
+            glVertexArrayAttribBinding(vertexArray.handle, location, location);
+            glEnableVertexArrayAttrib(vertexArray.handle, location);
+        }
+
+        glState->setVertexArrayElementBuffer(vertexArray.handle, indexBuffer->getHandle());
+    }
+    else
+    {
+        glGenVertexArrays(1, &vertexArray.handle);
+        glState->bindVertexArray(vertexArray.handle);
+
+        if(location != -1)
+        {
+            glState->bindBuffer(GL_ARRAY_BUFFER, vertexBuffer->getHandle());
+            glVertexAttribPointer(location, vertexBuffer->getGlBaseSize(), vertexBuffer->getGlType(), GL_FALSE, 0, nullptr);
+            glEnableVertexAttribArray(location);
+        }
+
+        // The element array buffer binding is stored in the vertex array
+        glState->bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->getHandle());
+    }
+
+    return &vertexArray;
+}
+
+void RenderSystem::releaseVertexAttributes()
+{
+    auto attributeIter = mCurrentVertexArray->attributes.begin();
+    while(attributeIter != mCurrentVertexArray->attributes.end())
+    {
+        if(attributeIter->second.used)
+        {
+            attributeIter->second.used = false;
+            ++attributeIter;
+            continue;
+        }
+
+        if(GlState::getInstance()->usesDirectStateAccess())
+            glDisableVertexArrayAttrib(mCurrentVertexArray->handle, attributeIter->first);
+        else
+            glDisableVertexAttribArray(attributeIter->first);
+
+        attributeIter = mCurrentVertexArray->attributes.erase(attributeIter);
+    }
+}
+
+bool RenderSystem::cullParticleSystem(ParticleSystem* particleSystem)
+{
+    if(!mCullingProgram)
+    {
+        GPUProgramService* gpuService = Engine::getInstance()->getGPUProgramService();
+        mCullingProgram = gpuService->getComputeProgram("np-frustum-cull");
+        if(!mCullingProgram)
+            mCullingProgram = gpuService->createComputeProgram("np-frustum-cull", "/np/frustum-cull.glsl");
+
+        if(!mCullingProgram)
+        {
+            Logger::getInstance()->logWarning("RenderSystem: cannot create frustum culling program, culling is disabled. Is \"/np\" added to the GPUProgramService?");
+            particleSystem->disableFrustumCulling();
+            return false;
+        }
+
+        mCullViewProjectionMatrixUniform = mCullingProgram->getUniformHandle<glm::mat4>("npCullViewProjectionMatrix");
+        mCullRadiusUniform = mCullingProgram->getUniformHandle<float>("npCullRadius");
+        mCullParticleCountUniform = mCullingProgram->getUniformHandle<GLuint>("npCullParticleCount");
+        mCullDynamicUniform = mCullingProgram->getUniformHandle<bool>("npCullDynamic");
+    }
+
+    BufferBase* positions = particleSystem->getParticleAttributeBuffer(particleSystem->getCullingPositionAttribute());
+    Buffer<GLuint>* visibleInstances = particleSystem->getVisibleInstancesBuffer();
+    Buffer<GLuint>* command = particleSystem->getCullingCommandBuffer();
+    AtomicCounterBuffer* aliveCountBuffer = particleSystem->getAliveCountBuffer();
+
+    // Reset the instance count of the command on the GPU, the culling counts the visible particles
+    command->clearData(sizeof(GLuint), sizeof(GLuint));
+
+    mCullingProgram->bind();
+    mCullViewProjectionMatrixUniform.set(mViewProjectionMatrix);
+    mCullRadiusUniform.set(particleSystem->getCullingRadius());
+    mCullParticleCountUniform.set(particleSystem->getParticleCount());
+    mCullDynamicUniform.set(aliveCountBuffer != nullptr);
+
+    mCullingProgram->bindShaderStorageBuffer("NPCullPositions", positions);
+    mCullingProgram->bindShaderStorageBuffer("NPCullVisibleInstances", visibleInstances);
+    mCullingProgram->bindShaderStorageBuffer("NPCullCommand", command);
+
+    BufferBase* aliveFlags = particleSystem->getStorageBuffer(ParticleSystem::ALIVE_FLAGS_BUFFER);
+    if(aliveCountBuffer)
+    {
+        aliveCountBuffer->bindBase(GL_ATOMIC_COUNTER_BUFFER, 0);
+        mCullingProgram->bindShaderStorageBuffer(ParticleSystem::ALIVE_FLAGS_BUFFER, aliveFlags);
+    }
+
+    // One particle per work item, the work groups may be spread over two dimensions
+    const unsigned groupCount = (particleSystem->getParticleCount() + mCullingProgram->getNumWorkItemsPerGroup() - 1) / mCullingProgram->getNumWorkItemsPerGroup();
+    const unsigned groupsX = std::min(groupCount, 65535u);
+    glDispatchCompute(groupsX, (groupCount + groupsX - 1) / groupsX, 1);
+
+    // The draw reads the command and the vertex shader the visible instances
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    positions->unbind();
+    visibleInstances->unbind();
+    command->unbind();
+    if(aliveCountBuffer)
+    {
+        aliveCountBuffer->unbind();
+        aliveFlags->unbind();
+    }
+
+    mCullingProgram->unbind();
+    return true;
+}
+
 } // namespace nparticles
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "ringbuffer.hpp"
+
+#include <GL/glew.h>
+
+#include <algorithm>
+
+namespace nparticles
+{
+
+namespace
+{
+
+/**
+ * The time waited for a fence before it is polled again, in nanoseconds.
+ */
+const GLuint64 FENCE_TIMEOUT = 1000000000;
+
+} // anonymous namespace
+
+RingBufferBase::RingBufferBase(int itemCount, GLsizeiptr itemSize, unsigned regionCount)
+    : BufferBase(itemCount, itemSize),
+      mRegionCount(std::max(regionCount, 2u)),
+      mRegionStride(0),
+      mCurrentRegion(0),
+      mWriteRegion(0),
+      mWriting(false),
+      mFences(mRegionCount, nullptr),
+      mPersistentPointer(nullptr),
+      mWaitCount(0)
+{
+    // Indexed bindings of a region have to start at a multiple of the offset alignments
+    GLsizeiptr alignment = std::max(glutils::glGet(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT), glutils::glGet(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT));
+    alignment = std::max(alignment, (GLsizeiptr)1);
+    mRegionStride = (itemCount * itemSize + alignment - 1) / alignment * alignment;
+
+    const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    // Direct state access requires OpenGL 4.5, which includes buffer storage
+    if(GlState::getInstance()->usesDirectStateAccess())
+    {
+        glNamedBufferStorage(mBufferHandle, mRegionCount * mRegionStride, nullptr, flags);
+        mPersistentPointer = static_cast<char*>(glMapNamedBufferRange(mBufferHandle, 0, mRegionCount * mRegionStride, flags));
+    }
+    else if(GLEW_ARB_buffer_storage)
+    {
+        GlState::getInstance()->bindBuffer(GL_COPY_WRITE_BUFFER, mBufferHandle);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, mRegionCount * mRegionStride, nullptr, flags);
+        mPersistentPointer = static_cast<char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, mRegionCount * mRegionStride, flags));
+    }
+    else
+    {
+        Logger::getInstance()->logWarning("RingBuffer: GL_ARB_buffer_storage is not available, regions are mapped while they are written.");
+        GlState::getInstance()->bindBuffer(GL_COPY_WRITE_BUFFER, mBufferHandle);
+        glBufferData(GL_COPY_WRITE_BUFFER, mRegionCount * mRegionStride, nullptr, GL_STREAM_DRAW);
+    }
+
+    // Only the current region is bound
+    mBindOffset = 0;
+    mBindSize = itemCount * itemSize;
+}
+
+RingBufferBase::~RingBufferBase()
+{
+    for(auto fence : mFences)
+    {
+        if(fence)
+            glDeleteSync(fence);
+    }
+
+    // The persistent mapping is released along with the buffer
+}
+
+void* RingBufferBase::beginWriteRaw()
+{
+    if(mWriting)
+    {
+        Logger::getInstance()->logWarning("RingBuffer: beginWrite() called twice without endWrite().");
+        endWrite();
+    }
+
+    // All commands issued so far may read the current region
+    if(mFences[mCurrentRegion])
+        glDeleteSync(mFences[mCurrentRegion]);
+    mFences[mCurrentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    mWriteRegion = (mCurrentRegion + 1) % mRegionCount;
+    mWriting = true;
+
+    // Wait until the GPU has finished reading the region the last time it was written
+    GLsync fence = mFences[mWriteRegion];
+    if(fence)
+    {
+        if(waitForFence(fence))
+            ++mWaitCount;
+
+        glDeleteSync(fence);
+        mFences[mWriteRegion] = nullptr;
+    }
+
+    const GLintptr offset = mWriteRegion * mRegionStride;
+
+    if(mPersistentPointer)
+        return mPersistentPointer + offset;
+
+    // The fence protects the region, so the mapping need not synchronise
+    GlState::getInstance()->bindBuffer(GL_COPY_WRITE_BUFFER, mBufferHandle);
+    void* region = glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, mItemCount * mItemSize,
+                                    GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+
+    return region;
+}
+
+void RingBufferBase::endWrite()
+{
+    if(!mWriting)
+        return;
+
+    if(!mPersistentPointer)
+    {
+        GlState::getInstance()->bindBuffer(GL_COPY_WRITE_BUFFER, mBufferHandle);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+
+    // The coherent mapping makes the writes visible to all following commands
+    mCurrentRegion = mWriteRegion;
+    mBindOffset = mCurrentRegion * mRegionStride;
+    mWriting = false;
+}
+
+void* RingBufferBase::mapRaw()
+{
+    if(mMapPointer)
+        return mMapPointer;
+
+    const GLintptr offset = getCurrentRegionOffset();
+
+    if(mPersistentPointer)
+    {
+        // The persistent mapping does not synchronise, so wait for all commands which may write the region
+        glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        waitForFence(fence);
+        glDeleteSync(fence);
+
+        mMapPointer = mPersistentPointer + offset;
+        return mMapPointer;
+    }
+
+    GlState::getInstance()->bindBuffer(GL_COPY_READ_BUFFER, mBufferHandle);
+    mMapPointer = glMapBufferRange(GL_COPY_READ_BUFFER, offset, mItemCount * mItemSize, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT);
+
+    return mMapPointer;
+}
+
+void RingBufferBase::unmap()
+{
+    if(!mMapPointer)
+        return;
+
+    if(!mPersistentPointer)
+    {
+        GlState::getInstance()->bindBuffer(GL_COPY_READ_BUFFER, mBufferHandle);
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+    }
+
+    mMapPointer = nullptr;
+}
+
+bool RingBufferBase::waitForFence(GLsync fence)
+{
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if(status != GL_TIMEOUT_EXPIRED)
+        return false;
+
+    // Flush, so the fence is signalled eventually
+    do
+    {
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+    }
+    while(status == GL_TIMEOUT_EXPIRED);
+
+    return true;
+}
+
+} // namespace nparticles
@@ -9,6 +9,10 @@
 
 #include "shaderprogram.hpp"
 
+#include "glstate.hpp"
+
+#include <algorithm>
+
 namespace nparticles
 {
 
@@ -20,13 +24,13 @@ bool ShaderProgram::bind() const
         return false;
     }
 
-    glUseProgram(mShaderProgram);
+    GlState::getInstance()->useProgram(mShaderProgram);
     return true;
 }
 
 void ShaderProgram::unbind() const
 {
-    glUseProgram(0);
+    GlState::getInstance()->useProgram(0);
 }
 
 bool ShaderProgram::build()
@@ -47,10 +51,13 @@ bool ShaderProgram::build()
 
     mBuildStatus = link();
 
-    // Query subroitines if build was successful.
+    // Query subroitines and uniforms if build was successful.
     if(mBuildStatus)
+    {
         for(auto shaderIter : mShaderMap)
             querySubroutines(shaderIter.first);
+        queryUniforms();
+    }
 
     return mBuildStatus;
 }
@@ -59,7 +66,16 @@ GLint ShaderProgram::getUniformLocation(const std::string& name) const
 {
     if(!mBuildStatus)
         return -1;
-    return glGetUniformLocation(mShaderProgram, name.c_str());
+
+    const UniformInfo* uniform = findUniform(name);
+    if(uniform)
+        return uniform->location;
+
+    // Only the first element of arrays is in the table
+    if(name.find('[') != std::string::npos)
+        return glGetUniformLocation(mShaderProgram, name.c_str());
+
+    return -1;
 }
 
 bool ShaderProgram::setUniform(const std::string& name, bool value) const
@@ -122,6 +138,17 @@ bool ShaderProgram::setUniform(const std::string& name, uint value) const
     return true;
 }
 
+bool ShaderProgram::setUniform(const std::string& name, const glm::uvec3& value) const
+{
+    GLint location = getUniformLocation(name);
+
+    if(location == -1)
+        return false;
+
+    glProgramUniform3uiv(mShaderProgram, location, 1, &value[0]);
+    return true;
+}
+
 ShaderProgram::ShaderProgram()
     : mBuildStatus(false)
 {
@@ -132,7 +159,7 @@ ShaderProgram::~ShaderProgram()
 {
     for(auto shaderIter : mShaderMap)
         glDeleteShader(shaderIter.second);
-    glDeleteProgram(mShaderProgram);
+    GlState::getInstance()->deleteProgram(mShaderProgram);
 
     for(auto subroutineIter : mActiveSubroutines)
         delete[] subroutineIter.second;
@@ -301,7 +328,59 @@ bool ShaderProgram::selectSubroutine(GLenum shaderStage, std::string selectorNam
     return true;
 }
 
-bool ShaderProgram::bindBufferToShaderVariable(GLenum bufferTarget, const std::string& shaderVariableName, BufferBase* buffer) const
+void ShaderProgram::queryUniforms()
+{
+    mUniforms.clear();
+
+    GLint uniformCount = 0;
+    GLint maxNameLength = 0;
+    glGetProgramInterfaceiv(mShaderProgram, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+    glGetProgramInterfaceiv(mShaderProgram, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxNameLength);
+
+    std::vector<GLchar> name(std::max(maxNameLength, 1));
+    const GLenum properties[] = { GL_LOCATION, GL_TYPE };
+
+    for(GLint i = 0; i < uniformCount; ++i)
+    {
+        GLint values[2];
+        glGetProgramResourceiv(mShaderProgram, GL_UNIFORM, i, 2, properties, 2, nullptr, values);
+
+        // Members of uniform blocks and atomic counters have no location
+        if(values[0] == -1)
+            continue;
+
+        glGetProgramResourceName(mShaderProgram, GL_UNIFORM, i, name.size(), nullptr, name.data());
+
+        UniformInfo uniform;
+        uniform.name = name.data();
+        uniform.location = values[0];
+        uniform.type = values[1];
+        mUniforms.push_back(uniform);
+
+        // Arrays are reported as "name[0]" but usually set as "name"
+        const std::string arraySuffix = "[0]";
+        if(uniform.name.size() > arraySuffix.size() && uniform.name.compare(uniform.name.size() - arraySuffix.size(), arraySuffix.size(), arraySuffix) == 0)
+        {
+            uniform.name.erase(uniform.name.size() - arraySuffix.size());
+            mUniforms.push_back(uniform);
+        }
+    }
+
+    std::sort(mUniforms.begin(), mUniforms.end(), [](const UniformInfo& a, const UniformInfo& b) { return a.name < b.name; });
+}
+
+const ShaderProgram::UniformInfo* ShaderProgram::findUniform(const std::string& name) const
+{
+    auto uniformIter = std::lower_bound(mUniforms.begin(), mUniforms.end(), name,
+                                        [](const UniformInfo& uniform, const std::string& value) { return uniform.name < value; });
+
+    if(uniformIter == mUniforms.end() || uniformIter->name != name)
+        return nullptr;
+
+    return &(*uniformIter);
+}
+
+GLint ShaderProgram::getBufferBinding(GLenum bufferTarget, const std::string& shaderVariableName) const
 {
     GLenum property = GL_BUFFER_BINDING;
     GLenum block;
@@ -313,12 +392,14 @@ bool ShaderProgram::bindBufferToShaderVariable(GLenum bufferTarget, const std::s
         block = GL_SHADER_STORAGE_BLOCK;
     else if(bufferTarget == GL_ATOMIC_COUNTER_BUFFER)
         block = GL_UNIFORM;
+    else
+        return -1;
 
     // Get index of the block
     GLuint blockIndex = glGetProgramResourceIndex(mShaderProgram, block, shaderVariableName.c_str());
 
     if(blockIndex == GL_INVALID_INDEX)
-        return false;
+        return -1;
 
     // Special case for atomic counter buffers
     if(bufferTarget == GL_ATOMIC_COUNTER_BUFFER)
@@ -328,6 +409,16 @@ bool ShaderProgram::bindBufferToShaderVariable(GLenum bufferTarget, const std::s
     GLint binding;
     glGetProgramResourceiv(mShaderProgram, block, blockIndex, 1, &property, 1, nullptr, &binding);
 
+    return binding;
+}
+
+bool ShaderProgram::bindBufferToShaderVariable(GLenum bufferTarget, const std::string& shaderVariableName, BufferBase* buffer) const
+{
+    GLint binding = getBufferBinding(bufferTarget, shaderVariableName);
+
+    if(binding == -1)
+        return false;
+
     // Bind buffer
     buffer->bindBase(bufferTarget, binding);
 
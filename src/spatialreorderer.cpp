@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "spatialreorderer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include "engine.hpp"
+#include "particlesystem.hpp"
+#include "computeprogram.hpp"
+#include "computesystem.hpp"
+#include "gpuprogramservice.hpp"
+#include "cpukernel.hpp"
+#include "threadpool.hpp"
+#include "logger.hpp"
+
+namespace nparticles
+{
+
+const char* const SpatialReorderer::CELL_COUNTS_BUFFER = "NPReorderCellCounts";
+const char* const SpatialReorderer::CELL_STARTS_BUFFER = "NPReorderCellStarts";
+const char* const SpatialReorderer::PARTICLE_KEYS_BUFFER = "NPReorderParticleKeys";
+const char* const SpatialReorderer::PERMUTATION_BUFFER = "NPReorderPermutation";
+const char* const SpatialReorderer::SCRATCH_BUFFER = "NPReorderScratch";
+const char* const SpatialReorderer::PARTICLE_IDS_BUFFER = "NPReorderParticleIds";
+const char* const SpatialReorderer::PARTICLE_SLOTS_BUFFER = "NPReorderParticleSlots";
+const char* const SpatialReorderer::SCAN_DISPATCH_BUFFER = "NPReorderScanDispatch";
+
+namespace
+{
+
+/**
+ * Interleave the bits of three cell coordinates, x being the most significant of each triple.
+ */
+unsigned interleaveBits(unsigned x, unsigned y, unsigned z, unsigned bits)
+{
+    unsigned key = 0;
+    for(int bit = bits - 1; bit >= 0; --bit)
+        key = (key << 3) | (((x >> bit) & 1u) << 2) | (((y >> bit) & 1u) << 1) | ((z >> bit) & 1u);
+    return key;
+}
+
+/**
+ * Transform cell coordinates so their interleaved bits are the Hilbert index
+ * (J. Skilling, "Programming the Hilbert curve", 2004).
+ */
+void hilbertTranspose(unsigned coordinates[3], unsigned bits)
+{
+    const unsigned highestBit = 1u << (bits - 1);
+
+    // Inverse undo
+    for(unsigned q = highestBit; q > 1; q >>= 1)
+    {
+        const unsigned p = q - 1;
+        for(unsigned i = 0; i < 3; ++i)
+        {
+            if(coordinates[i] & q)
+            {
+                coordinates[0] ^= p;
+            }
+            else
+            {
+                unsigned t = (coordinates[0] ^ coordinates[i]) & p;
+                coordinates[0] ^= t;
+                coordinates[i] ^= t;
+            }
+        }
+    }
+
+    // Gray encode
+    coordinates[1] ^= coordinates[0];
+    coordinates[2] ^= coordinates[1];
+
+    unsigned t = 0;
+    for(unsigned q = highestBit; q > 1; q >>= 1)
+    {
+        if(coordinates[2] & q)
+            t ^= q - 1;
+    }
+
+    for(unsigned i = 0; i < 3; ++i)
+        coordinates[i] ^= t;
+}
+
+/**
+ * Get a permuted buffer by name: a particle attribute or a storage buffer.
+ */
+BufferBase* getPermutedBuffer(ParticleSystem* particleSystem, const std::string& name)
+{
+    BufferBase* buffer = particleSystem->getParticleAttributeBuffer(name);
+    if(!buffer)
+        buffer = particleSystem->getStorageBuffer(name);
+    return buffer;
+}
+
+/**
+ * Base class of the CPU kernels of the sort. The reorderer is set by the pre update listener
+ * of the Action, so one kernel serves all SpatialReorderers.
+ */
+class ReorderCPUKernel : public CPUKernel
+{
+public:
+    ReorderCPUKernel(unsigned grainSize)
+        : CPUKernel(kernel_function(), grainSize),
+          mReorderer(nullptr)
+    {
+    }
+
+    void setReorderer(const SpatialReorderer* reorderer) { mReorderer = reorderer; }
+
+protected:
+    GLuint* getStorage(ParticleSystem* particleSystem, const char* name) const
+    {
+        return ((Buffer<GLuint>*)particleSystem->getStorageBuffer(name))->map();
+    }
+
+    const SpatialReorderer* mReorderer;
+};
+
+/**
+ * CPU counterpart of reorder-count.glsl. The keys are determined in parallel, the ranks are assigned
+ * sequentially, so the particles of each cell keep their order.
+ */
+class ReorderCountKernel : public ReorderCPUKernel
+{
+public:
+    ReorderCountKernel()
+        : ReorderCPUKernel(4096)
+    {
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        glm::vec4* positions = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(mReorderer->getPositionsAttribute()))->map();
+        glm::uvec2* particleKeys = ((Buffer<glm::uvec2>*)particleSystem->getStorageBuffer(SpatialReorderer::PARTICLE_KEYS_BUFFER))->map();
+
+        for(unsigned i = first; i < last; ++i)
+            particleKeys[i].x = mReorderer->getKey(glm::vec3(positions[i]));
+    }
+
+    void endUpdate(ParticleSystem* particleSystem, ThreadPool&)
+    {
+        glm::uvec2* particleKeys = ((Buffer<glm::uvec2>*)particleSystem->getStorageBuffer(SpatialReorderer::PARTICLE_KEYS_BUFFER))->map();
+        GLuint* cellCounts = getStorage(particleSystem, SpatialReorderer::CELL_COUNTS_BUFFER);
+
+        for(unsigned i = 0; i < particleSystem->getParticleCount(); ++i)
+            particleKeys[i].y = cellCounts[particleKeys[i].x]++;
+    }
+};
+
+/**
+ * CPU counterpart of reorder-scan.glsl. The prefix sum runs in beginUpdate(), there is no per particle work.
+ */
+class ReorderScanKernel : public ReorderCPUKernel
+{
+public:
+    ReorderScanKernel()
+        : ReorderCPUKernel(std::numeric_limits<unsigned>::max())
+    {
+    }
+
+    void beginUpdate(ParticleSystem* particleSystem, ThreadPool&)
+    {
+        GLuint* cellCounts = getStorage(particleSystem, SpatialReorderer::CELL_COUNTS_BUFFER);
+        GLuint* cellStarts = getStorage(particleSystem, SpatialReorderer::CELL_STARTS_BUFFER);
+
+        unsigned offset = 0;
+        for(unsigned c = 0; c < mReorderer->getCellCount(); ++c)
+        {
+            cellStarts[c] = offset;
+            offset += cellCounts[c];
+            cellCounts[c] = 0;
+        }
+    }
+};
+
+/**
+ * CPU counterpart of reorder-scatter.glsl.
+ */
+class ReorderScatterKernel : public ReorderCPUKernel
+{
+public:
+    ReorderScatterKernel()
+        : ReorderCPUKernel(4096)
+    {
+    }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        glm::uvec2* particleKeys = ((Buffer<glm::uvec2>*)particleSystem->getStorageBuffer(SpatialReorderer::PARTICLE_KEYS_BUFFER))->map();
+        GLuint* cellStarts = getStorage(particleSystem, SpatialReorderer::CELL_STARTS_BUFFER);
+        GLuint* permutation = getStorage(particleSystem, SpatialReorderer::PERMUTATION_BUFFER);
+        GLuint* particleIds = getStorage(particleSystem, SpatialReorderer::PARTICLE_IDS_BUFFER);
+        GLuint* particleSlots = getStorage(particleSystem, SpatialReorderer::PARTICLE_SLOTS_BUFFER);
+
+        for(unsigned i = first; i < last; ++i)
+        {
+            unsigned slot = cellStarts[particleKeys[i].x] + particleKeys[i].y;
+            permutation[slot] = i;
+            particleSlots[particleIds[i]] = slot;
+        }
+    }
+};
+
+/**
+ * CPU counterpart of reorder-gather.glsl. The items are gathered into the scratch buffer and copied back
+ * in endUpdate().
+ */
+class ReorderGatherKernel : public ReorderCPUKernel
+{
+public:
+    ReorderGatherKernel()
+        : ReorderCPUKernel(4096),
+          mSource(nullptr)
+    {
+    }
+
+    void setSource(BufferBase* source) { mSource = source; }
+
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const char* source = (const char*)mSource->mapRaw();
+        char* scratch = (char*)particleSystem->getStorageBuffer(SpatialReorderer::SCRATCH_BUFFER)->mapRaw();
+        GLuint* permutation = getStorage(particleSystem, SpatialReorderer::PERMUTATION_BUFFER);
+        const GLsizeiptr itemSize = mSource->getItemSize();
+
+        for(unsigned i = first; i < last; ++i)
+            std::memcpy(scratch + i * itemSize, source + permutation[i] * itemSize, itemSize);
+    }
+
+    void endUpdate(ParticleSystem* particleSystem, ThreadPool& threadPool)
+    {
+        char* source = (char*)mSource->mapRaw();
+        const char* scratch = (const char*)particleSystem->getStorageBuffer(SpatialReorderer::SCRATCH_BUFFER)->mapRaw();
+        const GLsizeiptr itemSize = mSource->getItemSize();
+
+        threadPool.parallelFor(0, particleSystem->getParticleCount(), [=](unsigned first, unsigned last)
+        {
+            std::memcpy(source + first * itemSize, scratch + first * itemSize, (last - first) * itemSize);
+        }, 16384);
+    }
+
+private:
+    BufferBase* mSource;
+};
+
+/**
+ * Get a compute program of the sort. The program is created and its CPU kernel registered on first use.
+ */
+template<typename Kernel>
+ComputeProgram* getReorderProgram(const std::string& id, const std::string& sourceFile)
+{
+    Engine* engine = Engine::getInstance();
+    GPUProgramService* gpuService = engine->getGPUProgramService();
+
+    ComputeProgram* computeProgram = gpuService->getComputeProgram(id);
+    if(computeProgram)
+        return computeProgram;
+
+    computeProgram = gpuService->createComputeProgram(id, sourceFile);
+    if(!computeProgram)
+        return nullptr;
+
+    engine->getComputeSystem().registerCPUKernel(*computeProgram, new Kernel());
+    return computeProgram;
+}
+
+} // anonymous namespace
+
+SpatialReorderer::SpatialReorderer(const glm::vec3& origin, float size, space_filling_curves curve, unsigned bitsPerAxis, const std::string& positionsAttribute)
+    : mOrigin(origin),
+      mSize(size),
+      mCurve(curve),
+      mBitsPerAxis(std::min(std::max(bitsPerAxis, 1u), 7u)),
+      mPositionsAttribute(positionsAttribute)
+{
+}
+
+void SpatialReorderer::addPerParticleBuffer(const std::string& name)
+{
+    mPerParticleBuffers.push_back(name);
+}
+
+bool SpatialReorderer::attach(ParticleSystem* particleSystem, unsigned interval)
+{
+    if(particleSystem->getStorageBuffer(PERMUTATION_BUFFER))
+    {
+        Logger::getInstance()->logWarning("SpatialReorderer: particle system already has a spatial reorderer.");
+        return false;
+    }
+
+    // Permuting would mix dead particles into the alive range
+    if(particleSystem->getAliveCountBuffer())
+    {
+        Logger::getInstance()->logWarning("SpatialReorderer: particle systems with a dynamic particle count cannot be reordered.");
+        return false;
+    }
+
+    const unsigned particleCount = particleSystem->getParticleCount();
+
+    // Collect the permuted buffers. The gather copies 32 bit words.
+    std::vector<std::string> permutedBuffers;
+    for(auto attributeIter : particleSystem->getParticleAttributeBuffers())
+        permutedBuffers.push_back(attributeIter.first);
+    permutedBuffers.insert(permutedBuffers.end(), mPerParticleBuffers.begin(), mPerParticleBuffers.end());
+
+    GLsizeiptr largestItemSize = sizeof(GLuint);
+    for(auto& name : permutedBuffers)
+    {
+        BufferBase* buffer = getPermutedBuffer(particleSystem, name);
+        if(!buffer || buffer->getItemCount() != (GLsizei)particleCount || buffer->getItemSize() % 4 != 0)
+        {
+            Logger::getInstance()->logWarning("SpatialReorderer: cannot permute buffer \"" + name + "\". It has to hold one item of a multiple of four bytes per particle.");
+            return false;
+        }
+
+        // Streamed attributes are rewritten every frame and cannot be copied
+        if(dynamic_cast<RingBufferBase*>(buffer))
+        {
+            Logger::getInstance()->logWarning("SpatialReorderer: cannot permute streamed attribute \"" + name + "\". Add it after the SpatialReorderer is attached.");
+            return false;
+        }
+        largestItemSize = std::max(largestItemSize, buffer->getItemSize());
+    }
+    permutedBuffers.push_back(PARTICLE_IDS_BUFFER);
+
+    ComputeProgram* countProgram = getReorderProgram<ReorderCountKernel>("np-reorder-count", "/np/reorder-count.glsl");
+    ComputeProgram* scanProgram = getReorderProgram<ReorderScanKernel>("np-reorder-scan", "/np/reorder-scan.glsl");
+    ComputeProgram* scatterProgram = getReorderProgram<ReorderScatterKernel>("np-reorder-scatter", "/np/reorder-scatter.glsl");
+    ComputeProgram* gatherProgram = getReorderProgram<ReorderGatherKernel>("np-reorder-gather", "/np/reorder-gather.glsl");
+
+    if(!countProgram || !scanProgram || !scatterProgram || !gatherProgram)
+    {
+        Logger::getInstance()->logWarning("SpatialReorderer: cannot create compute programs. Is \"/np\" added to the GPUProgramService?");
+        return false;
+    }
+
+    // The counts are reset by the scan, so they only have to be cleared once. Ids start as the initial slots.
+    std::vector<GLuint> zeros(getCellCount(), 0);
+    std::vector<GLuint> identity(particleCount);
+    for(unsigned i = 0; i < particleCount; ++i)
+        identity[i] = i;
+
+    particleSystem->addStorageBuffer<GLuint>(CELL_COUNTS_BUFFER, getCellCount(), GL_UNSIGNED_INT, 1)->setData(zeros.data());
+    particleSystem->addStorageBuffer<GLuint>(CELL_STARTS_BUFFER, getCellCount(), GL_UNSIGNED_INT, 1);
+    particleSystem->addStorageBuffer<glm::uvec2>(PARTICLE_KEYS_BUFFER, particleCount, GL_UNSIGNED_INT, 2);
+    particleSystem->addStorageBuffer<GLuint>(PERMUTATION_BUFFER, particleCount, GL_UNSIGNED_INT, 1);
+    particleSystem->addStorageBuffer<GLuint>(SCRATCH_BUFFER, particleCount * (largestItemSize / 4), GL_UNSIGNED_INT, 1);
+    particleSystem->addStorageBuffer<GLuint>(PARTICLE_IDS_BUFFER, particleCount, GL_UNSIGNED_INT, 1)->setData(identity.data());
+    particleSystem->addStorageBuffer<GLuint>(PARTICLE_SLOTS_BUFFER, particleCount, GL_UNSIGNED_INT, 1)->setData(identity.data());
+
+    // The scan runs in a single work group, whatever the particle count
+    GLuint scanDispatch[3] = {1, 1, 1};
+    particleSystem->addStorageBuffer<GLuint>(SCAN_DISPATCH_BUFFER, 3, GL_UNSIGNED_INT, 1)->setData(scanDispatch);
+
+    // Sort passes
+    for(ComputeProgram* computeProgram : {countProgram, scanProgram, scatterProgram})
+    {
+        Action* action = particleSystem->appendAction(*computeProgram);
+        action->setUpdateInterval(interval);
+
+        action->preUpdateSignal.connect([this, computeProgram](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+        {
+            setUniforms(*computeProgram);
+            computeProgram->setUniform("npReorderParticleCount", particleSystem->getParticleCount());
+
+            ReorderCPUKernel* kernel = (ReorderCPUKernel*)computeSystem->getCurrentCPUKernel();
+            if(kernel)
+                kernel->setReorderer(this);
+            else
+                computeProgram->bindShaderStorageBuffer("NPReorderPositions", particleSystem->getParticleAttributeBuffer(mPositionsAttribute));
+        });
+    }
+
+    // Declare the buffer accesses of the passes (see ActionGraph)
+    const ParticleSystem::particle_actions& actions = particleSystem->getActions();
+    Action* countAction = actions[actions.size() - 3];
+    Action* scanAction = actions[actions.size() - 2];
+    Action* scatterAction = actions.back();
+
+    countAction->addRead(mPositionsAttribute);
+    countAction->addWrite(CELL_COUNTS_BUFFER);
+    countAction->addWrite(PARTICLE_KEYS_BUFFER);
+
+    scanAction->setIndirectDispatchBuffer(particleSystem->getStorageBuffer(SCAN_DISPATCH_BUFFER));
+    scanAction->addWrite(CELL_COUNTS_BUFFER);
+    scanAction->addWrite(CELL_STARTS_BUFFER);
+
+    scatterAction->addRead(PARTICLE_KEYS_BUFFER);
+    scatterAction->addRead(CELL_STARTS_BUFFER);
+    scatterAction->addRead(PARTICLE_IDS_BUFFER);
+    scatterAction->addWrite(PERMUTATION_BUFFER);
+    scatterAction->addWrite(PARTICLE_SLOTS_BUFFER);
+
+    // One gather per permuted buffer. The buffers are looked up by name, so swapped attributes are handled.
+    for(auto& name : permutedBuffers)
+    {
+        Action* action = particleSystem->appendAction(*gatherProgram);
+        action->setUpdateInterval(interval);
+
+        action->addRead(PERMUTATION_BUFFER);
+        action->addWrite(SCRATCH_BUFFER);
+        action->addWrite(name);
+
+        action->preUpdateSignal.connect([this, gatherProgram, name](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+        {
+            BufferBase* buffer = getPermutedBuffer(particleSystem, name);
+
+            gatherProgram->setUniform("npReorderParticleCount", particleSystem->getParticleCount());
+            gatherProgram->setUniform("npReorderWordsPerItem", (unsigned)(buffer->getItemSize() / 4));
+
+            ReorderGatherKernel* kernel = (ReorderGatherKernel*)computeSystem->getCurrentCPUKernel();
+            if(kernel)
+            {
+                kernel->setReorderer(this);
+                kernel->setSource(buffer);
+            }
+            else
+            {
+                gatherProgram->bindShaderStorageBuffer("NPReorderSource", buffer);
+            }
+        });
+
+        // On the GPU, the gathered items are copied back after the dispatch
+        action->postUpdateSignal.connect([name](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+        {
+            if(computeSystem->getCurrentCPUKernel())
+                return;
+
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+            getPermutedBuffer(particleSystem, name)->copyData(*particleSystem->getStorageBuffer(SCRATCH_BUFFER));
+        });
+    }
+
+    return true;
+}
+
+void SpatialReorderer::setUniforms(const ShaderProgram& program) const
+{
+    program.setUniform("npReorderOrigin", mOrigin);
+    program.setUniform("npReorderSize", mSize);
+    program.setUniform("npReorderBitsPerAxis", mBitsPerAxis);
+    program.setUniform("npReorderHilbert", mCurve == NP_SFC_HILBERT);
+    program.setUniform("npReorderCellCount", getCellCount());
+}
+
+unsigned SpatialReorderer::getKey(const glm::vec3& position) const
+{
+    const float cellsPerAxis = (float)(1u << mBitsPerAxis);
+    glm::vec3 cell = glm::clamp((position - mOrigin) / mSize * cellsPerAxis, glm::vec3(0.0f), glm::vec3(cellsPerAxis - 1.0f));
+
+    unsigned coordinates[3] = {(unsigned)cell.x, (unsigned)cell.y, (unsigned)cell.z};
+    if(mCurve == NP_SFC_HILBERT)
+        hilbertTranspose(coordinates, mBitsPerAxis);
+
+    return interleaveBits(coordinates[0], coordinates[1], coordinates[2], mBitsPerAxis);
+}
+
+} // namespace nparticles
@@ -0,0 +1,421 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "sphpipeline.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "engine.hpp"
+#include "particlesystem.hpp"
+#include "computeprogram.hpp"
+#include "computesystem.hpp"
+#include "gpuprogramservice.hpp"
+#include "cpukernel.hpp"
+#include "logger.hpp"
+#include "threadpool.hpp"
+
+namespace nparticles
+{
+
+const char* const SPHPipeline::POSITIONS_ATTRIBUTE = "SPHPositions";
+const char* const SPHPipeline::VELOCITIES_ATTRIBUTE = "SPHVelocities";
+const char* const SPHPipeline::DENSITIES_ATTRIBUTE = "SPHDensities";
+const char* const SPHPipeline::ACCELERATIONS_ATTRIBUTE = "SPHAccelerations";
+
+namespace
+{
+
+/**
+ * The attributes and grid tables of a ParticleSystem. The buffers are mapped while CPU kernels run.
+ */
+struct FluidData
+{
+    FluidData(ParticleSystem* particleSystem)
+    {
+        positions = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(SPHPipeline::POSITIONS_ATTRIBUTE))->map();
+        velocities = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(SPHPipeline::VELOCITIES_ATTRIBUTE))->map();
+        densities = ((Buffer<glm::vec2>*)particleSystem->getParticleAttributeBuffer(SPHPipeline::DENSITIES_ATTRIBUTE))->map();
+        accelerations = ((Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(SPHPipeline::ACCELERATIONS_ATTRIBUTE))->map();
+        cellStarts = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::CELL_STARTS_BUFFER))->map();
+        cellEnds = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::CELL_ENDS_BUFFER))->map();
+        particleIndices = ((Buffer<GLuint>*)particleSystem->getStorageBuffer(NeighborGrid::PARTICLE_INDICES_BUFFER))->map();
+    }
+
+    glm::vec4* positions;
+    glm::vec4* velocities;
+    glm::vec2* densities;
+    glm::vec4* accelerations;
+    GLuint* cellStarts;
+    GLuint* cellEnds;
+    GLuint* particleIndices;
+};
+
+/**
+ * Call @p function for each particle in the cells adjacent to @p position.
+ */
+template<typename Function>
+inline void forEachNeighbor(const NeighborGrid& grid, const FluidData& data, const glm::vec3& position, Function function)
+{
+    unsigned cells[27];
+    unsigned cellCount = grid.getNeighborCells(position, cells);
+
+    for(unsigned c = 0; c < cellCount; ++c)
+    {
+        for(unsigned n = data.cellStarts[cells[c]]; n < data.cellEnds[cells[c]]; ++n)
+            function(data.particleIndices[n]);
+    }
+}
+
+/**
+ * Base class of the CPU kernels of the pipeline. The pipeline is set by the pre update listener
+ * of the Action, so one kernel serves all SPHPipelines.
+ */
+class SPHCPUKernel : public CPUKernel
+{
+public:
+    SPHCPUKernel()
+        : CPUKernel(kernel_function(), 256),
+          mPipeline(nullptr)
+    {
+    }
+
+    void setPipeline(const SPHPipeline* pipeline) { mPipeline = pipeline; }
+
+protected:
+    const SPHPipeline* mPipeline;
+};
+
+/**
+ * CPU counterpart of sph-density.glsl.
+ */
+class SPHDensityKernel : public SPHCPUKernel
+{
+public:
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const SPHParameters& parameters = mPipeline->getParameters();
+        const NeighborGrid& grid = mPipeline->getGrid();
+        const float h2 = parameters.smoothingLength * parameters.smoothingLength;
+        const float factor = parameters.particleMass * mPipeline->getPoly6Factor();
+
+        FluidData data(particleSystem);
+
+        // Process the particles in grid order, so consecutive particles visit the same cells.
+        for(unsigned slot = first; slot < last; ++slot)
+        {
+            unsigned particle = data.particleIndices[slot];
+            glm::vec3 position(data.positions[particle]);
+
+            float density = 0;
+            forEachNeighbor(grid, data, position, [&](unsigned neighbor)
+            {
+                glm::vec3 d = position - glm::vec3(data.positions[neighbor]);
+                float r2 = glm::dot(d, d);
+
+                if(r2 < h2)
+                {
+                    float w = h2 - r2;
+                    density += w * w * w;
+                }
+            });
+
+            density *= factor;
+            data.densities[particle] = glm::vec2(density, std::max(0.0f, parameters.stiffness * (density - parameters.restDensity)));
+        }
+    }
+};
+
+/**
+ * CPU counterpart of sph-pressure.glsl.
+ */
+class SPHPressureKernel : public SPHCPUKernel
+{
+public:
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const SPHParameters& parameters = mPipeline->getParameters();
+        const NeighborGrid& grid = mPipeline->getGrid();
+        const float h = parameters.smoothingLength;
+        const float factor = parameters.particleMass * mPipeline->getSpikyGradientFactor();
+
+        FluidData data(particleSystem);
+
+        for(unsigned slot = first; slot < last; ++slot)
+        {
+            unsigned particle = data.particleIndices[slot];
+            glm::vec3 position(data.positions[particle]);
+            glm::vec2 densityPressure = data.densities[particle];
+
+            glm::vec3 acceleration(0, 0, 0);
+            forEachNeighbor(grid, data, position, [&](unsigned neighbor)
+            {
+                glm::vec3 d = position - glm::vec3(data.positions[neighbor]);
+                float r2 = glm::dot(d, d);
+
+                if(r2 < h * h && neighbor != particle && r2 > 0)
+                {
+                    float r = std::sqrt(r2);
+                    const glm::vec2& neighborDensityPressure = data.densities[neighbor];
+                    float w = h - r;
+                    acceleration += d * ((densityPressure.y + neighborDensityPressure.y) / (2.0f * neighborDensityPressure.x) * w * w / r);
+                }
+            });
+
+            data.accelerations[particle] = glm::vec4(acceleration * (factor / densityPressure.x), 0);
+        }
+    }
+};
+
+/**
+ * CPU counterpart of sph-viscosity.glsl.
+ */
+class SPHViscosityKernel : public SPHCPUKernel
+{
+public:
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const SPHParameters& parameters = mPipeline->getParameters();
+        const NeighborGrid& grid = mPipeline->getGrid();
+        const float h = parameters.smoothingLength;
+        const float factor = parameters.viscosity * parameters.particleMass * mPipeline->getViscosityLaplacianFactor();
+
+        FluidData data(particleSystem);
+
+        for(unsigned slot = first; slot < last; ++slot)
+        {
+            unsigned particle = data.particleIndices[slot];
+            glm::vec3 position(data.positions[particle]);
+            glm::vec3 velocity(data.velocities[particle]);
+
+            glm::vec3 acceleration(0, 0, 0);
+            forEachNeighbor(grid, data, position, [&](unsigned neighbor)
+            {
+                glm::vec3 d = position - glm::vec3(data.positions[neighbor]);
+                float r2 = glm::dot(d, d);
+
+                if(r2 < h * h && neighbor != particle)
+                    acceleration += (glm::vec3(data.velocities[neighbor]) - velocity) * ((h - std::sqrt(r2)) / data.densities[neighbor].x);
+            });
+
+            acceleration *= factor / data.densities[particle].x;
+            data.accelerations[particle] += glm::vec4(acceleration + parameters.gravity, 0);
+        }
+    }
+};
+
+/**
+ * CPU counterpart of sph-integrate.glsl.
+ */
+class SPHIntegrateKernel : public SPHCPUKernel
+{
+public:
+    void update(ParticleSystem* particleSystem, unsigned first, unsigned last)
+    {
+        const SPHParameters& parameters = mPipeline->getParameters();
+
+        FluidData data(particleSystem);
+
+        for(unsigned particle = first; particle < last; ++particle)
+        {
+            glm::vec3 velocity = glm::vec3(data.velocities[particle]) + glm::vec3(data.accelerations[particle]) * parameters.timeStep;
+            glm::vec3 position = glm::vec3(data.positions[particle]) + velocity * parameters.timeStep;
+
+            // Reflect the velocity at the bounds
+            for(unsigned axis = 0; axis < 3; ++axis)
+            {
+                if(position[axis] < parameters.boundsMin[axis] || position[axis] > parameters.boundsMax[axis])
+                {
+                    velocity[axis] *= -parameters.boundaryDamping;
+                    position[axis] = std::min(std::max(position[axis], parameters.boundsMin[axis]), parameters.boundsMax[axis]);
+                }
+            }
+
+            data.positions[particle] = glm::vec4(position, data.positions[particle].w);
+            data.velocities[particle] = glm::vec4(velocity, data.velocities[particle].w);
+        }
+    }
+};
+
+/**
+ * Get a compute program of the pipeline. The program is created and its CPU kernel registered on first use.
+ */
+template<typename Kernel>
+ComputeProgram* getSPHProgram(const std::string& id, const std::string& sourceFile)
+{
+    Engine* engine = Engine::getInstance();
+    GPUProgramService* gpuService = engine->getGPUProgramService();
+
+    ComputeProgram* computeProgram = gpuService->getComputeProgram(id);
+    if(computeProgram)
+        return computeProgram;
+
+    computeProgram = gpuService->createComputeProgram(id, sourceFile);
+    if(!computeProgram)
+        return nullptr;
+
+    engine->getComputeSystem().registerCPUKernel(*computeProgram, new Kernel());
+    return computeProgram;
+}
+
+/**
+ * The number of grid cells of size @p cellSize needed to cover the bounds.
+ */
+glm::uvec3 getGridDimensions(const SPHParameters& parameters)
+{
+    glm::vec3 extent = (parameters.boundsMax - parameters.boundsMin) / parameters.smoothingLength;
+    return glm::uvec3(std::ceil(extent.x), std::ceil(extent.y), std::ceil(extent.z));
+}
+
+} // anonymous namespace
+
+SPHParameters::SPHParameters()
+    : smoothingLength(0.0457f),
+      particleMass(0.02f),
+      restDensity(998.29f),
+      stiffness(3.0f),
+      viscosity(3.5f),
+      boundaryDamping(0.5f),
+      timeStep(0.001f),
+      gravity(0, -9.81f, 0),
+      boundsMin(-0.5f, -0.5f, -0.5f),
+      boundsMax(0.5f, 0.5f, 0.5f)
+{
+}
+
+SPHPipeline::SPHPipeline(const SPHParameters& parameters)
+    : mParameters(parameters),
+      mGrid(parameters.boundsMin, getGridDimensions(parameters), parameters.smoothingLength, POSITIONS_ATTRIBUTE)
+{
+    const float h = parameters.smoothingLength;
+    mPoly6Factor = 315.0f / (64.0f * M_PI * std::pow(h, 9.0f));
+    mSpikyGradientFactor = 45.0f / (M_PI * std::pow(h, 6.0f));
+    mViscosityLaplacianFactor = 45.0f / (M_PI * std::pow(h, 6.0f));
+}
+
+bool SPHPipeline::attach(ParticleSystem* particleSystem)
+{
+    ComputeProgram* densityProgram = getSPHProgram<SPHDensityKernel>("np-sph-density", "/np/sph-density.glsl");
+    ComputeProgram* pressureProgram = getSPHProgram<SPHPressureKernel>("np-sph-pressure", "/np/sph-pressure.glsl");
+    ComputeProgram* viscosityProgram = getSPHProgram<SPHViscosityKernel>("np-sph-viscosity", "/np/sph-viscosity.glsl");
+    ComputeProgram* integrateProgram = getSPHProgram<SPHIntegrateKernel>("np-sph-integrate", "/np/sph-integrate.glsl");
+
+    if(!densityProgram || !pressureProgram || !viscosityProgram || !integrateProgram)
+    {
+        Logger::getInstance()->logWarning("SPHPipeline: cannot create compute programs. Is \"/np\" added to the GPUProgramService?");
+        return false;
+    }
+
+    if(!particleSystem->addParticleAttribute<glm::vec4>(POSITIONS_ATTRIBUTE) ||
+       !particleSystem->addParticleAttribute<glm::vec4>(VELOCITIES_ATTRIBUTE) ||
+       !particleSystem->addParticleAttribute<glm::vec2>(DENSITIES_ATTRIBUTE, GL_FLOAT, 2) ||
+       !particleSystem->addParticleAttribute<glm::vec4>(ACCELERATIONS_ATTRIBUTE))
+    {
+        Logger::getInstance()->logWarning("SPHPipeline: particle system already has SPH attributes.");
+        return false;
+    }
+
+    if(!mGrid.attach(particleSystem))
+        return false;
+
+    for(ComputeProgram* computeProgram : {densityProgram, pressureProgram, viscosityProgram, integrateProgram})
+    {
+        Action* action = particleSystem->appendAction(*computeProgram);
+
+        action->preUpdateSignal.connect([this, computeProgram](ParticleSystem* particleSystem, const ComputeSystem* computeSystem)
+        {
+            setUniforms(*computeProgram, particleSystem->getParticleCount());
+
+            SPHCPUKernel* kernel = (SPHCPUKernel*)computeSystem->getCurrentCPUKernel();
+            if(kernel)
+                kernel->setPipeline(this);
+        });
+
+        // All passes look up neighbors except the integration
+        if(computeProgram != integrateProgram)
+        {
+            action->addRead(POSITIONS_ATTRIBUTE);
+            action->addRead(NeighborGrid::CELL_STARTS_BUFFER);
+            action->addRead(NeighborGrid::CELL_ENDS_BUFFER);
+            action->addRead(NeighborGrid::PARTICLE_INDICES_BUFFER);
+        }
+    }
+
+    // Declare the remaining buffer accesses of the passes (see ActionGraph)
+    const ParticleSystem::particle_actions& actions = particleSystem->getActions();
+    Action* densityAction = actions[actions.size() - 4];
+    Action* pressureAction = actions[actions.size() - 3];
+    Action* viscosityAction = actions[actions.size() - 2];
+    Action* integrateAction = actions.back();
+
+    densityAction->addWrite(DENSITIES_ATTRIBUTE);
+
+    pressureAction->addRead(DENSITIES_ATTRIBUTE);
+    pressureAction->addWrite(ACCELERATIONS_ATTRIBUTE);
+
+    viscosityAction->addRead(VELOCITIES_ATTRIBUTE);
+    viscosityAction->addRead(DENSITIES_ATTRIBUTE);
+    viscosityAction->addWrite(ACCELERATIONS_ATTRIBUTE);
+
+    integrateAction->addRead(ACCELERATIONS_ATTRIBUTE);
+    integrateAction->addWrite(POSITIONS_ATTRIBUTE);
+    integrateAction->addWrite(VELOCITIES_ATTRIBUTE);
+
+    return true;
+}
+
+void SPHPipeline::initialiseBlock(ParticleSystem* particleSystem, const glm::vec3& origin, unsigned width) const
+{
+    Buffer<glm::vec4>* positionsBuffer = (Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(POSITIONS_ATTRIBUTE);
+    Buffer<glm::vec4>* velocitiesBuffer = (Buffer<glm::vec4>*)particleSystem->getParticleAttributeBuffer(VELOCITIES_ATTRIBUTE);
+
+    glm::vec4* positions = positionsBuffer->map();
+    glm::vec4* velocities = velocitiesBuffer->map();
+
+    const float spacing = getParticleSpacing();
+    Engine::getInstance()->getThreadPool().parallelFor(0, particleSystem->getParticleCount(), [=](unsigned first, unsigned last)
+    {
+        for(unsigned i = first; i < last; ++i)
+        {
+            glm::vec3 lattice(i % width, i / (width * width), (i / width) % width);
+            positions[i] = glm::vec4(origin + lattice * spacing, 1);
+            velocities[i] = glm::vec4(0, 0, 0, 0);
+        }
+    });
+
+    positionsBuffer->unmap();
+    velocitiesBuffer->unmap();
+}
+
+void SPHPipeline::setUniforms(const ShaderProgram& program, unsigned particleCount) const
+{
+    mGrid.setUniforms(program);
+
+    program.setUniform("npSPHParticleCount", particleCount);
+    program.setUniform("npSPHSmoothingLength", mParameters.smoothingLength);
+    program.setUniform("npSPHParticleMass", mParameters.particleMass);
+    program.setUniform("npSPHRestDensity", mParameters.restDensity);
+    program.setUniform("npSPHStiffness", mParameters.stiffness);
+    program.setUniform("npSPHViscosity", mParameters.viscosity);
+    program.setUniform("npSPHBoundaryDamping", mParameters.boundaryDamping);
+    program.setUniform("npSPHTimeStep", mParameters.timeStep);
+    program.setUniform("npSPHGravity", mParameters.gravity);
+    program.setUniform("npSPHBoundsMin", mParameters.boundsMin);
+    program.setUniform("npSPHBoundsMax", mParameters.boundsMax);
+    program.setUniform("npSPHPoly6Factor", mPoly6Factor);
+    program.setUniform("npSPHSpikyGradientFactor", mSpikyGradientFactor);
+    program.setUniform("npSPHViscosityLaplacianFactor", mViscosityLaplacianFactor);
+}
+
+float SPHPipeline::getParticleSpacing() const
+{
+    return std::cbrt(mParameters.particleMass / mParameters.restDensity);
+}
+
+} // namespace nparticles
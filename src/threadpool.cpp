@@ -0,0 +1,310 @@
+/*
+ * Copyright (C) 2015 Simon Kerler
+ *
+ * This file is part of the "Nameless Particle Engine".
+ * For conditions of distribution and use, see the copyright notice you should
+ * have recievied with this software. I not, see:
+ * http://opensource.org/licenses/Zlib
+ */
+
+#include "threadpool.hpp"
+
+#include <algorithm>
+
+namespace nparticles
+{
+
+namespace
+{
+    // The pool and WorkQueue index of the current thread if it is a worker.
+    thread_local const ThreadPool* currentPool = nullptr;
+    thread_local unsigned currentQueueIndex = 0;
+}
+
+struct ThreadPool::Task
+{
+    Task(const task_function& function, unsigned dependencies)
+        : function(function),
+          dependencies(dependencies),
+          finished(false)
+    {
+    }
+
+    /**
+     * The function of the task.
+     */
+    task_function function;
+
+    /**
+     * The number of unfinished antecedents. The task is scheduled when it drops to 0.
+     */
+    std::atomic<unsigned> dependencies;
+
+    /**
+     * Mutex protecting the continuations.
+     */
+    std::mutex mutex;
+
+    /**
+     * The continuations started when the task is finished.
+     */
+    std::vector<task_handle> continuations;
+
+    /**
+     * Set to true when the function returned.
+     */
+    std::atomic<bool> finished;
+};
+
+ThreadPool::ThreadPool(unsigned threadCount)
+    : mQueuedJobs(0),
+      mSleepingWorkers(0),
+      mTerminate(false)
+{
+    if(threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    for(unsigned i = 0; i < threadCount; ++i)
+        mQueues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+
+    // Waiting threads take part in processing.
+    for(unsigned i = 1; i < threadCount; ++i)
+        mWorkers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mTerminate = true;
+    }
+    mWorkAvailable.notify_all();
+
+    for(auto& worker : mWorkers)
+        worker.join();
+}
+
+void ThreadPool::parallelFor(unsigned first, unsigned last, const range_function& function, unsigned grainSize)
+{
+    if(last <= first)
+        return;
+
+    unsigned count = last - first;
+
+    if(grainSize == 0)
+        grainSize = std::max(1u, count / (getThreadCount() * 4));
+
+    // Nothing to distribute: process the range directly.
+    if(mWorkers.empty() || count <= grainSize)
+    {
+        function(first, last);
+        return;
+    }
+
+    std::atomic<unsigned> remaining(count);
+    processRange(first, last, &function, grainSize, &remaining);
+
+    unsigned queueIndex = getQueueIndex();
+    while(remaining > 0)
+    {
+        if(!runPendingJob(queueIndex))
+            std::this_thread::yield();
+    }
+}
+
+ThreadPool::task_handle ThreadPool::submit(const task_function& function)
+{
+    task_handle task = std::make_shared<Task>(function, 0);
+    schedule(task);
+    return task;
+}
+
+ThreadPool::task_handle ThreadPool::then(const task_handle& antecedent, const task_function& function)
+{
+    return then(std::vector<task_handle>(1, antecedent), function);
+}
+
+ThreadPool::task_handle ThreadPool::then(const std::vector<task_handle>& antecedents, const task_function& function)
+{
+    // One additional dependency keeps the task from being scheduled while it is registered
+    task_handle task = std::make_shared<Task>(function, antecedents.size() + 1);
+
+    for(auto& antecedent : antecedents)
+    {
+        if(antecedent)
+        {
+            std::lock_guard<std::mutex> lock(antecedent->mutex);
+            if(!antecedent->finished)
+            {
+                antecedent->continuations.push_back(task);
+                continue;
+            }
+        }
+
+        --task->dependencies;
+    }
+
+    if(--task->dependencies == 0)
+        schedule(task);
+
+    return task;
+}
+
+bool ThreadPool::isFinished(const task_handle& task) const
+{
+    return task->finished;
+}
+
+void ThreadPool::wait(const task_handle& task)
+{
+    unsigned queueIndex = getQueueIndex();
+    while(!task->finished)
+    {
+        if(!runPendingJob(queueIndex))
+            std::this_thread::yield();
+    }
+}
+
+unsigned ThreadPool::waitAny(const std::vector<task_handle>& tasks)
+{
+    unsigned queueIndex = getQueueIndex();
+    while(true)
+    {
+        for(unsigned i = 0; i < tasks.size(); ++i)
+        {
+            if(tasks[i]->finished)
+                return i;
+        }
+
+        if(!runPendingJob(queueIndex))
+            std::this_thread::yield();
+    }
+}
+
+void ThreadPool::workerLoop(unsigned queueIndex)
+{
+    currentPool = this;
+    currentQueueIndex = queueIndex;
+
+    while(true)
+    {
+        if(runPendingJob(queueIndex))
+            continue;
+
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+
+        // Announce sleeping before checking for jobs, push() checks the other way round.
+        ++mSleepingWorkers;
+        mWorkAvailable.wait(lock, [this]{ return mTerminate || mQueuedJobs > 0; });
+        --mSleepingWorkers;
+
+        if(mTerminate)
+            return;
+    }
+}
+
+unsigned ThreadPool::getQueueIndex() const
+{
+    return currentPool == this ? currentQueueIndex : 0;
+}
+
+void ThreadPool::push(job&& newJob)
+{
+    WorkQueue& queue = *mQueues[getQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(newJob));
+    }
+
+    ++mQueuedJobs;
+
+    if(mSleepingWorkers > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+        }
+        mWorkAvailable.notify_one();
+    }
+}
+
+bool ThreadPool::runPendingJob(unsigned queueIndex)
+{
+    job pendingJob;
+
+    // Pop the most recent own job first, it works on the data touched last.
+    {
+        WorkQueue& queue = *mQueues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(!queue.jobs.empty())
+        {
+            pendingJob = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+        }
+    }
+
+    // Steal the oldest job of another thread, it is usually the largest.
+    for(unsigned i = 1; !pendingJob && i < mQueues.size(); ++i)
+    {
+        WorkQueue& queue = *mQueues[(queueIndex + i) % mQueues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(!queue.jobs.empty())
+        {
+            pendingJob = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+        }
+    }
+
+    if(!pendingJob)
+        return false;
+
+    --mQueuedJobs;
+    pendingJob();
+    return true;
+}
+
+void ThreadPool::processRange(unsigned first, unsigned last, const range_function* function, unsigned grainSize,
+                              std::atomic<unsigned>* remaining)
+{
+    // Split off the upper half until one chunk is left. Halves are split at multiples of the grain size.
+    while(last - first > grainSize)
+    {
+        unsigned middle = first + ((last - first) / grainSize + 1) / 2 * grainSize;
+        push([this, middle, last, function, grainSize, remaining]
+             {
+                 processRange(middle, last, function, grainSize, remaining);
+             });
+        last = middle;
+    }
+
+    (*function)(first, last);
+
+    // The range may be destroyed as soon as nothing remains, so this has to be the last access.
+    *remaining -= last - first;
+}
+
+void ThreadPool::schedule(const task_handle& task)
+{
+    push([this, task]
+         {
+             task->function();
+             finish(task);
+         });
+}
+
+void ThreadPool::finish(const task_handle& task)
+{
+    std::vector<task_handle> continuations;
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        task->finished = true;
+        continuations.swap(task->continuations);
+    }
+
+    for(auto& continuation : continuations)
+    {
+        if(--continuation->dependencies == 0)
+            schedule(continuation);
+    }
+}
+
+} // namespace nparticles